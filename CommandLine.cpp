@@ -166,6 +166,7 @@ CommandLine::setup()
 	m_deskewAngle = fetchDeskewAngle();
 	m_startFilterIdx = fetchStartFilterIdx();
 	m_endFilterIdx = fetchEndFilterIdx();
+	m_threads = fetchThreads();
 }
 
 
@@ -232,6 +233,7 @@ CommandLine::printHelp()
 	std::cout << "\t--depth-perception=<1.0...3.0>\t\t-- default: 2.0" << "\n";
 	std::cout << "\t--start-filter=<1...6>\t\t\t-- default: 4" << "\n";
 	std::cout << "\t--end-filter=<1...6>\t\t\t-- default: 6" << "\n";
+	std::cout << "\t--threads=<number>\t\t\t-- threads to use within a page; default: all cores" << "\n";
 	std::cout << "\t--output-project=, -o=<project_name>" << "\n";
 	std::cout << "\n";
 }
@@ -458,6 +460,15 @@ CommandLine::fetchEndFilterIdx()
 	return m_options.value("end-filter").toInt() - 1;
 }
 
+int
+CommandLine::fetchThreads()
+{
+	if (!hasThreads())
+		return 0;
+
+	return m_options.value("threads").toInt();
+}
+
 output::DewarpingMode
 CommandLine::fetchDewarpingMode()
 {
@@ -81,6 +81,7 @@ public:
 	bool hasDespeckle() const { return contains("despeckle"); }
 	bool hasDewarping() const { return contains("dewarping"); }
 	bool hasDepthPerception() const { return contains("dewarping"); }
+	bool hasThreads() const { return contains("threads"); }
 
 	page_split::LayoutType getLayout() const { return m_layoutType; }
 	Qt::LayoutDirection getLayoutDirection() const { return m_layoutDirection; }
@@ -96,6 +97,7 @@ public:
 	double getDeskewAngle() const { return m_deskewAngle; }
 	int getStartFilterIdx() const { return m_startFilterIdx; }
 	int getEndFilterIdx() const { return m_endFilterIdx; }
+	int getThreads() const { return m_threads; }
 	output::DewarpingMode getDewarpingMode() const { return m_dewarpingMode; }
 	output::DespeckleLevel getDespeckleLevel() const { return m_despeckleLevel; }
 	output::DepthPerception getDepthPerception() const { return m_depthPerception; }
@@ -137,6 +139,7 @@ private:
 	double m_deskewAngle;
 	int m_startFilterIdx;
 	int m_endFilterIdx;
+	int m_threads;
 	output::DewarpingMode m_dewarpingMode;
 	output::DespeckleLevel m_despeckleLevel;
 	output::DepthPerception m_depthPerception;
@@ -158,6 +161,7 @@ private:
 	double fetchDeskewAngle();
 	int fetchStartFilterIdx();
 	int fetchEndFilterIdx();
+	int fetchThreads();
 	output::DewarpingMode fetchDewarpingMode();
 	output::DespeckleLevel fetchDespeckleLevel();
 	output::DepthPerception fetchDepthPerception();
@@ -21,7 +21,10 @@
 #include "DebugImages.h"
 #include "Dpi.h"
 #include "FastQueue.h"
+#include "NonCopyable.h"
 #include "imageproc/BinaryImage.h"
+#include "imageproc/BWColor.h"
+#include "imageproc/RasterOp.h"
 #include "imageproc/ConnectivityMap.h"
 #include "imageproc/Connectivity.h"
 #ifndef Q_MOC_RUN
@@ -29,9 +32,11 @@
 #endif
 #include <QtGlobal>
 #include <QImage>
+#include <QSize>
+#include <QRect>
+#include <QPoint>
 #include <QDebug>
 #include <vector>
-#include <map>
 #include <limits>
 #include <algorithm>
 #include <stddef.h>
@@ -256,6 +261,11 @@ struct Connection
 		}
 	}
 	
+	bool operator==(Connection const& rhs) const {
+		return lesser_label == rhs.lesser_label
+			&& greater_label == rhs.greater_label;
+	}
+	
 	bool operator<(Connection const& rhs) const {
 		if (lesser_label < rhs.lesser_label) {
 			return true;
@@ -267,6 +277,157 @@ struct Connection
 	}
 };
 
+/**
+ * \brief A map of connections to squared distances.
+ *
+ * Entries are stored in a vector, in the order they were added.
+ * An open addressing hash table of indexes into that vector is used
+ * to locate them.  That's a lot faster than a std::map, as we have
+ * one lookup per pixel on a boundary of Voronoi regions.
+ */
+class Connections
+{
+public:
+	struct Entry
+	{
+		Connection conn;
+		uint32_t sqdist;
+		
+		Entry(Connection const& c, uint32_t sqd) : conn(c), sqdist(sqd) {}
+		
+		bool operator<(Entry const& rhs) const { return conn < rhs.conn; }
+	};
+	
+	Connections() : m_mask(0) {}
+	
+	/**
+	 * \brief Makes room for the specified number of connections.
+	 */
+	void reserve(size_t num_connections);
+	
+	/**
+	 * \brief If the association didn't exist, create it,
+	 *        otherwise the minimum distance.
+	 */
+	void updateDistance(uint32_t label1, uint32_t label2, uint32_t sqdist);
+	
+	/**
+	 * \brief Entries in the order they were added.
+	 */
+	std::vector<Entry> const& entries() const { return m_entries; }
+	
+	/**
+	 * \brief Entries ordered by connection labels.
+	 *
+	 * Tagging components depends on the order connections are visited in,
+	 * so it has to be the order a std::map<Connection, ...> would give.
+	 */
+	std::vector<Entry> sortedEntries() const;
+	
+	/**
+	 * \brief Removes all entries and frees memory.
+	 */
+	void clear();
+private:
+	void rehash(size_t min_slots);
+	
+	static uint32_t hash(Connection const& conn);
+	
+	std::vector<Entry> m_entries;
+	
+	/**
+	 * Indexes into m_entries plus one.  Zero marks an empty slot.
+	 * The size is a power of two, and at most half of slots are occupied.
+	 */
+	std::vector<uint32_t> m_slots;
+	
+	uint32_t m_mask;
+};
+
+void
+Connections::reserve(size_t const num_connections)
+{
+	m_entries.reserve(num_connections);
+	if (m_slots.size() < num_connections * 2) {
+		rehash(num_connections * 2);
+	}
+}
+
+void
+Connections::updateDistance(
+	uint32_t const label1, uint32_t const label2, uint32_t const sqdist)
+{
+	if ((m_entries.size() + 1) * 2 > m_slots.size()) {
+		rehash((m_entries.size() + 1) * 2);
+	}
+	
+	Connection const conn(label1, label2);
+	uint32_t slot = hash(conn) & m_mask;
+	for (;; slot = (slot + 1) & m_mask) {
+		uint32_t const idx = m_slots[slot];
+		if (idx == 0) {
+			m_entries.push_back(Entry(conn, sqdist));
+			m_slots[slot] = m_entries.size();
+			return;
+		}
+		
+		Entry& entry = m_entries[idx - 1];
+		if (entry.conn == conn) {
+			if (sqdist < entry.sqdist) {
+				entry.sqdist = sqdist;
+			}
+			return;
+		}
+	}
+}
+
+std::vector<Connections::Entry>
+Connections::sortedEntries() const
+{
+	std::vector<Entry> entries(m_entries);
+	std::sort(entries.begin(), entries.end());
+	return entries;
+}
+
+void
+Connections::clear()
+{
+	std::vector<Entry>().swap(m_entries);
+	std::vector<uint32_t>().swap(m_slots);
+	m_mask = 0;
+}
+
+void
+Connections::rehash(size_t const min_slots)
+{
+	size_t num_slots = 16;
+	while (num_slots < min_slots) {
+		num_slots <<= 1;
+	}
+	
+	std::vector<uint32_t>(num_slots, 0).swap(m_slots);
+	m_mask = num_slots - 1;
+	
+	size_t const num_entries = m_entries.size();
+	for (size_t i = 0; i < num_entries; ++i) {
+		uint32_t slot = hash(m_entries[i].conn) & m_mask;
+		while (m_slots[slot] != 0) {
+			slot = (slot + 1) & m_mask;
+		}
+		m_slots[slot] = i + 1;
+	}
+}
+
+uint32_t
+Connections::hash(Connection const& conn)
+{
+	uint32_t h = conn.lesser_label * uint32_t(0x9E3779B1) + conn.greater_label;
+	h ^= h >> 16;
+	h *= uint32_t(0x85EBCA6B);
+	h ^= h >> 13;
+	return h;
+}
+
 /**
  * \brief A directional assiciation between two connected components.
  */
@@ -293,25 +454,6 @@ struct TargetSourceConn
 	}
 };
 
-/**
- * \brief If the association didn't exist, create it,
- *        otherwise the minimum distance.
- */
-void updateDistance(
-	std::map<Connection, uint32_t>& conns,
-	uint32_t label1, uint32_t label2, uint32_t sqdist)
-{
-	typedef std::map<Connection, uint32_t> Connections;
-	
-	Connection const conn(label1, label2);
-	Connections::iterator it(conns.lower_bound(conn));
-	if (it == conns.end() || conn < it->first) {
-		conns.insert(Connections::value_type(conn, sqdist));
-	} else if (sqdist < it->second) {
-		it->second = sqdist;
-	}
-}
-
 /**
  * \brief Tag the source component with ANCHORED_TO_SMALL, ANCHORED_TO_BIG
  *        or none of the above.
@@ -656,7 +798,7 @@ void voronoiSpecial(ConnectivityMap& cmap, std::vector<Distance>& dist, Distance
 void voronoiDistances(
 	ConnectivityMap const& cmap,
 	std::vector<Distance> const& distance_matrix,
-	std::map<Connection, uint32_t>& conns)
+	Connections& conns)
 {
 	int const width = cmap.size().width();
 	int const height = cmap.size().height();
@@ -688,77 +830,155 @@ void voronoiDistances(
 				int const dy = y1 - y2;
 				uint32_t const sqdist = dx * dx + dy * dy;
 				
-				updateDistance(conns, label, nbh_label, sqdist);
+				conns.updateDistance(label, nbh_label, sqdist);
 			}
 		}
 	}
 }
 
-} // anonymous namespace
-
-
-BinaryImage
-Despeckle::despeckle(
-	BinaryImage const& src, Dpi const& dpi, Level const level,
-	TaskStatus const& status, DebugImages* const dbg)
+/**
+ * \brief The part of despeckling that doesn't depend on the level.
+ *
+ * Which components get unified into a big one does depend on the level,
+ * but labels never affect how Voronoi regions grow.  Therefore, we build
+ * the Voronoi diagram from the original labels and remap it for each level
+ * afterwards, which gives the same result as building it from remapped
+ * labels.  Connections between regions are remapped the same way.
+ */
+class SpeckleAnalysis
 {
-	BinaryImage dst(src);
-	despeckleInPlace(dst, dpi, level, status, dbg);
-	return dst;
-}
+	DECLARE_NON_COPYABLE(SpeckleAnalysis)
+public:
+	SpeckleAnalysis(BinaryImage const& image,
+		TaskStatus const& status, DebugImages* dbg);
+	
+	/**
+	 * \brief Returns true if there are no components at all.
+	 */
+	bool empty() const { return m_voronoi.maxLabel() == 0; }
+	
+	/**
+	 * \brief Finds components to be removed at a particular level.
+	 *
+	 * \param is_speckle Will be indexed by the original labels, with
+	 *        non-zero values indicating components to be removed.
+	 */
+	void findSpeckles(Settings const& settings, std::vector<uint8_t>& is_speckle,
+		TaskStatus const& status, DebugImages* dbg) const;
+	
+	/**
+	 * \brief Clears black pixels belonging to speckles.
+	 *
+	 * \p image has to be the one the analysis was done on.
+	 */
+	void removeSpeckles(BinaryImage& image,
+		std::vector<uint8_t> const& is_speckle) const;
+private:
+	static void remapLabels(ConnectivityMap& cmap,
+		std::vector<uint32_t> const& remapping_table);
+	
+	/**
+	 * The original labels.  Only kept for debugging images.
+	 */
+	ConnectivityMap m_labels;
+	
+	/**
+	 * The Voronoi diagram built from the original labels.  Black pixels
+	 * keep their labels, as they are never taken over by other regions.
+	 */
+	ConnectivityMap m_voronoi;
+	
+	std::vector<Distance> m_distanceMatrix;
+	
+	/**
+	 * Indexed by original labels.  Tags are not set.
+	 */
+	std::vector<Component> m_components;
+	
+	/**
+	 * Indexed by original labels.
+	 */
+	std::vector<BoundingBox> m_boundingBoxes;
+	
+	/**
+	 * Connections between the original Voronoi regions.
+	 */
+	Connections m_conns;
+};
 
-void
-Despeckle::despeckleInPlace(
-	BinaryImage& image, Dpi const& dpi, Level const level,
-	TaskStatus const& status, DebugImages* const dbg)
+SpeckleAnalysis::SpeckleAnalysis(
+	BinaryImage const& image, TaskStatus const& status, DebugImages* const dbg)
+:	m_voronoi(image, CONN8)
 {
-	Settings const settings(Settings::get(level, dpi));
-
-	ConnectivityMap cmap(image, CONN8);
-	if (cmap.maxLabel() == 0) {
+	if (m_voronoi.maxLabel() == 0) {
 		// Completely white image?
 		return;
 	}
 
 	status.throwIfCancelled();
 	
-	std::vector<Component> components(cmap.maxLabel() + 1);
-	std::vector<BoundingBox> bounding_boxes(cmap.maxLabel() + 1);
+	m_components.resize(m_voronoi.maxLabel() + 1);
+	m_boundingBoxes.resize(m_voronoi.maxLabel() + 1);
 
 	int const width = image.width();
 	int const height = image.height();
 
-	uint32_t* const cmap_data = cmap.data();
-	
 	// Count the number of pixels and a bounding rect of each component.
-	uint32_t* cmap_line = cmap_data;
-	int const cmap_stride = cmap.stride();
+	uint32_t const* cmap_line = m_voronoi.data();
+	int const cmap_stride = m_voronoi.stride();
 	for (int y = 0; y < height; ++y) {
 		for (int x = 0; x < width; ++x) {
 			uint32_t const label = cmap_line[x];
-			++components[label].num_pixels;
-			bounding_boxes[label].extend(x, y);
+			++m_components[label].num_pixels;
+			m_boundingBoxes[label].extend(x, y);
 		}
 		cmap_line += cmap_stride;
 	}
 	
+	if (dbg) {
+		m_labels = m_voronoi;
+	}
+	
 	status.throwIfCancelled();
+	
+	// Build a Voronoi diagram.
+	voronoi(m_voronoi, m_distanceMatrix);
+	
+	status.throwIfCancelled();
+	
+	// Now build a bidirectional map of distances between neighboring
+	// connected components.  Voronoi regions of an average component
+	// have about 6 neighbors, and each connection is shared by two
+	// components.
+	m_conns.reserve(m_voronoi.maxLabel() * 3);
+	voronoiDistances(m_voronoi, m_distanceMatrix, m_conns);
+}
 
+void
+SpeckleAnalysis::findSpeckles(
+	Settings const& settings, std::vector<uint8_t>& is_speckle,
+	TaskStatus const& status, DebugImages* const dbg) const
+{
+	int const width = m_voronoi.size().width();
+	int const height = m_voronoi.size().height();
+	uint32_t const orig_max_label = m_voronoi.maxLabel();
+	
 	// Unify big components into one.
-	std::vector<uint32_t> remapping_table(components.size());
+	std::vector<Component> components(m_components.size());
+	std::vector<uint32_t> remapping_table(m_components.size(), 0);
 	uint32_t unified_big_component = 0;
 	uint32_t next_avail_component = 1;
-	for (uint32_t label = 1; label <= cmap.maxLabel(); ++label) {
-		if (bounding_boxes[label].width() < settings.bigObjectThreshold &&
-				bounding_boxes[label].height() < settings.bigObjectThreshold) {
-			components[next_avail_component] = components[label];
+	for (uint32_t label = 1; label <= orig_max_label; ++label) {
+		if (m_boundingBoxes[label].width() < settings.bigObjectThreshold &&
+				m_boundingBoxes[label].height() < settings.bigObjectThreshold) {
+			components[next_avail_component] = m_components[label];
 			remapping_table[label] = next_avail_component;
 			++next_avail_component;
 		} else {
 			if (unified_big_component == 0) {
 				unified_big_component = next_avail_component;
 				++next_avail_component;
-				components[unified_big_component] = components[label];
+				components[unified_big_component] = m_components[label];
 				// Set num_pixels to a large value so that canBeAttachedTo()
 				// always allows attaching to any such component.
 				components[unified_big_component].num_pixels = width * height;
@@ -767,51 +987,42 @@ Despeckle::despeckleInPlace(
 		}
 	}
 	components.resize(next_avail_component);
-	std::vector<BoundingBox>().swap(bounding_boxes); // We don't need them any more.
 	
-	status.throwIfCancelled();
-
 	uint32_t const max_label = next_avail_component - 1;
 	
-	// Remapping individual pixels.
-	cmap_line = cmap_data;
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			cmap_line[x] = remapping_table[cmap_line[x]];
-		}
-		cmap_line += cmap_stride;
-	}
 	if (dbg) {
-		dbg->add(cmap.visualized(), "big_components_unified");
+		ConnectivityMap unified(m_labels);
+		remapLabels(unified, remapping_table);
+		dbg->add(unified.visualized(), "big_components_unified");
 	}
-
+	
 	status.throwIfCancelled();
 	
-	// Build a Voronoi diagram.
-	std::vector<Distance> distance_matrix;
-	voronoi(cmap, distance_matrix);
+	// The Voronoi diagram of remapped components.
+	ConnectivityMap cmap(m_voronoi);
+	remapLabels(cmap, remapping_table);
 	if (dbg) {
 		dbg->add(cmap.visualized(), "voronoi");
 	}
 	
-	status.throwIfCancelled();
-
-	Distance* const distance_data = &distance_matrix[0] + width + 3;
-	
-	// Now build a bidirectional map of distances between neighboring
-	// connected components.
-	
-	typedef std::map<Connection, uint32_t> Connections; // conn -> sqdist
+	// A bidirectional map of distances between neighboring
+	// remapped components.
 	Connections conns;
-	
-	voronoiDistances(cmap, distance_matrix, conns);
+	conns.reserve(m_conns.entries().size());
+	BOOST_FOREACH(Connections::Entry const& entry, m_conns.entries()) {
+		uint32_t const label1 = remapping_table[entry.conn.lesser_label];
+		uint32_t const label2 = remapping_table[entry.conn.greater_label];
+		if (label1 != label2) {
+			conns.updateDistance(label1, label2, entry.sqdist);
+		}
+	}
 	
 	status.throwIfCancelled();
 
 	// Tag connected components with ANCHORED_TO_BIG or ANCHORED_TO_SMALL.
-	BOOST_FOREACH(Connections::value_type const& pair, conns) {
-		Connection const conn(pair.first);
-		uint32_t const sqdist = pair.second;
+	BOOST_FOREACH(Connections::Entry const& entry, conns.sortedEntries()) {
+		Connection const conn(entry.conn);
+		uint32_t const sqdist = entry.sqdist;
 		Component& comp1 = components[conn.lesser_label];
 		Component& comp2 = components[conn.greater_label];
 		tagSourceComponent(comp1, comp2, sqdist, settings);
@@ -835,6 +1046,10 @@ Despeckle::despeckleInPlace(
 		// big neighbors, but Voronoi regions from a smaller ones
 		// block the path to the bigger ones.
 		
+		std::vector<Distance> distance_matrix(m_distanceMatrix);
+		Distance* const distance_data = &distance_matrix[0] + width + 3;
+		uint32_t const* const cmap_data = cmap.data();
+		
 		Distance const zero_distance(Distance::zero());
 		Distance const special_distance(Distance::special());
 		for (int y = 0, offset = 0; y < height; ++y, offset += 2) {
@@ -878,9 +1093,6 @@ Despeckle::despeckleInPlace(
 	
 	status.throwIfCancelled();
 
-	// Clear the distance matrix.
-	std::vector<Distance>().swap(distance_matrix);
-	
 	// Remove tags from components.
 	BOOST_FOREACH(Component& comp, components) {
 		comp.clearTags();
@@ -889,13 +1101,12 @@ Despeckle::despeckleInPlace(
 	// Build a directional connection map and only include
 	// good connections, that is those with a small enough
 	// distance.
-	// While at it, clear the bidirectional connection map.
 	std::vector<TargetSourceConn> target_source;
-	while (!conns.empty()) {
-		Connections::iterator const it(conns.begin());
-		uint32_t const label1 = it->first.lesser_label;
-		uint32_t const label2 = it->first.greater_label;
-		uint32_t const sqdist = it->second;
+	target_source.reserve(conns.entries().size());
+	BOOST_FOREACH(Connections::Entry const& entry, conns.entries()) {
+		uint32_t const label1 = entry.conn.lesser_label;
+		uint32_t const label2 = entry.conn.greater_label;
+		uint32_t const sqdist = entry.sqdist;
 		Component const& comp1 = components[label1];
 		Component const& comp2 = components[label2];
 		if (canBeAttachedTo(comp1, comp2, sqdist, settings)) {
@@ -904,8 +1115,10 @@ Despeckle::despeckleInPlace(
 		if (canBeAttachedTo(comp2, comp1, sqdist, settings)) {
 			target_source.push_back(TargetSourceConn(label1, label2));
 		}
-		conns.erase(it);
 	}
+	
+	// We don't need the bidirectional connection map any more.
+	conns.clear();
 
 	std::sort(target_source.begin(), target_source.end());
 	
@@ -952,16 +1165,30 @@ Despeckle::despeckleInPlace(
 		}
 	}
 	
-	status.throwIfCancelled();
+	// Unmarked components are speckles.
+	is_speckle.assign(orig_max_label + 1, 0);
+	for (uint32_t label = 1; label <= orig_max_label; ++label) {
+		if (!components[remapping_table[label]].anchoredToBig()) {
+			is_speckle[label] = 1;
+		}
+	}
+}
 
-	// Remove unmarked components from the binary image.
+void
+SpeckleAnalysis::removeSpeckles(
+	BinaryImage& image, std::vector<uint8_t> const& is_speckle) const
+{
+	int const width = image.width();
+	int const height = image.height();
+	
 	uint32_t const msb = uint32_t(1) << 31;
 	uint32_t* image_line = image.data();
 	int const image_stride = image.wordsPerLine();
-	cmap_line = cmap_data;
+	uint32_t const* cmap_line = m_voronoi.data();
+	int const cmap_stride = m_voronoi.stride();
 	for (int y = 0; y < height; ++y) {
 		for (int x = 0; x < width; ++x) {
-			if (!components[cmap_line[x]].anchoredToBig()) {
+			if (is_speckle[cmap_line[x]]) {
 				image_line[x >> 5] &= ~(msb >> (x & 31));
 			}
 		}
@@ -969,3 +1196,104 @@ Despeckle::despeckleInPlace(
 		cmap_line += cmap_stride;
 	}
 }
+
+void
+SpeckleAnalysis::remapLabels(
+	ConnectivityMap& cmap, std::vector<uint32_t> const& remapping_table)
+{
+	// Padding is remapped as well, as Voronoi regions extend there.
+	uint32_t* data = cmap.paddedData();
+	size_t const size = (cmap.size().width() + 2) * (cmap.size().height() + 2);
+	for (size_t i = 0; i < size; ++i) {
+		data[i] = remapping_table[data[i]];
+	}
+}
+
+} // anonymous namespace
+
+
+BinaryImage
+Despeckle::despeckle(
+	BinaryImage const& src, Dpi const& dpi, Level const level,
+	TaskStatus const& status, DebugImages* const dbg)
+{
+	BinaryImage dst(src);
+	despeckleInPlace(dst, dpi, level, status, dbg);
+	return dst;
+}
+
+void
+Despeckle::despeckleInPlace(
+	BinaryImage& image, Dpi const& dpi, Level const level,
+	TaskStatus const& status, DebugImages* const dbg)
+{
+	SpeckleAnalysis const analysis(image, status, dbg);
+	if (analysis.empty()) {
+		return;
+	}
+	
+	std::vector<uint8_t> is_speckle;
+	analysis.findSpeckles(Settings::get(level, dpi), is_speckle, status, dbg);
+	
+	status.throwIfCancelled();
+	
+	analysis.removeSpeckles(image, is_speckle);
+}
+
+Despeckle::Profile
+Despeckle::buildProfile(
+	BinaryImage const& src, Dpi const& dpi,
+	TaskStatus const& status, DebugImages* const dbg)
+{
+	Profile profile;
+	
+	SpeckleAnalysis const analysis(src, status, dbg);
+	std::vector<uint8_t> is_speckle;
+	for (int level = 0; level < NUM_LEVELS; ++level) {
+		BinaryImage& speckles = profile.m_speckles[level];
+		if (analysis.empty()) {
+			speckles = BinaryImage(src.size(), WHITE);
+			continue;
+		}
+		
+		// Debugging images are only produced for the first level.
+		analysis.findSpeckles(
+			Settings::get((Level)level, dpi), is_speckle,
+			status, level == 0 ? dbg : 0
+		);
+		
+		status.throwIfCancelled();
+		
+		speckles = src;
+		analysis.removeSpeckles(speckles, is_speckle);
+		rasterOp<RopSubtract<RopSrc, RopDst> >(speckles, src);
+	}
+	
+	return profile;
+}
+
+
+/*============================ Despeckle::Profile ============================*/
+
+void
+Despeckle::Profile::apply(BinaryImage& image, Level const level) const
+{
+	rasterOp<RopSubtract<RopDst, RopSrc> >(image, m_speckles[level]);
+}
+
+Despeckle::Profile
+Despeckle::Profile::embedded(
+	QSize const& size, QRect const& dst_rect, QPoint const& src_pos) const
+{
+	Profile profile;
+	
+	for (int i = 0; i < NUM_LEVELS; ++i) {
+		BinaryImage speckles(size, WHITE);
+		if (!dst_rect.isEmpty()) {
+			rasterOp<RopSrc>(speckles, dst_rect, m_speckles[i], src_pos);
+		}
+		profile.m_speckles[i].swap(speckles);
+	}
+	
+	return profile;
+}
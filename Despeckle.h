@@ -19,19 +19,69 @@
 #ifndef DESPECKLE_H_
 #define DESPECKLE_H_
 
+#include "imageproc/BinaryImage.h"
+
 class Dpi;
 class TaskStatus;
 class DebugImages;
-
-namespace imageproc
-{
-	class BinaryImage;
-}
+class QSize;
+class QRect;
+class QPoint;
 
 class Despeckle
 {
 public:
 	enum Level { CAUTIOUS, NORMAL, AGGRESSIVE };
+	
+	enum { NUM_LEVELS = AGGRESSIVE + 1 };
+	
+	/**
+	 * \brief Speckles of an image, found for all levels at once.
+	 *
+	 * Once built, despeckling at any level is just masking out
+	 * the speckles for that level.
+	 */
+	class Profile
+	{
+		// Member-wise copying is OK.
+	public:
+		/**
+		 * \brief Constructs a null profile.
+		 */
+		Profile() {}
+		
+		bool isNull() const { return m_speckles[0].isNull(); }
+		
+		/**
+		 * \brief The black pixels despeckle() would remove at \p level.
+		 */
+		imageproc::BinaryImage const& speckles(Level level) const {
+			return m_speckles[level];
+		}
+		
+		/**
+		 * \brief Removes the speckles for \p level from \p image.
+		 *
+		 * Applying it to the image the profile was built from gives
+		 * the same result as despeckleInPlace() at that level.
+		 */
+		void apply(imageproc::BinaryImage& image, Level level) const;
+		
+		/**
+		 * \brief Returns the profile of a white image of \p size,
+		 *        with the analyzed image drawn over its \p dst_rect.
+		 *
+		 * \p src_pos is the point of the analyzed image that ends up
+		 * at dst_rect.topLeft().  Speckles outside of \p dst_rect
+		 * are dropped.
+		 */
+		Profile embedded(QSize const& size,
+			QRect const& dst_rect, QPoint const& src_pos) const;
+	private:
+		friend class Despeckle;
+		
+		imageproc::BinaryImage m_speckles[NUM_LEVELS];
+	};
 
 	/**
 	 * \brief Removes small speckles from a binary image.
@@ -53,6 +103,22 @@ public:
 	static void despeckleInPlace(
 		imageproc::BinaryImage& image, Dpi const& dpi,
 		Level level, TaskStatus const& status, DebugImages* dbg = 0);
+	
+	/**
+	 * \brief Finds speckles for all levels in one pass.
+	 *
+	 * Labelling and building the Voronoi diagram are done once.
+	 * Only the analysis of which components to attach to which
+	 * is done for each level.
+	 *
+	 * \param src The image to analyze.  Must not be null.
+	 * \param dpi DPI of \p src.
+	 * \param status For asynchronous task cancellation.
+	 * \param dbg An optional sink for debugging images.
+	 */
+	static Profile buildProfile(
+		imageproc::BinaryImage const& src, Dpi const& dpi,
+		TaskStatus const& status, DebugImages* dbg = 0);
 };
 
 #endif
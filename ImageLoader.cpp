@@ -19,6 +19,8 @@
 #include "ImageLoader.h"
 #include "TiffReader.h"
 #include "ImageId.h"
+#include "imageproc/Grayscale.h"
+#include "imageproc/BinaryImage.h"
 #include <QImage>
 #include <QString>
 #include <QIODevice>
@@ -54,5 +56,30 @@ ImageLoader::load(QIODevice& io_dev, int const page_num)
 	
 	QImage image;
 	image.load(&io_dev, 0);
+	
+	if (image.format() == QImage::Format_Indexed8 && image.isGrayscale()) {
+		// Single-channel images are brought to the standard grayscale
+		// palette, so that further conversions to GrayImage are no-ops.
+		// For most grayscale images that's already the case.
+		image = imageproc::toGrayscale(image);
+	}
+	
 	return image;
 }
+
+imageproc::BinaryImage
+ImageLoader::loadBinary(QIODevice& io_dev, int const page_num)
+{
+	using namespace imageproc;
+	
+	if (TiffReader::canRead(io_dev)) {
+		return TiffReader::readBinaryImage(io_dev, page_num);
+	}
+	
+	QImage const image(load(io_dev, page_num));
+	if (image.isNull()) {
+		return BinaryImage();
+	}
+	
+	return BinaryImage(image);
+}
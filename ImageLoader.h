@@ -24,6 +24,11 @@ class QImage;
 class QString;
 class QIODevice;
 
+namespace imageproc
+{
+	class BinaryImage;
+}
+
 class ImageLoader
 {
 public:
@@ -32,6 +37,14 @@ public:
 	static QImage load(ImageId const& image_id);
 	
 	static QImage load(QIODevice& io_dev, int page_num);
+	
+	/**
+	 * \brief Loads an image as a BinaryImage.
+	 *
+	 * Bitonal TIFF images are read directly into BinaryImage, bypassing
+	 * QImage.  Anything else is loaded with load() and binarized.
+	 */
+	static imageproc::BinaryImage loadBinary(QIODevice& io_dev, int page_num);
 };
 
 #endif
@@ -671,6 +671,19 @@ MainWindow::resetThumbSequence(
 		m_ptrThumbSequence->setThumbnailFactory(
 			IntrusivePtr<ThumbnailFactory>()
 		);
+	} else {
+		// Let the cache know which thumbnails are going to be
+		// needed next when the user scrolls the list.
+		PageSequence const pages(m_ptrThumbSequence->toPageSequence());
+		std::vector<ImageId> image_ids;
+		image_ids.reserve(pages.numPages());
+		for (size_t i = 0; i < pages.numPages(); ++i) {
+			ImageId const& image_id = pages.pageAt(i).imageId();
+			if (image_ids.empty() || image_ids.back() != image_id) {
+				image_ids.push_back(image_id);
+			}
+		}
+		m_ptrThumbnailCache->setPrefetchOrder(image_ids);
 	}
 
 	PageId const page(m_selectedPage.get(getCurrentView()));
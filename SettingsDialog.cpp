@@ -19,6 +19,7 @@
 #include "SettingsDialog.h"
 #include "SettingsDialog.h.moc"
 #include "OpenGLSupport.h"
+#include "Utils.h"
 #include "config.h"
 #include <QSettings>
 #include <QVariant>
@@ -46,6 +47,11 @@ SettingsDialog::SettingsDialog(QWidget* parent)
 	}
 #endif
 
+	ui.thumbnailCacheSize->setRange(
+		Utils::MIN_THUMBNAIL_CACHE_MB, Utils::MAX_THUMBNAIL_CACHE_MB
+	);
+	ui.thumbnailCacheSize->setValue(Utils::thumbnailCacheMb());
+
 	connect(ui.buttonBox, SIGNAL(accepted()), SLOT(commitChanges()));
 }
 
@@ -60,4 +66,5 @@ SettingsDialog::commitChanges()
 #ifdef ENABLE_OPENGL
 	settings.setValue("settings/use_3d_acceleration", ui.use3DAcceleration->isChecked());
 #endif
+	settings.setValue("settings/thumbnail_cache_mb", ui.thumbnailCacheSize->value());
 }
@@ -19,7 +19,8 @@
 #include "ThumbnailPixmapCache.h"
 #include "ImageId.h"
 #include "ImageLoader.h"
-#include "AtomicFileOverwriter.h"
+#include "ThumbnailStore.h"
+#include "IntrusivePtr.h"
 #include "RelinkablePath.h"
 #include "OutOfMemoryHandler.h"
 #include "imageproc/Scale.h"
@@ -29,6 +30,7 @@
 #include <QThread>
 #include <QMutex>
 #include <QMutexLocker>
+#include <QWaitCondition>
 #include <QFileInfo>
 #include <QDir>
 #include <QFile>
@@ -45,9 +47,13 @@
 #include <boost/multi_index/sequenced_index.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #endif
 #include <algorithm>
+#include <iterator>
 #include <vector>
+#include <deque>
+#include <map>
 #include <new>
 
 using namespace ::boost;
@@ -109,16 +115,18 @@ private:
 };
 
 
-class ThumbnailPixmapCache::Impl : public QThread
+class ThumbnailPixmapCache::Impl : public QObject
 {
 public:
 	Impl(QString const& thumb_dir, QSize const& max_thumb_size,
-		int max_cached_pixmaps, int expiration_threshold);
+		qint64 max_cached_bytes, int expiration_threshold);
 	
 	~Impl();
 
 	void setThumbDir(QString const& thumb_dir);
 	
+	void setPrefetchOrder(std::vector<ImageId> const& image_ids);
+	
 	Status request(
 		ImageId const& image_id, QPixmap& pixmap, bool load_now = false,
 		boost::weak_ptr<CompletionHandler> const* completion_handler = 0);
@@ -127,11 +135,10 @@ public:
 	
 	void recreateThumbnail(ImageId const& image_id, QImage const& image);
 protected:
-	virtual void run();
-	
 	virtual void customEvent(QEvent* e);
 private:
 	class LoadResultEvent;
+	class LoaderThread;
 	class ItemsByKeyTag;
 	class LoadQueueTag;
 	class RemoveQueueTag;
@@ -149,21 +156,34 @@ private:
 	typedef Container::index<LoadQueueTag>::type LoadQueue;
 	typedef Container::index<RemoveQueueTag>::type RemoveQueue;
 	
-	class BackgroundLoader : public QObject
-	{
-	public:
-		BackgroundLoader(Impl& owner);
-	protected:
-		virtual void customEvent(QEvent* e);
-	private:
-		Impl& m_rOwner;
-	};
+	/**
+	 * The maximum number of threads loading thumbnails concurrently.
+	 * Loading is mostly I/O and decoding, so more threads won't help.
+	 */
+	enum { MAX_LOADER_THREADS = 3 };
+	
+	/**
+	 * The number of most recent requests used to figure out
+	 * where and in which direction the user is scrolling.
+	 */
+	enum { PREFETCH_HISTORY = 16 };
+	
+	/**
+	 * The bounds on the number of thumbnails prefetched ahead of
+	 * the requested ones.  The actual number is the size of the span
+	 * of recently requested thumbnails, that is roughly a screenful.
+	 */
+	enum { MIN_PREFETCH = 4, MAX_PREFETCH = 32 };
 	
 	void backgroundProcessing();
 	
+	void wakeLoadersLocked();
+	
+	void prefetchLocked(ImageId const& requested_id);
+	
 	static QImage loadSaveThumbnail(
 		ImageId const& image_id, QString const& thumb_dir,
-		QSize const& max_thumb_size);
+		ThumbnailStore& store, QSize const& max_thumb_size);
 	
 	static QString getThumbFilePath(
 		ImageId const& image_id, QString const& thumb_dir);
@@ -179,7 +199,7 @@ private:
 	
 	void processLoadResult(LoadResultEvent* result);
 	
-	void removeExcessLocked();
+	void removeExcessLocked(qint64 incoming_bytes);
 	
 	void removeItemLocked(RemoveQueue::iterator const& it);
 	
@@ -187,8 +207,11 @@ private:
 	
 	void cachePixmapLocked(ImageId const& image_id, QPixmap const& pixmap);
 	
+	static qint64 pixmapBytes(QPixmap const& pixmap);
+	
 	mutable QMutex m_mutex;
-	BackgroundLoader m_backgroundLoader;
+	QWaitCondition m_loadersWakeup;
+	std::vector<boost::shared_ptr<LoaderThread> > m_loaderThreads;
 	Container m_items;
 	ItemsByKey& m_itemsByKey; /**< ImageId => Item mapping */
 	
@@ -217,8 +240,10 @@ private:
 	RemoveQueue::iterator m_endOfLoadedItems;
 	
 	QString m_thumbDir;
+	IntrusivePtr<ThumbnailStore> m_ptrStore;
 	QSize m_maxThumbSize;
-	int m_maxCachedPixmaps;
+	qint64 m_maxCachedBytes;
+	qint64 m_numCachedBytes;
 	
 	/**
 	 * \see ThumbnailPixmapCache::ThumbnailPixmapCache()
@@ -234,11 +259,50 @@ private:
 	 */
 	int m_totalLoadAttempts;
 	
+	/**
+	 * Images in the order they are presented to the user.
+	 * \see ThumbnailPixmapCache::setPrefetchOrder()
+	 */
+	std::vector<ImageId> m_prefetchOrder;
+	
+	/**
+	 * ImageId => index in m_prefetchOrder mapping.
+	 */
+	std::map<ImageId, int> m_prefetchPositions;
+	
+	/**
+	 * Positions in m_prefetchOrder of the most recently requested images.
+	 */
+	std::deque<int> m_recentPositions;
+	
+	/**
+	 * The average of m_recentPositions at the time we last
+	 * changed m_prefetchDirection.
+	 */
+	double m_recentCenter;
+	
+	/**
+	 * 1 to prefetch images following the requested ones in
+	 * m_prefetchOrder, -1 to prefetch the preceding ones.
+	 */
+	int m_prefetchDirection;
+	
 	bool m_threadStarted;
 	bool m_shuttingDown;
 };
 
 
+class ThumbnailPixmapCache::Impl::LoaderThread : public QThread
+{
+public:
+	LoaderThread(Impl& owner) : m_rOwner(owner) {}
+protected:
+	virtual void run() { m_rOwner.backgroundProcessing(); }
+private:
+	Impl& m_rOwner;
+};
+
+
 class ThumbnailPixmapCache::Impl::LoadResultEvent : public QEvent
 {
 public:
@@ -265,11 +329,11 @@ private:
 
 ThumbnailPixmapCache::ThumbnailPixmapCache(
 	QString const& thumb_dir, QSize const& max_thumb_size,
-	int const max_cached_pixmaps, int const expiration_threshold)
+	qint64 const max_cached_bytes, int const expiration_threshold)
 :	m_ptrImpl(
 		new Impl(
 			RelinkablePath::normalize(thumb_dir), max_thumb_size,
-			max_cached_pixmaps, expiration_threshold
+			max_cached_bytes, expiration_threshold
 		)
 	)
 {
@@ -285,6 +349,12 @@ ThumbnailPixmapCache::setThumbDir(QString const& thumb_dir)
 	m_ptrImpl->setThumbDir(RelinkablePath::normalize(thumb_dir));
 }
 
+void
+ThumbnailPixmapCache::setPrefetchOrder(std::vector<ImageId> const& image_ids)
+{
+	m_ptrImpl->setPrefetchOrder(image_ids);
+}
+
 ThumbnailPixmapCache::Status
 ThumbnailPixmapCache::loadFromCache(ImageId const& image_id, QPixmap& pixmap)
 {
@@ -324,20 +394,22 @@ ThumbnailPixmapCache::recreateThumbnail(
 
 ThumbnailPixmapCache::Impl::Impl(
 	QString const& thumb_dir, QSize const& max_thumb_size,
-	int const max_cached_pixmaps, int const expiration_threshold)
-:	m_backgroundLoader(*this),
-	m_items(),
+	qint64 const max_cached_bytes, int const expiration_threshold)
+:	m_items(),
 	m_itemsByKey(m_items.get<ItemsByKeyTag>()),
 	m_loadQueue(m_items.get<LoadQueueTag>()),
 	m_removeQueue(m_items.get<RemoveQueueTag>()),
 	m_endOfLoadedItems(m_removeQueue.end()),
 	m_thumbDir(thumb_dir),
 	m_maxThumbSize(max_thumb_size),
-	m_maxCachedPixmaps(max_cached_pixmaps),
+	m_maxCachedBytes(max_cached_bytes),
+	m_numCachedBytes(0),
 	m_expirationThreshold(expiration_threshold),
 	m_numQueuedItems(0),
 	m_numLoadedItems(0),
 	m_totalLoadAttempts(0),
+	m_recentCenter(0),
+	m_prefetchDirection(1),
 	m_threadStarted(false),
 	m_shuttingDown(false)
 {
@@ -346,8 +418,16 @@ ThumbnailPixmapCache::Impl::Impl(
 	// as otherwise when loading a project from a different machine,
 	// a whole bunch of bogus directories would be created.
 	QDir().mkdir(m_thumbDir);
-
-	m_backgroundLoader.moveToThread(this);
+	m_ptrStore = ThumbnailStore::open(m_thumbDir);
+	
+	int const num_threads = std::max(
+		1, std::min<int>(QThread::idealThreadCount(), MAX_LOADER_THREADS)
+	);
+	for (int i = 0; i < num_threads; ++i) {
+		m_loaderThreads.push_back(
+			boost::shared_ptr<LoaderThread>(new LoaderThread(*this))
+		);
+	}
 }
 
 ThumbnailPixmapCache::Impl::~Impl()
@@ -360,10 +440,12 @@ ThumbnailPixmapCache::Impl::~Impl()
 		}
 		
 		m_shuttingDown = true;
+		m_loadersWakeup.wakeAll();
 	}
 	
-	quit();
-	wait();
+	BOOST_FOREACH(boost::shared_ptr<LoaderThread> const& thread, m_loaderThreads) {
+		thread->wait();
+	}
 }
 
 void
@@ -376,6 +458,7 @@ ThumbnailPixmapCache::Impl::setThumbDir(QString const& thumb_dir)
 	}
 
 	m_thumbDir = thumb_dir;
+	m_ptrStore = ThumbnailStore::open(m_thumbDir);
 
 	BOOST_FOREACH(Item const& item, m_loadQueue) {
 		// This trick will make all queued tasks to expire.
@@ -386,6 +469,23 @@ ThumbnailPixmapCache::Impl::setThumbDir(QString const& thumb_dir)
 	}
 }
 
+void
+ThumbnailPixmapCache::Impl::setPrefetchOrder(std::vector<ImageId> const& image_ids)
+{
+	QMutexLocker const locker(&m_mutex);
+	
+	m_prefetchOrder = image_ids;
+	m_prefetchPositions.clear();
+	m_recentPositions.clear();
+	m_prefetchDirection = 1;
+	
+	int const num_images = m_prefetchOrder.size();
+	for (int i = 0; i < num_images; ++i) {
+		// In case of duplicates, the first occurrence wins.
+		m_prefetchPositions.insert(std::make_pair(m_prefetchOrder[i], i));
+	}
+}
+
 ThumbnailPixmapCache::Status
 ThumbnailPixmapCache::Impl::request(
 	ImageId const& image_id, QPixmap& pixmap, bool const load_now,
@@ -399,6 +499,12 @@ ThumbnailPixmapCache::Impl::request(
 		return LOAD_FAILED;
 	}
 	
+	if (completion_handler) {
+		// Requests with a completion handler come from thumbnails
+		// being painted, so they tell us what the user is looking at.
+		prefetchLocked(image_id);
+	}
+	
 	ItemsByKey::iterator const k_it(m_itemsByKey.find(image_id));
 	if (k_it != m_itemsByKey.end()) {
 		if (k_it->status == Item::LOADED) {
@@ -419,12 +525,13 @@ ThumbnailPixmapCache::Impl::request(
 	
 	if (load_now) {
 		QString const thumb_dir(m_thumbDir);
+		IntrusivePtr<ThumbnailStore> const store(m_ptrStore);
 		QSize const max_thumb_size(m_maxThumbSize);
 		
 		locker.unlock();
 		
 		pixmap = QPixmap::fromImage(
-			loadSaveThumbnail(image_id, thumb_dir, max_thumb_size)
+			loadSaveThumbnail(image_id, thumb_dir, *store, max_thumb_size)
 		);
 		if (pixmap.isNull()) {
 			return LOAD_FAILED;
@@ -474,20 +581,108 @@ ThumbnailPixmapCache::Impl::request(
 	}
 	lq_it->completionHandlers.push_back(*completion_handler);
 	
-	if (m_numQueuedItems++ == 0) {
-		if (m_threadStarted) {
-			// Wake the background thread up.
-			QCoreApplication::postEvent(
-				&m_backgroundLoader, new QEvent(QEvent::User)
-			);
-		} else {
-			// Start the background thread.
-			start();
-			m_threadStarted = true;
+	++m_numQueuedItems;
+	wakeLoadersLocked();
+	
+	return QUEUED;
+}
+
+void
+ThumbnailPixmapCache::Impl::wakeLoadersLocked()
+{
+	if (m_threadStarted) {
+		m_loadersWakeup.wakeAll();
+	} else {
+		BOOST_FOREACH(boost::shared_ptr<LoaderThread> const& thread, m_loaderThreads) {
+			thread->start();
 		}
+		m_threadStarted = true;
+	}
+}
+
+void
+ThumbnailPixmapCache::Impl::prefetchLocked(ImageId const& requested_id)
+{
+	std::map<ImageId, int>::const_iterator const pos_it(
+		m_prefetchPositions.find(requested_id)
+	);
+	if (pos_it == m_prefetchPositions.end()) {
+		return;
 	}
 	
-	return QUEUED;
+	if (!m_recentPositions.empty() && m_recentPositions.back() == pos_it->second) {
+		return;
+	}
+	
+	m_recentPositions.push_back(pos_it->second);
+	if (m_recentPositions.size() > PREFETCH_HISTORY) {
+		m_recentPositions.pop_front();
+	}
+	
+	int min_pos = m_recentPositions.front();
+	int max_pos = min_pos;
+	double sum = 0;
+	BOOST_FOREACH(int const pos, m_recentPositions) {
+		min_pos = std::min(min_pos, pos);
+		max_pos = std::max(max_pos, pos);
+		sum += pos;
+	}
+	
+	// Thumbnails within a screenful are requested in no particular order,
+	// but the center of recent requests follows the scrolling direction.
+	double const center = sum / m_recentPositions.size();
+	if (center > m_recentCenter + 0.5) {
+		m_prefetchDirection = 1;
+		m_recentCenter = center;
+	} else if (center < m_recentCenter - 0.5) {
+		m_prefetchDirection = -1;
+		m_recentCenter = center;
+	}
+	
+	int const num_to_prefetch = std::max<int>(
+		MIN_PREFETCH, std::min<int>(max_pos - min_pos + 1, MAX_PREFETCH)
+	);
+	int const num_images = m_prefetchOrder.size();
+	
+	// Prefetch requests go after any other QUEUED items.
+	LoadQueue::iterator insert_pos(m_loadQueue.begin());
+	std::advance(insert_pos, m_numQueuedItems);
+	
+	int num_prefetched = 0;
+	for (int i = 1; i <= num_to_prefetch; ++i) {
+		int const pos = m_prefetchDirection > 0 ? max_pos + i : min_pos - i;
+		if (pos < 0 || pos >= num_images) {
+			break;
+		}
+		
+		ImageId const& image_id = m_prefetchOrder[pos];
+		if (m_itemsByKey.find(image_id) != m_itemsByKey.end()) {
+			continue;
+		}
+		
+		// Items queued ahead of this one shouldn't make it expire.
+		int const preceding_load_attempts =
+			m_totalLoadAttempts + m_numQueuedItems;
+		LoadQueue::iterator const lq_it(
+			m_loadQueue.insert(
+				insert_pos,
+				Item(image_id, preceding_load_attempts, Item::QUEUED)
+			).first
+		);
+		// Now our new item is after all other QUEUED items in the
+		// load queue and at the end of the remove queue.
+		
+		if (m_endOfLoadedItems == m_removeQueue.end()) {
+			m_endOfLoadedItems = m_items.project<RemoveQueueTag>(lq_it);
+		}
+		
+		++m_numQueuedItems;
+		++num_prefetched;
+	}
+	
+	if (num_prefetched > 0) {
+		wakeLoadersLocked();
+	}
 }
 
 void
@@ -503,22 +698,15 @@ ThumbnailPixmapCache::Impl::ensureThumbnailExists(
 	}
 	
 	QMutexLocker locker(&m_mutex);
-	QString const thumb_dir(m_thumbDir);
+	IntrusivePtr<ThumbnailStore> const store(m_ptrStore);
 	QSize const max_thumb_size(m_maxThumbSize);
 	locker.unlock();
 	
-	QString const thumb_file_path(getThumbFilePath(image_id, thumb_dir));
-	if (QFile::exists(thumb_file_path)) {
+	if (store->contains(image_id)) {
 		return;
 	}
 	
-	QImage const thumbnail(makeThumbnail(image, max_thumb_size));
-	
-	AtomicFileOverwriter overwriter;
-	QIODevice* iodev = overwriter.startWriting(thumb_file_path);
-	if (iodev && thumbnail.save(iodev, "PNG")) {
-		overwriter.commit();
-	}
+	store->save(image_id, makeThumbnail(image, max_thumb_size));
 }
 
 void
@@ -534,22 +722,15 @@ ThumbnailPixmapCache::Impl::recreateThumbnail(
 	}
 	
 	QMutexLocker locker(&m_mutex);
-	QString const thumb_dir(m_thumbDir);
+	IntrusivePtr<ThumbnailStore> const store(m_ptrStore);
 	QSize const max_thumb_size(m_maxThumbSize);
 	locker.unlock();
 	
-	QString const thumb_file_path(getThumbFilePath(image_id, thumb_dir));
-	QImage const thumbnail(makeThumbnail(image, max_thumb_size));
-	bool thumb_written = false;
-	
 	// Note that we may be called from multiple threads at the same time.
-	AtomicFileOverwriter overwriter;
-	QIODevice* iodev = overwriter.startWriting(thumb_file_path);
-	if (iodev && thumbnail.save(iodev, "PNG")) {
-		thumb_written = overwriter.commit();
-	} else {
-		overwriter.abort();
-	}
+	// ThumbnailStore takes care of that.
+	bool const thumb_written = store->save(
+		image_id, makeThumbnail(image, max_thumb_size)
+	);
 	
 	if (!thumb_written) {
 		return;
@@ -580,13 +761,6 @@ ThumbnailPixmapCache::Impl::recreateThumbnail(
 	}
 }
 
-void
-ThumbnailPixmapCache::Impl::run()
-{
-	backgroundProcessing();
-	exec(); // Wait for further processing requests (via custom events).
-}
-
 void
 ThumbnailPixmapCache::Impl::customEvent(QEvent* e)
 {
@@ -605,25 +779,25 @@ ThumbnailPixmapCache::Impl::backgroundProcessing()
 			LoadQueue::iterator lq_it;
 			ImageId image_id;
 			QString thumb_dir;
+			IntrusivePtr<ThumbnailStore> store;
 			QSize max_thumb_size;
 
 			{
 				QMutexLocker const locker(&m_mutex);
 
-				if (m_shuttingDown || m_items.empty()) {
+				while (!m_shuttingDown && m_numQueuedItems == 0) {
+					m_loadersWakeup.wait(&m_mutex);
+				}
+
+				if (m_shuttingDown) {
 					break;
 				}
 
+				// All QUEUED items precede any other items
+				// in the load queue.
 				lq_it = m_loadQueue.begin();
 				image_id = lq_it->imageId;
-
-				if (lq_it->status != Item::QUEUED) {
-					// All QUEUED items precede any other items
-					// in the load queue, so it means there are no
-					// QUEUED items at all.
-					assert(m_numQueuedItems == 0);
-					break;
-				}
+				assert(lq_it->status == Item::QUEUED);
 
 				// By marking the item as IN_PROGRESS, we prevent it
 				// from being processed again before the GUI thread
@@ -650,11 +824,12 @@ ThumbnailPixmapCache::Impl::backgroundProcessing()
 
 				// Copy those while holding the mutex.
 				thumb_dir = m_thumbDir;
+				store = m_ptrStore;
 				max_thumb_size = m_maxThumbSize;
 			} // mutex scope
 
 			QImage const image(
-				loadSaveThumbnail(image_id, thumb_dir, max_thumb_size)
+				loadSaveThumbnail(image_id, thumb_dir, *store, max_thumb_size)
 			);
 
 			ThumbnailLoadResult::Status const status = image.isNull()
@@ -670,22 +845,33 @@ ThumbnailPixmapCache::Impl::backgroundProcessing()
 QImage
 ThumbnailPixmapCache::Impl::loadSaveThumbnail(
 	ImageId const& image_id, QString const& thumb_dir,
-	QSize const& max_thumb_size)
+	ThumbnailStore& store, QSize const& max_thumb_size)
 {
-	QString const thumb_file_path(getThumbFilePath(image_id, thumb_dir));
-	
-	QImage image(ImageLoader::load(thumb_file_path, 0));
+	QImage image(store.load(image_id));
 	if (!image.isNull()) {
 		return image;
 	}
 	
+	// Projects created before the introduction of ThumbnailStore have
+	// one file per thumbnail.  Move such thumbnails into the store.
+	QString const legacy_thumb_path(getThumbFilePath(image_id, thumb_dir));
+	if (QFile::exists(legacy_thumb_path)) {
+		image = ImageLoader::load(legacy_thumb_path, 0);
+		if (!image.isNull()) {
+			if (store.save(image_id, image)) {
+				QFile::remove(legacy_thumb_path);
+			}
+			return image;
+		}
+	}
+	
 	image = ImageLoader::load(image_id);
 	if (image.isNull()) {
 		return QImage();
 	}
 	
 	QImage const thumbnail(makeThumbnail(image, max_thumb_size));
-	thumbnail.save(thumb_file_path, "PNG");
+	store.save(image_id, thumbnail);
 	
 	return thumbnail;
 }
@@ -804,11 +990,14 @@ ThumbnailPixmapCache::Impl::processLoadResult(LoadResultEvent* result)
 		item.completionHandlers.swap(completion_handlers);
 		
 		if (result->status() == ThumbnailLoadResult::LOADED) {
-			// Maybe remove an older item.
-			removeExcessLocked();
+			qint64 const num_bytes = pixmapBytes(item.pixmap);
+			
+			// Maybe remove some older items.
+			removeExcessLocked(num_bytes);
 			
 			item.status = Item::LOADED;
 			++m_numLoadedItems;
+			m_numCachedBytes += num_bytes;
 			
 			// Move this item after all other LOADED items in
 			// the remove queue.
@@ -845,10 +1034,10 @@ ThumbnailPixmapCache::Impl::processLoadResult(LoadResultEvent* result)
 }
 
 void
-ThumbnailPixmapCache::Impl::removeExcessLocked()
+ThumbnailPixmapCache::Impl::removeExcessLocked(qint64 const incoming_bytes)
 {
-	if (m_numLoadedItems >= m_maxCachedPixmaps) {
-		assert(m_numLoadedItems > 0);
+	while (m_numLoadedItems > 0 &&
+			m_numCachedBytes + incoming_bytes > m_maxCachedBytes) {
 		assert(!m_removeQueue.empty());
 		assert(m_removeQueue.front().status == Item::LOADED);
 		removeItemLocked(m_removeQueue.begin());
@@ -867,6 +1056,7 @@ ThumbnailPixmapCache::Impl::removeItemLocked(
 		case Item::LOADED:
 			assert(m_numLoadedItems > 0);
 			--m_numLoadedItems;
+			m_numCachedBytes -= pixmapBytes(it->pixmap);
 			break;
 		default:;
 	}
@@ -896,14 +1086,15 @@ ThumbnailPixmapCache::Impl::cachePixmapLocked(
 	
 	Item::Status const new_status = pixmap.isNull()
 			? Item::LOAD_FAILED : Item::LOADED;
+	qint64 const num_bytes = pixmapBytes(pixmap);
 	
 	// Check if such item already exists.
 	ItemsByKey::iterator const k_it(m_itemsByKey.find(image_id));
 	if (k_it == m_itemsByKey.end()) {
 		// Existing item not found.
 		
-		// Maybe remove an older item.
-		removeExcessLocked();
+		// Maybe remove some older items.
+		removeExcessLocked(num_bytes);
 		
 		// Insert our new item.
 		RemoveQueue::iterator const rq_it(
@@ -917,6 +1108,9 @@ ThumbnailPixmapCache::Impl::cachePixmapLocked(
 		
 		if (new_status == Item::LOAD_FAILED) {
 			--m_endOfLoadedItems;
+		} else {
+			++m_numLoadedItems;
+			m_numCachedBytes += num_bytes;
 		}
 		
 		rq_it->pixmap = pixmap;
@@ -941,8 +1135,7 @@ ThumbnailPixmapCache::Impl::cachePixmapLocked(
 		// handlers right now.  We'd rather do it asynchronously,
 		// so let's transition it to IN_PROGRESS and send
 		// a LoadResultEvent asynchronously.
-		
-		assert(!k_it->completionHandlers.empty());
+		// Note that prefetched items don't have completion handlers.
 		
 		LoadQueue::iterator const lq_it(
 			m_items.project<LoadQueueTag>(k_it)
@@ -956,6 +1149,10 @@ ThumbnailPixmapCache::Impl::cachePixmapLocked(
 	
 	assert(k_it->status == Item::LOAD_FAILED);
 	
+	if (new_status == Item::LOADED) {
+		removeExcessLocked(num_bytes);
+	}
+	
 	k_it->status = new_status;
 	k_it->pixmap = pixmap;
 	
@@ -965,9 +1162,19 @@ ThumbnailPixmapCache::Impl::cachePixmapLocked(
 		);
 		m_removeQueue.relocate(m_endOfLoadedItems, rq_it);
 		++m_numLoadedItems;
+		m_numCachedBytes += num_bytes;
 	}
 }
 
+qint64
+ThumbnailPixmapCache::Impl::pixmapBytes(QPixmap const& pixmap)
+{
+	// QPixmap::depth() doesn't tell how much memory a pixmap takes.
+	// On X11 it reports 24 for 32-bit pixmaps, and 1 for bitmaps that
+	// may have been converted to 32 bits anyway.  We assume the worst.
+	return qint64(pixmap.width()) * pixmap.height() * 4;
+}
+
 
 /*====================== ThumbnailPixmapCache::Item =========================*/
 
@@ -1005,16 +1212,3 @@ ThumbnailPixmapCache::Impl::LoadResultEvent::~LoadResultEvent()
 {
 }
 
-
-/*================== ThumbnailPixmapCache::BackgroundLoader =================*/
-
-ThumbnailPixmapCache::Impl::BackgroundLoader::BackgroundLoader(Impl& owner)
-:	m_rOwner(owner)
-{
-}
-
-void
-ThumbnailPixmapCache::Impl::BackgroundLoader::customEvent(QEvent*)
-{
-	m_rOwner.backgroundProcessing();
-}
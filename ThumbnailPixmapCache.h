@@ -26,7 +26,9 @@
 #ifndef Q_MOC_RUN
 #include <boost/weak_ptr.hpp>
 #endif
+#include <QtGlobal>
 #include <memory>
+#include <vector>
 
 class ImageId;
 class QImage;
@@ -49,11 +51,14 @@ public:
 	 *
 	 * \param thumb_dir The directory to store thumbnails in.  If the
 	 *        provided directory doesn't exist, it will be created.
+	 *        Thumbnails are kept in a single file there.
+	 *        \see ThumbnailStore
 	 * \param max_size The maximum width and height for thumbnails.
 	 *        The actual thumbnail size is going to depend on its aspect
 	 *        ratio, but it won't exceed the provided maximum.
-	 * \param max_cached_pixmaps The maximum number of pixmaps to store
-	 *        in memory.
+	 * \param max_cached_bytes The maximum total size of pixmaps
+	 *        to keep in memory.  The least recently used pixmaps are
+	 *        evicted to stay within this limit.
 	 * \param expiration_threshold Requests are served from newest to
 	 *        oldest ones. If a request is still not served after a certain
 	 *        number of newer requests have been served, that request is
@@ -63,7 +68,7 @@ public:
 	 * \see ThumbnailLoadResult::REQUEST_EXPIRED
 	 */
 	ThumbnailPixmapCache(QString const& thumb_dir, QSize const& max_size,
-		int max_cached_pixmaps, int expiration_threshold);
+		qint64 max_cached_bytes, int expiration_threshold);
 	
 	/**
 	 * \brief Destructor.  To be called from the GUI thread only.
@@ -71,6 +76,19 @@ public:
 	virtual ~ThumbnailPixmapCache();
 	
 	void setThumbDir(QString const& thumb_dir);
+	
+	/**
+	 * \brief Sets the order in which images are presented to the user.
+	 *
+	 * Load requests are matched against this order to figure out which
+	 * part of it is visible and in which direction it's being scrolled.
+	 * The thumbnails that are about to become visible are then loaded
+	 * in background, after any explicitly requested ones.
+	 * Passing an empty vector disables prefetching.
+	 *
+	 * \note This function is to be called from the GUI thread only.
+	 */
+	void setPrefetchOrder(std::vector<ImageId> const& image_ids);
 
 	/**
 	 * \brief Take the pixmap from cache, if it's there.
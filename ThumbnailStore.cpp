@@ -0,0 +1,480 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThumbnailStore.h"
+#include "AtomicFileOverwriter.h"
+#include <QIODevice>
+#include <QBuffer>
+#include <QByteArray>
+#include <QImage>
+#include <QDir>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDebug>
+#include <algorithm>
+#include <map>
+#include <string.h>
+#include <assert.h>
+
+namespace
+{
+
+/*
+ * File layout (all integers are big-endian):
+ *
+ * Header:
+ *   "STTH"          4 bytes
+ *   version         uint32
+ * Record (repeated):
+ *   RECORD_MARKER   uint32
+ *   page            uint32, as in ImageId::page()
+ *   key_size        uint32
+ *   data_size       uint32
+ *   key             key_size bytes, UTF-8 encoded ImageId::filePath()
+ *   data            data_size bytes, PNG data
+ */
+
+char const FILE_MAGIC[4] = { 'S', 'T', 'T', 'H' };
+quint32 const FILE_VERSION = 1;
+int const FILE_HEADER_SIZE = 8;
+quint32 const RECORD_MARKER = 0x54485242;
+int const RECORD_HEADER_SIZE = 16;
+quint32 const MAX_KEY_SIZE = 64 * 1024;
+
+/**
+ * Compaction is only considered when overridden records take
+ * more than that.
+ */
+qint64 const MIN_DEAD_SIZE_TO_COMPACT = 1024 * 1024;
+
+/**
+ * The file is mapped in chunks of this size.  It has to be a multiple
+ * of the mapping granularity, which is 64K on Windows.
+ */
+qint64 const MAPPING_CHUNK_SIZE = 4 * 1024 * 1024;
+
+/**
+ * Stores that are currently open, by file path.
+ */
+struct Registry
+{
+	QMutex mutex;
+	std::map<QString, ThumbnailStore*> stores;
+};
+
+Q_GLOBAL_STATIC(Registry, registry)
+
+quint32 readU32(uchar const* p)
+{
+	return (quint32(p[0]) << 24) | (quint32(p[1]) << 16)
+		| (quint32(p[2]) << 8) | quint32(p[3]);
+}
+
+void appendU32(QByteArray& ba, quint32 const val)
+{
+	ba.append(char(val >> 24));
+	ba.append(char(val >> 16));
+	ba.append(char(val >> 8));
+	ba.append(char(val));
+}
+
+QByteArray fileHeader()
+{
+	QByteArray header(FILE_MAGIC, sizeof(FILE_MAGIC));
+	appendU32(header, FILE_VERSION);
+	return header;
+}
+
+} // anonymous namespace
+
+IntrusivePtr<ThumbnailStore>
+ThumbnailStore::open(QString const& thumb_dir)
+{
+	QString const file_path(
+		QDir::cleanPath(
+			QDir(thumb_dir).absoluteFilePath(QString::fromAscii("thumbs.pack"))
+		)
+	);
+
+	Registry* const reg = registry();
+	QMutexLocker const locker(&reg->mutex);
+
+	ThumbnailStore*& store = reg->stores[file_path];
+	if (!store) {
+		store = new ThumbnailStore(file_path);
+	}
+
+	// Taking a reference doesn't lock the registry mutex,
+	// so we can do it while holding one.
+	return IntrusivePtr<ThumbnailStore>(store);
+}
+
+ThumbnailStore::ThumbnailStore(QString const& file_path)
+:	m_numRefs(0),
+	m_filePath(file_path),
+	m_file(m_filePath),
+	m_validSize(0),
+	m_deadSize(0)
+{
+	QMutexLocker const locker(&m_mutex);
+
+	if (openLocked()) {
+		scanLocked();
+		if (m_deadSize > MIN_DEAD_SIZE_TO_COMPACT &&
+				m_deadSize > m_validSize - m_deadSize) {
+			compactLocked();
+		}
+	}
+}
+
+ThumbnailStore::~ThumbnailStore()
+{
+	unmapLocked();
+}
+
+bool
+ThumbnailStore::contains(ImageId const& image_id) const
+{
+	QMutexLocker const locker(&m_mutex);
+	return m_index.find(image_id) != m_index.end();
+}
+
+QImage
+ThumbnailStore::load(ImageId const& image_id)
+{
+	QByteArray data;
+
+	{
+		QMutexLocker const locker(&m_mutex);
+
+		Index::const_iterator const it(m_index.find(image_id));
+		if (it == m_index.end()) {
+			return QImage();
+		}
+
+		if (!readLocked(it->second, data)) {
+			return QImage();
+		}
+	} // mutex scope
+
+	// Decoding happens without holding the mutex.
+	return QImage::fromData(data, "PNG");
+}
+
+bool
+ThumbnailStore::save(ImageId const& image_id, QImage const& thumbnail)
+{
+	if (thumbnail.isNull()) {
+		return false;
+	}
+
+	// Encoding happens without holding the mutex.
+	QByteArray data;
+	QBuffer buffer(&data);
+	buffer.open(QIODevice::WriteOnly);
+	if (!thumbnail.save(&buffer, "PNG")) {
+		return false;
+	}
+	buffer.close();
+
+	QMutexLocker const locker(&m_mutex);
+	return appendLocked(image_id, data);
+}
+
+bool
+ThumbnailStore::openLocked()
+{
+	if (!m_file.open(QIODevice::ReadWrite)) {
+		return false;
+	}
+
+	QByteArray const expected_header(fileHeader());
+	if (m_file.read(FILE_HEADER_SIZE) == expected_header) {
+		m_validSize = FILE_HEADER_SIZE;
+		return true;
+	}
+
+	// Either a new file or one we don't understand.
+	if (!m_file.resize(0) || !m_file.seek(0)
+			|| m_file.write(expected_header) != FILE_HEADER_SIZE) {
+		m_file.close();
+		return false;
+	}
+
+	m_validSize = FILE_HEADER_SIZE;
+	return true;
+}
+
+void
+ThumbnailStore::scanLocked()
+{
+	qint64 const file_size = m_file.size();
+
+	uchar hdr[RECORD_HEADER_SIZE];
+	QByteArray key;
+	qint64 offset = FILE_HEADER_SIZE;
+	while (offset + RECORD_HEADER_SIZE <= file_size) {
+		if (!readLocked(offset, RECORD_HEADER_SIZE, (char*)hdr)
+				|| readU32(hdr) != RECORD_MARKER) {
+			break;
+		}
+
+		quint32 const page = readU32(hdr + 4);
+		quint32 const key_size = readU32(hdr + 8);
+		quint32 const data_size = readU32(hdr + 12);
+		if (key_size > MAX_KEY_SIZE) {
+			break;
+		}
+
+		qint64 const key_offset = offset + RECORD_HEADER_SIZE;
+		qint64 const data_offset = key_offset + key_size;
+		qint64 const record_end = data_offset + data_size;
+		if (record_end > file_size) {
+			// Truncated record.
+			break;
+		}
+
+		key.resize(key_size);
+		if (!readLocked(key_offset, key_size, key.data())) {
+			break;
+		}
+
+		ImageId const image_id(QString::fromUtf8(key.constData(), key_size), (int)page);
+		Record const record(data_offset, data_size);
+
+		Index::iterator const it(m_index.lower_bound(image_id));
+		if (it != m_index.end() && !m_index.key_comp()(image_id, it->first)) {
+			// An earlier record is overridden by this one.
+			m_deadSize += RECORD_HEADER_SIZE + key_size + it->second.size;
+			it->second = record;
+		} else {
+			m_index.insert(it, Index::value_type(image_id, record));
+		}
+
+		offset = record_end;
+	}
+
+	m_validSize = offset;
+
+	if (file_size > m_validSize) {
+		// Get rid of an incomplete record, so that it's not mistaken
+		// for something else after shorter records get appended.
+		unmapLocked();
+		m_file.resize(m_validSize);
+	}
+}
+
+/**
+ * Returns the mapping of the given chunk, extending at least
+ * to the \p end offset of the file, or null if mapping failed.
+ */
+uchar const*
+ThumbnailStore::mapChunkLocked(int const chunk_idx, qint64 const end)
+{
+	if (chunk_idx >= (int)m_mappedChunks.size()) {
+		m_mappedChunks.resize(chunk_idx + 1);
+	}
+
+	MappedChunk& chunk = m_mappedChunks[chunk_idx];
+	qint64 const chunk_offset = chunk_idx * MAPPING_CHUNK_SIZE;
+	if (chunk.data && chunk_offset + chunk.size >= end) {
+		return chunk.data;
+	}
+
+	if (chunk.data) {
+		// The file has grown since.  Only this chunk has to be remapped.
+		m_file.unmap(chunk.data);
+		chunk = MappedChunk();
+	}
+
+	qint64 const size = std::min(MAPPING_CHUNK_SIZE, m_file.size() - chunk_offset);
+	if (chunk_offset + size < end) {
+		return 0;
+	}
+
+	chunk.data = m_file.map(chunk_offset, size);
+	if (!chunk.data) {
+		return 0;
+	}
+
+	chunk.size = size;
+	return chunk.data;
+}
+
+void
+ThumbnailStore::unmapLocked()
+{
+	for (size_t i = 0; i < m_mappedChunks.size(); ++i) {
+		if (m_mappedChunks[i].data) {
+			m_file.unmap(m_mappedChunks[i].data);
+		}
+	}
+	m_mappedChunks.clear();
+}
+
+bool
+ThumbnailStore::readLocked(qint64 offset, qint64 size, char* dst)
+{
+	while (size > 0) {
+		int const chunk_idx = (int)(offset / MAPPING_CHUNK_SIZE);
+		qint64 const chunk_offset = chunk_idx * MAPPING_CHUNK_SIZE;
+		qint64 const len = std::min(size, chunk_offset + MAPPING_CHUNK_SIZE - offset);
+
+		uchar const* const chunk = mapChunkLocked(chunk_idx, offset + len);
+		if (!chunk) {
+			// Mapping may fail on 32-bit systems with address space exhausted.
+			// Fall back to regular reading.
+			return m_file.seek(offset) && m_file.read(dst, size) == size;
+		}
+
+		memcpy(dst, chunk + (offset - chunk_offset), len);
+		offset += len;
+		dst += len;
+		size -= len;
+	}
+
+	return true;
+}
+
+bool
+ThumbnailStore::readLocked(Record const& record, QByteArray& data)
+{
+	data.resize(record.size);
+	return readLocked(record.offset, record.size, data.data());
+}
+
+bool
+ThumbnailStore::appendLocked(ImageId const& image_id, QByteArray const& data)
+{
+	if (!m_file.isOpen()) {
+		return false;
+	}
+
+	QByteArray const header(encodeRecordHeader(image_id, data.size()));
+
+	// Anything past m_validSize is a garbage from an incomplete write.
+	if (!m_file.seek(m_validSize)) {
+		return false;
+	}
+	if (m_file.write(header) != header.size() ||
+			m_file.write(data) != data.size() || !m_file.flush()) {
+		// Whatever got written will be overwritten next time.
+		return false;
+	}
+
+	Record const record(m_validSize + header.size(), data.size());
+	m_validSize = record.offset + record.size;
+
+	Index::iterator const it(m_index.lower_bound(image_id));
+	if (it != m_index.end() && !m_index.key_comp()(image_id, it->first)) {
+		m_deadSize += header.size() + it->second.size;
+		it->second = record;
+	} else {
+		m_index.insert(it, Index::value_type(image_id, record));
+	}
+
+	return true;
+}
+
+void
+ThumbnailStore::compactLocked()
+{
+	AtomicFileOverwriter overwriter;
+	QIODevice* iodev = overwriter.startWriting(m_filePath);
+	if (!iodev) {
+		return;
+	}
+
+	if (iodev->write(fileHeader()) != FILE_HEADER_SIZE) {
+		return;
+	}
+
+	QByteArray data;
+	Index::const_iterator it(m_index.begin());
+	Index::const_iterator const end(m_index.end());
+	for (; it != end; ++it) {
+		if (!readLocked(it->second, data)) {
+			return;
+		}
+		QByteArray const header(encodeRecordHeader(it->first, data.size()));
+		if (iodev->write(header) != header.size() ||
+				iodev->write(data) != data.size()) {
+			return;
+		}
+	}
+
+	// The target file has to be closed for the rename to work on Windows.
+	unmapLocked();
+	m_file.close();
+
+	if (!overwriter.commit()) {
+		qDebug() << "Failed to compact" << m_filePath;
+	}
+
+	m_index.clear();
+	m_validSize = 0;
+	m_deadSize = 0;
+	if (openLocked()) {
+		scanLocked();
+	}
+}
+
+QByteArray
+ThumbnailStore::encodeRecordHeader(
+	ImageId const& image_id, quint32 const data_size)
+{
+	QByteArray const key(image_id.filePath().toUtf8());
+
+	QByteArray header;
+	header.reserve(RECORD_HEADER_SIZE + key.size());
+	appendU32(header, RECORD_MARKER);
+	appendU32(header, (quint32)image_id.page());
+	appendU32(header, key.size());
+	appendU32(header, data_size);
+	header.append(key);
+
+	return header;
+}
+
+void intrusive_ref(ThumbnailStore& store)
+{
+	store.m_numRefs.fetchAndAddRelaxed(1);
+}
+
+void intrusive_unref(ThumbnailStore& store)
+{
+	Registry* const reg = registry();
+	if (!reg) {
+		// The registry is already destroyed at exit.
+		if (store.m_numRefs.fetchAndAddRelease(-1) == 1) {
+			delete &store;
+		}
+		return;
+	}
+
+	{
+		QMutexLocker const locker(&reg->mutex);
+		if (store.m_numRefs.fetchAndAddRelease(-1) != 1) {
+			return;
+		}
+		reg->stores.erase(store.filePath());
+	}
+
+	// Closing the file happens without holding the mutex.
+	delete &store;
+}
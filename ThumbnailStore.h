@@ -0,0 +1,173 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THUMBNAILSTORE_H_
+#define THUMBNAILSTORE_H_
+
+#include "NonCopyable.h"
+#include "IntrusivePtr.h"
+#include "ImageId.h"
+#include <QString>
+#include <QFile>
+#include <QMutex>
+#include <QAtomicInt>
+#include <map>
+#include <vector>
+
+class QImage;
+class QByteArray;
+
+/**
+ * \brief A single-file container of PNG-encoded thumbnails.
+ *
+ * Instead of keeping one file per thumbnail, all thumbnails of a project
+ * are kept in one file, consisting of a small header followed by records.
+ * Each record holds an ImageId and the PNG data of its thumbnail.
+ * New and updated thumbnails are appended to the end of the file, so
+ * a record that appears later overrides an earlier one for the same ImageId.
+ *
+ * The file is opened once and memory-mapped in chunks of fixed size,
+ * so that growing the file only requires remapping its last chunk.
+ * The in-memory index, mapping ImageId to a record's location, is built
+ * by scanning record headers when the store is opened.  A truncated record
+ * at the end of file (for example after a crash) is discarded.  If the file
+ * contains more overridden records than live ones, it's compacted on opening.
+ *
+ * Appending relies on the in-memory index and file size being up to date,
+ * so there is only one ThumbnailStore per file, shared by everyone who
+ * opens it.
+ *
+ * All methods are thread-safe.
+ */
+class ThumbnailStore
+{
+	DECLARE_NON_COPYABLE(ThumbnailStore)
+public:
+	/**
+	 * \brief Returns the store in the given directory.
+	 *
+	 * If the store is already open, the existing instance is returned.
+	 * Otherwise, the store file is opened or created.  If the directory
+	 * doesn't exist, the store will be empty and all writes to it will fail.
+	 */
+	static IntrusivePtr<ThumbnailStore> open(QString const& thumb_dir);
+
+	QString const& filePath() const { return m_filePath; }
+
+	bool contains(ImageId const& image_id) const;
+
+	/**
+	 * \brief Decodes a stored thumbnail.
+	 *
+	 * \return The thumbnail or a null image, if there is no such thumbnail
+	 *         in the store or it failed to decode.
+	 */
+	QImage load(ImageId const& image_id);
+
+	/**
+	 * \brief Encodes a thumbnail as PNG and appends it to the store.
+	 *
+	 * A thumbnail previously stored under the same ImageId is overridden.
+	 */
+	bool save(ImageId const& image_id, QImage const& thumbnail);
+private:
+	friend void intrusive_ref(ThumbnailStore& store);
+
+	friend void intrusive_unref(ThumbnailStore& store);
+
+	struct Record
+	{
+		qint64 offset; /**< Offset of PNG data in file. */
+		quint32 size; /**< The size of PNG data. */
+
+		Record() : offset(0), size(0) {}
+
+		Record(qint64 off, quint32 sz) : offset(off), size(sz) {}
+	};
+
+	struct MappedChunk
+	{
+		uchar* data;
+		qint64 size; /**< Less than MAPPING_CHUNK_SIZE near the end of file. */
+
+		MappedChunk() : data(0), size(0) {}
+	};
+
+	typedef std::map<ImageId, Record> Index;
+
+	explicit ThumbnailStore(QString const& file_path);
+
+	~ThumbnailStore();
+
+	bool openLocked();
+
+	void scanLocked();
+
+	uchar const* mapChunkLocked(int chunk_idx, qint64 end);
+
+	void unmapLocked();
+
+	bool readLocked(qint64 offset, qint64 size, char* dst);
+
+	bool readLocked(Record const& record, QByteArray& data);
+
+	bool appendLocked(ImageId const& image_id, QByteArray const& data);
+
+	void compactLocked();
+
+	static QByteArray encodeRecordHeader(
+		ImageId const& image_id, quint32 data_size);
+
+	/**
+	 * The number of IntrusivePtr's pointing to us.  It only drops
+	 * to zero while holding the mutex of the store registry.
+	 */
+	QAtomicInt m_numRefs;
+
+	mutable QMutex m_mutex;
+	QString m_filePath;
+	QFile m_file;
+	Index m_index;
+
+	/**
+	 * m_mappedChunks[i] maps the part of file starting at
+	 * i * MAPPING_CHUNK_SIZE.  Chunks are mapped on demand.
+	 */
+	std::vector<MappedChunk> m_mappedChunks;
+
+	/**
+	 * The size of the part of file that consists of complete records.
+	 * Anything beyond that will be overwritten by the next append.
+	 */
+	qint64 m_validSize;
+
+	/**
+	 * The total size of records that were overridden by later ones.
+	 */
+	qint64 m_deadSize;
+};
+
+/**
+ * The last reference going away closes the store under the registry
+ * mutex, so that ThumbnailStore::open() never returns a dying instance.
+ */
+void intrusive_ref(ThumbnailStore& store);
+
+void intrusive_unref(ThumbnailStore& store);
+
+#endif
@@ -21,6 +21,9 @@
 #include "NonCopyable.h"
 #include "Dpi.h"
 #include "Dpm.h"
+#include "imageproc/Grayscale.h"
+#include "imageproc/BinaryImage.h"
+#include "imageproc/ByteOrder.h"
 #include <QtGlobal>
 #include <QSysInfo>
 #include <QIODevice>
@@ -144,15 +147,17 @@ TiffReader::TiffInfo::TiffInfo(TiffHandle const& tif, TiffHeader const& header)
 bool
 TiffReader::TiffInfo::mapsToBinaryOrIndexed8() const
 {
-	if (samples_per_pixel != 1 || sample_format != SAMPLEFORMAT_UINT || bits_per_sample > 8) {
+	if (samples_per_pixel != 1 || sample_format != SAMPLEFORMAT_UINT) {
 		return false;
 	}
 	
 	switch (photometric) {
 		case PHOTOMETRIC_PALETTE:
+			return bits_per_sample <= 8;
 		case PHOTOMETRIC_MINISBLACK:
 		case PHOTOMETRIC_MINISWHITE:
-			return true;
+			// 16 bit grayscale gets reduced to 8 bits.
+			return bits_per_sample <= 8 || bits_per_sample == 16;
 	}
 	
 	return false;
@@ -312,6 +317,101 @@ TiffReader::readImage(QIODevice& device, int const page_num)
 	
 	ImageMetadata const metadata(currentPageMetadata(tif));
 	
+	QImage image(readCurrentPage(tif, info));
+	
+	if (!image.isNull() && !metadata.dpi().isNull()) {
+		Dpm const dpm(metadata.dpi());
+		image.setDotsPerMeterX(dpm.horizontal());
+		image.setDotsPerMeterY(dpm.vertical());
+	}
+	
+	return image;
+}
+
+imageproc::BinaryImage
+TiffReader::readBinaryImage(QIODevice& device, int const page_num)
+{
+	using namespace imageproc;
+	
+	if (!device.isReadable()) {
+		return BinaryImage();
+	}
+	if (device.isSequential()) {
+		// libtiff needs to be able to seek.
+		return BinaryImage();
+	}
+	
+	TiffHeader header(readHeader(device));
+	if (!checkHeader(header)) {
+		return BinaryImage();
+	}
+	
+	TiffHandle tif(
+		TIFFClientOpen(
+			"file", "rBm", &device, &deviceRead, &deviceWrite,
+			&deviceSeek, &deviceClose, &deviceSize,
+			&deviceMap, &deviceUnmap
+		)
+	);
+	if (!tif.handle()) {
+		return BinaryImage();
+	}
+	
+	if (!TIFFSetDirectory(tif.handle(), page_num)) {
+		return BinaryImage();
+	}
+	
+	TiffInfo const info(tif, header);
+	if (info.width <= 0 || info.height <= 0) {
+		return BinaryImage();
+	}
+	
+	bool const bitonal = info.samples_per_pixel == 1
+		&& info.bits_per_sample == 1
+		&& (info.photometric == PHOTOMETRIC_MINISBLACK
+		|| info.photometric == PHOTOMETRIC_MINISWHITE);
+	if (!bitonal) {
+		// General case.
+		QImage const image(readCurrentPage(tif, info));
+		if (image.isNull()) {
+			return BinaryImage();
+		}
+		return BinaryImage(image);
+	}
+	
+	// Because we open with the B option, the bit order within bytes is
+	// MSB to LSB, the same as within BinaryImage words.  So, a scanline
+	// read straight into a BinaryImage line only needs its words converted
+	// from big-endian to host order.  TIFF scanlines are padded to a byte
+	// boundary, while BinaryImage lines are padded to a word boundary, so
+	// a scanline always fits.
+	BinaryImage image(info.width, info.height);
+	int const wpl = image.wordsPerLine();
+	uint32_t* line = image.data();
+	
+	// In BinaryImage, 1 means black.
+	uint32_t const modifier = info.photometric == PHOTOMETRIC_MINISBLACK
+		? ~uint32_t(0) : 0;
+	
+	// TIFFReadScanline() only fills the bytes covering the width,
+	// so the padding bits of the last word have to be cleared.
+	int const last_word_unused_bits = (wpl << 5) - info.width;
+	uint32_t const last_word_mask = ~uint32_t(0) << last_word_unused_bits;
+	
+	for (int y = 0; y < info.height; ++y, line += wpl) {
+		if (TIFFReadScanline(tif.handle(), line, y) == -1) {
+			return BinaryImage();
+		}
+		bigEndianToHostInPlace(line, wpl, modifier);
+		line[wpl - 1] &= last_word_mask;
+	}
+	
+	return image;
+}
+
+QImage
+TiffReader::readCurrentPage(TiffHandle const& tif, TiffInfo const& info)
+{
 	QImage image;
 	
 	if (info.mapsToBinaryOrIndexed8()) {
@@ -358,12 +458,6 @@ TiffReader::readImage(QIODevice& device, int const page_num)
 		}
 	}
 	
-	if (!metadata.dpi().isNull()) {
-		Dpm const dpm(metadata.dpi());
-		image.setDotsPerMeterX(dpm.horizontal());
-		image.setDotsPerMeterY(dpm.vertical());
-	}
-	
 	return image;
 }
 
@@ -443,6 +537,34 @@ TiffReader::extractBinaryOrIndexed8Image(
 		throw std::bad_alloc();
 	}
 	
+	if (info.photometric != PHOTOMETRIC_PALETTE && info.bits_per_sample > 1) {
+		// We produce images with the standard grayscale palette,
+		// so that converting them to GrayImage is a no-op.
+		image.setColorTable(imageproc::createGrayscalePalette());
+		
+		if (info.bits_per_sample == 16) {
+			readGray16Lines(tif, info, image);
+			return image;
+		}
+		
+		int const max_level = (1 << info.bits_per_sample) - 1;
+		double const f = 255.0 / max_level;
+		uint8 lut[256];
+		for (int i = 0; i <= max_level; ++i) {
+			int const level = info.photometric == PHOTOMETRIC_MINISWHITE
+				? max_level - i : i;
+			lut[i] = static_cast<uint8>(level * f + 0.5);
+		}
+		
+		if (info.bits_per_sample == 8) {
+			bool const identity = info.photometric == PHOTOMETRIC_MINISBLACK;
+			readLines(tif, image, identity ? 0 : lut);
+		} else {
+			readAndUnpackLines(tif, info, image, lut);
+		}
+		return image;
+	}
+	
 	int const num_colors = 1 << info.bits_per_sample;
 	image.setNumColors(num_colors);
 	
@@ -494,17 +616,25 @@ TiffReader::extractBinaryOrIndexed8Image(
 }
 
 void
-TiffReader::readLines(TiffHandle const& tif, QImage& image)
+TiffReader::readLines(TiffHandle const& tif, QImage& image, uint8 const* lut)
 {
 	int const height = image.height();
+	int const width = image.width();
 	for (int y = 0; y < height; ++y) {
-		TIFFReadScanline(tif.handle(), image.scanLine(y), y);
+		uint8* line = (uint8*)image.scanLine(y);
+		TIFFReadScanline(tif.handle(), line, y);
+		if (lut) {
+			// Remap while the line is still in cache.
+			for (int x = 0; x < width; ++x) {
+				line[x] = lut[line[x]];
+			}
+		}
 	}
 }
 
 void
 TiffReader::readAndUnpackLines(
-	TiffHandle const& tif, TiffInfo const& info, QImage& image)
+	TiffHandle const& tif, TiffInfo const& info, QImage& image, uint8 const* lut)
 {
 	TiffBuffer<uint8> buf(TIFFScanlineSize(tif.handle()));
 	
@@ -530,7 +660,30 @@ TiffReader::readAndUnpackLines(
 				++src;
 			}
 			bits_in_accum -= bits_per_sample;
-			*dst = static_cast<uint8>((accum >> bits_in_accum) & dst_mask);
+			uint8 const val = static_cast<uint8>((accum >> bits_in_accum) & dst_mask);
+			*dst = lut ? lut[val] : val;
+		}
+	}
+}
+
+void
+TiffReader::readGray16Lines(
+	TiffHandle const& tif, TiffInfo const& info, QImage& image)
+{
+	TiffBuffer<uint16> buf(TIFFScanlineSize(tif.handle()) / 2 + 1);
+	
+	int const width = image.width();
+	int const height = image.height();
+	uint8 const invert = info.photometric == PHOTOMETRIC_MINISWHITE ? 0xff : 0;
+	
+	for (int y = 0; y < height; ++y) {
+		// libtiff takes care of byte order for 16 bit samples.
+		TIFFReadScanline(tif.handle(), buf.data(), y);
+		
+		uint16 const* src = buf.data();
+		uint8* dst = (uint8*)image.scanLine(y);
+		for (int x = 0; x < width; ++x) {
+			dst[x] = static_cast<uint8>(src[x] >> 8) ^ invert;
 		}
 	}
 }
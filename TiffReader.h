@@ -27,6 +27,11 @@ class QImage;
 class ImageMetadata;
 class Dpi;
 
+namespace imageproc
+{
+	class BinaryImage;
+}
+
 class TiffReader
 {
 public:
@@ -39,6 +44,11 @@ public:
 	/**
 	 * \brief Reads the image from io device to QImage.
 	 *
+	 * Single-channel grayscale images (of any bit depth up to 16) are
+	 * returned as Format_Indexed8 with the standard grayscale palette,
+	 * so that converting them to imageproc::GrayImage doesn't involve
+	 * copying pixels.
+	 *
 	 * \param device The device to read from.  This device must be
 	 *        opened for reading and must be seekable.
 	 * \param page_num A zero-based page number within a multi-page
@@ -46,6 +56,23 @@ public:
 	 * \return The resulting image, or a null image in case of failure.
 	 */
 	static QImage readImage(QIODevice& device, int page_num = 0);
+	
+	/**
+	 * \brief Reads the image from io device to a BinaryImage.
+	 *
+	 * Bitonal images are read directly into BinaryImage lines, without
+	 * going through QImage.  Other images are read with readImage()
+	 * and then binarized the way BinaryImage's constructor does.
+	 * Resolution information is lost in either case.
+	 *
+	 * \param device The device to read from.  This device must be
+	 *        opened for reading and must be seekable.
+	 * \param page_num A zero-based page number within a multi-page
+	 *        TIFF file.
+	 * \return The resulting image, or a null image in case of failure.
+	 */
+	static imageproc::BinaryImage readBinaryImage(
+		QIODevice& device, int page_num = 0);
 private:
 	class TiffHeader;
 	class TiffHandle;
@@ -60,12 +87,19 @@ private:
 	
 	static Dpi getDpi(float xres, float yres, unsigned res_unit);
 	
+	static QImage readCurrentPage(TiffHandle const& tif, TiffInfo const& info);
+	
 	static QImage extractBinaryOrIndexed8Image(
 		TiffHandle const& tif, TiffInfo const& info);
 	
-	static void readLines(TiffHandle const& tif, QImage& image);
+	static void readLines(
+		TiffHandle const& tif, QImage& image, unsigned char const* lut = 0);
 	
 	static void readAndUnpackLines(
+		TiffHandle const& tif, TiffInfo const& info, QImage& image,
+		unsigned char const* lut = 0);
+	
+	static void readGray16Lines(
 		TiffHandle const& tif, TiffInfo const& info, QImage& image);
 };
 
@@ -19,6 +19,8 @@
 #include "TiffWriter.h"
 #include "Dpm.h"
 #include "imageproc/Constants.h"
+#include "imageproc/BinaryImage.h"
+#include "imageproc/ByteOrder.h"
 #include <QtGlobal>
 #include <QFile>
 #include <QIODevice>
@@ -214,6 +216,68 @@ TiffWriter::writeImage(QIODevice& device, QImage const& image)
 	}
 }
 
+bool
+TiffWriter::writeImage(
+	QString const& file_path, imageproc::BinaryImage const& image)
+{
+	if (image.isNull()) {
+		return false;
+	}
+	
+	QFile file(file_path);
+	if (!file.open(QFile::WriteOnly)) {
+		return false;
+	}
+	
+	if (!writeImage(file, image)) {
+		file.remove();
+		return false;
+	}
+	
+	return true;
+}
+
+bool
+TiffWriter::writeImage(
+	QIODevice& device, imageproc::BinaryImage const& image)
+{
+	if (image.isNull()) {
+		return false;
+	}
+	if (!device.isWritable()) {
+		return false;
+	}
+	if (device.isSequential()) {
+		// libtiff needs to be able to seek.
+		return false;
+	}
+	
+	TiffHandle tif(
+		TIFFClientOpen(
+			// B makes the bit order within bytes match BinaryImage.
+			"file", "wBm", &device, &deviceRead, &deviceWrite,
+			&deviceSeek, &deviceClose, &deviceSize,
+			&deviceMap, &deviceUnmap
+		)
+	);
+	if (!tif.handle()) {
+		return false;
+	}
+	
+	TIFFSetField(tif.handle(), TIFFTAG_IMAGEWIDTH, uint32(image.width()));
+	TIFFSetField(tif.handle(), TIFFTAG_IMAGELENGTH, uint32(image.height()));
+	TIFFSetField(tif.handle(), TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+	TIFFSetField(tif.handle(), TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(tif.handle(), TIFFTAG_SAMPLESPERPIXEL, uint16(1));
+	TIFFSetField(tif.handle(), TIFFTAG_COMPRESSION, uint16(COMPRESSION_LZW));
+	TIFFSetField(tif.handle(), TIFFTAG_BITSPERSAMPLE, uint16(1));
+	
+	// In BinaryImage, 1 means black.
+	TIFFSetField(tif.handle(), TIFFTAG_PHOTOMETRIC, uint16(PHOTOMETRIC_MINISWHITE));
+	
+	return writeBinaryImageLines(tif, image);
+}
+
 /**
  * Set the physical resolution, if it's defined.
  */
@@ -441,6 +505,31 @@ TiffWriter::writeBinaryLinesAsIs(
 	return true;
 }
 
+bool
+TiffWriter::writeBinaryImageLines(
+	TiffHandle const& tif, imageproc::BinaryImage const& image)
+{
+	int const height = image.height();
+	int const wpl = image.wordsPerLine();
+	
+	// TIFFWriteScanline() can modify the data we pass it, so we
+	// byte-swap into a temporary buffer, which we'd need anyway.
+	// The padding bits at the end of each line are written as is,
+	// but TIFF readers ignore them.
+	std::vector<uint32_t> tmp_line(wpl, 0);
+	uint32_t const* src_line = image.data();
+	
+	for (int y = 0; y < height; ++y, src_line += wpl) {
+		memcpy(&tmp_line[0], src_line, wpl * 4);
+		imageproc::hostToBigEndianInPlace(&tmp_line[0], wpl);
+		if (TIFFWriteScanline(tif.handle(), &tmp_line[0], y) == -1) {
+			return false;
+		}
+	}
+	
+	return true;
+}
+
 bool
 TiffWriter::writeBinaryLinesReversed(
 	TiffHandle const& tif, QImage const& image)
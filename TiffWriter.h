@@ -27,6 +27,11 @@ class QString;
 class QImage;
 class Dpm;
 
+namespace imageproc
+{
+	class BinaryImage;
+}
+
 class TiffWriter
 {
 public:
@@ -48,6 +53,28 @@ public:
 	 * \return True on success, false on failure.
 	 */
 	static bool writeImage(QIODevice& device, QImage const& image);
+	
+	/**
+	 * \brief Writes a BinaryImage in TIFF format to a file.
+	 *
+	 * The image is written as 1 bit per pixel, min-is-white, with no
+	 * resolution information.  Words are taken directly from the
+	 * BinaryImage, without going through QImage.
+	 *
+	 * \param file_path The full path to the file.
+	 * \param image The image to write.  Writing a null image will fail.
+	 * \return True on success, false on failure.
+	 */
+	static bool writeImage(
+		QString const& file_path, imageproc::BinaryImage const& image);
+	
+	/**
+	 * \brief Writes a BinaryImage in TIFF format to an IO device.
+	 *
+	 * \see writeImage(QString const&, imageproc::BinaryImage const&)
+	 */
+	static bool writeImage(
+		QIODevice& device, imageproc::BinaryImage const& image);
 private:
 	class TiffHandle;
 	
@@ -71,6 +98,9 @@ private:
 	static bool writeBinaryLinesReversed(
 		TiffHandle const& tif, QImage const& image);
 	
+	static bool writeBinaryImageLines(
+		TiffHandle const& tif, imageproc::BinaryImage const& image);
+	
 	static uint8_t const m_reverseBitsLUT[256];
 };
 
@@ -21,6 +21,9 @@
 #include <QByteArray>
 #include <QFile>
 #include <QDir>
+#include <QSettings>
+#include <QVariant>
+#include <QtGlobal>
 #include <Qt>
 #include <QTextDocument> // Qt::escape() is actually declare there.
 
@@ -30,6 +33,10 @@
 #include <stdio.h>
 #endif
 
+int const Utils::MIN_THUMBNAIL_CACHE_MB = 4;
+int const Utils::MAX_THUMBNAIL_CACHE_MB = 4096;
+int const Utils::DEFAULT_THUMBNAIL_CACHE_MB = 32;
+
 bool
 Utils::overwritingRename(QString const& from, QString const& to)
 {
@@ -82,7 +89,20 @@ Utils::createThumbnailCache(QString const& output_dir)
 	QString const thumbs_cache_path(outputDirToThumbDir(output_dir));
 	
 	return IntrusivePtr<ThumbnailPixmapCache>(
-		new ThumbnailPixmapCache(thumbs_cache_path, max_pixmap_size, 40, 5)
+		new ThumbnailPixmapCache(
+			thumbs_cache_path, max_pixmap_size,
+			qint64(thumbnailCacheMb()) << 20, 5
+		)
 	);
 }
 
+int
+Utils::thumbnailCacheMb()
+{
+	QSettings settings;
+	int const mb = settings.value(
+		"settings/thumbnail_cache_mb", DEFAULT_THUMBNAIL_CACHE_MB
+	).toInt();
+	return qBound(MIN_THUMBNAIL_CACHE_MB, mb, MAX_THUMBNAIL_CACHE_MB);
+}
+
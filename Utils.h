@@ -41,6 +41,18 @@ public:
 
 	static IntrusivePtr<ThumbnailPixmapCache> createThumbnailCache(QString const& output_dir);
 
+	/**
+	 * \brief The limits and the default of the thumbnail cache size, in megabytes.
+	 */
+	static int const MIN_THUMBNAIL_CACHE_MB;
+	static int const MAX_THUMBNAIL_CACHE_MB;
+	static int const DEFAULT_THUMBNAIL_CACHE_MB;
+
+	/**
+	 * \brief Returns the thumbnail cache size from settings, in megabytes.
+	 */
+	static int thumbnailCacheMb();
+
 	/**
 	 * Unlike QFile::rename(), this one overwrites existing files.
 	 */
@@ -107,7 +107,11 @@ TextLineTracer::trace(
 		qRound(dpi.vertical() * downscale_y_factor)
 	);
 
-	BinaryImage binarized(binarizeWolf(downscaled, QSize(31, 31)));
+	// Only text lines are traced here, so thresholds interpolated
+	// between those of 6x6 pixel blocks are good enough.
+	BinaryImage binarized(
+		binarizeWolf(downscaled, QSize(31, 31), 1, 254, APPROXIMATE_LOCAL_STATS)
+	);
 	if (dbg) {
 		dbg->add(binarized, "binarized");
 	}
@@ -18,10 +18,8 @@
 
 #include "DespeckleState.h"
 #include "DespeckleVisualization.h"
-#include "Despeckle.h"
 #include "TaskStatus.h"
 #include "DebugImages.h"
-#include "imageproc/RasterOp.h"
 #include <new>
 #include <stdint.h>
 
@@ -33,10 +31,12 @@ namespace output
 DespeckleState::DespeckleState(
 	QImage const& output,
 	imageproc::BinaryImage const& speckles,
-	DespeckleLevel level, Dpi const& dpi)
+	DespeckleLevel level, Dpi const& dpi,
+	Despeckle::Profile const& profile)
 :	m_speckles(speckles),
 	m_dpi(dpi),
-	m_despeckleLevel(level)
+	m_despeckleLevel(level),
+	m_profile(profile)
 {
 	m_everythingMixed = overlaySpeckles(output, speckles);
 	m_everythingBW = extractBW(m_everythingMixed);
@@ -78,13 +78,13 @@ DespeckleState::redespeckle(
 			break;
 	}
 
-	new_state.m_speckles = Despeckle::despeckle(
-		m_everythingBW, m_dpi, level2, status, dbg
-	);
-
-	status.throwIfCancelled();
+	if (new_state.m_profile.isNull()) {
+		new_state.m_profile = Despeckle::buildProfile(
+			m_everythingBW, m_dpi, status, dbg
+		);
+	}
 
-	rasterOp<RopSubtract<RopSrc, RopDst> >(new_state.m_speckles, m_everythingBW);
+	new_state.m_speckles = new_state.m_profile.speckles(level2);
 
 	return new_state;
 }
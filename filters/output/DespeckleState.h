@@ -21,6 +21,7 @@
 #define OUTPUT_DESPECKLE_STATE_H_
 
 #include "DespeckleLevel.h"
+#include "Despeckle.h"
 #include "Dpi.h"
 #include "imageproc/BinaryImage.h"
 #include <QImage>
@@ -41,9 +42,15 @@ class DespeckleState
 {
 	// Member-wise copying is OK.
 public:
+	/**
+	 * \param profile Speckles of the image before despeckling, for all
+	 *        levels, if known.  Otherwise, it will be built on the first
+	 *        level change.
+	 */
 	DespeckleState(QImage const& output,
 		imageproc::BinaryImage const& speckles,
-		DespeckleLevel level, Dpi const& dpi);
+		DespeckleLevel level, Dpi const& dpi,
+		Despeckle::Profile const& profile = Despeckle::Profile());
 
 	DespeckleLevel level() const { return m_despeckleLevel; }
 
@@ -86,6 +93,14 @@ private:
 	 * m_everythingBW.
 	 */
 	DespeckleLevel m_despeckleLevel;
+	
+	/**
+	 * Speckles of m_everythingBW at every level.  Either passed in
+	 * by the output Task or built by the first redespeckle() call,
+	 * and carried over to the states it returns, so that level
+	 * changes don't need to re-analyze the image.
+	 */
+	Despeckle::Profile m_profile;
 };
 
 } // namespace output
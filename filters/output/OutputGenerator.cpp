@@ -264,13 +264,14 @@ OutputGenerator::process(
 	DepthPerception const& depth_perception,
 	imageproc::BinaryImage* auto_picture_mask,
 	imageproc::BinaryImage* speckles_image,
+	Despeckle::Profile* despeckle_profile,
 	DebugImages* const dbg) const
 {
 	QImage image(
 		processImpl(
 			status, input, picture_zones, fill_zones,
 			dewarping_mode, distortion_model, depth_perception,
-			auto_picture_mask, speckles_image, dbg
+			auto_picture_mask, speckles_image, despeckle_profile, dbg
 		)
 	);
 	assert(!image.isNull());
@@ -419,11 +420,15 @@ OutputGenerator::modifyBinarizationMask(
 
 	typedef PictureLayerProperty PLP;
 
+	// The passes below are collected into a single batch, which is
+	// then rasterized in one go, preserving the order of fills.
+	PolygonRasterizer::Batch batch;
+
 	// Pass 1: ERASER1
 	BOOST_FOREACH(Zone const& zone, zones) {
 		if (zone.properties().locateOrDefault<PLP>()->layer() == PLP::ERASER1) {
 			QPolygonF const poly(zone.spline().toPolygon());
-			PolygonRasterizer::fill(bw_mask, BLACK, xform.map(poly), Qt::WindingFill);
+			batch.fill(BLACK, xform.map(poly), Qt::WindingFill);
 		}
 	}
 
@@ -431,7 +436,7 @@ OutputGenerator::modifyBinarizationMask(
 	BOOST_FOREACH(Zone const& zone, zones) {
 		if (zone.properties().locateOrDefault<PLP>()->layer() == PLP::PAINTER2) {
 			QPolygonF const poly(zone.spline().toPolygon());
-			PolygonRasterizer::fill(bw_mask, WHITE, xform.map(poly), Qt::WindingFill);
+			batch.fill(WHITE, xform.map(poly), Qt::WindingFill);
 		}
 	}
 
@@ -439,9 +444,13 @@ OutputGenerator::modifyBinarizationMask(
 	BOOST_FOREACH(Zone const& zone, zones) {
 		if (zone.properties().locateOrDefault<PLP>()->layer() == PLP::ERASER3) {
 			QPolygonF const poly(zone.spline().toPolygon());
-			PolygonRasterizer::fill(bw_mask, BLACK, xform.map(poly), Qt::WindingFill);
+			batch.fill(BLACK, xform.map(poly), Qt::WindingFill);
 		}
 	}
+
+	if (!batch.empty()) {
+		batch.apply(bw_mask);
+	}
 }
 
 QImage
@@ -453,6 +462,7 @@ OutputGenerator::processImpl(
 	DepthPerception const& depth_perception,
 	imageproc::BinaryImage* auto_picture_mask,
 	imageproc::BinaryImage* speckles_image,
+	Despeckle::Profile* despeckle_profile,
 	DebugImages* const dbg) const
 {
 	RenderParams const render_params(m_colorParams);
@@ -462,7 +472,7 @@ OutputGenerator::processImpl(
 		return processWithDewarping(
 			status, input, picture_zones, fill_zones,
 			dewarping_mode, distortion_model, depth_perception,
-			auto_picture_mask, speckles_image, dbg
+			auto_picture_mask, speckles_image, despeckle_profile, dbg
 		);
 	} else if (!render_params.whiteMargins()) {
 		return processAsIs(
@@ -471,7 +481,7 @@ OutputGenerator::processImpl(
 	} else {
 		return processWithoutDewarping(
 			status, input, picture_zones, fill_zones,
-			auto_picture_mask, speckles_image, dbg
+			auto_picture_mask, speckles_image, despeckle_profile, dbg
 		);
 	}
 }
@@ -533,6 +543,7 @@ OutputGenerator::processWithoutDewarping(
 	ZoneSet const& picture_zones, ZoneSet const& fill_zones,
 	imageproc::BinaryImage* auto_picture_mask,
 	imageproc::BinaryImage* speckles_image,
+	Despeckle::Profile* despeckle_profile,
 	DebugImages* dbg) const
 {
 	RenderParams const render_params(m_colorParams);
@@ -641,7 +652,7 @@ OutputGenerator::processWithoutDewarping(
 			// operation from the final output file.
 			maybeDespeckleInPlace(
 				dst, m_outRect, m_outRect, m_despeckleLevel,
-				speckles_image, m_dpi, status, dbg
+				speckles_image, despeckle_profile, m_dpi, status, dbg
 			);
 		}
 		
@@ -740,7 +751,8 @@ OutputGenerator::processWithoutDewarping(
 		// operation from the final output file.
 		maybeDespeckleInPlace(
 			bw_content, small_margins_rect, m_contentRect,
-			m_despeckleLevel, speckles_image, m_dpi, status, dbg
+			m_despeckleLevel, speckles_image, despeckle_profile,
+			m_dpi, status, dbg
 		);
 		
 		status.throwIfCancelled();
@@ -799,6 +811,7 @@ OutputGenerator::processWithDewarping(
 	DepthPerception const& depth_perception,
 	imageproc::BinaryImage* auto_picture_mask,
 	imageproc::BinaryImage* speckles_image,
+	Despeckle::Profile* despeckle_profile,
 	DebugImages* dbg) const
 {
 	QSize const target_size(m_outRect.size().expandedTo(QSize(1, 1)));
@@ -1086,7 +1099,7 @@ OutputGenerator::processWithDewarping(
 		// operation from the final output file.
 		maybeDespeckleInPlace(
 			dewarped_bw_content, m_outRect, m_outRect, m_despeckleLevel,
-			speckles_image, m_dpi, status, dbg
+			speckles_image, despeckle_profile, m_dpi, status, dbg
 		);
 
 		applyFillZonesInPlace(dewarped_bw_content, fill_zones, orig_to_output);
@@ -1151,7 +1164,8 @@ OutputGenerator::processWithDewarping(
 		// operation from the final output file.
 		maybeDespeckleInPlace(
 			dewarped_bw_content, m_outRect, m_contentRect,
-			m_despeckleLevel, speckles_image, m_dpi, status, dbg
+			m_despeckleLevel, speckles_image, despeckle_profile,
+			m_dpi, status, dbg
 		);
 		
 		status.throwIfCancelled();
@@ -1524,6 +1538,9 @@ OutputGenerator::binarize(QImage const& image,
  *        to m_cropRect, so it will have the size of m_cropRect.size().
  *        Only the area within \p mask_rect will be copied to \p speckles_img.
  *        The rest will be filled with white.
+ * \param despeckle_profile If provided, speckles are found for all levels
+ *        and written there, laid out the same way as \p speckles_img.
+ *        Nothing is written if \p level is DESPECKLE_OFF.
  * \param dpi The DPI of the input image.  See the note below.
  * \param status Task status.
  * \param dbg An optional sink for debugging images.
@@ -1536,6 +1553,7 @@ OutputGenerator::maybeDespeckleInPlace(
 	imageproc::BinaryImage& image,
 	QRect const& image_rect, QRect const& mask_rect,
 	DespeckleLevel const level, BinaryImage* speckles_img,
+	Despeckle::Profile* despeckle_profile,
 	Dpi const& dpi, TaskStatus const& status, DebugImages* dbg) const
 {
 	QRect const src_rect(mask_rect.translated(-image_rect.topLeft()));
@@ -1563,7 +1581,19 @@ OutputGenerator::maybeDespeckleInPlace(
 			default:;
 		}
 
-		Despeckle::despeckleInPlace(image, dpi, lvl, status, dbg);
+		if (despeckle_profile) {
+			// Costs more than despeckling at one level, but spares
+			// DespeckleView from re-analyzing the image on level changes.
+			Despeckle::Profile const profile(
+				Despeckle::buildProfile(image, dpi, status, dbg)
+			);
+			profile.apply(image, lvl);
+			*despeckle_profile = profile.embedded(
+				m_outRect.size(), dst_rect, src_rect.topLeft()
+			);
+		} else {
+			Despeckle::despeckleInPlace(image, dpi, lvl, status, dbg);
+		}
 
 		if (dbg) {
 			dbg->add(image, "despeckled");
@@ -1831,12 +1861,14 @@ OutputGenerator::applyFillZonesInPlace(
 		return;
 	}
 
+	PolygonRasterizer::Batch batch;
 	BOOST_FOREACH(Zone const& zone, zones) {
 		QColor const color(zone.properties().locateOrDefault<FillColorProperty>()->color());
 		BWColor const bw_color = qGray(color.rgb()) < 128 ? BLACK : WHITE;
 		QPolygonF const poly(zone.spline().transformed(orig_to_output).toPolygon());
-		PolygonRasterizer::fill(img, bw_color, poly, Qt::WindingFill);
+		batch.fill(bw_color, poly, Qt::WindingFill);
 	}
+	batch.apply(img);
 }
 
 /**
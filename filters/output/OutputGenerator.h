@@ -24,6 +24,7 @@
 #include "ColorParams.h"
 #include "DepthPerception.h"
 #include "DespeckleLevel.h"
+#include "Despeckle.h"
 #include "DewarpingMode.h"
 #include "ImageTransformation.h"
 #ifndef Q_MOC_RUN
@@ -94,6 +95,11 @@ public:
 	 *        restored from the output and speckles images, allowing despeckling
 	 *        to be performed again with different settings, without going
 	 *        through the whole output generation process again.
+	 * \param despeckle_profile If provided, speckles for all despeckling
+	 *        levels will be written there, in output image coordinates.
+	 *        It would only happen if despeckling took place.  Finding them
+	 *        costs more than despeckling at one level, so it's only worth
+	 *        it when the level is likely to be changed interactively.
 	 * \param dbg An optional sink for debugging images.
 	 */
 	QImage process(
@@ -104,6 +110,7 @@ public:
 		DepthPerception const& depth_perception,
 		imageproc::BinaryImage* auto_picture_mask = 0,
 		imageproc::BinaryImage* speckles_image = 0,
+		Despeckle::Profile* despeckle_profile = 0,
 		DebugImages* dbg = 0) const;
 	
 	QSize outputImageSize() const;
@@ -121,6 +128,7 @@ private:
 		DepthPerception const& depth_perception,
 		imageproc::BinaryImage* auto_picture_mask = 0,
 		imageproc::BinaryImage* speckles_image = 0,
+		Despeckle::Profile* despeckle_profile = 0,
 		DebugImages* dbg = 0) const;
 
 	QImage processAsIs(
@@ -134,6 +142,7 @@ private:
 		ZoneSet const& picture_zones, ZoneSet const& fill_zones,
 		imageproc::BinaryImage* auto_picture_mask = 0,
 		imageproc::BinaryImage* speckles_image = 0,
+		Despeckle::Profile* despeckle_profile = 0,
 		DebugImages* dbg = 0) const;
 
 	QImage processWithDewarping(
@@ -144,6 +153,7 @@ private:
 		DepthPerception const& depth_perception,
 		imageproc::BinaryImage* auto_picture_mask = 0,
 		imageproc::BinaryImage* speckles_image = 0,
+		Despeckle::Profile* despeckle_profile = 0,
 		DebugImages* dbg = 0) const;
 	
 	void setupTrivialDistortionModel(dewarping::DistortionModel& distortion_model) const;
@@ -206,6 +216,7 @@ private:
 		imageproc::BinaryImage& image, QRect const& image_rect,
 		QRect const& mask_rect, DespeckleLevel level,
 		imageproc::BinaryImage* speckles_img,
+		Despeckle::Profile* despeckle_profile,
 		Dpi const& dpi, TaskStatus const& status, DebugImages* dbg) const;
 
 	static QImage smoothToGrayscale(QImage const& src, Dpi const& dpi);
@@ -256,6 +256,7 @@ Task::process(
 	QImage out_img;
 	BinaryImage automask_img;
 	BinaryImage speckles_img;
+	Despeckle::Profile despeckle_profile;
 	
 	if (!need_reprocess) {
 		QFile out_file(out_file_path);
@@ -267,7 +268,7 @@ Task::process(
 		if (need_picture_editor && !need_reprocess) {
 			QFile automask_file(automask_file_path);
 			if (automask_file.open(QIODevice::ReadOnly)) {
-				automask_img = BinaryImage(ImageLoader::load(automask_file, 0));
+				automask_img = ImageLoader::loadBinary(automask_file, 0);
 			}
 			need_reprocess = automask_img.isNull() || automask_img.size() != out_img.size();
 		}
@@ -275,7 +276,7 @@ Task::process(
 		if (need_speckles_image && !need_reprocess) {
 			QFile speckles_file(speckles_file_path);
 			if (speckles_file.open(QIODevice::ReadOnly)) {
-				speckles_img = BinaryImage(ImageLoader::load(speckles_file, 0));
+				speckles_img = ImageLoader::loadBinary(speckles_file, 0);
 			}
 			need_reprocess = speckles_img.isNull();
 		}
@@ -293,6 +294,12 @@ Task::process(
 
 		automask_img = BinaryImage();
 		speckles_img = BinaryImage();
+		
+		// When the despeckling level may be changed interactively,
+		// keep the speckles for all levels, so that DespeckleView
+		// doesn't have to find them again.
+		bool const keep_despeckle_profile = need_speckles_image
+			&& CommandLine::get().isGui();
 
 		DistortionModel distortion_model;
 		if (params.dewarpingMode() == DewarpingMode::MANUAL) {
@@ -307,6 +314,7 @@ Task::process(
 			params.depthPerception(),
 			write_automask ? &automask_img : 0,
 			write_speckles_file ? &speckles_img : 0,
+			keep_despeckle_profile ? &despeckle_profile : 0,
 			m_ptrDbg.get()
 		);
 
@@ -342,14 +350,14 @@ Task::process(
 			// Also note that QDir::mkdir() will fail if the directory already exists,
 			// so we ignore its return value here.
 
-			if (!TiffWriter::writeImage(automask_file_path, automask_img.toQImage())) {
+			if (!TiffWriter::writeImage(automask_file_path, automask_img)) {
 				invalidate_params = true;
 			}
 		}
 		if (write_speckles_file) {
 			if (!QDir().mkpath(speckles_dir)) {
 				invalidate_params = true;
-			} else if (!TiffWriter::writeImage(speckles_file_path, speckles_img.toQImage())) {
+			} else if (!TiffWriter::writeImage(speckles_file_path, speckles_img)) {
 				invalidate_params = true;
 			}
 		}
@@ -376,7 +384,8 @@ Task::process(
 	}
 
 	DespeckleState const despeckle_state(
-		out_img, speckles_img, params.despeckleLevel(), params.outputDpi()
+		out_img, speckles_img, params.despeckleLevel(),
+		params.outputDpi(), despeckle_profile
 	);
 
 	DespeckleVisualization despeckle_visualization;
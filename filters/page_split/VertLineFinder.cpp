@@ -143,6 +143,10 @@ VertLineFinder::findLines(
 	
 	unsigned weight_table[256];
 	buildWeightTable(weight_table);
+	
+	// Pixels with values of 0 and 1 are not considered.
+	weight_table[0] = 0;
+	weight_table[1] = 0;
 
 	// We don't want to process areas too close to the vertical edges.
 	double const margin_mm = 3.5;
@@ -150,16 +154,9 @@ VertLineFinder::findLines(
 
 	int const x_limit = raster_lines.width() - margin;
 	int const height = raster_lines.height();
-	uint8_t const* line = raster_lines.data();
-	int const stride = raster_lines.stride();
-	for (int y = 0; y < height; ++y, line += stride) {
-		for (int x = margin; x < x_limit; ++x) {
-			unsigned const val = line[x];
-			if (val > 1) {
-				line_detector.process(x, y, weight_table[val]);
-			}
-		}
-	}
+	line_detector.processImage(
+		raster_lines, QRect(margin, 0, x_limit - margin, height), weight_table
+	);
 	
 	unsigned const min_quality = (unsigned)(height * line_thickness * 1.8) + 1;
 	
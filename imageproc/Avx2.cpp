@@ -0,0 +1,77 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C) 2007-2008  Joseph Artsimovich <joseph_a@mail.ru>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "Avx2.h"
+
+#ifdef IMAGEPROC_HAVE_AVX2
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace imageproc
+{
+
+namespace
+{
+
+bool detectAvx2()
+{
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 0);
+	if (regs[0] < 7) {
+		return false;
+	}
+	
+	// The CPU has to support AVX, and the OS has to save YMM registers.
+	int const osxsave_avx = (1 << 27) | (1 << 28);
+	__cpuid(regs, 1);
+	if ((regs[2] & osxsave_avx) != osxsave_avx) {
+		return false;
+	}
+	if ((_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1 << 5)) != 0;
+#else
+	// Unlike us, __builtin_cpu_supports() checks OS support as well.
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+/**
+ * Should cpuHasAvx2() be called before this is initialized,
+ * it will return false, which is still safe.
+ */
+bool const g_haveAvx2 = detectAvx2();
+
+} // anonymous namespace
+
+bool cpuHasAvx2()
+{
+	return g_haveAvx2;
+}
+
+} // namespace imageproc
+
+#endif // IMAGEPROC_HAVE_AVX2
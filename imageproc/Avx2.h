@@ -0,0 +1,73 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C) 2007-2008  Joseph Artsimovich <joseph_a@mail.ru>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGEPROC_AVX2_H_
+#define IMAGEPROC_AVX2_H_
+
+/**
+ * \file
+ * Defines IMAGEPROC_HAVE_AVX2 and brings in AVX2 intrinsics, provided
+ * the compiler can generate AVX2 code for individual functions, without
+ * requiring AVX2 from the rest of the program.  Such functions have to be
+ * marked with IMAGEPROC_AVX2_TARGET and may only be called if cpuHasAvx2()
+ * returns true.  GCC can do that since 4.9, Clang since 3.8 and MSVC
+ * since 2012, where no marking is necessary.
+ */
+
+#include "Sse2.h"
+
+#ifdef IMAGEPROC_HAVE_SSE2
+#if defined(__clang__)
+#if defined(__apple_build_version__) ? __clang_major__ >= 8 \
+	: (__clang_major__ > 3 || (__clang_major__ == 3 && __clang_minor__ >= 8))
+#define IMAGEPROC_HAVE_AVX2
+#define IMAGEPROC_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#elif defined(__GNUC__)
+#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define IMAGEPROC_HAVE_AVX2
+#define IMAGEPROC_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#elif defined(_MSC_VER)
+#if _MSC_VER >= 1700
+#define IMAGEPROC_HAVE_AVX2
+#define IMAGEPROC_AVX2_TARGET
+#endif
+#endif
+#endif // IMAGEPROC_HAVE_SSE2
+
+#ifdef IMAGEPROC_HAVE_AVX2
+
+#include <immintrin.h>
+
+namespace imageproc
+{
+
+/**
+ * \brief Returns true if both the CPU and the OS support AVX2.
+ *
+ * The check is done once, at startup.
+ */
+bool cpuHasAvx2();
+
+} // namespace imageproc
+
+#endif // IMAGEPROC_HAVE_AVX2
+
+#endif
@@ -20,9 +20,12 @@
 #include "BinaryImage.h"
 #include "BinaryThreshold.h"
 #include "Grayscale.h"
-#include "IntegralImage.h"
+#include "ParallelRows.h"
+#include "Sse2.h"
 #include <QImage>
-#include <QRect>
+#include <QSize>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QDebug>
 #include <vector>
 #include <algorithm>
@@ -35,6 +38,1071 @@
 namespace imageproc
 {
 
+namespace
+{
+
+/**
+ * \brief Calculates the mean and the standard deviation of pixels
+ *        in a window sliding over a grayscale image.
+ *
+ * Instead of integral images, only per-column sums over the rows
+ * covered by the window are kept.  Moving the window down a row
+ * adds one row to those sums and subtracts another.  Within a row,
+ * window sums are differences of prefix sums over those columns.
+ */
+class SlidingWindowStats
+{
+public:
+	SlidingWindowStats(
+		uint8_t const* data, int stride, int width, int height,
+		QSize window_size, int first_row);
+	
+	/**
+	 * \brief Positions the window on row \p y.
+	 *
+	 * Rows have to be visited in increasing order.
+	 */
+	void moveToRow(int y);
+	
+	/**
+	 * \brief Calculates statistics for each pixel of the current row.
+	 */
+	void calcRow(double* means, double* deviations);
+private:
+	void calcPrefixSums();
+	
+	void calcOne(int x, double* mean, double* deviation) const;
+	
+	/**
+	 * \brief Adds row \p y to column sums, or subtracts it from them.
+	 */
+	void updateColumnSums(int y, bool subtract);
+	
+	uint8_t const* m_pData;
+	int m_stride;
+	int m_width;
+	int m_height;
+	int m_windowLowerHalf;
+	int m_windowUpperHalf;
+	int m_windowLeftHalf;
+	int m_windowRightHalf;
+	int m_top; // The first row currently summed.
+	int m_bottom; // The row after the last one currently summed.
+	std::vector<uint32_t> m_colSums;
+	std::vector<uint64_t> m_colSqSums;
+	std::vector<uint32_t> m_prefixSums; // m_width + 1 elements
+	std::vector<uint64_t> m_prefixSqSums; // m_width + 1 elements
+};
+
+
+SlidingWindowStats::SlidingWindowStats(
+	uint8_t const* data, int const stride, int const width, int const height,
+	QSize const window_size, int const first_row)
+:	m_pData(data),
+	m_stride(stride),
+	m_width(width),
+	m_height(height),
+	m_windowLowerHalf(window_size.height() >> 1),
+	m_windowUpperHalf(window_size.height() - m_windowLowerHalf),
+	m_windowLeftHalf(window_size.width() >> 1),
+	m_windowRightHalf(window_size.width() - m_windowLeftHalf),
+	m_top(std::max(0, first_row - m_windowLowerHalf)),
+	m_bottom(m_top),
+	m_colSums(width, 0),
+	m_colSqSums(width, 0),
+	m_prefixSums(width + 1),
+	m_prefixSqSums(width + 1)
+{
+}
+
+void
+SlidingWindowStats::moveToRow(int const y)
+{
+	int const bottom = std::min(m_height, y + m_windowUpperHalf); // exclusive
+	for (; m_bottom < bottom; ++m_bottom) {
+		updateColumnSums(m_bottom, false);
+	}
+	
+	int const top = std::max(0, y - m_windowLowerHalf);
+	for (; m_top < top; ++m_top) {
+		updateColumnSums(m_top, true);
+	}
+}
+
+void
+SlidingWindowStats::calcRow(double* const means, double* const deviations)
+{
+	calcPrefixSums();
+	
+	// Within [inner_begin, inner_end) the window doesn't touch
+	// the left or right edge, so its area is the same everywhere.
+	int const inner_begin = std::min(m_windowLeftHalf, m_width);
+	int const inner_end = std::max(inner_begin, m_width - m_windowRightHalf + 1);
+	
+	int x = 0;
+	for (; x < inner_begin; ++x) {
+		calcOne(x, means + x, deviations + x);
+	}
+	
+#ifdef IMAGEPROC_HAVE_SSE2
+	double const r_area = 1.0 / ((m_bottom - m_top) * (m_windowLeftHalf + m_windowRightHalf));
+	__m128d const v_r_area = _mm_set1_pd(r_area);
+	__m128d const sign_bit = _mm_set1_pd(-0.0);
+	
+	// Integers below 2^52 become doubles when put into the mantissa
+	// of 2^52, with 2^52 then subtracted.
+	__m128d const magic = _mm_set1_pd(4503599627370496.0);
+	__m128i const magic_bits = _mm_castpd_si128(magic);
+	__m128i const zero = _mm_setzero_si128();
+	
+	uint32_t const* const sums = &m_prefixSums[0];
+	uint64_t const* const sqsums = &m_prefixSqSums[0];
+	for (; x + 2 <= inner_end; x += 2) {
+		int const left = x - m_windowLeftHalf;
+		int const right = x + m_windowRightHalf;
+		
+		__m128i const sum = _mm_sub_epi32(
+			_mm_loadl_epi64((__m128i const*)(sums + right)),
+			_mm_loadl_epi64((__m128i const*)(sums + left))
+		);
+		__m128i const sqsum = _mm_sub_epi64(
+			_mm_loadu_si128((__m128i const*)(sqsums + right)),
+			_mm_loadu_si128((__m128i const*)(sqsums + left))
+		);
+		__m128d const window_sum = _mm_sub_pd(
+			_mm_castsi128_pd(_mm_or_si128(_mm_unpacklo_epi32(sum, zero), magic_bits)), magic
+		);
+		__m128d const window_sqsum = _mm_sub_pd(
+			_mm_castsi128_pd(_mm_or_si128(sqsum, magic_bits)), magic
+		);
+		
+		__m128d const mean = _mm_mul_pd(window_sum, v_r_area);
+		__m128d const sqmean = _mm_mul_pd(window_sqsum, v_r_area);
+		__m128d const variance = _mm_sub_pd(sqmean, _mm_mul_pd(mean, mean));
+		_mm_storeu_pd(means + x, mean);
+		_mm_storeu_pd(deviations + x, _mm_sqrt_pd(_mm_andnot_pd(sign_bit, variance)));
+	}
+#endif
+	
+	for (; x < m_width; ++x) {
+		calcOne(x, means + x, deviations + x);
+	}
+}
+
+void
+SlidingWindowStats::calcPrefixSums()
+{
+	uint32_t const* const col_sums = &m_colSums[0];
+	uint64_t const* const col_sqsums = &m_colSqSums[0];
+	uint32_t* const sums = &m_prefixSums[0];
+	uint64_t* const sqsums = &m_prefixSqSums[0];
+	
+	// Wrap-around is fine, as only differences are used.
+	uint32_t sum = 0;
+	uint64_t sqsum = 0;
+	sums[0] = 0;
+	sqsums[0] = 0;
+	for (int x = 0; x < m_width; ++x) {
+		sum += col_sums[x];
+		sqsum += col_sqsums[x];
+		sums[x + 1] = sum;
+		sqsums[x + 1] = sqsum;
+	}
+}
+
+inline void
+SlidingWindowStats::calcOne(int const x, double* const mean, double* const deviation) const
+{
+	int const left = std::max(0, x - m_windowLeftHalf);
+	int const right = std::min(m_width, x + m_windowRightHalf); // exclusive
+	int const area = (m_bottom - m_top) * (right - left);
+	assert(area > 0); // because window_size > 0 and w > 0 and h > 0
+	
+	uint32_t const window_sum = m_prefixSums[right] - m_prefixSums[left];
+	uint64_t const window_sqsum = m_prefixSqSums[right] - m_prefixSqSums[left];
+	
+	double const r_area = 1.0 / area;
+	double const m = window_sum * r_area;
+	double const sqmean = window_sqsum * r_area;
+	
+	double const variance = sqmean - m * m;
+	*mean = m;
+	*deviation = sqrt(fabs(variance));
+}
+
+void
+SlidingWindowStats::updateColumnSums(int const y, bool const subtract)
+{
+	uint8_t const* const line = m_pData + y * m_stride;
+	uint32_t* const col_sums = &m_colSums[0];
+	uint64_t* const col_sqsums = &m_colSqSums[0];
+	int x = 0;
+	
+#ifdef IMAGEPROC_HAVE_SSE2
+	// Subtraction is done by adding negated values, as in
+	// -v == (v ^ ~0) - ~0.  Wrap-around makes that work for
+	// unsigned sums as well.
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const neg = subtract ? _mm_set1_epi32(-1) : zero;
+	for (; x + 8 <= m_width; x += 8) {
+		__m128i const pixels = _mm_unpacklo_epi8(
+			_mm_loadl_epi64((__m128i const*)(line + x)), zero
+		);
+		// A square of an 8-bit value still fits into 16 bits.
+		__m128i const squares = _mm_mullo_epi16(pixels, pixels);
+		
+		__m128i v[2];
+		v[0] = _mm_unpacklo_epi16(pixels, zero);
+		v[1] = _mm_unpackhi_epi16(pixels, zero);
+		for (int i = 0; i < 2; ++i) {
+			__m128i* const sums = (__m128i*)(col_sums + x + i * 4);
+			__m128i const delta = _mm_sub_epi32(_mm_xor_si128(v[i], neg), neg);
+			_mm_storeu_si128(sums, _mm_add_epi32(_mm_loadu_si128(sums), delta));
+		}
+		
+		__m128i w[4];
+		v[0] = _mm_unpacklo_epi16(squares, zero);
+		v[1] = _mm_unpackhi_epi16(squares, zero);
+		w[0] = _mm_unpacklo_epi32(v[0], zero);
+		w[1] = _mm_unpackhi_epi32(v[0], zero);
+		w[2] = _mm_unpacklo_epi32(v[1], zero);
+		w[3] = _mm_unpackhi_epi32(v[1], zero);
+		for (int i = 0; i < 4; ++i) {
+			__m128i* const sums = (__m128i*)(col_sqsums + x + i * 2);
+			__m128i const delta = _mm_sub_epi64(_mm_xor_si128(w[i], neg), neg);
+			_mm_storeu_si128(sums, _mm_add_epi64(_mm_loadu_si128(sums), delta));
+		}
+	}
+#endif
+	
+	if (subtract) {
+		for (; x < m_width; ++x) {
+			uint32_t const pixel = line[x];
+			col_sums[x] -= pixel;
+			col_sqsums[x] -= pixel * pixel;
+		}
+	} else {
+		for (; x < m_width; ++x) {
+			uint32_t const pixel = line[x];
+			col_sums[x] += pixel;
+			col_sqsums[x] += pixel * pixel;
+		}
+	}
+}
+
+
+/**
+ * \brief Packs pixels into a BinaryImage line, one at a time.
+ */
+class LinePacker
+{
+public:
+	explicit LinePacker(uint32_t* line) : m_pLine(line), m_word(0), m_numBits(0) {}
+	
+	void push(bool const black) {
+		m_word = (m_word << 1) | uint32_t(black);
+		if (++m_numBits == 32) {
+			*m_pLine++ = m_word;
+			m_word = 0;
+			m_numBits = 0;
+		}
+	}
+	
+	void finish() {
+		if (m_numBits != 0) {
+			*m_pLine = m_word << (32 - m_numBits);
+		}
+	}
+private:
+	uint32_t* m_pLine;
+	uint32_t m_word;
+	int m_numBits;
+};
+
+
+#ifdef IMAGEPROC_HAVE_SSE2
+
+/**
+ * \brief Loads 2 adjacent pixels as doubles.
+ */
+inline __m128d loadPixelPair(uint8_t const* pixels)
+{
+	return _mm_set_pd(pixels[1], pixels[0]);
+}
+
+/**
+ * \brief Appends the 2 bits of a _mm_movemask_pd() result to
+ *        a word being packed, bit 0 going first.
+ */
+inline uint32_t appendBitPair(uint32_t const word, int const bits)
+{
+	return (word << 2) | ((bits & 1) << 1) | (bits >> 1);
+}
+
+#endif // IMAGEPROC_HAVE_SSE2
+
+
+/**
+ * Setting up SlidingWindowStats for a band costs about as much as
+ * processing window_size.height() rows, so bands shouldn't be
+ * much shorter than that.
+ */
+int minRowsPerBand(QSize const window_size)
+{
+	return std::max(32, window_size.height() * 2);
+}
+
+
+class SauvolaRows : public RowRangeProcessor
+{
+public:
+	SauvolaRows(QImage const& gray, QSize window_size, BinaryImage& bw_img)
+	:	m_pGray(gray.bits()),
+		m_grayBpl(gray.bytesPerLine()),
+		m_width(gray.width()),
+		m_height(gray.height()),
+		m_windowSize(window_size),
+		m_pBw(bw_img.data()),
+		m_bwWpl(bw_img.wordsPerLine())
+	{
+	}
+	
+	virtual void processRows(int begin, int end) const;
+private:
+	uint8_t const* m_pGray;
+	int m_grayBpl;
+	int m_width;
+	int m_height;
+	QSize m_windowSize;
+	uint32_t* m_pBw;
+	int m_bwWpl;
+};
+
+
+void
+SauvolaRows::processRows(int const begin, int const end) const
+{
+	SlidingWindowStats stats(
+		m_pGray, m_grayBpl, m_width, m_height, m_windowSize, begin
+	);
+	std::vector<double> means(m_width);
+	std::vector<double> deviations(m_width);
+	
+	uint8_t const* gray_line = m_pGray + begin * m_grayBpl;
+	uint32_t* bw_line = m_pBw + begin * m_bwWpl;
+	
+	for (int y = begin; y < end; ++y, gray_line += m_grayBpl, bw_line += m_bwWpl) {
+		stats.moveToRow(y);
+		stats.calcRow(&means[0], &deviations[0]);
+		
+		double const k = 0.34;
+		uint32_t* bw_word = bw_line;
+		int x = 0;
+		
+#ifdef IMAGEPROC_HAVE_SSE2
+		// 32 pixels at a time, 2 per vector.  Operations are the
+		// same as below, so thresholds are the same to the last bit.
+		__m128d const v_k = _mm_set1_pd(k);
+		__m128d const one = _mm_set1_pd(1.0);
+		__m128d const max_deviation = _mm_set1_pd(128.0);
+		for (; x + 32 <= m_width; x += 32, ++bw_word) {
+			uint32_t word = 0;
+			for (int i = x; i < x + 32; i += 2) {
+				__m128d const deviation = _mm_loadu_pd(&deviations[i]);
+				__m128d const factor = _mm_add_pd(
+					one, _mm_mul_pd(v_k, _mm_sub_pd(_mm_div_pd(deviation, max_deviation), one))
+				);
+				__m128d const threshold = _mm_mul_pd(_mm_loadu_pd(&means[i]), factor);
+				__m128d const black = _mm_cmplt_pd(loadPixelPair(gray_line + i), threshold);
+				word = appendBitPair(word, _mm_movemask_pd(black));
+			}
+			*bw_word = word;
+		}
+#endif
+		
+		LinePacker packer(bw_word);
+		for (; x < m_width; ++x) {
+			double const threshold = means[x] * (1.0 + k * (deviations[x] / 128.0 - 1.0));
+			packer.push(int(gray_line[x]) < threshold);
+		}
+		packer.finish();
+	}
+}
+
+
+/**
+ * The first pass of Wolf's method.
+ */
+class WolfStatsRows : public RowRangeProcessor
+{
+public:
+	WolfStatsRows(QImage const& gray, QSize window_size)
+	:	m_pGray(gray.bits()),
+		m_grayBpl(gray.bytesPerLine()),
+		m_width(gray.width()),
+		m_height(gray.height()),
+		m_windowSize(window_size),
+		m_minGrayLevel(255),
+		m_maxDeviation(0)
+	{
+	}
+	
+	virtual void processRows(int begin, int end) const;
+	
+	uint32_t minGrayLevel() const { return m_minGrayLevel; }
+	
+	double maxDeviation() const { return m_maxDeviation; }
+private:
+	uint8_t const* m_pGray;
+	int m_grayBpl;
+	int m_width;
+	int m_height;
+	QSize m_windowSize;
+	mutable QMutex m_mutex;
+	mutable uint32_t m_minGrayLevel;
+	mutable double m_maxDeviation;
+};
+
+
+void
+WolfStatsRows::processRows(int const begin, int const end) const
+{
+	SlidingWindowStats stats(
+		m_pGray, m_grayBpl, m_width, m_height, m_windowSize, begin
+	);
+	std::vector<double> means(m_width);
+	std::vector<double> deviations(m_width);
+	
+	uint32_t min_gray_level = 255;
+	double max_deviation = 0;
+	
+	uint8_t const* gray_line = m_pGray + begin * m_grayBpl;
+	for (int y = begin; y < end; ++y, gray_line += m_grayBpl) {
+		for (int x = 0; x < m_width; ++x) {
+			min_gray_level = std::min<uint32_t>(min_gray_level, gray_line[x]);
+		}
+		
+		stats.moveToRow(y);
+		stats.calcRow(&means[0], &deviations[0]);
+		int x = 0;
+		
+#ifdef IMAGEPROC_HAVE_SSE2
+		__m128d max = _mm_set1_pd(max_deviation);
+		for (; x + 2 <= m_width; x += 2) {
+			max = _mm_max_pd(max, _mm_loadu_pd(&deviations[x]));
+		}
+		max = _mm_max_pd(max, _mm_unpackhi_pd(max, max));
+		max_deviation = _mm_cvtsd_f64(max);
+#endif
+		
+		for (; x < m_width; ++x) {
+			max_deviation = std::max(max_deviation, deviations[x]);
+		}
+	}
+	
+	QMutexLocker const locker(&m_mutex);
+	m_minGrayLevel = std::min(m_minGrayLevel, min_gray_level);
+	m_maxDeviation = std::max(m_maxDeviation, max_deviation);
+}
+
+
+/**
+ * The second pass of Wolf's method.
+ */
+class WolfRows : public RowRangeProcessor
+{
+public:
+	WolfRows(QImage const& gray, QSize window_size,
+		uint32_t min_gray_level, double max_deviation,
+		unsigned char lower_bound, unsigned char upper_bound,
+		BinaryImage& bw_img)
+	:	m_pGray(gray.bits()),
+		m_grayBpl(gray.bytesPerLine()),
+		m_width(gray.width()),
+		m_height(gray.height()),
+		m_windowSize(window_size),
+		m_minGrayLevel(min_gray_level),
+		m_maxDeviation(max_deviation),
+		m_lowerBound(lower_bound),
+		m_upperBound(upper_bound),
+		m_pBw(bw_img.data()),
+		m_bwWpl(bw_img.wordsPerLine())
+	{
+	}
+	
+	virtual void processRows(int begin, int end) const;
+private:
+	uint8_t const* m_pGray;
+	int m_grayBpl;
+	int m_width;
+	int m_height;
+	QSize m_windowSize;
+	uint32_t m_minGrayLevel;
+	double m_maxDeviation;
+	unsigned char m_lowerBound;
+	unsigned char m_upperBound;
+	uint32_t* m_pBw;
+	int m_bwWpl;
+};
+
+
+void
+WolfRows::processRows(int const begin, int const end) const
+{
+	SlidingWindowStats stats(
+		m_pGray, m_grayBpl, m_width, m_height, m_windowSize, begin
+	);
+	std::vector<double> means(m_width);
+	std::vector<double> deviations(m_width);
+	
+	uint8_t const* gray_line = m_pGray + begin * m_grayBpl;
+	uint32_t* bw_line = m_pBw + begin * m_bwWpl;
+	
+	for (int y = begin; y < end; ++y, gray_line += m_grayBpl, bw_line += m_bwWpl) {
+		stats.moveToRow(y);
+		stats.calcRow(&means[0], &deviations[0]);
+		
+		double const k = 0.3;
+		uint32_t* bw_word = bw_line;
+		int x = 0;
+		
+#ifdef IMAGEPROC_HAVE_SSE2
+		// 32 pixels at a time, 2 per vector.  Operations are the
+		// same as below, so thresholds are the same to the last bit.
+		__m128d const v_k = _mm_set1_pd(k);
+		__m128d const one = _mm_set1_pd(1.0);
+		__m128d const max_deviation = _mm_set1_pd(m_maxDeviation);
+		__m128d const min_gray_level = _mm_set1_pd(m_minGrayLevel);
+		__m128d const lower_bound = _mm_set1_pd(m_lowerBound);
+		__m128d const upper_bound = _mm_set1_pd(m_upperBound);
+		for (; x + 32 <= m_width; x += 32, ++bw_word) {
+			uint32_t word = 0;
+			for (int i = x; i < x + 32; i += 2) {
+				__m128d const mean = _mm_cvtps_pd(_mm_cvtpd_ps(_mm_loadu_pd(&means[i])));
+				__m128d const deviation = _mm_cvtps_pd(_mm_cvtpd_ps(_mm_loadu_pd(&deviations[i])));
+				__m128d const a = _mm_sub_pd(one, _mm_div_pd(deviation, max_deviation));
+				__m128d const threshold = _mm_sub_pd(
+					mean, _mm_mul_pd(_mm_mul_pd(v_k, a), _mm_sub_pd(mean, min_gray_level))
+				);
+				__m128d const pixels = loadPixelPair(gray_line + i);
+				__m128d const black = _mm_or_pd(
+					_mm_cmplt_pd(pixels, lower_bound),
+					_mm_and_pd(
+						_mm_cmple_pd(pixels, upper_bound),
+						_mm_cmplt_pd(pixels, threshold)
+					)
+				);
+				word = appendBitPair(word, _mm_movemask_pd(black));
+			}
+			*bw_word = word;
+		}
+#endif
+		
+		LinePacker packer(bw_word);
+		for (; x < m_width; ++x) {
+			// Precision is reduced to float on purpose, to produce
+			// the same results as when these were stored as floats.
+			float const mean = means[x];
+			float const deviation = deviations[x];
+			double const a = 1.0 - deviation / m_maxDeviation;
+			double const threshold = mean - k * a * (mean - m_minGrayLevel);
+			
+			packer.push(
+				gray_line[x] < m_lowerBound ||
+				(gray_line[x] <= m_upperBound &&
+				int(gray_line[x]) < threshold)
+			);
+		}
+		packer.finish();
+	}
+}
+
+
+/**
+ * \brief Splits one axis of an image into blocks,
+ *        for APPROXIMATE_LOCAL_STATS mode.
+ *
+ * Block i covers pixels [i * step, (i + 1) * step), except the last one,
+ * which may be shorter.  The statistics of a block are those of a window
+ * of an odd number of blocks centered on it.  The step is chosen so that
+ * such a window is about as large as the requested one, and a block is
+ * no more than 8 pixels long.
+ */
+class BlockAxis
+{
+public:
+	BlockAxis(int size, int window_size)
+	:	m_size(size),
+		m_windowHalf(((window_size + 7) / 8) >> 1),
+		m_step(std::max(1, window_size / (m_windowHalf * 2 + 1))),
+		m_numBlocks((size + m_step - 1) / m_step) {}
+	
+	int numBlocks() const { return m_numBlocks; }
+	
+	/**
+	 * The number of blocks on each side of a window's central block.
+	 */
+	int windowHalf() const { return m_windowHalf; }
+	
+	int blockBegin(int block) const { return block * m_step; }
+	
+	int blockEnd(int block) const { return std::min(m_size, (block + 1) * m_step); }
+	
+	float blockCenter(int block) const {
+		return 0.5f * float(blockBegin(block) + blockEnd(block) - 1);
+	}
+private:
+	int m_size;
+	int m_windowHalf;
+	int m_step;
+	int m_numBlocks;
+};
+
+
+/**
+ * \brief Sums up pixels and their squares over each block.
+ */
+class BlockSumsRows : public RowRangeProcessor
+{
+public:
+	BlockSumsRows(QImage const& gray,
+		BlockAxis const& hor_axis, BlockAxis const& ver_axis);
+	
+	uint32_t const* sums() const { return &m_sums[0]; }
+	
+	uint32_t const* sqSums() const { return &m_sqSums[0]; }
+	
+	unsigned minGrayLevel() const;
+	
+	/**
+	 * Processes block rows [begin, end).
+	 */
+	virtual void processRows(int begin, int end) const;
+private:
+	/**
+	 * \brief Adds pixels and their squares to column sums.
+	 *
+	 * \return The lesser of \p min_level and the minimum pixel value.
+	 */
+	static unsigned addToColumnSums(uint8_t const* line, int width,
+		uint32_t* col_sums, uint32_t* col_sqsums, unsigned min_level);
+	
+	uint8_t const* m_pGray;
+	int m_grayBpl;
+	BlockAxis m_horAxis;
+	BlockAxis m_verAxis;
+	
+	// Different threads write non-overlapping parts of these.
+	// A block has at most 64 pixels, so its sums fit 32 bits.
+	mutable std::vector<uint32_t> m_sums;
+	mutable std::vector<uint32_t> m_sqSums;
+	mutable std::vector<uint8_t> m_rowMinLevels;
+};
+
+
+BlockSumsRows::BlockSumsRows(
+	QImage const& gray, BlockAxis const& hor_axis, BlockAxis const& ver_axis)
+:	m_pGray(gray.bits()),
+	m_grayBpl(gray.bytesPerLine()),
+	m_horAxis(hor_axis),
+	m_verAxis(ver_axis),
+	m_sums(hor_axis.numBlocks() * ver_axis.numBlocks(), 0),
+	m_sqSums(hor_axis.numBlocks() * ver_axis.numBlocks(), 0),
+	m_rowMinLevels(ver_axis.numBlocks(), 255)
+{
+}
+
+unsigned
+BlockSumsRows::minGrayLevel() const
+{
+	return *std::min_element(m_rowMinLevels.begin(), m_rowMinLevels.end());
+}
+
+void
+BlockSumsRows::processRows(int const begin, int const end) const
+{
+	int const width = m_horAxis.blockEnd(m_horAxis.numBlocks() - 1);
+	int const num_cols = m_horAxis.numBlocks();
+	
+	// Sums over the rows of a block row, per column.
+	std::vector<uint32_t> col_sums(width);
+	std::vector<uint32_t> col_sqsums(width);
+	
+	for (int by = begin; by < end; ++by) {
+		std::fill(col_sums.begin(), col_sums.end(), 0);
+		std::fill(col_sqsums.begin(), col_sqsums.end(), 0);
+		unsigned min_level = 255;
+		
+		int const y_end = m_verAxis.blockEnd(by);
+		for (int y = m_verAxis.blockBegin(by); y < y_end; ++y) {
+			uint8_t const* const line = m_pGray + y * m_grayBpl;
+			min_level = addToColumnSums(line, width, &col_sums[0], &col_sqsums[0], min_level);
+		}
+		
+		uint32_t* const sums = &m_sums[by * num_cols];
+		uint32_t* const sqsums = &m_sqSums[by * num_cols];
+		for (int bx = 0; bx < num_cols; ++bx) {
+			uint32_t sum = 0;
+			uint32_t sqsum = 0;
+			int const x_end = m_horAxis.blockEnd(bx);
+			for (int x = m_horAxis.blockBegin(bx); x < x_end; ++x) {
+				sum += col_sums[x];
+				sqsum += col_sqsums[x];
+			}
+			sums[bx] = sum;
+			sqsums[bx] = sqsum;
+		}
+		
+		m_rowMinLevels[by] = min_level;
+	}
+}
+
+unsigned
+BlockSumsRows::addToColumnSums(
+	uint8_t const* const line, int const width,
+	uint32_t* const col_sums, uint32_t* const col_sqsums, unsigned min_level)
+{
+	int x = 0;
+	
+#ifdef IMAGEPROC_HAVE_SSE2
+	__m128i const zero = _mm_setzero_si128();
+	__m128i min = _mm_set1_epi8((char)min_level);
+	for (; x + 16 <= width; x += 16) {
+		__m128i const pixels = _mm_loadu_si128((__m128i const*)(line + x));
+		min = _mm_min_epu8(min, pixels);
+		
+		__m128i p16[2];
+		p16[0] = _mm_unpacklo_epi8(pixels, zero);
+		p16[1] = _mm_unpackhi_epi8(pixels, zero);
+		for (int i = 0; i < 2; ++i) {
+			// A square of an 8-bit value still fits into 16 bits.
+			__m128i const squares = _mm_mullo_epi16(p16[i], p16[i]);
+			__m128i* const sums = (__m128i*)(col_sums + x + i * 8);
+			__m128i* const sqsums = (__m128i*)(col_sqsums + x + i * 8);
+			_mm_storeu_si128(sums, _mm_add_epi32(
+				_mm_loadu_si128(sums), _mm_unpacklo_epi16(p16[i], zero)
+			));
+			_mm_storeu_si128(sums + 1, _mm_add_epi32(
+				_mm_loadu_si128(sums + 1), _mm_unpackhi_epi16(p16[i], zero)
+			));
+			_mm_storeu_si128(sqsums, _mm_add_epi32(
+				_mm_loadu_si128(sqsums), _mm_unpacklo_epi16(squares, zero)
+			));
+			_mm_storeu_si128(sqsums + 1, _mm_add_epi32(
+				_mm_loadu_si128(sqsums + 1), _mm_unpackhi_epi16(squares, zero)
+			));
+		}
+	}
+	
+	uint8_t mins[16];
+	_mm_storeu_si128((__m128i*)mins, min);
+	min_level = *std::min_element(mins, mins + 16);
+#endif
+	
+	for (; x < width; ++x) {
+		uint32_t const pixel = line[x];
+		col_sums[x] += pixel;
+		col_sqsums[x] += pixel * pixel;
+		min_level = std::min<unsigned>(min_level, pixel);
+	}
+	
+	return min_level;
+}
+
+
+/**
+ * \brief Calculates window statistics of image blocks,
+ *        for APPROXIMATE_LOCAL_STATS mode.
+ *
+ * Pixels are visited once, to be summed up per block.
+ * Only block sums are visited after that.
+ */
+class BlockStats
+{
+public:
+	BlockStats(QImage const& gray, QSize window_size);
+	
+	BlockAxis const& horAxis() const { return m_horAxis; }
+	
+	BlockAxis const& verAxis() const { return m_verAxis; }
+	
+	int numBlocks() const { return m_horAxis.numBlocks() * m_verAxis.numBlocks(); }
+	
+	double const* means() const { return &m_means[0]; }
+	
+	double const* deviations() const { return &m_deviations[0]; }
+	
+	/**
+	 * The minimum gray level of the whole image.
+	 */
+	unsigned minGrayLevel() const { return m_minGrayLevel; }
+private:
+	BlockAxis m_horAxis;
+	BlockAxis m_verAxis;
+	std::vector<double> m_means;
+	std::vector<double> m_deviations;
+	unsigned m_minGrayLevel;
+};
+
+
+BlockStats::BlockStats(QImage const& gray, QSize const window_size)
+:	m_horAxis(gray.width(), window_size.width()),
+	m_verAxis(gray.height(), window_size.height()),
+	m_means(numBlocks()),
+	m_deviations(numBlocks()),
+	m_minGrayLevel(255)
+{
+	int const num_cols = m_horAxis.numBlocks();
+	int const num_rows = m_verAxis.numBlocks();
+	
+	BlockSumsRows const block_sums(gray, m_horAxis, m_verAxis);
+	processRowsInParallel(block_sums, num_rows, 4);
+	m_minGrayLevel = block_sums.minGrayLevel();
+	
+	// Block sums are added up over a window of block rows, which slides
+	// down, and then over a window of block columns, which are differences
+	// of prefix sums.  Sums are kept in doubles, which are exact up to 2^53,
+	// as converting 64-bit integers to doubles is slow.
+	int const hor_half = m_horAxis.windowHalf();
+	int const ver_half = m_verAxis.windowHalf();
+	std::vector<double> col_sums(num_cols, 0.0);
+	std::vector<double> col_sqsums(num_cols, 0.0);
+	std::vector<double> prefix_sums(num_cols + 1, 0.0);
+	std::vector<double> prefix_sqsums(num_cols + 1, 0.0);
+	int top = 0;
+	int bottom = 0; // exclusive
+	
+	for (int by = 0; by < num_rows; ++by) {
+		for (; bottom < std::min(num_rows, by + ver_half + 1); ++bottom) {
+			uint32_t const* const sums = block_sums.sums() + bottom * num_cols;
+			uint32_t const* const sqsums = block_sums.sqSums() + bottom * num_cols;
+			for (int bx = 0; bx < num_cols; ++bx) {
+				col_sums[bx] += sums[bx];
+				col_sqsums[bx] += sqsums[bx];
+			}
+		}
+		for (; top < by - ver_half; ++top) {
+			uint32_t const* const sums = block_sums.sums() + top * num_cols;
+			uint32_t const* const sqsums = block_sums.sqSums() + top * num_cols;
+			for (int bx = 0; bx < num_cols; ++bx) {
+				col_sums[bx] -= sums[bx];
+				col_sqsums[bx] -= sqsums[bx];
+			}
+		}
+		
+		for (int bx = 0; bx < num_cols; ++bx) {
+			prefix_sums[bx + 1] = prefix_sums[bx] + col_sums[bx];
+			prefix_sqsums[bx + 1] = prefix_sqsums[bx] + col_sqsums[bx];
+		}
+		
+		int const height = m_verAxis.blockEnd(bottom - 1) - m_verAxis.blockBegin(top);
+		double* const means = &m_means[by * num_cols];
+		double* const deviations = &m_deviations[by * num_cols];
+		for (int bx = 0; bx < num_cols; ++bx) {
+			int const left = std::max(0, bx - hor_half);
+			int const right = std::min(num_cols, bx + hor_half + 1); // exclusive
+			int const width = m_horAxis.blockEnd(right - 1) - m_horAxis.blockBegin(left);
+			
+			double const r_area = 1.0 / (width * height);
+			double const mean = (prefix_sums[right] - prefix_sums[left]) * r_area;
+			double const sqmean = (prefix_sqsums[right] - prefix_sqsums[left]) * r_area;
+			double const variance = sqmean - mean * mean;
+			means[bx] = mean;
+			deviations[bx] = sqrt(fabs(variance));
+		}
+	}
+}
+
+
+#ifdef IMAGEPROC_HAVE_SSE2
+
+/**
+ * \brief Compares 16 pixels with thresholds interpolated between
+ *        \p t0 and \p t1, and clamped to [\p lower, \p upper].
+ *
+ * \return A mask with bit 15 set if the first pixel is below its
+ *         threshold, and so on, down to bit 0 for the last pixel.
+ */
+inline uint32_t blackMask16(
+	uint8_t const* const pixels, float const* const t0, float const* const t1,
+	__m128 const ty, __m128 const lower, __m128 const upper)
+{
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const p8 = _mm_loadu_si128((__m128i const*)pixels);
+	__m128i p16[2];
+	p16[0] = _mm_unpacklo_epi8(p8, zero);
+	p16[1] = _mm_unpackhi_epi8(p8, zero);
+	
+	__m128i black32[4];
+	for (int i = 0; i < 4; ++i) {
+		__m128i const p32 = (i & 1) ? _mm_unpackhi_epi16(p16[i >> 1], zero)
+			: _mm_unpacklo_epi16(p16[i >> 1], zero);
+		__m128 const a = _mm_loadu_ps(t0 + i * 4);
+		__m128 const b = _mm_loadu_ps(t1 + i * 4);
+		__m128 threshold = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), ty));
+		// _mm_max_ps() returns lower for a NaN threshold.
+		threshold = _mm_min_ps(_mm_max_ps(threshold, lower), upper);
+		black32[i] = _mm_castps_si128(_mm_cmplt_ps(_mm_cvtepi32_ps(p32), threshold));
+	}
+	
+	__m128i black8 = _mm_packs_epi16(
+		_mm_packs_epi32(black32[0], black32[1]),
+		_mm_packs_epi32(black32[2], black32[3])
+	);
+	
+	// Reverse the byte order, so that the first pixel ends up at bit 15.
+	black8 = _mm_shuffle_epi32(black8, _MM_SHUFFLE(0, 1, 2, 3));
+	black8 = _mm_shufflelo_epi16(black8, _MM_SHUFFLE(2, 3, 0, 1));
+	black8 = _mm_shufflehi_epi16(black8, _MM_SHUFFLE(2, 3, 0, 1));
+	black8 = _mm_or_si128(_mm_slli_epi16(black8, 8), _mm_srli_epi16(black8, 8));
+	return _mm_movemask_epi8(black8);
+}
+
+#endif // IMAGEPROC_HAVE_SSE2
+
+
+/**
+ * \brief Binarizes an image with thresholds bilinearly interpolated
+ *        between those at block centers.
+ *
+ * A pixel becomes black if it's below \p lower_bound, or if it's below
+ * its threshold while not being above \p upper_bound.
+ */
+class InterpolatedThresholdRows : public RowRangeProcessor
+{
+public:
+	InterpolatedThresholdRows(
+		QImage const& gray, std::vector<float> const& block_thresholds,
+		BlockAxis const& hor_axis, BlockAxis const& ver_axis,
+		unsigned lower_bound, unsigned upper_bound, BinaryImage& bw_img)
+	:	m_pGray(gray.bits()),
+		m_grayBpl(gray.bytesPerLine()),
+		m_width(gray.width()),
+		m_rBlockThresholds(block_thresholds),
+		m_horAxis(hor_axis),
+		m_verAxis(ver_axis),
+		m_lowerBound(lower_bound),
+		m_upperBound(upper_bound),
+		m_pBw(bw_img.data()),
+		m_bwWpl(bw_img.wordsPerLine())
+	{
+	}
+	
+	virtual void processRows(int begin, int end) const;
+private:
+	/**
+	 * \brief Interpolates thresholds of a block row horizontally,
+	 *        between the centers of adjacent blocks.
+	 */
+	void interpolateBlockRow(int block_row, float* thresholds) const;
+	
+	bool isBlack(unsigned const pixel, float const threshold) const {
+		return pixel < m_lowerBound
+			|| (pixel <= m_upperBound && float(pixel) < threshold);
+	}
+	
+	uint8_t const* m_pGray;
+	int m_grayBpl;
+	int m_width;
+	std::vector<float> const& m_rBlockThresholds;
+	BlockAxis m_horAxis;
+	BlockAxis m_verAxis;
+	unsigned m_lowerBound;
+	unsigned m_upperBound;
+	uint32_t* m_pBw;
+	int m_bwWpl;
+};
+
+
+void
+InterpolatedThresholdRows::processRows(int const begin, int const end) const
+{
+	int const last_row = m_verAxis.numBlocks() - 1;
+	
+	// The last block row with its center at or above the current row, or 0.
+	int by = 0;
+	while (by < last_row && m_verAxis.blockCenter(by + 1) <= begin) {
+		++by;
+	}
+	
+	// Thresholds of block rows by and by + 1, interpolated horizontally.
+	std::vector<float> thresholds0(m_width);
+	std::vector<float> thresholds1(m_width);
+	interpolateBlockRow(by, &thresholds0[0]);
+	interpolateBlockRow(std::min(by + 1, last_row), &thresholds1[0]);
+	
+	uint8_t const* gray_line = m_pGray + begin * m_grayBpl;
+	uint32_t* bw_line = m_pBw + begin * m_bwWpl;
+	
+	for (int y = begin; y < end; ++y, gray_line += m_grayBpl, bw_line += m_bwWpl) {
+		while (by < last_row && m_verAxis.blockCenter(by + 1) <= y) {
+			++by;
+			thresholds0.swap(thresholds1);
+			interpolateBlockRow(std::min(by + 1, last_row), &thresholds1[0]);
+		}
+		
+		// Then interpolate vertically.
+		float const y0 = m_verAxis.blockCenter(by);
+		float const y1 = m_verAxis.blockCenter(std::min(by + 1, last_row));
+		float const ty = y > y0 && y1 > y0 ? (y - y0) / (y1 - y0) : 0.0f;
+		float const* const t0 = &thresholds0[0];
+		float const* const t1 = &thresholds1[0];
+		
+		uint32_t* bw_word = bw_line;
+		int x = 0;
+		
+#ifdef IMAGEPROC_HAVE_SSE2
+		// Clamping the threshold to [lower_bound, upper_bound + 1]
+		// gives the same result as isBlack() for integer pixels.
+		__m128 const v_ty = _mm_set1_ps(ty);
+		__m128 const lower = _mm_set1_ps(float(m_lowerBound));
+		__m128 const upper = _mm_set1_ps(float(m_upperBound + 1));
+		for (; x + 32 <= m_width; x += 32, ++bw_word) {
+			*bw_word = (blackMask16(gray_line + x, t0 + x, t1 + x, v_ty, lower, upper) << 16)
+				| blackMask16(gray_line + x + 16, t0 + x + 16, t1 + x + 16, v_ty, lower, upper);
+		}
+#endif
+		
+		LinePacker packer(bw_word);
+		for (; x < m_width; ++x) {
+			float const threshold = t0[x] + (t1[x] - t0[x]) * ty;
+			packer.push(isBlack(gray_line[x], threshold));
+		}
+		packer.finish();
+	}
+}
+
+void
+InterpolatedThresholdRows::interpolateBlockRow(
+	int const block_row, float* const thresholds) const
+{
+	int const num_cols = m_horAxis.numBlocks();
+	float const* const block_thresholds = &m_rBlockThresholds[block_row * num_cols];
+	
+	int x = 0;
+	for (; x <= m_horAxis.blockCenter(0); ++x) {
+		thresholds[x] = block_thresholds[0];
+	}
+	
+	// Thresholds change linearly between block centers,
+	// so they are stepped rather than interpolated for every pixel.
+	for (int bx = 1; bx < num_cols; ++bx) {
+		float const x0 = m_horAxis.blockCenter(bx - 1);
+		float const x1 = m_horAxis.blockCenter(bx);
+		float const slope = (block_thresholds[bx] - block_thresholds[bx - 1]) / (x1 - x0);
+		float threshold = block_thresholds[bx - 1] + slope * (x - x0);
+		for (; x <= x1; ++x, threshold += slope) {
+			thresholds[x] = threshold;
+		}
+	}
+	
+	for (; x < m_width; ++x) {
+		thresholds[x] = block_thresholds[num_cols - 1];
+	}
+}
+
+} // anonymous namespace
+
 BinaryImage binarizeOtsu(QImage const& src)
 {
 	return BinaryImage(src, BinaryThreshold::otsuThreshold(src));
@@ -52,7 +1120,8 @@ BinaryImage binarizeMokji(
 	return BinaryImage(src, threshold);
 }
 
-BinaryImage binarizeSauvola(QImage const& src, QSize const window_size)
+BinaryImage binarizeSauvola(
+	QImage const& src, QSize const window_size, LocalStatsMode const mode)
 {
 	if (window_size.isEmpty()) {
 		throw std::invalid_argument("binarizeSauvola: invalid window_size");
@@ -63,80 +1132,38 @@ BinaryImage binarizeSauvola(QImage const& src, QSize const window_size)
 	}
 	
 	QImage const gray(toGrayscale(src));
-	int const w = gray.width();
-	int const h = gray.height();
-	
-	IntegralImage<uint32_t> integral_image(w, h);
-	IntegralImage<uint64_t> integral_sqimage(w, h);
-	
-	uint8_t const* gray_line = gray.bits();
-	int const gray_bpl = gray.bytesPerLine();
+	BinaryImage bw_img(gray.width(), gray.height());
 	
-	for (int y = 0; y < h; ++y, gray_line += gray_bpl) {
-		integral_image.beginRow();
-		integral_sqimage.beginRow();
-		for (int x = 0; x < w; ++x) {
-			uint32_t const pixel = gray_line[x];
-			integral_image.push(pixel);
-			integral_sqimage.push(pixel * pixel);
-		}
-	}
-	
-	int const window_lower_half = window_size.height() >> 1;
-	int const window_upper_half = window_size.height() - window_lower_half;
-	int const window_left_half = window_size.width() >> 1;
-	int const window_right_half = window_size.width() - window_left_half;
-	
-	BinaryImage bw_img(w, h);
-	uint32_t* bw_line = bw_img.data();
-	int const bw_wpl = bw_img.wordsPerLine();
-	
-	gray_line = gray.bits();
-	for (int y = 0; y < h; ++y) {
-		int const top = std::max(0, y - window_lower_half);
-		int const bottom = std::min(h, y + window_upper_half); // exclusive
-		
-		for (int x = 0; x < w; ++x) {
-			int const left = std::max(0, x - window_left_half);
-			int const right = std::min(w, x + window_right_half); // exclusive
-			int const area = (bottom - top) * (right - left);
-			assert(area > 0); // because window_size > 0 and w > 0 and h > 0
-			
-			QRect const rect(left, top, right - left, bottom - top);
-			double const window_sum = integral_image.sum(rect);
-			double const window_sqsum = integral_sqimage.sum(rect);
-			
-			double const r_area = 1.0 / area;
-			double const mean = window_sum * r_area;
-			double const sqmean = window_sqsum * r_area;
-			
-			double const variance = sqmean - mean * mean;
-			double const deviation = sqrt(fabs(variance));
-			
+	if (mode == APPROXIMATE_LOCAL_STATS) {
+		BlockStats const stats(gray, window_size);
+		int const num_blocks = stats.numBlocks();
+		std::vector<float> thresholds(num_blocks);
+		for (int i = 0; i < num_blocks; ++i) {
+			double const mean = stats.means()[i];
+			double const deviation = stats.deviations()[i];
 			double const k = 0.34;
-			double const threshold = mean * (1.0 + k * (deviation / 128.0 - 1.0));
-			
-			uint32_t const msb = uint32_t(1) << 31;
-			uint32_t const mask = msb >> (x & 31);
-			if (int(gray_line[x]) < threshold) {
-				// black
-				bw_line[x >> 5] |= mask;
-			} else {
-				// white
-				bw_line[x >> 5] &= ~mask;
-			}
+			thresholds[i] = mean * (1.0 + k * (deviation / 128.0 - 1.0));
 		}
 		
-		gray_line += gray_bpl;
-		bw_line += bw_wpl;
+		InterpolatedThresholdRows const processor(
+			gray, thresholds, stats.horAxis(), stats.verAxis(), 0, 255, bw_img
+		);
+		processRowsInParallel(processor, gray.height(), 32);
+		return bw_img;
 	}
 	
+	SauvolaRows const processor(gray, window_size, bw_img);
+	processRowsInParallel(
+		processor, gray.height(), minRowsPerBand(window_size)
+	);
+	
 	return bw_img;
 }
 
 BinaryImage binarizeWolf(
 	QImage const& src, QSize const window_size,
-	unsigned char const lower_bound, unsigned char const upper_bound)
+	unsigned char const lower_bound, unsigned char const upper_bound,
+	LocalStatsMode const mode)
 {
 	if (window_size.isEmpty()) {
 		throw std::invalid_argument("binarizeWolf: invalid window_size");
@@ -147,92 +1174,44 @@ BinaryImage binarizeWolf(
 	}
 	
 	QImage const gray(toGrayscale(src));
-	int const w = gray.width();
-	int const h = gray.height();
-	
-	IntegralImage<uint32_t> integral_image(w, h);
-	IntegralImage<uint64_t> integral_sqimage(w, h);
-	
-	uint8_t const* gray_line = gray.bits();
-	int const gray_bpl = gray.bytesPerLine();
-	
-	uint32_t min_gray_level = 255;
+	int const min_rows_per_band = minRowsPerBand(window_size);
 	
-	for (int y = 0; y < h; ++y, gray_line += gray_bpl) {
-		integral_image.beginRow();
-		integral_sqimage.beginRow();
-		for (int x = 0; x < w; ++x) {
-			uint32_t const pixel = gray_line[x];
-			integral_image.push(pixel);
-			integral_sqimage.push(pixel * pixel);
-			min_gray_level = std::min(min_gray_level, pixel);
-		}
-	}
-	
-	int const window_lower_half = window_size.height() >> 1;
-	int const window_upper_half = window_size.height() - window_lower_half;
-	int const window_left_half = window_size.width() >> 1;
-	int const window_right_half = window_size.width() - window_left_half;
-	
-	std::vector<float> means(w * h, 0);
-	std::vector<float> deviations(w * h, 0);
-	
-	double max_deviation = 0;
-	
-	for (int y = 0; y < h; ++y) {
-		int const top = std::max(0, y - window_lower_half);
-		int const bottom = std::min(h, y + window_upper_half); // exclusive
+	if (mode == APPROXIMATE_LOCAL_STATS) {
+		BlockStats const stats(gray, window_size);
+		int const num_blocks = stats.numBlocks();
+		double const* const means = stats.means();
+		double const* const deviations = stats.deviations();
+		double const max_deviation = *std::max_element(deviations, deviations + num_blocks);
+		unsigned const min_gray_level = stats.minGrayLevel();
 		
-		for (int x = 0; x < w; ++x) {
-			int const left = std::max(0, x - window_left_half);
-			int const right = std::min(w, x + window_right_half); // exclusive
-			int const area = (bottom - top) * (right - left);
-			assert(area > 0); // because window_size > 0 and w > 0 and h > 0
-			
-			QRect const rect(left, top, right - left, bottom - top);
-			double const window_sum = integral_image.sum(rect);
-			double const window_sqsum = integral_sqimage.sum(rect);
-			
-			double const r_area = 1.0 / area;
-			double const mean = window_sum * r_area;
-			double const sqmean = window_sqsum * r_area;
-			
-			double const variance = sqmean - mean * mean;
-			double const deviation = sqrt(fabs(variance));
-			max_deviation = std::max(max_deviation, deviation);
-			means[w * y + x] = mean;
-			deviations[w * y + x] = deviation;
+		std::vector<float> thresholds(num_blocks);
+		for (int i = 0; i < num_blocks; ++i) {
+			double const k = 0.3;
+			double const a = 1.0 - deviations[i] / max_deviation;
+			thresholds[i] = means[i] - k * a * (means[i] - min_gray_level);
 		}
+		
+		BinaryImage bw_img(gray.width(), gray.height());
+		InterpolatedThresholdRows const processor(
+			gray, thresholds, stats.horAxis(), stats.verAxis(),
+			lower_bound, upper_bound, bw_img
+		);
+		processRowsInParallel(processor, gray.height(), 32);
+		return bw_img;
 	}
 	
-	// TODO: integral images can be disposed at this point.
+	// Rather than storing the mean and deviation for every pixel,
+	// we make two passes, calculating them twice.
+	WolfStatsRows const stats_processor(gray, window_size);
+	processRowsInParallel(stats_processor, gray.height(), min_rows_per_band);
 	
-	BinaryImage bw_img(w, h);
-	uint32_t* bw_line = bw_img.data();
-	int const bw_wpl = bw_img.wordsPerLine();
+	BinaryImage bw_img(gray.width(), gray.height());
 	
-	gray_line = gray.bits();
-	for (int y = 0; y < h; ++y, gray_line += gray_bpl, bw_line += bw_wpl) {
-		for (int x = 0; x < w; ++x) {
-			float const mean = means[y * w + x];
-			float const deviation = deviations[y * w + x];
-			double const k = 0.3;
-			double const a = 1.0 - deviation / max_deviation;
-			double const threshold = mean - k * a * (mean - min_gray_level);
-			
-			uint32_t const msb = uint32_t(1) << 31;
-			uint32_t const mask = msb >> (x & 31);
-			if (gray_line[x] < lower_bound ||
-					(gray_line[x] <= upper_bound &&
-					int(gray_line[x]) < threshold)) {
-				// black
-				bw_line[x >> 5] |= mask;
-			} else {
-				// white
-				bw_line[x >> 5] &= ~mask;
-			}
-		}
-	}
+	WolfRows const processor(
+		gray, window_size, stats_processor.minGrayLevel(),
+		stats_processor.maxDeviation(), lower_bound, upper_bound, bw_img
+	);
+	processRowsInParallel(processor, gray.height(), min_rows_per_band);
 	
 	return bw_img;
 }
@@ -28,6 +28,27 @@ namespace imageproc
 
 class BinaryImage;
 
+/**
+ * \brief How local thresholding methods calculate window statistics.
+ */
+enum LocalStatsMode
+{
+	/**
+	 * Statistics are calculated exactly, for every pixel's window.
+	 */
+	EXACT_LOCAL_STATS,
+	
+	/**
+	 * The image is split into blocks of up to 8x8 pixels, and statistics
+	 * are calculated per block, over a window of whole blocks that is
+	 * about the requested size.  Thresholds are bilinearly interpolated
+	 * between block centers.  That's several times faster, and as long
+	 * as the background varies slowly, as it does on scanned pages,
+	 * the results are about the same.
+	 */
+	APPROXIMATE_LOCAL_STATS
+};
+
 /**
  * \brief Image binarization using Otsu's global thresholding method.
  *
@@ -59,7 +80,9 @@ BinaryImage binarizeMokji(
  * Sauvola, J. and M. Pietikainen. 2000. "Adaptive document image binarization".
  * http://www.mediateam.oulu.fi/publications/pdf/24.pdf
  */
-BinaryImage binarizeSauvola(QImage const& src, QSize window_size);
+BinaryImage binarizeSauvola(
+	QImage const& src, QSize window_size,
+	LocalStatsMode mode = EXACT_LOCAL_STATS);
 
 /**
  * \brief Image binarization using Wolf's local thresholding method.
@@ -72,10 +95,12 @@ BinaryImage binarizeSauvola(QImage const& src, QSize window_size);
  * \param window_size The dimensions of a pixel neighborhood to consider.
  * \param lower_bound The minimum possible gray level that can be made white.
  * \param upper_bound The maximum possible gray level that can be made black.
+ * \param mode Whether to calculate window statistics exactly.
  */
 BinaryImage binarizeWolf(
 	QImage const& src, QSize window_size,
-	unsigned char lower_bound = 1, unsigned char upper_bound = 254);
+	unsigned char lower_bound = 1, unsigned char upper_bound = 254,
+	LocalStatsMode mode = EXACT_LOCAL_STATS);
 
 } // namespace imageproc
 
@@ -24,5 +24,36 @@
 #else
 #include <netinet/in.h>
 #endif
+#include <stdint.h>
+#include <stddef.h>
+
+namespace imageproc
+{
+
+/**
+ * \brief Converts big-endian 32-bit words to host byte order, in place.
+ *
+ * Each converted word is then XORed with \p modifier, which makes it
+ * possible to invert the bits in the same pass.
+ */
+inline void bigEndianToHostInPlace(
+	uint32_t* words, size_t num_words, uint32_t modifier = 0)
+{
+	for (size_t i = 0; i < num_words; ++i) {
+		words[i] = ntohl(words[i]) ^ modifier;
+	}
+}
+
+/**
+ * \brief Converts 32-bit words from host to big-endian byte order, in place.
+ */
+inline void hostToBigEndianInPlace(uint32_t* words, size_t num_words)
+{
+	for (size_t i = 0; i < num_words; ++i) {
+		words[i] = htonl(words[i]);
+	}
+}
+
+} // namespace imageproc
 
 #endif
@@ -20,11 +20,14 @@
 #include "BinaryImage.h"
 #include "InfluenceMap.h"
 #include "BitOps.h"
+#include "ParallelRows.h"
 #ifndef Q_MOC_RUN
 #include <boost/foreach.hpp>
 #endif
 #include <QImage>
 #include <QColor>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QDebug>
 #include <algorithm>
 #include <stdexcept>
@@ -33,6 +36,154 @@
 namespace imageproc
 {
 
+namespace
+{
+
+/**
+ * Bands shorter than that aren't worth labelling separately.
+ */
+int const MIN_ROWS_PER_BAND = 64;
+
+/*
+ * Equivalences between provisional labels are kept as a union-find
+ * forest, where parents[label] is the parent of the label, and roots
+ * are their own parents.  The root of each set is always its smallest
+ * label.  parents[0] is unused.
+ */
+
+uint32_t findRoot(std::vector<uint32_t>& parents, uint32_t label)
+{
+	uint32_t root = label;
+	while (parents[root] != root) {
+		root = parents[root];
+	}
+	
+	// Path compression.
+	while (parents[label] != root) {
+		uint32_t const next = parents[label];
+		parents[label] = root;
+		label = next;
+	}
+	
+	return root;
+}
+
+void unite(std::vector<uint32_t>& parents, uint32_t const label1, uint32_t const label2)
+{
+	uint32_t const root1 = findRoot(parents, label1);
+	uint32_t const root2 = findRoot(parents, label2);
+	if (root1 < root2) {
+		parents[root2] = root1;
+	} else if (root2 < root1) {
+		parents[root1] = root2;
+	}
+}
+
+/**
+ * \brief Provisional labels of a horizontal band of a map.
+ */
+struct LabelledBand
+{
+	int begin;
+	int end;
+	std::vector<uint32_t> parents;
+};
+
+struct BandsByPosition
+{
+	bool operator()(LabelledBand const& lhs, LabelledBand const& rhs) const {
+		return lhs.begin < rhs.begin;
+	}
+};
+
+/**
+ * \brief Labels horizontal bands of a map independently of each other.
+ *
+ * Every run of foreground pixels gets a new label, in raster order
+ * within the band, with labels starting from 1 in each band.
+ * Labels of runs connected to ones on the previous line of the
+ * same band are united.
+ */
+class RunLabeller : public RowRangeProcessor
+{
+public:
+	RunLabeller(
+		uint32_t* data, int stride, int width,
+		Connectivity conn, uint32_t background)
+	:	m_pData(data),
+		m_stride(stride),
+		m_width(width),
+		m_dx(conn == CONN8 ? 1 : 0),
+		m_background(background)
+	{
+	}
+	
+	virtual void processRows(int begin, int end) const;
+	
+	std::vector<LabelledBand>& bands() { return m_bands; }
+private:
+	uint32_t* m_pData;
+	int m_stride;
+	int m_width;
+	int m_dx;
+	uint32_t m_background;
+	mutable QMutex m_mutex;
+	mutable std::vector<LabelledBand> m_bands;
+};
+
+void
+RunLabeller::processRows(int const begin, int const end) const
+{
+	std::vector<uint32_t> parents(1, 0);
+	uint32_t const background = m_background;
+	
+	uint32_t* line = m_pData + begin * m_stride;
+	for (int y = begin; y < end; ++y, line += m_stride) {
+		uint32_t const* const prev_line = line - m_stride;
+		
+		int x = 0;
+		while (x < m_width) {
+			if (line[x] == background) {
+				++x;
+				continue;
+			}
+			
+			// The padding guarantees a background pixel
+			// at the end of each line.
+			int const run_begin = x;
+			do {
+				++x;
+			} while (line[x] != background);
+			int const run_end = x;
+			
+			uint32_t const label = parents.size();
+			parents.push_back(label);
+			
+			if (y != begin) {
+				uint32_t prev_label = background;
+				for (int i = run_begin - m_dx; i < run_end + m_dx; ++i) {
+					uint32_t const neighbor = prev_line[i];
+					if (neighbor != background && neighbor != prev_label) {
+						unite(parents, label, neighbor);
+					}
+					prev_label = neighbor;
+				}
+			}
+			
+			std::fill(line + run_begin, line + run_end, label);
+		}
+	}
+	
+	QMutexLocker const locker(&m_mutex);
+	m_bands.push_back(LabelledBand());
+	LabelledBand& band = m_bands.back();
+	band.begin = begin;
+	band.end = end;
+	band.parents.swap(parents);
+}
+
+} // anonymous namespace
+
 uint32_t const ConnectivityMap::BACKGROUND = ~uint32_t(0);
 uint32_t const ConnectivityMap::UNTAGGED_FG = BACKGROUND - 1;
 
@@ -260,314 +411,97 @@ ConnectivityMap::copyFromInfluenceMap(InfluenceMap const& imap)
 
 void
 ConnectivityMap::assignIds(Connectivity const conn)
-{
-	uint32_t const num_initial_tags = initialTagging();
-	std::vector<uint32_t> table(num_initial_tags, 0);
-	
-	switch (conn) {
-		case CONN4:
-			spreadMin4();
-			break;
-		case CONN8:
-			spreadMin8();
-			break;
-	}
-	
-	markUsedIds(table);
-	
-	uint32_t next_label = 1;
-	for (uint32_t i = 0; i < num_initial_tags; ++i) {
-		if (table[i]) {
-			table[i] = next_label;
-			++next_label;
-		}
-	}
-	
-	remapIds(table);
-	
-	m_maxLabel = next_label - 1;
-}
-
-/**
- * Tags every object pixel that has a non-object pixel to the left.
- */
-uint32_t
-ConnectivityMap::initialTagging()
 {
 	int const width = m_size.width();
 	int const height = m_size.height();
 	
-	uint32_t next_label = 1;
-	
-	uint32_t* line = m_pData;
-	int const stride = m_stride;
-	
-	for (int y = 0; y < height; ++y, line += stride) {
-		for (int x = 0; x < width; ++x) {
-			if (line[x - 1] == BACKGROUND
-					&& line[x] == UNTAGGED_FG) {
-				line[x] = next_label;
-				++next_label;
-			}
+	RunLabeller labeller(m_pData, m_stride, width, conn, BACKGROUND);
+	processRowsInParallel(labeller, height, MIN_ROWS_PER_BAND);
+	std::vector<LabelledBand>& bands = labeller.bands();
+	std::sort(bands.begin(), bands.end(), BandsByPosition());
+	
+	// Concatenate equivalences of individual bands, offsetting their
+	// labels so that labels keep following the raster order.
+	std::vector<uint32_t> parents(1, 0);
+	std::vector<uint32_t> row_offsets(height);
+	BOOST_FOREACH(LabelledBand const& band, bands) {
+		uint32_t const offset = parents.size() - 1;
+		for (size_t i = 1; i < band.parents.size(); ++i) {
+			parents.push_back(band.parents[i] + offset);
 		}
+		std::fill(
+			row_offsets.begin() + band.begin,
+			row_offsets.begin() + band.end, offset
+		);
 	}
 	
-	return next_label - 1;
-}
-
-void
-ConnectivityMap::spreadMin4()
-{
-	int const width = m_size.width();
-	int const height = m_size.height();
-	int const stride = m_stride;
-	
-	uint32_t* line = m_pData;
-	uint32_t* prev_line = m_pData - stride;
-	
-	// Top to bottom.
-	for (int y = 0; y < height; ++y) {
-		// Left to right.
-		for (int x = 0; x < width; ++x) {
-			if (line[x] == BACKGROUND) {
-				continue;
-			}
-			line[x] = std::min(
-				prev_line[x],
-				std::min(line[x - 1], line[x])
-			);
+	// Merge components across band boundaries.
+	int const dx = (conn == CONN8) ? 1 : 0;
+	BOOST_FOREACH(LabelledBand const& band, bands) {
+		if (band.begin == 0) {
+			continue;
 		}
 		
-		prev_line = line;
-		line += stride;
-	}
-	
-	prev_line = line;
-	line -= stride;
-	
-	FastQueue<uint32_t*> queue;
-	
-	// Bottom to top.
-	for (int y = height - 1; y >= 0; --y) {
-		// Right to left.
-		for (int x = width - 1; x >= 0; --x) {
-			if (line[x] == BACKGROUND) {
-				continue;
-			}
-			
-			uint32_t const new_val = std::min(
-				line[x + 1], prev_line[x]
-			);
-			
-			if (new_val >= line[x]) {
-				continue;
-			}
-			
-			line[x] = new_val;
-			
-			// We compare new_val + 1 < neighbor + 1 to
-			// make BACKGROUND neighbors overflow and become
-			// zero.
-			uint32_t const nvp1 = new_val + 1;
-			if (nvp1 < line[x + 1] + 1 || nvp1 < prev_line[x] + 1) {
-				queue.push(&line[x]);
-			}
-		}
-		prev_line = line;
-		line -= stride;
-	}
-	
-	processQueue4(queue);
-}
-
-void
-ConnectivityMap::spreadMin8()
-{
-	int const width = m_size.width();
-	int const height = m_size.height();
-	int const stride = m_stride;
-	
-	uint32_t* line = m_pData;
-	uint32_t* prev_line = m_pData - stride;
-	
-	// Top to bottom.
-	for (int y = 0; y < height; ++y) {
-		// Left to right.
-		for (int x = 0; x < width; ++x) {
-			if (line[x] == BACKGROUND) {
-				continue;
-			}
-			line[x] = std::min(
-				std::min(
-					std::min(prev_line[x - 1], prev_line[x]),
-					std::min(prev_line[x + 1], line[x - 1])
-				),
-				line[x]
-			);
-		}
+		uint32_t const* const line = m_pData + band.begin * m_stride;
+		uint32_t const* const prev_line = line - m_stride;
+		uint32_t const offset = row_offsets[band.begin];
+		uint32_t const prev_offset = row_offsets[band.begin - 1];
 		
-		prev_line = line;
-		line += stride;
-	}
-	
-	prev_line = line;
-	line -= stride;
-	
-	FastQueue<uint32_t*> queue;
-	
-	// Bottom to top.
-	for (int y = height - 1; y >= 0; --y) {
-		for (int x = width - 1; x >= 0; --x) {
+		for (int x = 0; x < width; ++x) {
 			if (line[x] == BACKGROUND) {
 				continue;
 			}
-			
-			uint32_t const new_val = std::min(
-				std::min(prev_line[x - 1], prev_line[x]),
-				std::min(prev_line[x + 1], line[x + 1])
-			);
-			
-			if (new_val >= line[x]) {
-				continue;
-			}
-			
-			line[x] = new_val;
-			
-			// We compare new_val + 1 < neighbor + 1 to
-			// make BACKGROUND neighbors overflow and become
-			// zero.
-			uint32_t const nvp1 = new_val + 1;
-			if (nvp1 < prev_line[x - 1] + 1
-					|| nvp1 < prev_line[x] + 1
-					|| nvp1 < prev_line[x + 1] + 1
-					|| nvp1 < line[x + 1] + 1) {
-				queue.push(&line[x]);
+			for (int nx = x - dx; nx <= x + dx; ++nx) {
+				if (prev_line[nx] != BACKGROUND) {
+					unite(parents, line[x] + offset, prev_line[nx] + prev_offset);
+				}
 			}
 		}
-		
-		prev_line = line;
-		line -= stride;
 	}
 	
-	processQueue8(queue);
-}
-
-void
-ConnectivityMap::processNeighbor(
-	FastQueue<uint32_t*>& queue,
-	uint32_t const this_val, uint32_t* neighbor)
-{
-	// *neighbor + 1 will overflow if *neighbor == BACKGROUND,
-	// which is what we want.
-	if (this_val + 1 < *neighbor + 1) {
-		*neighbor = this_val;
-		queue.push(neighbor);
+	// The root of each set is its smallest label, which belongs
+	// to the component's first run in raster order.  That makes final
+	// labels follow the order of the first pixel of each component.
+	std::vector<uint32_t> final_labels(parents.size(), 0);
+	uint32_t next_label = 1;
+	for (size_t i = 1; i < parents.size(); ++i) {
+		uint32_t const root = findRoot(parents, i);
+		if (root == i) {
+			final_labels[i] = next_label;
+			++next_label;
+		} else {
+			final_labels[i] = final_labels[root];
+		}
 	}
-}
-
-void
-ConnectivityMap::processQueue4(FastQueue<uint32_t*>& queue)
-{
-	int const stride = m_stride;
 	
-	while (!queue.empty()) {
-		uint32_t* p = queue.front();
-		queue.pop();
-		
-		uint32_t const this_val = *p;
-		
-		// Northern neighbor.
-		p -= stride;
-		processNeighbor(queue, this_val, p);
-		
-		// Eastern neighbor.
-		p += stride + 1;
-		processNeighbor(queue, this_val, p);
-		
-		// Southern neighbor.
-		p += stride - 1;
-		processNeighbor(queue, this_val, p);
-		
-		// Western neighbor.
-		p -= stride + 1;
-		processNeighbor(queue, this_val, p);
-	}
-}
-
-void
-ConnectivityMap::processQueue8(FastQueue<uint32_t*>& queue)
-{
-	int const stride = m_stride;
+	remapIds(final_labels, row_offsets);
 	
-	while (!queue.empty()) {
-		uint32_t* p = queue.front();
-		queue.pop();
-		
-		uint32_t const this_val = *p;
-		
-		// Northern neighbor.
-		p -= stride;
-		processNeighbor(queue, this_val, p);
-		
-		// North-eastern neighbor.
-		++p;
-		processNeighbor(queue, this_val, p);
-		
-		// Eastern neighbor.
-		p += stride;
-		processNeighbor(queue, this_val, p);
-		
-		// South-eastern neighbor.
-		p += stride;
-		processNeighbor(queue, this_val, p);
-		
-		// Southern neighbor.
-		--p;
-		processNeighbor(queue, this_val, p);
-		
-		// South-western neighbor.
-		--p;
-		processNeighbor(queue, this_val, p);
-		
-		// Western neighbor.
-		p -= stride;
-		processNeighbor(queue, this_val, p);
-		
-		// North-western neighbor.
-		p -= stride;
-		processNeighbor(queue, this_val, p);
-	}
+	m_maxLabel = next_label - 1;
 }
 
+/**
+ * Converts labels set by assignIds() to final ones.  BACKGROUND,
+ * including the padding, becomes zero.
+ */
 void
-ConnectivityMap::markUsedIds(std::vector<uint32_t>& used_map) const
+ConnectivityMap::remapIds(
+	std::vector<uint32_t> const& map, std::vector<uint32_t> const& row_offsets)
 {
 	int const width = m_size.width();
 	int const height = m_size.height();
 	int const stride = m_stride;
 	
-	uint32_t const* line = m_pData;
+	std::fill(m_data.begin(), m_data.begin() + stride, 0);
+	std::fill(m_data.end() - stride, m_data.end(), 0);
 	
-	// Top to bottom.
+	uint32_t* line = m_pData;
 	for (int y = 0; y < height; ++y, line += stride) {
-		// Left to right.
+		uint32_t const offset = row_offsets[y];
+		line[-1] = 0;
+		line[width] = 0;
 		for (int x = 0; x < width; ++x) {
-			if (line[x] == BACKGROUND) {
-				continue;
-			}
-			used_map[line[x] - 1] = 1;
-		}
-	}
-}
-
-void
-ConnectivityMap::remapIds(std::vector<uint32_t> const& map)
-{
-	BOOST_FOREACH(uint32_t& label, m_data) {
-		if (label == BACKGROUND) {
-			label = 0;
-		} else {
-			label = map[label - 1];
+			uint32_t const label = line[x];
+			line[x] = label == BACKGROUND ? 0 : map[label + offset];
 		}
 	}
 }
@@ -20,7 +20,6 @@
 #define IMAGEPROC_CONNECTIVITY_MAP_H_
 
 #include "Connectivity.h"
-#include "FastQueue.h"
 #include <QSize>
 #include <QColor>
 #include <Qt>
@@ -179,23 +178,9 @@ private:
 	
 	void assignIds(Connectivity conn);
 	
-	uint32_t initialTagging();
-	
-	void spreadMin4();
-	
-	void spreadMin8();
-	
-	void processNeighbor(
-		FastQueue<uint32_t*>& queue,
-		uint32_t this_val, uint32_t* neighbor);
-
-	void processQueue4(FastQueue<uint32_t*>& queue);
-	
-	void processQueue8(FastQueue<uint32_t*>& queue);
-	
-	void markUsedIds(std::vector<uint32_t>& used_map) const;
-	
-	void remapIds(std::vector<uint32_t> const& map);
+	void remapIds(
+		std::vector<uint32_t> const& map,
+		std::vector<uint32_t> const& row_offsets);
 	
 	void expandImpl(BinaryImage const* mask);
 	
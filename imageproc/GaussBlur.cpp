@@ -22,9 +22,11 @@
 #include "GaussBlur.h"
 #include "GrayImage.h"
 #include "Constants.h"
+#include "Sse2.h"
 #include <boost/lambda/lambda.hpp>
 #include <boost/lambda/bind.hpp>
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 
 namespace imageproc
@@ -97,6 +99,171 @@ void find_iir_constants(
 	}
 }
 
+namespace
+{
+
+#ifdef IMAGEPROC_HAVE_SSE2
+
+/**
+ * \brief LANES floats, processed in parallel.
+ */
+class Lanes
+{
+public:
+	Lanes() : m_v(_mm_setzero_ps()) {}
+	
+	explicit Lanes(float v) : m_v(_mm_set1_ps(v)) {}
+	
+	static Lanes load(float const* p) { return Lanes(_mm_loadu_ps(p)); }
+	
+	void store(float* p) const { _mm_storeu_ps(p, m_v); }
+	
+	Lanes operator+(Lanes const& other) const {
+		return Lanes(_mm_add_ps(m_v, other.m_v));
+	}
+	
+	Lanes operator-(Lanes const& other) const {
+		return Lanes(_mm_sub_ps(m_v, other.m_v));
+	}
+	
+	Lanes operator*(Lanes const& other) const {
+		return Lanes(_mm_mul_ps(m_v, other.m_v));
+	}
+private:
+	explicit Lanes(__m128 v) : m_v(v) {}
+	
+	__m128 m_v;
+};
+
+#else
+
+/**
+ * \brief LANES floats, processed in parallel.
+ */
+class Lanes
+{
+public:
+	Lanes() { set(0.0f); }
+	
+	explicit Lanes(float v) { set(v); }
+	
+	static Lanes load(float const* p) {
+		Lanes lanes;
+		memcpy(lanes.m_v, p, sizeof(lanes.m_v));
+		return lanes;
+	}
+	
+	void store(float* p) const { memcpy(p, m_v, sizeof(m_v)); }
+	
+	Lanes operator+(Lanes const& other) const {
+		Lanes res;
+		for (int i = 0; i < LANES; ++i) {
+			res.m_v[i] = m_v[i] + other.m_v[i];
+		}
+		return res;
+	}
+	
+	Lanes operator-(Lanes const& other) const {
+		Lanes res;
+		for (int i = 0; i < LANES; ++i) {
+			res.m_v[i] = m_v[i] - other.m_v[i];
+		}
+		return res;
+	}
+	
+	Lanes operator*(Lanes const& other) const {
+		Lanes res;
+		for (int i = 0; i < LANES; ++i) {
+			res.m_v[i] = m_v[i] * other.m_v[i];
+		}
+		return res;
+	}
+private:
+	void set(float v) {
+		for (int i = 0; i < LANES; ++i) {
+			m_v[i] = v;
+		}
+	}
+	
+	float m_v[LANES];
+};
+
+#endif
+
+/**
+ * Runs one direction of the recursion.  For the causal direction,
+ * \p step is LANES, and \p src and \p dst point to the first sample.
+ * For the anti-causal one, \p step is -LANES, and they point to the last.
+ */
+void filterLanesInDirection(
+	float const* src, float* dst, int const step, int const len,
+	float const* n, float const* d, float const* bd)
+{
+	Lanes const first_val(Lanes::load(src));
+	
+	Lanes nv[5];
+	Lanes dv[5];
+	Lanes boundary[5]; // The weights of first_val for samples before the first one.
+	for (int i = 0; i <= 4; ++i) {
+		nv[i] = Lanes(n[i]);
+		dv[i] = Lanes(d[i]);
+		boundary[i] = Lanes(n[i] - bd[i]);
+	}
+	
+	// The first few samples, where the filter extends beyond the signal.
+	int const head = len < 4 ? len : 4;
+	for (int j = 0; j < head; ++j) {
+		Lanes acc(nv[0] * Lanes::load(src));
+		int i = 1;
+		for (; i <= j; ++i) {
+			acc = acc + nv[i] * Lanes::load(src - i * step)
+				- dv[i] * Lanes::load(dst - i * step);
+		}
+		for (; i <= 4; ++i) {
+			acc = acc + boundary[i] * first_val;
+		}
+		acc.store(dst);
+		src += step;
+		dst += step;
+	}
+	
+	for (int j = head; j < len; ++j) {
+		Lanes acc(nv[0] * Lanes::load(src));
+		acc = acc + nv[1] * Lanes::load(src - step) - dv[1] * Lanes::load(dst - step);
+		acc = acc + nv[2] * Lanes::load(src - 2 * step) - dv[2] * Lanes::load(dst - 2 * step);
+		acc = acc + nv[3] * Lanes::load(src - 3 * step) - dv[3] * Lanes::load(dst - 3 * step);
+		acc = acc + nv[4] * Lanes::load(src - 4 * step) - dv[4] * Lanes::load(dst - 4 * step);
+		acc.store(dst);
+		src += step;
+		dst += step;
+	}
+}
+
+} // anonymous namespace
+
+IirFilter::IirFilter(float const std_dev)
+{
+	find_iir_constants(m_np, m_nm, m_dp, m_dm, m_bdp, m_bdm, std_dev);
+}
+
+void
+IirFilter::filterLanes(
+	float const* const src, float* const dst,
+	float* const tmp, int const len) const
+{
+	if (len <= 0) {
+		return;
+	}
+	
+	int const last = (len - 1) * LANES;
+	filterLanesInDirection(src, dst, LANES, len, m_np, m_dp, m_bdp);
+	filterLanesInDirection(src + last, tmp + last, -LANES, len, m_nm, m_dm, m_bdm);
+	
+	for (int i = 0; i < len * LANES; i += LANES) {
+		(Lanes::load(dst + i) + Lanes::load(tmp + i)).store(dst + i);
+	}
+}
+
 } // namespace gauss_blur_impl
 
 GrayImage gaussBlur(GrayImage const& src, float h_sigma, float v_sigma)
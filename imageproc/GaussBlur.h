@@ -27,6 +27,7 @@
 #ifndef Q_MOC_RUN
 #include <boost/scoped_array.hpp>
 #endif
+#include <algorithm>
 #include <iterator>
 #include <string.h>
 
@@ -99,22 +100,34 @@ void find_iir_constants(
 	float* n_p, float *n_m, float *d_p,
 	float* d_m, float *bd_p, float *bd_m, float std_dev);
 
-template<typename Src1It, typename Src2It, typename DstIt, typename FloatWriter>
-void save(int num_items, Src1It src1, Src2It src2,
-		  DstIt dst, int dst_stride, FloatWriter writer)
-{
-	while (num_items-- != 0) {
-		writer(*dst, *src1 + *src2);
-		++src1;
-		++src2;
-		dst += dst_stride;
-	}
-}
+/**
+ * The number of signals IirFilter::filterLanes() processes at once.
+ */
+enum { LANES = 4 };
 
-class FloatToFloatWriter
+/**
+ * \brief A 4th order recursive approximation of a 1D gaussian filter.
+ */
+class IirFilter
 {
 public:
-	void operator()(float& dst, float src) const { dst = src; }
+	explicit IirFilter(float std_dev);
+	
+	/**
+	 * \brief Filters LANES interleaved signals of length \p len at once.
+	 *
+	 * Sample i of signal c is at src[i * LANES + c].  The same layout
+	 * is used for \p dst.  \p tmp has to have room for len * LANES
+	 * values.  None of the buffers may overlap.
+	 */
+	void filterLanes(float const* src, float* dst, float* tmp, int len) const;
+private:
+	float m_np[5];
+	float m_nm[5];
+	float m_dp[5];
+	float m_dm[5];
+	float m_bdp[5];
+	float m_bdm[5];
 };
 
 } // namespace gauss_blur_impl
@@ -124,6 +137,8 @@ void gaussBlurGeneric(QSize const size, float const h_sigma, float const v_sigma
 					  SrcIt const input, int const input_stride, FloatReader const float_reader,
 					  DstIt const output, int const output_stride, FloatWriter const float_writer)
 {
+	using gauss_blur_impl::LANES;
+	
 	if (size.isEmpty()) {
 		return;
 	}
@@ -132,87 +147,71 @@ void gaussBlurGeneric(QSize const size, float const h_sigma, float const v_sigma
 	int const height = size.height();
 	int const width_height_max = width > height ? width : height;
 
-	boost::scoped_array<float> val_p(new float[width_height_max]);
-	boost::scoped_array<float> val_m(new float[width_height_max]);
+	// The recursion runs on LANES signals at once.  They are kept
+	// interleaved in these buffers.
+	boost::scoped_array<float> lanes_in(new float[width_height_max * LANES]);
+	boost::scoped_array<float> lanes_out(new float[width_height_max * LANES]);
+	boost::scoped_array<float> lanes_tmp(new float[width_height_max * LANES]);
 	boost::scoped_array<float> intermediate_image(new float[width * height]);
 	int const intermediate_stride = width;
 
-	// IIR parameters.
-	float n_p[5], n_m[5], d_p[5], d_m[5], bd_p[5], bd_m[5];
-	
-	// Vertical pass.
-	gauss_blur_impl::find_iir_constants(n_p, n_m, d_p, d_m, bd_p, bd_m, v_sigma);
-	for (int x = 0; x < width; ++x) {
-		memset(&val_p[0], 0, height * sizeof(val_p[0]));
-		memset(&val_m[0], 0, height * sizeof(val_m[0]));
-		
-		SrcIt sp_p(input + x);
-		SrcIt sp_m(sp_p + (height - 1) * input_stride);
-		float* vp = &val_p[0];
-		float* vm = &val_m[0] + height - 1;
-		float const initial_p = float_reader(sp_p[0]);
-		float const initial_m = float_reader(sp_m[0]);
+	// Vertical pass, on LANES adjacent columns at a time.  Those are
+	// read and written row by row, which is kind to the CPU cache.
+	gauss_blur_impl::IirFilter const v_filter(v_sigma);
+	for (int x0 = 0; x0 < width; x0 += LANES) {
+		int const num_lanes = std::min<int>(LANES, width - x0);
 		
+		SrcIt input_line(input + x0);
+		float* lane_p = &lanes_in[0];
 		for (int y = 0; y < height; ++y) {
-			int const terms = y < 4 ? y : 4;
-			int i = 0;
-			int sp_off = 0;
-			for (; i <= terms; ++i, sp_off += input_stride) {
-				*vp += n_p[i] * float_reader(sp_p[-sp_off]) - d_p[i] * vp[-i];
-				*vm += n_m[i] * float_reader(sp_m[sp_off]) - d_m[i] * vm[i];
+			for (int c = 0; c < LANES; ++c) {
+				// Unused lanes duplicate the last column.
+				lane_p[c] = float_reader(input_line[std::min(c, num_lanes - 1)]);
 			}
-			for (; i <= 4; ++i) {
-				*vp += (n_p[i] - bd_p[i]) * initial_p;
-				*vm += (n_m[i] - bd_m[i]) * initial_m;
-			}
-			sp_p += input_stride;
-			sp_m -= input_stride;
-			++vp;
-			--vm;
+			input_line += input_stride;
+			lane_p += LANES;
 		}
 		
-		gauss_blur_impl::save(
-			height, &val_p[0], &val_m[0], &intermediate_image[0] + x,
-			intermediate_stride, gauss_blur_impl::FloatToFloatWriter()
-		);
+		v_filter.filterLanes(&lanes_in[0], &lanes_out[0], &lanes_tmp[0], height);
+		
+		float* intermediate_line = &intermediate_image[0] + x0;
+		lane_p = &lanes_out[0];
+		for (int y = 0; y < height; ++y) {
+			for (int c = 0; c < num_lanes; ++c) {
+				intermediate_line[c] = lane_p[c];
+			}
+			intermediate_line += intermediate_stride;
+			lane_p += LANES;
+		}
 	}
 	
-	// Horizontal pass.
-	gauss_blur_impl::find_iir_constants(n_p, n_m, d_p, d_m, bd_p, bd_m, h_sigma);
-	float const* intermediate_line = &intermediate_image[0];
-	DstIt output_line(output);
-	for (int y = 0; y < height; ++y) {
-		memset(&val_p[0], 0, width * sizeof(val_p[0]));
-		memset(&val_m[0], 0, width * sizeof(val_m[0]));
-		
-		float const* sp_p = intermediate_line;
-		float const* sp_m = intermediate_line + width - 1;
-		float* vp = &val_p[0];
-		float* vm = &val_m[0] + width - 1;
-		float const initial_p = sp_p[0];
-		float const initial_m = sp_m[0];
+	// Horizontal pass, on LANES rows at a time, which are
+	// transposed into lanes and back.
+	gauss_blur_impl::IirFilter const h_filter(h_sigma);
+	for (int y0 = 0; y0 < height; y0 += LANES) {
+		int const num_lanes = std::min<int>(LANES, height - y0);
 		
-		for (int x = 0; x < width; ++x) {
-			int const terms = x < 4 ? x : 4;
-			int i = 0;
-			for (; i <= terms; ++i) {
-				*vp += n_p[i] * sp_p[-i] - d_p[i] * vp[-i];
-				*vm += n_m[i] * sp_m[i] - d_m[i] * vm[i];
+		for (int c = 0; c < LANES; ++c) {
+			// Unused lanes duplicate the last row.
+			int const y = y0 + std::min(c, num_lanes - 1);
+			float const* intermediate_line = &intermediate_image[0] + y * intermediate_stride;
+			float* lane_p = &lanes_in[c];
+			for (int x = 0; x < width; ++x) {
+				*lane_p = intermediate_line[x];
+				lane_p += LANES;
 			}
-			for (; i <= 4; ++i) {
-				*vp += (n_p[i] - bd_p[i]) * initial_p;
-				*vm += (n_m[i] - bd_m[i]) * initial_m;
-			}
-			++sp_p;
-			--sp_m;
-			++vp;
-			--vm;
 		}
 		
-		gauss_blur_impl::save(width, &val_p[0], &val_m[0], output_line, 1, float_writer);
-
-		intermediate_line += intermediate_stride;
-		output_line += output_stride;
+		h_filter.filterLanes(&lanes_in[0], &lanes_out[0], &lanes_tmp[0], width);
+		
+		for (int c = 0; c < num_lanes; ++c) {
+			DstIt output_line(output + (y0 + c) * output_stride);
+			float const* lane_p = &lanes_out[c];
+			for (int x = 0; x < width; ++x) {
+				float_writer(output_line[x], *lane_p);
+				lane_p += LANES;
+			}
+		}
 	}
 }
 
@@ -20,6 +20,7 @@
 #include "GrayImage.h"
 #include "BinaryImage.h"
 #include "BitOps.h"
+#include "Sse2.h"
 #include <QImage>
 #include <QColor>
 #include <QtGlobal>
@@ -118,6 +119,143 @@ static QImage monoLsbToGrayscale(QImage const& src)
 	return dst;
 }
 
+/**
+ * Converts an indexed image with any palette into a grayscale image
+ * with the standard palette.  If the palette is already the standard
+ * one, the pixels are shared rather than copied.
+ */
+static QImage indexed8ToGrayscale(QImage const& src)
+{
+	QVector<QRgb> const palette(src.colorTable());
+	int const num_colors = palette.size();
+	
+	uint8_t lut[256];
+	bool standard_palette = (num_colors == 256);
+	for (int i = 0; i < 256; ++i) {
+		if (i < num_colors) {
+			lut[i] = static_cast<uint8_t>(qGray(palette[i]));
+			if (palette[i] != qRgb(i, i, i)) {
+				standard_palette = false;
+			}
+		} else {
+			lut[i] = 0;
+		}
+	}
+	
+	if (standard_palette) {
+		return src;
+	}
+	
+	int const width = src.width();
+	int const height = src.height();
+	
+	QImage dst(width, height, QImage::Format_Indexed8);
+	dst.setColorTable(createGrayscalePalette());
+	if (width > 0 && height > 0 && dst.isNull()) {
+		throw std::bad_alloc();
+	}
+	
+	uint8_t const* src_line = src.bits();
+	uint8_t* dst_line = dst.bits();
+	int const src_bpl = src.bytesPerLine();
+	int const dst_bpl = dst.bytesPerLine();
+	
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			dst_line[x] = lut[src_line[x]];
+		}
+		src_line += src_bpl;
+		dst_line += dst_bpl;
+	}
+	
+	dst.setDotsPerMeterX(src.dotsPerMeterX());
+	dst.setDotsPerMeterY(src.dotsPerMeterY());
+	
+	return dst;
+}
+
+#ifdef IMAGEPROC_HAVE_SSE2
+
+/**
+ * Computes qGray() for 4 RGB32 pixels, producing a 32-bit result per pixel.
+ */
+static inline __m128i rgb32ToGraySse2(__m128i const pixels)
+{
+	__m128i const byte_mask = _mm_set1_epi32(0xff);
+	__m128i const r = _mm_and_si128(_mm_srli_epi32(pixels, 16), byte_mask);
+	__m128i const g = _mm_and_si128(_mm_srli_epi32(pixels, 8), byte_mask);
+	__m128i const b = _mm_and_si128(pixels, byte_mask);
+	
+	// The upper halves of 32-bit lanes are zero and products fit
+	// 16 bits, so 16-bit multiplication is enough.
+	__m128i sum = _mm_mullo_epi16(r, _mm_set1_epi32(11));
+	sum = _mm_add_epi32(sum, _mm_slli_epi32(g, 4));
+	sum = _mm_add_epi32(sum, _mm_mullo_epi16(b, _mm_set1_epi32(5)));
+	
+	return _mm_srli_epi32(sum, 5);
+}
+
+/**
+ * Converts as many pixels of a line as possible, 8 at a time.
+ * \return The number of pixels converted.
+ */
+static int rgb32LineToGraySse2(
+	uint32_t const* src_line, uint8_t* dst_line, int const width)
+{
+	int x = 0;
+	for (; x + 8 <= width; x += 8) {
+		__m128i const gray1 = rgb32ToGraySse2(
+			_mm_loadu_si128((__m128i const*)(src_line + x))
+		);
+		__m128i const gray2 = rgb32ToGraySse2(
+			_mm_loadu_si128((__m128i const*)(src_line + x + 4))
+		);
+		__m128i const gray16 = _mm_packs_epi32(gray1, gray2);
+		_mm_storel_epi64((__m128i*)(dst_line + x), _mm_packus_epi16(gray16, gray16));
+	}
+	return x;
+}
+
+#endif // IMAGEPROC_HAVE_SSE2
+
+/**
+ * Handles Format_RGB32 and Format_ARGB32.  For those, QImage::pixel()
+ * returns the stored value as is, so we can skip it.
+ */
+static QImage rgb32ToGrayscale(QImage const& src)
+{
+	int const width = src.width();
+	int const height = src.height();
+	
+	QImage dst(width, height, QImage::Format_Indexed8);
+	dst.setColorTable(createGrayscalePalette());
+	if (width > 0 && height > 0 && dst.isNull()) {
+		throw std::bad_alloc();
+	}
+	
+	uint32_t const* src_line = (uint32_t const*)src.bits();
+	uint8_t* dst_line = dst.bits();
+	int const src_stride = src.bytesPerLine() / 4;
+	int const dst_bpl = dst.bytesPerLine();
+	
+	for (int y = 0; y < height; ++y) {
+		int x = 0;
+#ifdef IMAGEPROC_HAVE_SSE2
+		x = rgb32LineToGraySse2(src_line, dst_line, width);
+#endif
+		for (; x < width; ++x) {
+			dst_line[x] = static_cast<uint8_t>(qGray(src_line[x]));
+		}
+		src_line += src_stride;
+		dst_line += dst_bpl;
+	}
+	
+	dst.setDotsPerMeterX(src.dotsPerMeterX());
+	dst.setDotsPerMeterY(src.dotsPerMeterY());
+	
+	return dst;
+}
+
 static QImage anyToGrayscale(QImage const& src)
 {
 	int const width = src.width();
@@ -166,19 +304,10 @@ QImage toGrayscale(QImage const& src)
 	case QImage::Format_MonoLSB:
 		return monoLsbToGrayscale(src);
 	case QImage::Format_Indexed8:
-		if (src.isGrayscale()) {
-			if (src.numColors() == 256) {
-				return src;
-			} else {
-				QImage dst(src);
-				dst.setColorTable(createGrayscalePalette());
-				if (!src.isNull() && dst.isNull()) {
-					throw std::bad_alloc();
-				}
-				return dst;
-			}
-		}
-		// fall though
+		return indexed8ToGrayscale(src);
+	case QImage::Format_RGB32:
+	case QImage::Format_ARGB32:
+		return rgb32ToGrayscale(src);
 	default:
 		return anyToGrayscale(src);
 	}
@@ -192,16 +321,14 @@ GrayImage stretchGrayRange(
 		return src;
 	}
 	
-	GrayImage dst(src);
-	
-	int const width = dst.width();
-	int const height = dst.height();
+	int const width = src.width();
+	int const height = src.height();
 	
 	int const num_pixels = width * height;
 	int black_clip_pixels = qRound(black_clip_fraction * num_pixels);
 	int white_clip_pixels = qRound(white_clip_fraction * num_pixels);
 	
-	GrayscaleHistogram const hist(dst);
+	GrayscaleHistogram const hist(src);
 	
 	int min = 0;
 	for (; min <= 255; ++min) {
@@ -239,13 +366,31 @@ GrayImage stretchGrayRange(
 		}
 	}
 	
-	uint8_t* line = dst.data();
-	int const stride = dst.stride();
+	// Mapping into a new image rather than into a copy of src
+	// saves a pass over the whole image.
+	GrayImage dst(src.size());
+	uint8_t const* src_line = src.data();
+	uint8_t* dst_line = dst.data();
+	int const src_stride = src.stride();
+	int const dst_stride = dst.stride();
 	
-	for (int y = 0; y < height; ++y, line += stride) {
-		for (int x = 0; x < width; ++x) {
-			line[x] = gray_mapping[line[x]];
+	for (int y = 0; y < height; ++y) {
+		int x = 0;
+		for (; x + 4 <= width; x += 4) {
+			uint8_t const p0 = gray_mapping[src_line[x]];
+			uint8_t const p1 = gray_mapping[src_line[x + 1]];
+			uint8_t const p2 = gray_mapping[src_line[x + 2]];
+			uint8_t const p3 = gray_mapping[src_line[x + 3]];
+			dst_line[x] = p0;
+			dst_line[x + 1] = p1;
+			dst_line[x + 2] = p2;
+			dst_line[x + 3] = p3;
+		}
+		for (; x < width; ++x) {
+			dst_line[x] = gray_mapping[src_line[x]];
 		}
+		src_line += src_stride;
+		dst_line += dst_stride;
 	}
 	
 	return dst;
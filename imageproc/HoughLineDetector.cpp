@@ -27,6 +27,8 @@
 #include "RasterOp.h"
 #include "SeedFill.h"
 #include "Grayscale.h"
+#include "GrayImage.h"
+#include "ParallelRows.h"
 #include <QSize>
 #include <QRect>
 #include <QPoint>
@@ -35,11 +37,14 @@
 #include <QImage>
 #include <QColor>
 #include <QPainter>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QDebug>
 #ifndef Q_MOC_RUN
 #include <boost/foreach.hpp>
 #endif
 #include <algorithm>
+#include <vector>
 #include <new>
 #include <math.h>
 #include <stdint.h>
@@ -57,6 +62,105 @@ public:
 };
 
 
+/**
+ * \brief Accumulates bands of an image into private histograms,
+ *        which are then added to the detector's one.
+ */
+class HoughLineDetector::BandAccumulator : public RowRangeProcessor
+{
+public:
+	BandAccumulator(HoughLineDetector& owner, GrayImage const& image,
+		QRect const& rect, unsigned const* weights);
+	
+	virtual void processRows(int begin, int end) const;
+private:
+	HoughLineDetector& m_rOwner;
+	GrayImage const& m_rImage;
+	QRect m_rect;
+	unsigned const* m_pWeights;
+	int m_numAngles;
+	
+	/**
+	 * uv.x() * x for each x in m_rect (outer index)
+	 * and each angle unit vector (inner index).
+	 */
+	std::vector<double> m_xTerms;
+	
+	mutable QMutex m_mutex;
+};
+
+HoughLineDetector::BandAccumulator::BandAccumulator(
+	HoughLineDetector& owner, GrayImage const& image,
+	QRect const& rect, unsigned const* weights)
+:	m_rOwner(owner),
+	m_rImage(image),
+	m_rect(rect),
+	m_pWeights(weights),
+	m_numAngles(owner.m_angleUnitVectors.size()),
+	m_xTerms(rect.width() * m_numAngles)
+{
+	double* x_terms = m_xTerms.empty() ? 0 : &m_xTerms[0];
+	for (int x = rect.left(); x <= rect.right(); ++x) {
+		BOOST_FOREACH (QPointF const& uv, owner.m_angleUnitVectors) {
+			*x_terms = uv.x() * x;
+			++x_terms;
+		}
+	}
+}
+
+void
+HoughLineDetector::BandAccumulator::processRows(int const begin, int const end) const
+{
+	std::vector<QPointF> const& uvs = m_rOwner.m_angleUnitVectors;
+	int const hist_width = m_rOwner.m_histWidth;
+	double const distance_bias = m_rOwner.m_distanceBias;
+	double const recip_distance_resolution = m_rOwner.m_recipDistanceResolution;
+	
+	std::vector<unsigned> hist(m_rOwner.m_histogram.size(), 0);
+	std::vector<double> y_terms(m_numAngles);
+	
+	int const width = m_rect.width();
+	int const stride = m_rImage.stride();
+	uint8_t const* line = m_rImage.data() + (m_rect.top() + begin) * stride + m_rect.left();
+	
+	for (int i = begin; i < end; ++i, line += stride) {
+		int const y = m_rect.top() + i;
+		for (int a = 0; a < m_numAngles; ++a) {
+			y_terms[a] = uvs[a].y() * y;
+		}
+		
+		for (int x = 0; x < width; ++x) {
+			unsigned const weight = m_pWeights[line[x]];
+			if (weight == 0) {
+				continue;
+			}
+			
+			double const* x_terms = &m_xTerms[x * m_numAngles];
+			unsigned* hist_line = &hist[0];
+			for (int a = 0; a < m_numAngles; ++a) {
+				double const distance = x_terms[a] + y_terms[a];
+				double const biased_distance = distance + distance_bias;
+				
+				int const bin = (int)(biased_distance * recip_distance_resolution + 0.5);
+				assert(bin >= 0 && bin < hist_width);
+				hist_line[bin] += weight;
+				
+				hist_line += hist_width;
+			}
+		}
+	}
+	
+	QMutexLocker const locker(&m_mutex);
+	
+	std::vector<unsigned>& dst = m_rOwner.m_histogram;
+	size_t const size = dst.size();
+	for (size_t i = 0; i < size; ++i) {
+		dst[i] += hist[i];
+	}
+}
+
+
+
 HoughLineDetector::HoughLineDetector(
 	QSize const& input_dimensions, double const distance_resolution,
 	double const start_angle, double const angle_delta, int const num_angles)
@@ -119,6 +223,20 @@ HoughLineDetector::process(int x, int y, unsigned weight)
 	}
 }
 
+void
+HoughLineDetector::processImage(
+	GrayImage const& image, QRect const& rect, unsigned const* const weights)
+{
+	assert(image.rect().contains(rect) || rect.isEmpty());
+	
+	if (rect.isEmpty() || m_histogram.empty()) {
+		return;
+	}
+	
+	BandAccumulator const accumulator(*this, image, rect, weights);
+	processRowsInParallel(accumulator, rect.height(), 32);
+}
+
 QImage
 HoughLineDetector::visualizeHoughSpace(unsigned const lower_bound) const
 {
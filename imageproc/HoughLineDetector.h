@@ -23,6 +23,7 @@
 #include <vector>
 
 class QSize;
+class QRect;
 class QLineF;
 class QImage;
 
@@ -30,6 +31,7 @@ namespace imageproc
 {
 
 class BinaryImage;
+class GrayImage;
 
 /**
  * \brief A line detected by HoughLineDetector.
@@ -102,6 +104,21 @@ public:
 	 */
 	void process(int x, int y, unsigned weight = 1);
 	
+	/**
+	 * \brief Processes all pixels in an area of an image.
+	 *
+	 * A pixel at (x, y) with value v is processed with weight
+	 * weights[v], unless that weight is zero.  The result is the same
+	 * as if process() was called for each such pixel, but bands of
+	 * rows are accumulated in parallel.
+	 *
+	 * \param image The image, whose coordinates are the input coordinates.
+	 * \param rect The area of \p image to process.
+	 * \param weights An array of 256 weights, indexed by pixel values.
+	 */
+	void processImage(GrayImage const& image, QRect const& rect,
+		unsigned const* weights);
+	
 	QImage visualizeHoughSpace(unsigned lower_bound) const;
 	
 	/**
@@ -115,6 +132,7 @@ public:
 	std::vector<HoughLine> findLines(unsigned quality_lower_bound) const;
 private:
 	class GreaterQualityFirst;
+	class BandAccumulator;
 	
 	static BinaryImage findHistogramPeaks(
 		std::vector<unsigned> const& hist, int width, int height,
@@ -21,6 +21,7 @@
 #include "GrayImage.h"
 #include "RasterOp.h"
 #include "Grayscale.h"
+#include "Sse2.h"
 #include <QPoint>
 #include <QSize>
 #include <QRect>
@@ -31,7 +32,6 @@
 #include <vector>
 #include <stdexcept>
 #include <algorithm>
-#include <math.h>
 #include <assert.h>
 #include <string.h>
 
@@ -231,6 +231,22 @@ void spreadInto(
 	}
 }
 
+/**
+ * \brief Combines an image with a shifted version of itself.
+ */
+void spreadWithinImage(
+	BinaryImage& img, QRect const& relevant_rect,
+	int const dx, int const dy, AbstractRasterOp const& rop)
+{
+	QRect dst_rect(img.rect());
+	QRect src_rect(dst_rect);
+	dst_rect.translate(dx, dy);
+	
+	adjustToFit(relevant_rect, dst_rect, src_rect);
+	
+	rop(img, dst_rect, img, src_rect.topLeft());
+}
+
 void spreadInDirectionLow(
 	BinaryImage& dst, CoordinateSystem const& dst_cs,
 	QRect const& dst_relevant_rect,
@@ -256,34 +272,31 @@ void spreadInDirectionLow(
 		return;
 	}
 	
-	int remaining_dx_min = dx_min + dx_step;
-	int remaining_dy_min = dy_min + dy_step;
-	int remaining_steps = num_steps - 1;
-	
 	if (dst_composition_allowed) {
-		int dx = dx_step;
-		int dy = dy_step;
-		int i = 1;
-		for (; (i << 1) <= num_steps; i <<= 1, dx <<= 1, dy <<= 1) {
-			QRect dst_rect(dst.rect());
-			QRect src_rect(dst_rect);
-			dst_rect.translate(dx, dy);
-			
-			adjustToFit(dst_relevant_rect, dst_rect, src_rect);
-			
-			rop(dst, dst_rect, dst, src_rect.topLeft());
+		// Each pass doubles the length of spread runs, for as long
+		// as that doesn't overshoot.  The final pass spreads by the
+		// remaining distance, with the runs being allowed to overlap,
+		// as OR and AND don't mind that.  That's a logarithmic number
+		// of passes in total.
+		int span = 1;
+		for (; (span << 1) <= num_steps; span <<= 1) {
+			spreadWithinImage(
+				dst, dst_relevant_rect,
+				dx_step * span, dy_step * span, rop
+			);
 		}
-		
-		remaining_dx_min = dx_min + dx;
-		remaining_dy_min = dy_min + dy;
-		remaining_steps = num_steps - i;
-	}
-	
-	if (remaining_steps > 0) {
+		if (span < num_steps) {
+			spreadWithinImage(
+				dst, dst_relevant_rect,
+				dx_step * (num_steps - span),
+				dy_step * (num_steps - span), rop
+			);
+		}
+	} else {
 		spreadInto(
 			dst, dst_cs, dst_relevant_rect, src, src_cs,
-			remaining_dx_min, dx_step, remaining_dy_min, dy_step,
-			remaining_steps, rop
+			dx_min + dx_step, dx_step, dy_min + dy_step, dy_step,
+			num_steps - 1, rop
 		);
 	}
 }
@@ -302,7 +315,7 @@ void spreadInDirection(
 {
 	assert(dx_step == 0 || dy_step == 0);
 	
-	if (num_steps < COMPOSITE_THRESHOLD) {
+	if (dst_composition_allowed || num_steps < COMPOSITE_THRESHOLD) {
 		spreadInDirectionLow(
 			dst, dst_cs, dst_relevant_rect, src, src_cs,
 			dx_min, dx_step, dy_min, dy_step, num_steps,
@@ -311,57 +324,21 @@ void spreadInDirection(
 		return;
 	}
 	
-	int const first_phase_steps = (int)sqrt((double)num_steps);
-	
+	// dst doesn't cover enough of the area around dst_relevant_rect
+	// to spread within itself, so we spread within tmp instead.
 	BinaryImage tmp(tmp_images.retrieveOrCreate(tmp_image_size));
 	
-	spreadInDirection(
+	spreadInDirectionLow(
 		tmp, tmp_cs, tmp.rect(), src, src_cs,
-		tmp_images, tmp_cs, tmp_image_size,
-		dx_min, dx_step, dy_min, dy_step,
-		first_phase_steps,
+		dx_min, dx_step, dy_min, dy_step, num_steps,
 		rop, initial_color, true
 	);
 	
-	int const second_phase_steps = num_steps / first_phase_steps;
-	
-	spreadInDirection(
-		dst, dst_cs, dst_relevant_rect, tmp, tmp_cs,
-		tmp_images, tmp_cs, tmp_image_size,
-		0, dx_step * first_phase_steps,
-		0, dy_step * first_phase_steps,
-		second_phase_steps,
-		rop, initial_color, dst_composition_allowed
+	doInitialCopy(
+		dst, dst_cs, dst_relevant_rect,
+		tmp, tmp_cs, initial_color, 0, 0
 	);
 	
-	int const steps_done = first_phase_steps * second_phase_steps;
-	int const steps_remaining = num_steps - steps_done;
-	
-	if (steps_remaining <= 0) {
-		assert(steps_remaining == 0);
-	} else if (steps_remaining < COMPOSITE_THRESHOLD) {
-		spreadInto(
-			dst, dst_cs, dst_relevant_rect, src, src_cs,
-			dx_min + dx_step * steps_done, dx_step,
-			dy_min + dy_step * steps_done, dy_step,
-			steps_remaining, rop
-		);
-	} else {
-		spreadInDirection(
-			tmp, tmp_cs, tmp.rect(), src, src_cs,
-			tmp_images, tmp_cs, tmp_image_size,
-			dx_min + dx_step * steps_done, dx_step,
-			dy_min + dy_step * steps_done, dy_step,
-			steps_remaining,
-			rop, initial_color, true
-		);
-		
-		spreadInto(
-			dst, dst_cs, dst_relevant_rect, tmp, tmp_cs,
-			0, 0, 0, 0, 1, rop
-		);
-	}
-	
 	tmp_images.store(tmp);
 }
 
@@ -456,6 +433,11 @@ public:
 	static uint8_t select(uint8_t v1, uint8_t v2) {
 		return std::min(v1, v2);
 	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i select(__m128i v1, __m128i v2) {
+		return _mm_min_epu8(v1, v2);
+	}
+#endif
 };
 
 class Lighter
@@ -464,42 +446,44 @@ public:
 	static uint8_t select(uint8_t v1, uint8_t v2) {
 		return std::max(v1, v2);
 	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i select(__m128i v1, __m128i v2) {
+		return _mm_max_epu8(v1, v2);
+	}
+#endif
 };
 
+/**
+ * dst[i] = MinOrMax::select(src1[i], src2[i]) for i in [0, len)
+ */
 template<typename MinOrMax>
-void fillExtremumArrayLeftHalf(
-	uint8_t* dst, uint8_t const* const src_center, int const src_delta,
-	int const src_first_offset, int const src_center_offset)
+void selectLine(
+	uint8_t* const dst, uint8_t const* const src1,
+	uint8_t const* const src2, int const len)
 {
-	uint8_t const* src = src_center;
-	uint8_t extremum = *src;
-	*dst = extremum;
-	
-	for (int i = src_center_offset - 1; i >= src_first_offset; --i) {
-		src -= src_delta;
-		--dst;
-		extremum = MinOrMax::select(extremum, *src);
-		*dst = extremum;
+	int i = 0;
+#ifdef IMAGEPROC_HAVE_SSE2
+	for (; i + 16 <= len; i += 16) {
+		__m128i const v1 = _mm_loadu_si128((__m128i const*)(src1 + i));
+		__m128i const v2 = _mm_loadu_si128((__m128i const*)(src2 + i));
+		_mm_storeu_si128((__m128i*)(dst + i), MinOrMax::select(v1, v2));
 	}
-}
-
-template<typename MinOrMax>
-void fillExtremumArrayRightHalf(
-	uint8_t* dst, uint8_t const* const src_center, int const src_delta,
-	int const src_center_offset, int const src_last_offset)
-{
-	uint8_t const* src = src_center;
-	uint8_t extremum = *src;
-	*dst = extremum;
-	
-	for (int i = src_center_offset + 1; i <= src_last_offset; ++i) {
-		src += src_delta;
-		++dst;
-		extremum = MinOrMax::select(extremum, *src);
-		*dst = extremum;
+#endif
+	for (; i < len; ++i) {
+		dst[i] = MinOrMax::select(src1[i], src2[i]);
 	}
 }
 
+/*
+ * Gray dilation and erosion by a line segment follow the van Herk /
+ * Gil-Werman algorithm.  The source span is split into blocks as long
+ * as the segment.  Within each block, we build running extrema from
+ * the block's start (prefix) and from its end (suffix).  A segment
+ * starting at i then covers the tail of one block and the head of the
+ * next one, so its extremum is select(suffix[i], prefix[i + len - 1]).
+ * That's 3 comparisons per pixel, regardless of the segment length.
+ */
+
 template<typename MinOrMax>
 void spreadGrayHorizontal(
 	GrayImage& dst, GrayImage const& src,
@@ -507,50 +491,42 @@ void spreadGrayHorizontal(
 {
 	int const src_stride = src.stride();
 	int const dst_stride = dst.stride();
-	uint8_t const* src_line = src.data() + dy * src_stride;
+	uint8_t const* src_span = src.data() + dy * src_stride + dx1;
 	uint8_t* dst_line = dst.data();
 	
 	int const dst_width = dst.width();
 	int const dst_height = dst.height();
 	
 	int const se_len = dx2 - dx1 + 1;
+	int const span_len = dst_width + se_len - 1;
 	
-	std::vector<uint8_t> min_max_array(se_len * 2 - 1, 0);
-	uint8_t* const array_center = &min_max_array[se_len - 1];
+	std::vector<uint8_t> prefix(span_len);
+	std::vector<uint8_t> suffix(span_len);
 	
 	for (int y = 0; y < dst_height; ++y) {
-		for (int dst_segment_first = 0; dst_segment_first < dst_width;
-				dst_segment_first += se_len) {
-			int const dst_segment_last = std::min(
-				dst_segment_first + se_len, dst_width
-			) - 1; // inclusive
-			int const src_segment_first = dst_segment_first + dx1;
-			int const src_segment_last = dst_segment_last + dx2;
-			int const src_segment_center =
-				(src_segment_first + src_segment_last) >> 1;
-			
-			fillExtremumArrayLeftHalf<MinOrMax>(
-				array_center, src_line + src_segment_center, 1,
-				src_segment_first, src_segment_center
-			);
+		for (int block = 0; block < span_len; block += se_len) {
+			int const block_end = std::min(block + se_len, span_len);
 			
-			fillExtremumArrayRightHalf<MinOrMax>(
-				array_center, src_line + src_segment_center, 1,
-				src_segment_center, src_segment_last
-			);
+			uint8_t extremum = src_span[block];
+			prefix[block] = extremum;
+			for (int i = block + 1; i < block_end; ++i) {
+				extremum = MinOrMax::select(extremum, src_span[i]);
+				prefix[i] = extremum;
+			}
 			
-			for (int x = dst_segment_first; x <= dst_segment_last; ++x) {
-				int const src_first = x + dx1;
-				int const src_last = x + dx2; // inclusive
-				assert(src_segment_center >= src_first);
-				assert(src_segment_center <= src_last);
-				uint8_t v1 = array_center[src_first - src_segment_center];
-				uint8_t v2 = array_center[src_last - src_segment_center];
-				dst_line[x] = MinOrMax::select(v1, v2);
+			extremum = src_span[block_end - 1];
+			suffix[block_end - 1] = extremum;
+			for (int i = block_end - 2; i >= block; --i) {
+				extremum = MinOrMax::select(extremum, src_span[i]);
+				suffix[i] = extremum;
 			}
 		}
 		
-		src_line += src_stride;
+		for (int x = 0; x < dst_width; ++x) {
+			dst_line[x] = MinOrMax::select(suffix[x], prefix[x + se_len - 1]);
+		}
+		
+		src_span += src_stride;
 		dst_line += dst_stride;
 	}
 }
@@ -570,6 +546,12 @@ void spreadGrayHorizontal(
 	);
 }
 
+/**
+ * The vertical pass works on whole rows of vertical strips of that width,
+ * rather than on individual columns, which is both cache and SIMD friendly.
+ */
+int const MAX_VERTICAL_STRIP_WIDTH = 256;
+
 template<typename MinOrMax>
 void spreadGrayVertical(
 	GrayImage& dst, GrayImage const& src,
@@ -577,50 +559,59 @@ void spreadGrayVertical(
 {
 	int const src_stride = src.stride();
 	int const dst_stride = dst.stride();
-	uint8_t const* const src_data = src.data() + dx;
-	uint8_t* const dst_data = dst.data();
 	
 	int const dst_width = dst.width();
 	int const dst_height = dst.height();
 	
 	int const se_len = dy2 - dy1 + 1;
-	
-	std::vector<uint8_t> min_max_array(se_len * 2 - 1, 0);
-	uint8_t* const array_center = &min_max_array[se_len - 1];
-	
-	for (int x = 0; x < dst_width; ++x) {
-		for (int dst_segment_first = 0; dst_segment_first < dst_height;
-				dst_segment_first += se_len) {
-			int const dst_segment_last = std::min(
-				dst_segment_first + se_len, dst_height
-			) - 1; // inclusive
-			int const src_segment_first = dst_segment_first + dy1;
-			int const src_segment_last = dst_segment_last + dy2;
-			int const src_segment_center =
-				(src_segment_first + src_segment_last) >> 1;
+	int const span_len = dst_height + se_len - 1;
+	int const strip_stride = std::min(dst_width, MAX_VERTICAL_STRIP_WIDTH);
+	
+	std::vector<uint8_t> prefix_buf(span_len * strip_stride);
+	std::vector<uint8_t> suffix_buf(span_len * strip_stride);
+	uint8_t* const prefix = &prefix_buf[0];
+	uint8_t* const suffix = &suffix_buf[0];
+	
+	for (int strip_x = 0; strip_x < dst_width; strip_x += strip_stride) {
+		int const strip_width = std::min(strip_stride, dst_width - strip_x);
+		uint8_t const* const src_span =
+			src.data() + dy1 * src_stride + dx + strip_x;
+		
+		for (int block = 0; block < span_len; block += se_len) {
+			int const block_end = std::min(block + se_len, span_len);
 			
-			fillExtremumArrayLeftHalf<MinOrMax>(
-				array_center, src_data + x + src_segment_center * src_stride,
-				src_stride, src_segment_first, src_segment_center
+			memcpy(
+				prefix + block * strip_stride,
+				src_span + block * src_stride, strip_width
 			);
+			for (int i = block + 1; i < block_end; ++i) {
+				selectLine<MinOrMax>(
+					prefix + i * strip_stride,
+					prefix + (i - 1) * strip_stride,
+					src_span + i * src_stride, strip_width
+				);
+			}
 			
-			fillExtremumArrayRightHalf<MinOrMax>(
-				array_center, src_data + x + src_segment_center * src_stride,
-				src_stride, src_segment_center, src_segment_last
+			memcpy(
+				suffix + (block_end - 1) * strip_stride,
+				src_span + (block_end - 1) * src_stride, strip_width
 			);
-			
-			uint8_t* dst = dst_data + x + dst_segment_first * dst_stride;
-			for (int y = dst_segment_first; y <= dst_segment_last; ++y) {
-				int const src_first = y + dy1;
-				int const src_last = y + dy2; // inclusive
-				assert(src_segment_center >= src_first);
-				assert(src_segment_center <= src_last);
-				uint8_t v1 = array_center[src_first - src_segment_center];
-				uint8_t v2 = array_center[src_last - src_segment_center];
-				*dst = MinOrMax::select(v1, v2);
-				dst += dst_stride;
+			for (int i = block_end - 2; i >= block; --i) {
+				selectLine<MinOrMax>(
+					suffix + i * strip_stride,
+					suffix + (i + 1) * strip_stride,
+					src_span + i * src_stride, strip_width
+				);
 			}
 		}
+		
+		uint8_t* dst_line = dst.data() + strip_x;
+		for (int y = 0; y < dst_height; ++y, dst_line += dst_stride) {
+			selectLine<MinOrMax>(
+				dst_line, suffix + y * strip_stride,
+				prefix + (y + se_len - 1) * strip_stride, strip_width
+			);
+		}
 	}
 }
 
@@ -20,6 +20,7 @@
 #include "BinaryImage.h"
 #include "BWColor.h"
 #include "RasterOp.h"
+#include "BitOps.h"
 #include <QRect>
 #include <algorithm>
 #include <stdexcept>
@@ -28,9 +29,46 @@
 namespace imageproc
 {
 
-static inline uint32_t mask(int x)
+/**
+ * Rotations by 90 and 270 degrees process the image in 32x32 pixel blocks,
+ * and those in tiles of BLOCKS_PER_TILE x BLOCKS_PER_TILE blocks, so that
+ * both the source and the destination lines of a tile stay in cache.
+ */
+static int const BLOCKS_PER_TILE = 16;
+
+/**
+ * \brief Returns 32 pixels of a line, starting at \p x.
+ *
+ * \p x may be negative.  Pixels outside of [0, wpl * 32) are returned as 0.
+ */
+static inline uint32_t extractWord(uint32_t const* line, int const wpl, int const x)
+{
+	int const word = x >> 5;
+	int const shift = x & 31;
+	uint32_t const hi = (word >= 0 && word < wpl) ? line[word] : 0;
+	if (shift == 0) {
+		return hi;
+	}
+	uint32_t const lo = (word + 1 >= 0 && word + 1 < wpl) ? line[word + 1] : 0;
+	return (hi << shift) | (lo >> (32 - shift));
+}
+
+/**
+ * \brief Transposes a 32x32 bit matrix in place.
+ *
+ * Bit j of a[i], counting from the most significant one, ends up
+ * as bit i of a[j].  This is the algorithm from Hacker's Delight.
+ */
+static void transpose32(uint32_t* a)
 {
-	return (uint32_t(1) << 31) >> (x % 32);
+	uint32_t m = 0x0000ffff;
+	for (int j = 16; j != 0; j >>= 1, m ^= m << j) {
+		for (int k = 0; k < 32; k = ((k | j) + 1) & ~j) {
+			uint32_t const t = (a[k] ^ (a[k | j] >> j)) & m;
+			a[k] ^= t;
+			a[k | j] ^= t << j;
+		}
+	}
 }
 
 static BinaryImage rotate0(BinaryImage const& src, QRect const& src_rect)
@@ -45,38 +83,81 @@ static BinaryImage rotate0(BinaryImage const& src, QRect const& src_rect)
 	return dst;
 }
 
-static BinaryImage rotate90(BinaryImage const& src, QRect const& src_rect)
+/**
+ * \brief Rotates by 90 (clockwise == true) or 270 degrees.
+ */
+static BinaryImage rotate90or270(
+	BinaryImage const& src, QRect const& src_rect, bool const clockwise)
 {
 	int const dst_w = src_rect.height();
 	int const dst_h = src_rect.width();
 	BinaryImage dst(dst_w, dst_h);
-	dst.fill(WHITE);
 	int const src_wpl = src.wordsPerLine();
 	int const dst_wpl = dst.wordsPerLine();
-	uint32_t const* const src_data = src.data() + src_rect.bottom() * src_wpl;
-	uint32_t* dst_line = dst.data();
+	uint32_t const* const src_data = src.data();
+	uint32_t* const dst_data = dst.data();
 	
 	/*
-	 *   dst
-	 *  ----->
-	 * ^
-	 * | src
-	 * |
+	 * Clockwise:           Counter-clockwise:
+	 *   dst                  dst
+	 *  ----->               ----->
+	 * ^                           |
+	 * | src                   src |
+	 * |                           v
+	 *
+	 * A block of the destination image, 32 lines starting at dst_y0
+	 * by one word at dst_x0, is built from 32 source lines.  The source
+	 * pixels form a matrix, where a source line is a row, and which,
+	 * transposed, gives us the destination lines.  For clockwise rotation,
+	 * row i is src_rect.bottom() - dst_x0 - i, and its pixels start at
+	 * src_rect.left() + dst_y0.  For counter-clockwise rotation, row i is
+	 * src_rect.top() + dst_x0 + i, and its pixels end at
+	 * src_rect.right() - dst_y0, so destination lines come out in
+	 * reverse order.  Pixels outside of src_rect end up in
+	 * destination lines past dst_h, which we don't store.
 	 */
 	
-	for (int dst_y = 0; dst_y < dst_h; ++dst_y) {
-		int const src_x = src_rect.left() + dst_y;
-		uint32_t const* src_pword = src_data + src_x / 32;
-		uint32_t const src_mask = mask(src_x);
-		
-		for (int dst_x = 0; dst_x < dst_w; ++dst_x) {
-			if (*src_pword & src_mask) {
-				dst_line[dst_x / 32] |= mask(dst_x);
+	int const tile_size = 32 * BLOCKS_PER_TILE;
+	uint32_t block[32];
+	
+	for (int tile_y0 = 0; tile_y0 < dst_h; tile_y0 += tile_size) {
+		int const tile_y1 = std::min(dst_h, tile_y0 + tile_size);
+		for (int tile_x0 = 0; tile_x0 < dst_w; tile_x0 += tile_size) {
+			int const tile_x1 = std::min(dst_w, tile_x0 + tile_size);
+			for (int dst_y0 = tile_y0; dst_y0 < tile_y1; dst_y0 += 32) {
+				int const src_x = clockwise
+					? src_rect.left() + dst_y0 : src_rect.right() - dst_y0 - 31;
+				int const num_dst_lines = std::min(32, dst_h - dst_y0);
+				
+				for (int dst_x0 = tile_x0; dst_x0 < tile_x1; dst_x0 += 32) {
+					int const num_src_lines = std::min(32, dst_w - dst_x0);
+					int i = 0;
+					if (clockwise) {
+						uint32_t const* src_line = src_data
+							+ (src_rect.bottom() - dst_x0) * src_wpl;
+						for (; i < num_src_lines; ++i, src_line -= src_wpl) {
+							block[i] = extractWord(src_line, src_wpl, src_x);
+						}
+					} else {
+						uint32_t const* src_line = src_data
+							+ (src_rect.top() + dst_x0) * src_wpl;
+						for (; i < num_src_lines; ++i, src_line += src_wpl) {
+							block[i] = extractWord(src_line, src_wpl, src_x);
+						}
+					}
+					for (; i < 32; ++i) {
+						block[i] = 0;
+					}
+					
+					transpose32(block);
+					
+					uint32_t* dst_word = dst_data + dst_y0 * dst_wpl + (dst_x0 >> 5);
+					for (int j = 0; j < num_dst_lines; ++j, dst_word += dst_wpl) {
+						*dst_word = block[clockwise ? j : 31 - j];
+					}
+				}
 			}
-			src_pword -= src_wpl;
 		}
-		
-		dst_line += dst_wpl;
 	}
 	
 	return dst;
@@ -87,7 +168,6 @@ static BinaryImage rotate180(BinaryImage const& src, QRect const& src_rect)
 	int const dst_w = src_rect.width();
 	int const dst_h = src_rect.height();
 	BinaryImage dst(dst_w, dst_h);
-	dst.fill(WHITE);
 	int const src_wpl = src.wordsPerLine();
 	int const dst_wpl = dst.wordsPerLine();
 	uint32_t const* src_line = src.data() + src_rect.bottom() * src_wpl;
@@ -98,54 +178,22 @@ static BinaryImage rotate180(BinaryImage const& src, QRect const& src_rect)
 	 * ----->
 	 * <-----
 	 *  src
+	 *
+	 * A destination word is a source word ending at the mirrored
+	 * position, with its bits reversed.
 	 */
 	
-	for (int dst_y = 0; dst_y < dst_h; ++dst_y) {
-		int src_x = src_rect.right();
-		for (int dst_x = 0; dst_x < dst_w; --src_x, ++dst_x) {
-			if (src_line[src_x / 32] & mask(src_x)) {
-				dst_line[dst_x / 32] |= mask(dst_x);
-			}
-		}
-		
-		src_line -= src_wpl;
-		dst_line += dst_wpl;
-	}
-	
-	return dst;
-}
-
-static BinaryImage rotate270(BinaryImage const& src, QRect const& src_rect)
-{
-	int const dst_w = src_rect.height();
-	int const dst_h = src_rect.width();
-	BinaryImage dst(dst_w, dst_h);
-	dst.fill(WHITE);
-	int const src_wpl = src.wordsPerLine();
-	int const dst_wpl = dst.wordsPerLine();
-	uint32_t const* const src_data = src.data() + src_rect.top() * src_wpl;
-	uint32_t* dst_line = dst.data();
-	
-	/*
-	 *  dst
-	 * ----->
-	 *       |
-	 *   src |
-	 *       v
-	 */
+	int const last_word_idx = (dst_w - 1) >> 5;
+	uint32_t const last_word_mask = ~uint32_t(0) << (31 - ((dst_w - 1) & 31));
 	
 	for (int dst_y = 0; dst_y < dst_h; ++dst_y) {
-		int const src_x = src_rect.right() - dst_y;
-		uint32_t const* src_pword = src_data + src_x / 32;
-		uint32_t const src_mask = mask(src_x);
-		
-		for (int dst_x = 0; dst_x < dst_w; ++dst_x) {
-			if (*src_pword & src_mask) {
-				dst_line[dst_x / 32] |= mask(dst_x);
-			}
-			src_pword += src_wpl;
+		int src_x = src_rect.right() - 31;
+		for (int i = 0; i <= last_word_idx; ++i, src_x -= 32) {
+			dst_line[i] = reverseBits(extractWord(src_line, src_wpl, src_x));
 		}
+		dst_line[last_word_idx] &= last_word_mask;
 		
+		src_line -= src_wpl;
 		dst_line += dst_wpl;
 	}
 	
@@ -168,13 +216,13 @@ BinaryImage orthogonalRotation(
 		return rotate0(src, src_rect);
 	case 90:
 	case -270:
-		return rotate90(src, src_rect);
+		return rotate90or270(src, src_rect, true);
 	case 180:
 	case -180:
 		return rotate180(src, src_rect);
 	case 270:
 	case -90:
-		return rotate270(src, src_rect);
+		return rotate90or270(src, src_rect, false);
 	default:
 		throw std::invalid_argument("orthogonalRotation: invalid angle");
 	}
@@ -0,0 +1,194 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ParallelRows.h"
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <QtGlobal>
+#ifndef Q_MOC_RUN
+#include <boost/exception_ptr.hpp>
+#endif
+#include <algorithm>
+
+namespace imageproc
+{
+
+namespace
+{
+
+/**
+ * More bands than threads, to balance the load.
+ */
+int const BANDS_PER_THREAD = 4;
+
+QAtomicInt g_maxThreads(0);
+
+Q_GLOBAL_STATIC(QThreadPool, intraPagePool)
+
+/**
+ * The state shared by all threads processing the same set of bands.
+ */
+class BandQueue
+{
+public:
+	BandQueue(RowRangeProcessor const& processor, int num_rows, int num_bands)
+	:	m_rProcessor(processor),
+		m_numRows(num_rows),
+		m_numBands(num_bands),
+		m_nextBand(0)
+	{
+	}
+	
+	/**
+	 * Processes bands until there are none left.  Doesn't throw.
+	 * If processing a band throws, the exception is stored to be
+	 * rethrown by rethrowIfFailed(), and no more bands are handed out.
+	 */
+	void processBands() {
+		try {
+			for (;;) {
+				int const band = m_nextBand.fetchAndAddOrdered(1);
+				if (band >= m_numBands) {
+					break;
+				}
+				
+				// Distribute the remainder evenly.
+				int const begin = int(qint64(m_numRows) * band / m_numBands);
+				int const end = int(qint64(m_numRows) * (band + 1) / m_numBands);
+				m_rProcessor.processRows(begin, end);
+			}
+		} catch (...) {
+			QMutexLocker const locker(&m_mutex);
+			if (!m_exception) {
+				m_exception = boost::current_exception();
+			}
+			cancel();
+		}
+	}
+	
+	/**
+	 * Makes processBands() return without taking any more bands.
+	 */
+	void cancel() {
+		m_nextBand.fetchAndStoreOrdered(m_numBands);
+	}
+	
+	/**
+	 * Rethrows the first exception caught by processBands(), if any.
+	 * Must only be called once all the threads are done with the queue.
+	 */
+	void rethrowIfFailed() const {
+		if (m_exception) {
+			boost::rethrow_exception(m_exception);
+		}
+	}
+private:
+	RowRangeProcessor const& m_rProcessor;
+	int const m_numRows;
+	int const m_numBands;
+	QAtomicInt m_nextBand;
+	QMutex m_mutex;
+	boost::exception_ptr m_exception;
+};
+
+
+class BandWorker : public QRunnable
+{
+public:
+	BandWorker(BandQueue& queue, QSemaphore& done)
+	: m_rQueue(queue), m_rDone(done) {}
+	
+	virtual void run() {
+		m_rQueue.processBands();
+		m_rDone.release();
+	}
+private:
+	BandQueue& m_rQueue;
+	QSemaphore& m_rDone;
+};
+
+} // anonymous namespace
+
+void processRowsInParallel(
+	RowRangeProcessor const& processor,
+	int const num_rows, int const min_rows_per_band)
+{
+	if (num_rows <= 0) {
+		return;
+	}
+	
+	int const max_threads = maxIntraPageThreads();
+	int const max_bands = num_rows / std::max(1, min_rows_per_band);
+	int const num_bands = std::min(max_threads * BANDS_PER_THREAD, max_bands);
+	if (max_threads <= 1 || num_bands <= 1) {
+		processor.processRows(0, num_rows);
+		return;
+	}
+	
+	QThreadPool* pool = intraPagePool();
+	
+	// The calling thread is one of the workers.
+	int const num_helpers = std::min(max_threads, num_bands) - 1;
+	if (pool->maxThreadCount() < num_helpers) {
+		pool->setMaxThreadCount(num_helpers);
+	}
+	
+	BandQueue queue(processor, num_rows, num_bands);
+	QSemaphore done;
+	int num_started = 0;
+	try {
+		for (; num_started < num_helpers; ++num_started) {
+			pool->start(new BandWorker(queue, done));
+		}
+	} catch (...) {
+		// The helpers we did start reference our local variables.
+		queue.cancel();
+		done.acquire(num_started);
+		throw;
+	}
+	
+	queue.processBands();
+	
+	// Helpers that were started after all bands were taken
+	// exit immediately, but we still have to wait for them,
+	// as they reference our local variables.
+	done.acquire(num_helpers);
+	
+	queue.rethrowIfFailed();
+}
+
+void setMaxIntraPageThreads(int const max_threads)
+{
+	g_maxThreads = max_threads;
+}
+
+int maxIntraPageThreads()
+{
+	int const max_threads = g_maxThreads;
+	if (max_threads > 0) {
+		return max_threads;
+	}
+	return std::max(1, QThread::idealThreadCount());
+}
+
+} // namespace imageproc
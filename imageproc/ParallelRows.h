@@ -0,0 +1,84 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGEPROC_PARALLELROWS_H_
+#define IMAGEPROC_PARALLELROWS_H_
+
+namespace imageproc
+{
+
+/**
+ * \brief Processes a range of rows of an image.
+ *
+ * \see processRowsInParallel()
+ */
+class RowRangeProcessor
+{
+public:
+	virtual ~RowRangeProcessor() {}
+	
+	/**
+	 * \brief Processes rows [begin, end).
+	 *
+	 * This method will be called concurrently from different threads
+	 * for non-overlapping ranges.  If it throws, no further bands are
+	 * started and the exception is rethrown from processRowsInParallel().
+	 */
+	virtual void processRows(int begin, int end) const = 0;
+};
+
+/**
+ * \brief Splits rows [0, num_rows) into bands and processes them
+ *        on a thread pool shared by all imageproc operations.
+ *
+ * The calling thread participates in processing and the function
+ * returns when all rows are processed.  Bands are handed out
+ * dynamically, so that rows that are cheaper to process don't leave
+ * threads idle.  Must not be called from within
+ * RowRangeProcessor::processRows().
+ *
+ * If processing a band throws, the bands being processed by other
+ * threads are allowed to finish, and then the first exception is
+ * rethrown on the calling thread.  Rows of bands that weren't
+ * processed are left untouched.
+ *
+ * \param processor The processor to call for each band.
+ * \param num_rows The total number of rows.
+ * \param min_rows_per_band Splitting won't produce bands shorter than this.
+ */
+void processRowsInParallel(
+	RowRangeProcessor const& processor, int num_rows, int min_rows_per_band);
+
+/**
+ * \brief Limits the number of threads (including the calling one)
+ *        processRowsInParallel() may use.
+ *
+ * Set from the --threads command line option.  A value of 1 makes
+ * everything run on the calling thread.  A value of 0 or less, which
+ * is the default, means QThread::idealThreadCount().
+ */
+void setMaxIntraPageThreads(int max_threads);
+
+/**
+ * \brief Returns the effective limit set by setMaxIntraPageThreads().
+ */
+int maxIntraPageThreads();
+
+} // namespace imageproc
+
+#endif
@@ -19,6 +19,7 @@
 #include "PolygonRasterizer.h"
 #include "PolygonUtils.h"
 #include "BinaryImage.h"
+#include "ParallelRows.h"
 #include <QRect>
 #include <QRectF>
 #include <QPolygonF>
@@ -30,7 +31,6 @@
 #include <boost/foreach.hpp>
 #endif
 #include <vector>
-#include <iterator>
 #include <algorithm>
 #include <stdexcept>
 #include <math.h>
@@ -72,17 +72,13 @@ private:
 
 
 /**
- * \brief A non-overlaping edge component.
+ * \brief An edge crossing the current line, along with the x coordinate
+ *        of the intersection point.
  */
-class PolygonRasterizer::EdgeComponent
+class PolygonRasterizer::ActiveEdge
 {
 public:
-	EdgeComponent(Edge const* edge, double top, double bottom)
-	: m_top(top), m_bottom(bottom), m_x(), m_pEdge(edge) {}
-	
-	double top() const { return m_top; }
-	
-	double bottom() const { return m_bottom; }
+	explicit ActiveEdge(Edge const* edge) : m_x(), m_pEdge(edge) {}
 	
 	Edge const& edge() const { return *m_pEdge; }
 	
@@ -90,8 +86,6 @@ public:
 	
 	void setX(double x) { m_x = x; }
 private:
-	double m_top;
-	double m_bottom;
 	double m_x;
 	Edge const* m_pEdge;
 };
@@ -100,16 +94,8 @@ private:
 class PolygonRasterizer::EdgeOrderY
 {
 public:
-	bool operator()(EdgeComponent const& lhs, EdgeComponent const& rhs) const {
-		return lhs.top() < rhs.top();
-	}
-	
-	bool operator()(EdgeComponent const& lhs, double rhs) const {
-		return lhs.bottom() <= rhs; // bottom is not a part of the interval.
-	}
-	
-	bool operator()(double lhs, EdgeComponent const& rhs) const {
-		return lhs < rhs.top();
+	bool operator()(Edge const& lhs, Edge const& rhs) const {
+		return lhs.topY() < rhs.topY();
 	}
 };
 
@@ -117,53 +103,136 @@ public:
 class PolygonRasterizer::EdgeOrderX
 {
 public:
-	bool operator()(EdgeComponent const& lhs, EdgeComponent const& rhs) const {
+	bool operator()(ActiveEdge const& lhs, ActiveEdge const& rhs) const {
 		return lhs.x() < rhs.x();
 	}
 };
 
 
+/**
+ * \brief Edges of a polygon crossing the current line, ordered by x.
+ *
+ * Lines have to be visited top to bottom, though not necessarily
+ * starting from the top one.  Edges enter the table in the order of
+ * their top y coordinate, so moving to the next line only involves
+ * the edges starting or ending there.
+ */
+class PolygonRasterizer::ActiveEdgeTable
+{
+public:
+	explicit ActiveEdgeTable(std::vector<Edge> const& edges);
+	
+	/**
+	 * \brief Makes the table contain the edges crossing the horizontal
+	 *        line at \p y, with intersection points calculated.
+	 *
+	 * \p y must not be less than the one passed on the previous call.
+	 */
+	void moveTo(double y);
+	
+	ActiveEdge const* edges() const { return m_active.empty() ? 0 : &m_active[0]; }
+	
+	int size() const { return m_active.size(); }
+private:
+	std::vector<Edge> const* m_pEdges; // Ordered by EdgeOrderY.
+	std::vector<ActiveEdge> m_active;
+	size_t m_nextEdge;
+};
+
+
 class PolygonRasterizer::Rasterizer
 {
 public:
 	Rasterizer(QRect const& image_rect, QPolygonF const& poly,
 		Qt::FillRule const fill_rule, bool invert);
 	
-	void fillBinary(BinaryImage& image, BWColor color) const;
+	/**
+	 * \brief The edges of the polygon, ordered by EdgeOrderY.
+	 */
+	std::vector<Edge> const& edges() const { return m_edges; }
+	
+	int firstLine() const { return m_firstLine; }
+	
+	int endLine() const { return m_endLine; }
 	
 	void fillGrayscale(QImage& image, uint8_t color) const;
+	
+	void fillBinaryLine(
+		ActiveEdgeTable const& aet, uint32_t* line, uint32_t pattern) const;
+	
+	void fillGrayscaleLine(
+		ActiveEdgeTable const& aet, uint8_t* line, uint8_t color) const;
 private:
 	void prepareEdges();
 	
 	static void oddEvenLineBinary(
-		EdgeComponent const* edges, int num_edges,
+		ActiveEdge const* edges, int num_edges,
 		uint32_t* line, uint32_t pattern);
 	
 	static void oddEvenLineGrayscale(
-		EdgeComponent const* edges, int num_edges,
+		ActiveEdge const* edges, int num_edges,
 		uint8_t* line, uint8_t color);
 	
 	static void windingLineBinary(
-		EdgeComponent const* edges, int num_edges,
+		ActiveEdge const* edges, int num_edges,
 		uint32_t* line, uint32_t pattern, bool invert);
 	
 	static void windingLineGrayscale(
-		EdgeComponent const* edges, int num_edges,
+		ActiveEdge const* edges, int num_edges,
 		uint8_t* line, uint8_t pattern, bool invert);
 	
 	static void fillBinarySegment(
 		int x_from, int x_to, uint32_t* line, uint32_t pattern);
 	
-	std::vector<Edge> m_edges; // m_edgeComponents references m_edges.
-	std::vector<EdgeComponent> m_edgeComponents;
+	std::vector<Edge> m_edges;
 	QRect m_imageRect;
 	QPolygonF m_fillPoly;
 	QRectF m_boundingBox;
+	int m_firstLine;
+	int m_endLine; // Exclusive.
 	Qt::FillRule m_fillRule;
 	bool m_invert;
 };
 
 
+/**
+ * \brief Fills a band of lines of a binary image with a number of polygons.
+ *
+ * Each line is filled by all of the polygons crossing it before
+ * moving on to the next one.
+ */
+class PolygonRasterizer::BinaryRows : public RowRangeProcessor
+{
+public:
+	BinaryRows(std::vector<Rasterizer> const& rasterizers,
+		std::vector<uint32_t> const& patterns, BinaryImage& image);
+	
+	virtual void processRows(int begin, int end) const;
+private:
+	std::vector<Rasterizer> const& m_rRasterizers;
+	std::vector<uint32_t> const& m_rPatterns;
+	uint32_t* m_pData;
+	int m_wpl;
+};
+
+
+class PolygonRasterizer::GrayscaleRows : public RowRangeProcessor
+{
+public:
+	GrayscaleRows(Rasterizer const& rasterizer, uint8_t color, QImage& image);
+	
+	virtual void processRows(int begin, int end) const;
+private:
+	Rasterizer const& m_rRasterizer;
+	uint8_t* m_pData;
+	int m_bpl;
+	uint8_t m_color;
+};
+
+
+static int const MIN_ROWS_PER_BAND = 32;
+
+
 /*============================= PolygonRasterizer ===========================*/
 
 void
@@ -171,12 +240,9 @@ PolygonRasterizer::fill(
 	BinaryImage& image, BWColor const color,
 	QPolygonF const& poly, Qt::FillRule const fill_rule)
 {
-	if (image.isNull()) {
-		throw std::invalid_argument("PolygonRasterizer: target image is null");
-	}
-	
-	Rasterizer rasterizer(image.rect(), poly, fill_rule, false);
-	rasterizer.fillBinary(image, color);
+	Batch batch;
+	batch.fill(color, poly, fill_rule);
+	batch.apply(image);
 }
 
 void
@@ -184,12 +250,9 @@ PolygonRasterizer::fillExcept(
 	BinaryImage& image, BWColor const color,
 	QPolygonF const& poly, Qt::FillRule const fill_rule)
 {
-	if (image.isNull()) {
-		throw std::invalid_argument("PolygonRasterizer: target image is null");
-	}
-	
-	Rasterizer rasterizer(image.rect(), poly, fill_rule, true);
-	rasterizer.fillBinary(image, color);
+	Batch batch;
+	batch.fillExcept(color, poly, fill_rule);
+	batch.apply(image);
 }
 
 void
@@ -225,6 +288,55 @@ PolygonRasterizer::grayFillExcept(
 }
 
 
+/*========================= PolygonRasterizer::Batch ========================*/
+
+void
+PolygonRasterizer::Batch::fill(
+	BWColor const color, QPolygonF const& poly, Qt::FillRule const fill_rule)
+{
+	m_items.push_back(Item(poly, color, fill_rule, false));
+}
+
+void
+PolygonRasterizer::Batch::fillExcept(
+	BWColor const color, QPolygonF const& poly, Qt::FillRule const fill_rule)
+{
+	m_items.push_back(Item(poly, color, fill_rule, true));
+}
+
+void
+PolygonRasterizer::Batch::apply(BinaryImage& image) const
+{
+	if (image.isNull()) {
+		throw std::invalid_argument("PolygonRasterizer: target image is null");
+	}
+	
+	std::vector<Rasterizer> rasterizers;
+	std::vector<uint32_t> patterns;
+	rasterizers.reserve(m_items.size());
+	patterns.reserve(m_items.size());
+	
+	BOOST_FOREACH(Item const& item, m_items) {
+		Rasterizer const rasterizer(
+			image.rect(), item.poly, item.fillRule, item.invert
+		);
+		if (rasterizer.edges().empty()) {
+			// Nothing to fill.
+			continue;
+		}
+		rasterizers.push_back(rasterizer);
+		patterns.push_back(item.color == WHITE ? 0 : ~uint32_t(0));
+	}
+	
+	if (rasterizers.empty()) {
+		return;
+	}
+	
+	BinaryRows const processor(rasterizers, patterns, image);
+	processRowsInParallel(processor, image.height(), MIN_ROWS_PER_BAND);
+}
+
+
 /*======================= PolygonRasterizer::Edge ==========================*/
 
 PolygonRasterizer::Edge::Edge(
@@ -286,6 +398,9 @@ PolygonRasterizer::Rasterizer::Rasterizer(
 		m_boundingBox = m_fillPoly.boundingRect();
 	}
 	
+	m_firstLine = qRound(m_boundingBox.top());
+	m_endLine = qRound(m_boundingBox.bottom());
+	
 	prepareEdges();
 }
 
@@ -317,167 +432,46 @@ PolygonRasterizer::Rasterizer::prepareEdges()
 		m_edges.push_back(Edge(rect.topRight(), rect.bottomRight(), 0));
 	}
 	
-	// Create an ordered list of y coordinates of polygon vertexes.
-	std::vector<double> y_values;
-	y_values.reserve(num_verts + 2);
-	BOOST_FOREACH(QPointF const& pt, m_fillPoly) {
-		y_values.push_back(pt.y());
-	}
-	
-	if (m_invert) {
-		y_values.push_back(0.0);
-		y_values.push_back(m_imageRect.height());
-	}
-	
-	// Sort and remove duplicates.
-	std::sort(y_values.begin(), y_values.end());
-	y_values.erase(std::unique(y_values.begin(), y_values.end()), y_values.end());
-	
-	// Break edges into non-overlaping components, then sort them.
-	m_edgeComponents.reserve(m_edges.size());
-	BOOST_FOREACH(Edge const& edge, m_edges) {
-		std::vector<double>::iterator it(
-			std::lower_bound(y_values.begin(), y_values.end(), edge.topY())
-		);
-		
-		assert(*it == edge.topY());
-		
-		do {
-			std::vector<double>::iterator next(it);
-			++next;
-			assert(next != y_values.end());
-			m_edgeComponents.push_back(
-				EdgeComponent(&edge, *it, *next)
-			);
-			it = next;
-		} while (*it != edge.bottomY());
+	std::sort(m_edges.begin(), m_edges.end(), EdgeOrderY());
+}
+
+void
+PolygonRasterizer::Rasterizer::fillGrayscale(
+	QImage& image, uint8_t const color) const
+{
+	if (m_edges.empty()) {
+		return;
 	}
 	
-	std::sort(m_edgeComponents.begin(), m_edgeComponents.end(), EdgeOrderY());
+	GrayscaleRows const processor(*this, color, image);
+	processRowsInParallel(processor, image.height(), MIN_ROWS_PER_BAND);
 }
 
 void
-PolygonRasterizer::Rasterizer::fillBinary(
-	BinaryImage& image, BWColor const color) const
+PolygonRasterizer::Rasterizer::fillBinaryLine(
+	ActiveEdgeTable const& aet, uint32_t* const line, uint32_t const pattern) const
 {
-	std::vector<EdgeComponent> edges_for_line;
-	typedef std::vector<EdgeComponent>::const_iterator EdgeIter;
-	
-	uint32_t* line = image.data();
-	int const wpl = image.wordsPerLine();
-	uint32_t const pattern = (color == WHITE) ? 0 : ~uint32_t(0);
-	
-	int i = qRound(m_boundingBox.top());
-	line += i * wpl;
-	int const limit = qRound(m_boundingBox.bottom());
-	for (; i < limit; ++i, line += wpl, edges_for_line.clear()) {
-		double const y = i + 0.5;
-		
-		// Get edges intersecting this horizontal line.
-		std::pair<EdgeIter, EdgeIter> const range(
-			std::equal_range(
-				m_edgeComponents.begin(), m_edgeComponents.end(),
-				y, EdgeOrderY()
-			)
-		);
-		
-		if (range.first == range.second) {
-			continue;
-		}
-		
-		std::copy(
-			range.first, range.second,
-			std::back_inserter(edges_for_line)
-		);
-		
-		// Calculate the intersection point of each edge with
-		// the current horizontal line.
-		BOOST_FOREACH(EdgeComponent& ecomp, edges_for_line) {
-			ecomp.setX(ecomp.edge().xForY(y));
-		}
-		
-		// Sort edge components by the x value of the intersection point.
-		std::sort(
-			edges_for_line.begin(), edges_for_line.end(),
-			EdgeOrderX()
-		);
-		
-		if (m_fillRule == Qt::OddEvenFill) {
-			oddEvenLineBinary(
-				&edges_for_line.front(), edges_for_line.size(),
-				line, pattern
-			);
-		} else {
-			windingLineBinary(
-				&edges_for_line.front(), edges_for_line.size(),
-				line, pattern, m_invert
-			);
-		}
+	if (m_fillRule == Qt::OddEvenFill) {
+		oddEvenLineBinary(aet.edges(), aet.size(), line, pattern);
+	} else {
+		windingLineBinary(aet.edges(), aet.size(), line, pattern, m_invert);
 	}
 }
 
 void
-PolygonRasterizer::Rasterizer::fillGrayscale(
-	QImage& image, uint8_t const color) const
+PolygonRasterizer::Rasterizer::fillGrayscaleLine(
+	ActiveEdgeTable const& aet, uint8_t* const line, uint8_t const color) const
 {
-	std::vector<EdgeComponent> edges_for_line;
-	typedef std::vector<EdgeComponent>::const_iterator EdgeIter;
-	
-	uint8_t* line = image.bits();
-	int const bpl = image.bytesPerLine();
-	
-	int i = qRound(m_boundingBox.top());
-	line += i * bpl;
-	int const limit = qRound(m_boundingBox.bottom());
-	for (; i < limit; ++i, line += bpl, edges_for_line.clear()) {
-		double const y = i + 0.5;
-		
-		// Get edges intersecting this horizontal line.
-		std::pair<EdgeIter, EdgeIter> const range(
-			std::equal_range(
-				m_edgeComponents.begin(), m_edgeComponents.end(),
-				y, EdgeOrderY()
-			)
-		);
-		
-		if (range.first == range.second) {
-			continue;
-		}
-		
-		std::copy(
-			range.first, range.second,
-			std::back_inserter(edges_for_line)
-		);
-		
-		// Calculate the intersection point of each edge with
-		// the current horizontal line.
-		BOOST_FOREACH(EdgeComponent& ecomp, edges_for_line) {
-			ecomp.setX(ecomp.edge().xForY(y));
-		}
-		
-		// Sort edge components by the x value of the intersection point.
-		std::sort(
-			edges_for_line.begin(), edges_for_line.end(),
-			EdgeOrderX()
-		);
-		
-		if (m_fillRule == Qt::OddEvenFill) {
-			oddEvenLineGrayscale(
-				&edges_for_line.front(), edges_for_line.size(),
-				line, color
-			);
-		} else {
-			windingLineGrayscale(
-				&edges_for_line.front(), edges_for_line.size(),
-				line, color, m_invert
-			);
-		}
+	if (m_fillRule == Qt::OddEvenFill) {
+		oddEvenLineGrayscale(aet.edges(), aet.size(), line, color);
+	} else {
+		windingLineGrayscale(aet.edges(), aet.size(), line, color, m_invert);
 	}
 }
 
 void
 PolygonRasterizer::Rasterizer::oddEvenLineBinary(
-	EdgeComponent const* const edges, int const num_edges,
+	ActiveEdge const* const edges, int const num_edges,
 	uint32_t* const line, uint32_t const pattern)
 {
 	for (int i = 0; i < num_edges - 1; i += 2) {
@@ -491,7 +485,7 @@ PolygonRasterizer::Rasterizer::oddEvenLineBinary(
 
 void
 PolygonRasterizer::Rasterizer::oddEvenLineGrayscale(
-	EdgeComponent const* const edges, int const num_edges,
+	ActiveEdge const* const edges, int const num_edges,
 	uint8_t* const line, uint8_t const color)
 {
 	for (int i = 0; i < num_edges - 1; i += 2) {
@@ -503,7 +497,7 @@ PolygonRasterizer::Rasterizer::oddEvenLineGrayscale(
 
 void
 PolygonRasterizer::Rasterizer::windingLineBinary(
-	EdgeComponent const* const edges, int const num_edges,
+	ActiveEdge const* const edges, int const num_edges,
 	uint32_t* const line, uint32_t const pattern, bool invert)
 {
 	int dir_sum = 0;
@@ -521,7 +515,7 @@ PolygonRasterizer::Rasterizer::windingLineBinary(
 
 void
 PolygonRasterizer::Rasterizer::windingLineGrayscale(
-	EdgeComponent const* const edges, int const num_edges,
+	ActiveEdge const* const edges, int const num_edges,
 	uint8_t* const line, uint8_t const color, bool invert)
 {
 	int dir_sum = 0;
@@ -573,5 +567,122 @@ PolygonRasterizer::Rasterizer::fillBinarySegment(
 	last_word = (last_word & ~last_word_mask) | (pattern & last_word_mask);
 }
 
+
+/*================ PolygonRasterizer::ActiveEdgeTable ===================*/
+
+PolygonRasterizer::ActiveEdgeTable::ActiveEdgeTable(std::vector<Edge> const& edges)
+:	m_pEdges(&edges),
+	m_nextEdge(0)
+{
+}
+
+void
+PolygonRasterizer::ActiveEdgeTable::moveTo(double const y)
+{
+	std::vector<Edge> const& edges = *m_pEdges;
+	
+	// Drop the edges that ended above or at y.  Bottom is not a part of an edge.
+	size_t num_active = 0;
+	for (size_t i = 0; i < m_active.size(); ++i) {
+		if (m_active[i].edge().bottomY() > y) {
+			m_active[num_active] = m_active[i];
+			++num_active;
+		}
+	}
+	m_active.resize(num_active, ActiveEdge(0));
+	
+	// Add the edges that started above or at y, skipping the ones
+	// that also ended there.  That only happens on the first call.
+	for (; m_nextEdge < edges.size() && edges[m_nextEdge].topY() <= y; ++m_nextEdge) {
+		if (edges[m_nextEdge].bottomY() > y) {
+			m_active.push_back(ActiveEdge(&edges[m_nextEdge]));
+		}
+	}
+	
+	BOOST_FOREACH(ActiveEdge& edge, m_active) {
+		edge.setX(edge.edge().xForY(y));
+	}
+	
+	// Edges rarely change their relative order from one line to the next,
+	// so an insertion sort is close to linear here.
+	EdgeOrderX const less;
+	for (size_t i = 1; i < m_active.size(); ++i) {
+		ActiveEdge const edge(m_active[i]);
+		size_t j = i;
+		for (; j > 0 && less(edge, m_active[j - 1]); --j) {
+			m_active[j] = m_active[j - 1];
+		}
+		m_active[j] = edge;
+	}
+}
+
+
+/*=================== PolygonRasterizer::BinaryRows ====================*/
+
+PolygonRasterizer::BinaryRows::BinaryRows(
+	std::vector<Rasterizer> const& rasterizers,
+	std::vector<uint32_t> const& patterns, BinaryImage& image)
+:	m_rRasterizers(rasterizers),
+	m_rPatterns(patterns),
+	m_pData(image.data()),
+	m_wpl(image.wordsPerLine())
+{
+}
+
+void
+PolygonRasterizer::BinaryRows::processRows(int const begin, int const end) const
+{
+	int const num_rasterizers = m_rRasterizers.size();
+	
+	std::vector<ActiveEdgeTable> tables;
+	tables.reserve(num_rasterizers);
+	BOOST_FOREACH(Rasterizer const& rasterizer, m_rRasterizers) {
+		tables.push_back(ActiveEdgeTable(rasterizer.edges()));
+	}
+	
+	uint32_t* line = m_pData + begin * m_wpl;
+	for (int i = begin; i < end; ++i, line += m_wpl) {
+		double const y = i + 0.5;
+		
+		// Polygons are applied in order, just like separate fills would.
+		for (int r = 0; r < num_rasterizers; ++r) {
+			Rasterizer const& rasterizer = m_rRasterizers[r];
+			if (i < rasterizer.firstLine() || i >= rasterizer.endLine()) {
+				continue;
+			}
+			
+			tables[r].moveTo(y);
+			rasterizer.fillBinaryLine(tables[r], line, m_rPatterns[r]);
+		}
+	}
+}
+
+
+/*================== PolygonRasterizer::GrayscaleRows ===================*/
+
+PolygonRasterizer::GrayscaleRows::GrayscaleRows(
+	Rasterizer const& rasterizer, uint8_t const color, QImage& image)
+:	m_rRasterizer(rasterizer),
+	m_pData(image.bits()),
+	m_bpl(image.bytesPerLine()),
+	m_color(color)
+{
+}
+
+void
+PolygonRasterizer::GrayscaleRows::processRows(int const begin, int const end) const
+{
+	ActiveEdgeTable aet(m_rRasterizer.edges());
+	
+	int const first = std::max(begin, m_rRasterizer.firstLine());
+	int const limit = std::min(end, m_rRasterizer.endLine());
+	
+	uint8_t* line = m_pData + first * m_bpl;
+	for (int i = first; i < limit; ++i, line += m_bpl) {
+		aet.moveTo(i + 0.5);
+		m_rRasterizer.fillGrayscaleLine(aet, line, m_color);
+	}
+}
+
 } // namespace imageproc
 
@@ -20,9 +20,10 @@
 #define IMAGEPROC_POLYGONRASTERIZER_H_
 
 #include "BWColor.h"
+#include <QPolygonF>
 #include <Qt>
+#include <vector>
 
-class QPolygonF;
 class QRectF;
 class QImage;
 
@@ -34,6 +35,8 @@ class BinaryImage;
 class PolygonRasterizer
 {
 public:
+	class Batch;
+	
 	static void fill(
 		BinaryImage& image, BWColor color,
 		QPolygonF const& poly, Qt::FillRule fill_rule);
@@ -51,10 +54,47 @@ public:
 		QPolygonF const& poly, Qt::FillRule fill_rule);
 private:
 	class Edge;
-	class EdgeComponent;
+	class ActiveEdge;
 	class EdgeOrderY;
 	class EdgeOrderX;
+	class ActiveEdgeTable;
 	class Rasterizer;
+	class BinaryRows;
+	class GrayscaleRows;
+};
+
+
+/**
+ * \brief A sequence of polygon fills, applied in a single pass over an image.
+ *
+ * Applying a batch produces the same result as calling
+ * PolygonRasterizer::fill() and PolygonRasterizer::fillExcept()
+ * for each polygon, in the order they were added, but every line
+ * of the image is visited just once.
+ */
+class PolygonRasterizer::Batch
+{
+public:
+	void fill(BWColor color, QPolygonF const& poly, Qt::FillRule fill_rule);
+	
+	void fillExcept(BWColor color, QPolygonF const& poly, Qt::FillRule fill_rule);
+	
+	bool empty() const { return m_items.empty(); }
+	
+	void apply(BinaryImage& image) const;
+private:
+	struct Item
+	{
+		QPolygonF poly;
+		BWColor color;
+		Qt::FillRule fillRule;
+		bool invert;
+		
+		Item(QPolygonF const& poly, BWColor color, Qt::FillRule fill_rule, bool invert)
+		: poly(poly), color(color), fillRule(fill_rule), invert(invert) {}
+	};
+	
+	std::vector<Item> m_items;
 };
 
 } // namespace imageproc
@@ -23,19 +23,324 @@
 #include "GrayImage.h"
 #include "Grayscale.h"
 #include "BitOps.h"
+#include "ParallelRows.h"
+#include "Sse2.h"
 #include <QDebug>
-#ifndef Q_MOC_RUN
-#include <boost/foreach.hpp>
-#endif
 #include <stdexcept>
 #include <algorithm>
 #include <math.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 namespace imageproc
 {
 
+namespace
+{
+
+/**
+ * \brief Returns the distance between adjacent pixels, pretending that
+ *        pixel positions lie in range of [0, 1].
+ */
+double calcScale(int const dimension)
+{
+	if (dimension <= 1) {
+		return 0.0;
+	} else {
+		return 1.0 / (dimension - 1);
+	}
+}
+
+/**
+ * \brief Rounds up to a multiple of 4, which suits both SSE2 doubles and floats.
+ */
+int padToSimd(int const num_elements)
+{
+	return (num_elements + 3) & ~3;
+}
+
+/**
+ * \brief Fills \p out[i * stride + n] with T_n(2 * i * scale - 1),
+ *        for n in [0, num_polys).
+ *
+ * T_n are Chebyshev polynomials of the first kind.  Values past num_polys
+ * are left untouched.
+ */
+template<typename T>
+void calcChebyshevTable(
+	T* out, int const stride, int const num_positions,
+	double const scale, int const num_polys)
+{
+	for (int i = 0; i < num_positions; ++i, out += stride) {
+		double const t = 2.0 * i * scale - 1.0;
+		double prev = 1.0;
+		double cur = t;
+		out[0] = static_cast<T>(prev);
+		for (int n = 1; n < num_polys; ++n) {
+			out[n] = static_cast<T>(cur);
+			double const next = 2.0 * t * cur - prev;
+			prev = cur;
+			cur = next;
+		}
+	}
+}
+
+/**
+ * \brief Computes per-line sums the normal equations are built from.
+ *
+ * For each line y, with T_n(x) standing for T_n(2 * x * xscale - 1)
+ * and v(x) for the pixel value scaled to [0, 1], stores:
+ * \code
+ * sums[y * stride + a] = sum(T_a(x)), a in [0, 2 * hor_degree]
+ * sums[y * stride + rhs_offset + j] = sum(T_j(x) * v(x)), j in [0, hor_degree]
+ * \endcode
+ * Only pixels black in the mask (if provided) take part.
+ * Each line is written by exactly one thread, so the result doesn't
+ * depend on how lines are split between threads.
+ */
+class LineSums : public RowRangeProcessor
+{
+public:
+	LineSums(GrayImage const& image, BinaryImage const* mask, int hor_degree);
+	
+	virtual void processRows(int begin, int end) const;
+	
+	int stride() const { return m_stride; }
+	
+	int rhsOffset() const { return m_rhsOffset; }
+	
+	double const* sums() const { return m_sums.data(); }
+private:
+	void processPixel(double const* terms, double value,
+		double* moments, double* rhs) const;
+	
+	GrayImage const& m_rImage;
+	BinaryImage const* m_pMask;
+	
+	/**
+	 * T_a(x), a in [0, 2 * hor_degree], for each x, padded
+	 * to m_termsStride with zeros.
+	 */
+	AlignedArray<double, 2> m_terms;
+	int m_termsStride;
+	int m_rhsStride;
+	int m_rhsOffset;
+	int m_stride;
+	
+	/**
+	 * Aligned, like m_terms, as processPixel() uses aligned SSE2
+	 * loads and stores on it.
+	 */
+	mutable AlignedArray<double, 2> m_sums;
+};
+
+LineSums::LineSums(
+	GrayImage const& image, BinaryImage const* mask, int const hor_degree)
+:	m_rImage(image),
+	m_pMask(mask),
+	m_termsStride(padToSimd(hor_degree * 2 + 1)),
+	m_rhsStride(padToSimd(hor_degree + 1)),
+	m_rhsOffset(m_termsStride),
+	m_stride(m_termsStride + m_rhsStride),
+	m_sums(m_stride * image.height())
+{
+	std::fill(m_sums.data(), m_sums.data() + m_stride * image.height(), 0.0);
+	
+	int const width = image.width();
+	AlignedArray<double, 2>(m_termsStride * width).swap(m_terms);
+	std::fill(m_terms.data(), m_terms.data() + m_termsStride * width, 0.0);
+	calcChebyshevTable(
+		m_terms.data(), m_termsStride, width,
+		calcScale(width), hor_degree * 2 + 1
+	);
+}
+
+void
+LineSums::processRows(int const begin, int const end) const
+{
+	int const width = m_rImage.width();
+	uint8_t const* image_line = m_rImage.data() + begin * m_rImage.stride();
+	
+	for (int y = begin; y < end; ++y, image_line += m_rImage.stride()) {
+		double* const moments = &m_sums[y * m_stride];
+		double* const rhs = moments + m_rhsOffset;
+		
+		if (!m_pMask) {
+			for (int x = 0; x < width; ++x) {
+				processPixel(
+					&m_terms[x * m_termsStride],
+					(1.0 / 255.0) * image_line[x], moments, rhs
+				);
+			}
+			continue;
+		}
+		
+		uint32_t const* mask_line = m_pMask->data() + y * m_pMask->wordsPerLine();
+		int const last_word_idx = (width - 1) >> 5;
+		uint32_t const last_word_mask = ~uint32_t(0) << (31 - ((width - 1) & 31));
+		for (int idx = 0; idx <= last_word_idx; ++idx) {
+			uint32_t word = mask_line[idx];
+			if (idx == last_word_idx) {
+				word &= last_word_mask;
+			}
+			while (word) {
+				int const x = (idx << 5) + countMostSignificantZeroes(word);
+				word &= ~(uint32_t(1) << (31 - (x & 31)));
+				processPixel(
+					&m_terms[x * m_termsStride],
+					(1.0 / 255.0) * image_line[x], moments, rhs
+				);
+			}
+		}
+	}
+}
+
+inline void
+LineSums::processPixel(
+	double const* const terms, double const value,
+	double* const moments, double* const rhs) const
+{
+#ifdef IMAGEPROC_HAVE_SSE2
+	for (int i = 0; i < m_termsStride; i += 2) {
+		__m128d const t = _mm_load_pd(terms + i);
+		_mm_store_pd(moments + i, _mm_add_pd(_mm_load_pd(moments + i), t));
+	}
+	__m128d const v = _mm_set1_pd(value);
+	for (int i = 0; i < m_rhsStride; i += 2) {
+		__m128d const t = _mm_mul_pd(_mm_load_pd(terms + i), v);
+		_mm_store_pd(rhs + i, _mm_add_pd(_mm_load_pd(rhs + i), t));
+	}
+#else
+	for (int i = 0; i < m_termsStride; ++i) {
+		moments[i] += terms[i];
+	}
+	for (int i = 0; i < m_rhsStride; ++i) {
+		rhs[i] += terms[i] * value;
+	}
+#endif
+}
+
+/**
+ * \brief Evaluates the polynomial for every pixel of an image.
+ *
+ * The polynomial is separable into sum(T_i(y) * sum(c_ij * T_j(x))),
+ * so each line is a 1D polynomial in x, evaluated from a table of
+ * T_j(x) values, 4 pixels at a time.
+ */
+class RenderRows : public RowRangeProcessor
+{
+public:
+	RenderRows(GrayImage& image, std::vector<double> const& coeffs,
+		int hor_degree, int vert_degree);
+	
+	virtual void processRows(int begin, int end) const;
+private:
+	uint8_t* m_pData;
+	int m_stride;
+	int m_width;
+	std::vector<double> const& m_rCoeffs;
+	int m_numHorTerms;
+	int m_numVertTerms;
+	
+	/**
+	 * T_j(x) for each x, stored as m_numHorTerms lines
+	 * of m_tableStride elements each.
+	 */
+	AlignedArray<float, 4> m_horTerms;
+	int m_tableStride;
+	
+	/**
+	 * T_i(y), i in [0, vert_degree], for each y.
+	 */
+	std::vector<double> m_vertTerms;
+};
+
+RenderRows::RenderRows(
+	GrayImage& image, std::vector<double> const& coeffs,
+	int const hor_degree, int const vert_degree)
+:	m_pData(image.data()),
+	m_stride(image.stride()),
+	m_width(image.width()),
+	m_rCoeffs(coeffs),
+	m_numHorTerms(hor_degree + 1),
+	m_numVertTerms(vert_degree + 1),
+	m_tableStride(padToSimd(image.width())),
+	m_vertTerms(m_numVertTerms * image.height())
+{
+	// The table is built transposed, as that's what calcChebyshevTable()
+	// produces, then rearranged so that consecutive pixels are adjacent.
+	std::vector<float> by_pixel(m_numHorTerms * m_width);
+	calcChebyshevTable(
+		&by_pixel[0], m_numHorTerms, m_width,
+		calcScale(m_width), m_numHorTerms
+	);
+	AlignedArray<float, 4>(m_numHorTerms * m_tableStride).swap(m_horTerms);
+	for (int j = 0; j < m_numHorTerms; ++j) {
+		float* const line = &m_horTerms[j * m_tableStride];
+		for (int x = 0; x < m_width; ++x) {
+			line[x] = by_pixel[x * m_numHorTerms + j];
+		}
+		std::fill(line + m_width, line + m_tableStride, 0.0f);
+	}
+	
+	calcChebyshevTable(
+		&m_vertTerms[0], m_numVertTerms, image.height(),
+		calcScale(image.height()), m_numVertTerms
+	);
+}
+
+void
+RenderRows::processRows(int const begin, int const end) const
+{
+	// The polynomial of the current line.
+	std::vector<float> line_coeffs(m_numHorTerms);
+	
+	uint8_t* line = m_pData + begin * m_stride;
+	for (int y = begin; y < end; ++y, line += m_stride) {
+		double const* const vert_terms = &m_vertTerms[y * m_numVertTerms];
+		for (int j = 0; j < m_numHorTerms; ++j) {
+			double sum = 0.0;
+			for (int i = 0; i < m_numVertTerms; ++i) {
+				sum += m_rCoeffs[i * m_numHorTerms + j] * vert_terms[i];
+			}
+			line_coeffs[j] = static_cast<float>(sum);
+		}
+		
+		int x = 0;
+		
+#ifdef IMAGEPROC_HAVE_SSE2
+		__m128 const zero = _mm_setzero_ps();
+		__m128 const max = _mm_set1_ps(255.0f);
+		for (; x + 4 <= m_width; x += 4) {
+			__m128 sum = _mm_set1_ps(0.5f / 255.0f); // for rounding purposes.
+			for (int j = 0; j < m_numHorTerms; ++j) {
+				__m128 const t = _mm_load_ps(&m_horTerms[j * m_tableStride + x]);
+				sum = _mm_add_ps(sum, _mm_mul_ps(t, _mm_set1_ps(line_coeffs[j])));
+			}
+			sum = _mm_min_ps(_mm_max_ps(_mm_mul_ps(sum, max), zero), max);
+			__m128i const isum = _mm_cvttps_epi32(sum);
+			__m128i const words = _mm_packs_epi32(isum, isum);
+			__m128i const packed = _mm_packus_epi16(words, words);
+			int32_t const pixels = _mm_cvtsi128_si32(packed);
+			memcpy(line + x, &pixels, 4);
+		}
+#endif
+		
+		for (; x < m_width; ++x) {
+			float sum = 0.5f / 255.0f; // for rounding purposes.
+			for (int j = 0; j < m_numHorTerms; ++j) {
+				sum += m_horTerms[j * m_tableStride + x] * line_coeffs[j];
+			}
+			sum = qBound(0.0f, sum * 255.0f, 255.0f);
+			line[x] = static_cast<unsigned char>(sum);
+		}
+	}
+}
+
+} // anonymous namespace
+
 PolynomialSurface::PolynomialSurface(
 	int const hor_degree, int const vert_degree, GrayImage const& src)
 :	m_horDegree(hor_degree),
@@ -59,20 +364,7 @@ PolynomialSurface::PolynomialSurface(
 	}
 	
 	maybeReduceDegrees(num_data_points);
-	
-	int const num_terms = calcNumTerms();
-	QSize const dimensions(num_terms, num_data_points);
-	std::vector<double> equations;
-	std::vector<double> data_points;
-	equations.reserve(dimensions.width() * dimensions.height());
-	data_points.reserve(dimensions.height());
-	m_coeffs.resize(dimensions.width());
-	
-	prepareEquationsAndDataPoints(src, equations, data_points);
-	assert(int(equations.size()) == dimensions.width() * dimensions.height());
-	assert(int(data_points.size()) == num_data_points);
-	
-	leastSquaresFit(dimensions, &equations[0], &m_coeffs[0], &data_points[0]);
+	fit(src, 0);
 }
 
 PolynomialSurface::PolynomialSurface(
@@ -102,21 +394,7 @@ PolynomialSurface::PolynomialSurface(
 	}
 	
 	maybeReduceDegrees(num_data_points);
-	
-	int const num_terms = calcNumTerms();
-	QSize const dimensions(num_terms, num_data_points);
-	
-	std::vector<double> equations;
-	std::vector<double> data_points;
-	equations.reserve(dimensions.width() * dimensions.height());
-	data_points.reserve(dimensions.height());
-	m_coeffs.resize(dimensions.width());
-	
-	prepareEquationsAndDataPoints(src, mask, equations, data_points);
-	assert(int(equations.size()) == dimensions.width() * dimensions.height());
-	assert(int(data_points.size()) == num_data_points);
-	
-	leastSquaresFit(dimensions, &equations[0], &m_coeffs[0], &data_points[0]);
+	fit(src, &mask);
 }
 
 GrayImage
@@ -127,57 +405,8 @@ PolynomialSurface::render(QSize const& size) const
 	}
 	
 	GrayImage image(size);
-	int const width = size.width();
-	int const height = size.height();
-	unsigned char* line = image.data();
-	int const bpl = image.stride();
-	int const num_coeffs = m_coeffs.size();
-	
-	// Pretend that both x and y positions of pixels
-	// lie in range of [0, 1].
-	double const xscale = calcScale(width);
-	double const yscale = calcScale(height);
-	
-	AlignedArray<float, 4> vert_matrix(num_coeffs * height);
-	float* out = &vert_matrix[0];
-	for (int y = 0; y < height; ++y) {
-		double const y_adjusted = y * yscale;
-		double pow = 1.0;
-		int pos = 0;
-		for (int i = 0; i <= m_vertDegree; ++i) {
-			for (int j = 0; j <= m_horDegree; ++j, ++pos, ++out) {
-				*out = static_cast<float>(m_coeffs[pos] * pow);
-			}
-			pow *= y_adjusted;
-		}
-	}
-	
-	AlignedArray<float, 4> hor_matrix(num_coeffs * width);
-	out = &hor_matrix[0];
-	for (int x = 0; x < width; ++x) {
-		double const x_adjusted = x * xscale;
-		for (int i = 0; i <= m_vertDegree; ++i) {
-			double pow = 1.0;
-			for (int j = 0; j <= m_horDegree; ++j, ++out) {
-				*out = static_cast<float>(pow);
-				pow *= x_adjusted;
-			}
-		}
-	}
-	
-	float const* vert_line = &vert_matrix[0];
-	for (int y = 0; y < height; ++y, line += bpl, vert_line += num_coeffs) {
-		float const* hor_line = &hor_matrix[0];
-		for (int x = 0; x < width; ++x, hor_line += num_coeffs) {
-			float sum = 0.5f / 255.0f; // for rounding purposes.
-			for (int i = 0; i < num_coeffs; ++i) {
-				sum += hor_line[i] * vert_line[i];
-			}
-			int const isum = (int)(sum * 255.0);
-			line[x] = static_cast<unsigned char>(qBound(0, isum, 255));
-		}
-	}
-	
+	RenderRows const renderer(image, m_coeffs, m_horDegree, m_vertDegree);
+	processRowsInParallel(renderer, size.height(), 32);
 	return image;
 }
 
@@ -201,135 +430,78 @@ PolynomialSurface::calcNumTerms() const
 	return (m_horDegree + 1) * (m_vertDegree + 1);
 }
 
-double
-PolynomialSurface::calcScale(int const dimension)
-{
-	if (dimension <= 1) {
-		return 0.0;
-	} else {
-		return 1.0 / (dimension - 1);
-	}
-}
-
 void
-PolynomialSurface::prepareEquationsAndDataPoints(
-	GrayImage const& image,
-	std::vector<double>& equations,
-	std::vector<double>& data_points) const
+PolynomialSurface::fit(GrayImage const& image, BinaryImage const* mask)
 {
-	int const width = image.width();
 	int const height = image.height();
+	int const num_hor_terms = m_horDegree + 1;
+	int const num_vert_terms = m_vertDegree + 1;
+	int const num_terms = calcNumTerms();
 	
-	uint8_t const* line = image.data();
-	int const bpl = image.stride();
+	LineSums const line_sums(image, mask, m_horDegree);
+	processRowsInParallel(line_sums, height, 32);
 	
-	// Pretend that both x and y positions of pixels
-	// lie in range of [0, 1].
-	double const xscale = calcScale(width);
-	double const yscale = calcScale(height);
+	// moments[a * num_vert_moments + b] = sum(T_a(x) * T_b(y))
+	// rhs_sums[j * num_vert_terms + i] = sum(T_j(x) * T_i(y) * v(x, y))
+	int const num_hor_moments = m_horDegree * 2 + 1;
+	int const num_vert_moments = m_vertDegree * 2 + 1;
+	std::vector<double> moments(num_hor_moments * num_vert_moments, 0.0);
+	std::vector<double> rhs_sums(num_hor_terms * num_vert_terms, 0.0);
 	
-	for (int y = 0; y < height; ++y, line += bpl) {
-		double const y_adjusted = yscale * y;
+	std::vector<double> vert_terms(num_vert_moments * height);
+	calcChebyshevTable(
+		&vert_terms[0], num_vert_moments, height,
+		calcScale(height), num_vert_moments
+	);
+	
+	// Lines are summed in order, to make the result reproducible.
+	double const* sums = line_sums.sums();
+	for (int y = 0; y < height; ++y, sums += line_sums.stride()) {
+		double const* const ty = &vert_terms[y * num_vert_moments];
 		
-		for (int x = 0; x < width; ++x) {
-			double const x_adjusted = xscale * x;
-			
-			data_points.push_back((1.0 / 255.0) * line[x]);
-			
-			double pow1 = 1.0;
-			for (int i = 0; i <= m_vertDegree; ++i) {
-				double pow2 = pow1;
-				for (int j = 0; j <= m_horDegree; ++j) {
-					equations.push_back(pow2);
-					pow2 *= x_adjusted;
-				}
-				pow1 *= y_adjusted;
+		double* moment = &moments[0];
+		for (int a = 0; a < num_hor_moments; ++a) {
+			for (int b = 0; b < num_vert_moments; ++b, ++moment) {
+				*moment += sums[a] * ty[b];
 			}
 		}
-	}
-}
-
-void
-PolynomialSurface::prepareEquationsAndDataPoints(
-	GrayImage const& image, BinaryImage const& mask,
-	std::vector<double>& equations,
-	std::vector<double>& data_points) const
-{
-	int const width = image.width();
-	int const height = image.height();
-	
-	double const xscale = calcScale(width);
-	double const yscale = calcScale(height);
-	
-	uint8_t const* image_line = image.data();
-	int const image_bpl = image.stride();
-	
-	uint32_t const* mask_line = mask.data();
-	int const mask_wpl = mask.wordsPerLine();
-	int const last_word_idx = (width - 1) >> 5;
-	int const last_word_mask = ~uint32_t(0) << (31 - ((width - 1) & 31));
-	
-	for (int y = 0; y < height; ++y) {
-		double const y_adjusted = y * yscale;
-		int idx = 0;
 		
-		// Full words.
-		for (; idx < last_word_idx; ++idx) {
-			processMaskWord(
-				image_line, mask_line[idx], idx, y,
-				y_adjusted, xscale, equations, data_points
-			);
+		double const* const rhs_line = sums + line_sums.rhsOffset();
+		double* rhs_sum = &rhs_sums[0];
+		for (int j = 0; j < num_hor_terms; ++j) {
+			for (int i = 0; i < num_vert_terms; ++i, ++rhs_sum) {
+				*rhs_sum += rhs_line[j] * ty[i];
+			}
 		}
-		
-		// Last word.
-		processMaskWord(
-			image_line, mask_line[idx] & last_word_mask,
-			idx, y, y_adjusted, xscale, equations, data_points
-		);
-		
-		image_line += image_bpl;
-		mask_line += mask_wpl;
 	}
-}
-
-void
-PolynomialSurface::processMaskWord(
-	uint8_t const* const image_line,
-	uint32_t word, int const word_idx, int const y,
-	double const y_adjusted, double const xscale,
-	std::vector<double>& equations,
-	std::vector<double>& data_points) const
-{
-	uint32_t const msb = uint32_t(1) << 31;
-	int const xbase = word_idx << 5;
-	
-	int x = xbase;
-	uint32_t mask = msb;
 	
-	for (; word; word &= ~mask, mask >>= 1, ++x) {
-		if (!(word & mask)) {
-			// Skip a group of zero bits.
-			int const offset = countMostSignificantZeroes(word);
-			x = xbase + offset;
-			mask = msb >> offset;
-			assert(word & mask);
-		}
-		
-		data_points.push_back((1.0 / 255.0) * image_line[x]);
-		
-		double const x_adjusted = xscale * x;
-		double pow1 = 1.0;
-		for (int i = 0; i <= m_vertDegree; ++i) {
-			double pow2 = pow1;
+	// Build the normal equations.  Because
+	// T_m * T_n = (T_(m + n) + T_|m - n|) / 2,
+	// every element of the matrix is a combination of 4 moments.
+	std::vector<double> equations(num_terms * num_terms);
+	std::vector<double> rhs(num_terms);
+	for (int i1 = 0; i1 < num_vert_terms; ++i1) {
+		for (int j1 = 0; j1 < num_hor_terms; ++j1) {
+			int const row = i1 * num_hor_terms + j1;
+			rhs[row] = rhs_sums[j1 * num_vert_terms + i1];
 			
-			for (int j = 0; j <= m_horDegree; ++j) {
-				equations.push_back(pow2);
-				pow2 *= x_adjusted;
+			for (int i2 = 0; i2 < num_vert_terms; ++i2) {
+				int const b1 = i1 + i2;
+				int const b2 = abs(i1 - i2);
+				for (int j2 = 0; j2 < num_hor_terms; ++j2) {
+					double const* const a1 = &moments[(j1 + j2) * num_vert_moments];
+					double const* const a2 = &moments[abs(j1 - j2) * num_vert_moments];
+					int const col = i2 * num_hor_terms + j2;
+					equations[row * num_terms + col] =
+						0.25 * (a1[b1] + a1[b2] + a2[b1] + a2[b2]);
+				}
 			}
-			
-			pow1 *= y_adjusted;
 		}
 	}
+	
+	// The system is square, so this is a QR-based solver for it.
+	m_coeffs.resize(num_terms);
+	leastSquaresFit(QSize(num_terms, num_terms), &equations[0], &m_coeffs[0], &rhs[0]);
 }
 
 }
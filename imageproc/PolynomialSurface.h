@@ -21,7 +21,6 @@
 
 #include <QSize>
 #include <vector>
-#include <stdint.h>
 
 namespace imageproc
 {
@@ -84,30 +83,31 @@ public:
 	 * The surface will be stretched / shrunk to fit the new size.
 	 */
 	GrayImage render(QSize const& size) const;
+	
+	/**
+	 * \brief Coefficients of T_i(y) * T_j(x) at i * (hor_degree + 1) + j.
+	 *
+	 * T_n are Chebyshev polynomials, and x and y are pixel positions
+	 * mapped to [-1, 1].  The degrees are the ones passed to the
+	 * constructor, unless there were too few data points for them.
+	 */
+	std::vector<double> const& coefficients() const { return m_coeffs; }
 private:
 	void maybeReduceDegrees(int num_data_points);
 	
 	int calcNumTerms() const;
 	
-	static double calcScale(int dimension);
-	
-	void prepareEquationsAndDataPoints(
-		GrayImage const& image,
-		std::vector<double>& equations,
-		std::vector<double>& data_points) const;
-	
-	void prepareEquationsAndDataPoints(
-		GrayImage const& image, BinaryImage const& mask,
-		std::vector<double>& equations,
-		std::vector<double>& data_points) const;
-	
-	void processMaskWord(
-		uint8_t const* image_line, uint32_t word,
-		int mask_word_idx, int y,
-		double y_adjusted, double xscale,
-		std::vector<double>& equations,
-		std::vector<double>& data_points) const;
+	/**
+	 * \brief Fits the polynomial to \p image pixels that are black
+	 *        in \p mask, or to all of them if \p mask is null.
+	 */
+	void fit(GrayImage const& image, BinaryImage const* mask);
 	
+	/**
+	 * Coefficients of T_i(y) * T_j(x) at i * (m_horDegree + 1) + j,
+	 * where T_n are Chebyshev polynomials, and x and y are pixel
+	 * positions mapped to [-1, 1].
+	 */
 	std::vector<double> m_coeffs;
 	int m_horDegree;
 	int m_vertDegree;
@@ -20,6 +20,8 @@
 #define IMAGEPROC_RASTEROP_H_
 
 #include "BinaryImage.h"
+#include "Sse2.h"
+#include "Avx2.h"
 #include <QPoint>
 #include <QRect>
 #include <QSize>
@@ -72,6 +74,16 @@ public:
 	static uint32_t transform(uint32_t src, uint32_t /*dst*/) {
 		return src;
 	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i src, __m128i /*dst*/) {
+		return src;
+	}
+#endif
+#ifdef IMAGEPROC_HAVE_AVX2
+	IMAGEPROC_AVX2_TARGET static __m256i transform(__m256i src, __m256i /*dst*/) {
+		return src;
+	}
+#endif
 };
 
 /**
@@ -84,6 +96,16 @@ public:
 	static uint32_t transform(uint32_t /*src*/, uint32_t dst) {
 		return dst;
 	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i /*src*/, __m128i dst) {
+		return dst;
+	}
+#endif
+#ifdef IMAGEPROC_HAVE_AVX2
+	IMAGEPROC_AVX2_TARGET static __m256i transform(__m256i /*src*/, __m256i dst) {
+		return dst;
+	}
+#endif
 };
 
 /**
@@ -97,6 +119,16 @@ public:
 	static uint32_t transform(uint32_t src, uint32_t dst) {
 		return ~Arg::transform(src, dst);
 	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i src, __m128i dst) {
+		return _mm_xor_si128(Arg::transform(src, dst), _mm_set1_epi32(-1));
+	}
+#endif
+#ifdef IMAGEPROC_HAVE_AVX2
+	IMAGEPROC_AVX2_TARGET static __m256i transform(__m256i src, __m256i dst) {
+		return _mm256_xor_si256(Arg::transform(src, dst), _mm256_set1_epi32(-1));
+	}
+#endif
 };
 
 /**
@@ -110,6 +142,16 @@ public:
 	static uint32_t transform(uint32_t src, uint32_t dst) {
 		return Arg1::transform(src, dst) & Arg2::transform(src, dst);
 	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i src, __m128i dst) {
+		return _mm_and_si128(Arg1::transform(src, dst), Arg2::transform(src, dst));
+	}
+#endif
+#ifdef IMAGEPROC_HAVE_AVX2
+	IMAGEPROC_AVX2_TARGET static __m256i transform(__m256i src, __m256i dst) {
+		return _mm256_and_si256(Arg1::transform(src, dst), Arg2::transform(src, dst));
+	}
+#endif
 };
 
 /**
@@ -123,6 +165,16 @@ public:
 	static uint32_t transform(uint32_t src, uint32_t dst) {
 		return Arg1::transform(src, dst) | Arg2::transform(src, dst);
 	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i src, __m128i dst) {
+		return _mm_or_si128(Arg1::transform(src, dst), Arg2::transform(src, dst));
+	}
+#endif
+#ifdef IMAGEPROC_HAVE_AVX2
+	IMAGEPROC_AVX2_TARGET static __m256i transform(__m256i src, __m256i dst) {
+		return _mm256_or_si256(Arg1::transform(src, dst), Arg2::transform(src, dst));
+	}
+#endif
 };
 
 /**
@@ -136,6 +188,16 @@ public:
 	static uint32_t transform(uint32_t src, uint32_t dst) {
 		return Arg1::transform(src, dst) ^ Arg2::transform(src, dst);
 	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i src, __m128i dst) {
+		return _mm_xor_si128(Arg1::transform(src, dst), Arg2::transform(src, dst));
+	}
+#endif
+#ifdef IMAGEPROC_HAVE_AVX2
+	IMAGEPROC_AVX2_TARGET static __m256i transform(__m256i src, __m256i dst) {
+		return _mm256_xor_si256(Arg1::transform(src, dst), Arg2::transform(src, dst));
+	}
+#endif
 };
 
 /**
@@ -151,6 +213,22 @@ public:
 		uint32_t rhs = Arg2::transform(src, dst);
 		return lhs & (lhs ^ rhs);
 	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i src, __m128i dst) {
+		__m128i const lhs = Arg1::transform(src, dst);
+		__m128i const rhs = Arg2::transform(src, dst);
+		// lhs & (lhs ^ rhs) == lhs & ~rhs
+		return _mm_andnot_si128(rhs, lhs);
+	}
+#endif
+#ifdef IMAGEPROC_HAVE_AVX2
+	IMAGEPROC_AVX2_TARGET static __m256i transform(__m256i src, __m256i dst) {
+		__m256i const lhs = Arg1::transform(src, dst);
+		__m256i const rhs = Arg2::transform(src, dst);
+		// lhs & (lhs ^ rhs) == lhs & ~rhs
+		return _mm256_andnot_si256(rhs, lhs);
+	}
+#endif
 };
 
 /**
@@ -166,6 +244,22 @@ public:
 		uint32_t rhs = Arg2::transform(src, dst);
 		return lhs | ~(lhs ^ rhs);
 	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i src, __m128i dst) {
+		__m128i const lhs = Arg1::transform(src, dst);
+		__m128i const rhs = Arg2::transform(src, dst);
+		// lhs | ~(lhs ^ rhs) == lhs | ~rhs
+		return _mm_or_si128(lhs, _mm_xor_si128(rhs, _mm_set1_epi32(-1)));
+	}
+#endif
+#ifdef IMAGEPROC_HAVE_AVX2
+	IMAGEPROC_AVX2_TARGET static __m256i transform(__m256i src, __m256i dst) {
+		__m256i const lhs = Arg1::transform(src, dst);
+		__m256i const rhs = Arg2::transform(src, dst);
+		// lhs | ~(lhs ^ rhs) == lhs | ~rhs
+		return _mm256_or_si256(lhs, _mm256_xor_si256(rhs, _mm256_set1_epi32(-1)));
+	}
+#endif
 };
 
 /**
@@ -210,6 +304,101 @@ public:
 namespace detail
 {
 
+#ifdef IMAGEPROC_HAVE_SSE2
+
+/**
+ * Processes whole words [begin, end) of a line, 4 words at a time,
+ * for the case of source and destination bits being aligned.
+ * \return The index of the first unprocessed word.
+ */
+template<typename Rop>
+int rasterOpAlignedSse2(
+	uint32_t* dst_span, uint32_t const* src_span, int begin, int const end)
+{
+	int widx = begin;
+	for (; widx + 4 <= end; widx += 4) {
+		__m128i const src_words = _mm_loadu_si128((__m128i const*)(src_span + widx));
+		__m128i const dst_words = _mm_loadu_si128((__m128i const*)(dst_span + widx));
+		_mm_storeu_si128((__m128i*)(dst_span + widx), Rop::transform(src_words, dst_words));
+	}
+	return widx;
+}
+
+/**
+ * Processes whole words [begin, end) of a line, 4 words at a time,
+ * where each source word is combined from two adjacent ones.
+ * Reads source words up to and including \p end.
+ * \return The index of the first unprocessed word.
+ */
+template<typename Rop>
+int rasterOpShiftedSse2(
+	uint32_t* dst_span, uint32_t const* src_span, int begin, int const end,
+	int const src_word1_shift, int const src_word2_shift)
+{
+	__m128i const shift1 = _mm_cvtsi32_si128(src_word1_shift);
+	__m128i const shift2 = _mm_cvtsi32_si128(src_word2_shift);
+	
+	int widx = begin;
+	for (; widx + 4 <= end; widx += 4) {
+		__m128i const src_words1 = _mm_loadu_si128((__m128i const*)(src_span + widx));
+		__m128i const src_words2 = _mm_loadu_si128((__m128i const*)(src_span + widx + 1));
+		__m128i const src_words = _mm_or_si128(
+			_mm_sll_epi32(src_words1, shift1),
+			_mm_srl_epi32(src_words2, shift2)
+		);
+		__m128i const dst_words = _mm_loadu_si128((__m128i const*)(dst_span + widx));
+		_mm_storeu_si128((__m128i*)(dst_span + widx), Rop::transform(src_words, dst_words));
+	}
+	return widx;
+}
+
+#endif // IMAGEPROC_HAVE_SSE2
+
+#ifdef IMAGEPROC_HAVE_AVX2
+
+/**
+ * The AVX2 version of rasterOpAlignedSse2(), processing 8 words at a time.
+ */
+template<typename Rop>
+IMAGEPROC_AVX2_TARGET int rasterOpAlignedAvx2(
+	uint32_t* dst_span, uint32_t const* src_span, int begin, int const end)
+{
+	int widx = begin;
+	for (; widx + 8 <= end; widx += 8) {
+		__m256i const src_words = _mm256_loadu_si256((__m256i const*)(src_span + widx));
+		__m256i const dst_words = _mm256_loadu_si256((__m256i const*)(dst_span + widx));
+		_mm256_storeu_si256((__m256i*)(dst_span + widx), Rop::transform(src_words, dst_words));
+	}
+	return widx;
+}
+
+/**
+ * The AVX2 version of rasterOpShiftedSse2(), processing 8 words at a time.
+ */
+template<typename Rop>
+IMAGEPROC_AVX2_TARGET int rasterOpShiftedAvx2(
+	uint32_t* dst_span, uint32_t const* src_span, int begin, int const end,
+	int const src_word1_shift, int const src_word2_shift)
+{
+	__m128i const shift1 = _mm_cvtsi32_si128(src_word1_shift);
+	__m128i const shift2 = _mm_cvtsi32_si128(src_word2_shift);
+	
+	int widx = begin;
+	for (; widx + 8 <= end; widx += 8) {
+		__m256i const src_words1 = _mm256_loadu_si256((__m256i const*)(src_span + widx));
+		__m256i const src_words2 = _mm256_loadu_si256((__m256i const*)(src_span + widx + 1));
+		__m256i const src_words = _mm256_or_si256(
+			_mm256_sll_epi32(src_words1, shift1),
+			_mm256_srl_epi32(src_words2, shift2)
+		);
+		__m256i const dst_words = _mm256_loadu_si256((__m256i const*)(dst_span + widx));
+		_mm256_storeu_si256((__m256i*)(dst_span + widx), Rop::transform(src_words, dst_words));
+	}
+	return widx;
+}
+
+#endif // IMAGEPROC_HAVE_AVX2
+
 template<typename Rop>
 void rasterOpInDirection(
 	BinaryImage& dst, QRect const& dr,
@@ -221,6 +410,9 @@ void rasterOpInDirection(
 	int const rightmost_dst_word = rightmost_dst_bit / 32 - dr.x() / 32;
 	uint32_t const leftmost_dst_mask = ~uint32_t(0) >> dst_start_bit;
 	uint32_t const rightmost_dst_mask = ~uint32_t(0) << (31 - rightmost_dst_bit % 32);
+#ifdef IMAGEPROC_HAVE_AVX2
+	bool const avx2 = cpuHasAvx2();
+#endif
 	
 	int first_dst_word;
 	int last_dst_word;
@@ -294,6 +486,21 @@ void rasterOpInDirection(
 				uint32_t new_dst_word = Rop::transform(src_word, dst_word);
 				dst_span[widx] = (dst_word & ~first_dst_mask) | (new_dst_word & first_dst_mask);
 				
+#ifdef IMAGEPROC_HAVE_SSE2
+				if (dx == 1) {
+					int begin = widx + 1;
+#ifdef IMAGEPROC_HAVE_AVX2
+					if (avx2) {
+						begin = rasterOpAlignedAvx2<Rop>(
+							dst_span, src_span, begin, last_dst_word
+						);
+					}
+#endif
+					widx = rasterOpAlignedSse2<Rop>(
+						dst_span, src_span, begin, last_dst_word
+					) - 1;
+				}
+#endif
 				while ((widx += dx) != last_dst_word) {
 					src_word = src_span[widx];
 					dst_word = dst_span[widx];
@@ -356,6 +563,29 @@ void rasterOpInDirection(
 			uint32_t new_dst_word = Rop::transform(src_word, dst_word);
 			new_dst_word = (dst_word & ~first_dst_mask) | (new_dst_word & first_dst_mask);
 			
+#ifdef IMAGEPROC_HAVE_SSE2
+			if (dx == 1) {
+				// The delayed write below is only necessary when going
+				// right to left.  Going left to right, source words are
+				// never located before the destination words we write
+				// within the same line, so we can flush it now.
+				dst_span[widx] = new_dst_word;
+				int begin = widx + 1;
+#ifdef IMAGEPROC_HAVE_AVX2
+				if (avx2) {
+					begin = rasterOpShiftedAvx2<Rop>(
+						dst_span, src_span, begin, last_dst_word,
+						src_word1_shift, src_word2_shift
+					);
+				}
+#endif
+				widx = rasterOpShiftedSse2<Rop>(
+					dst_span, src_span, begin, last_dst_word,
+					src_word1_shift, src_word2_shift
+				) - 1;
+				new_dst_word = dst_span[widx];
+			}
+#endif
 			while ((widx += dx) != last_dst_word) {
 				uint32_t const src_word1 = src_span[widx];
 				uint32_t const src_word2 = src_span[widx + 1];
@@ -17,6 +17,8 @@
 */
 
 #include "ReduceThreshold.h"
+#include "Sse2.h"
+#include <vector>
 #include <stdexcept>
 #include <stdint.h>
 #include <assert.h>
@@ -28,96 +30,270 @@ namespace
 {
 
 /**
- * This lookup table is filled like this:
- * \code
- * for (unsigned i = 0; i < 256; i += 2) {
- *	unsigned out =
- *		((i & (1 << 1)) >> 1) |  // bit 1 becomes bit 0
- *		((i & (1 << 3)) >> 2) |  // bit 3 becomes bit 1
- *		((i & (1 << 5)) >> 3) |  // bit 5 becomes bit 2
- *		((i & (1 << 7)) >> 4);   // bit 7 becomes bit 3
- *	compressBitsLut[i >> 1] = static_cast<uint8_t>(out);
- * }
- * \endcode
- * We take every other byte because bit 0 doesn't matter here.
+ * Throw away every other bit starting with bit 0 and pack the remaining
+ * 16 bits into the lower half of a word, keeping their order.
  */
-static uint8_t const compressBitsLut[128] = {
-	0x0, 0x1, 0x0, 0x1, 0x2, 0x3, 0x2, 0x3,
-	0x0, 0x1, 0x0, 0x1, 0x2, 0x3, 0x2, 0x3,
-	0x4, 0x5, 0x4, 0x5, 0x6, 0x7, 0x6, 0x7,
-	0x4, 0x5, 0x4, 0x5, 0x6, 0x7, 0x6, 0x7,
-	0x0, 0x1, 0x0, 0x1, 0x2, 0x3, 0x2, 0x3,
-	0x0, 0x1, 0x0, 0x1, 0x2, 0x3, 0x2, 0x3,
-	0x4, 0x5, 0x4, 0x5, 0x6, 0x7, 0x6, 0x7,
-	0x4, 0x5, 0x4, 0x5, 0x6, 0x7, 0x6, 0x7,
-	0x8, 0x9, 0x8, 0x9, 0xa, 0xb, 0xa, 0xb,
-	0x8, 0x9, 0x8, 0x9, 0xa, 0xb, 0xa, 0xb,
-	0xc, 0xd, 0xc, 0xd, 0xe, 0xf, 0xe, 0xf,
-	0xc, 0xd, 0xc, 0xd, 0xe, 0xf, 0xe, 0xf,
-	0x8, 0x9, 0x8, 0x9, 0xa, 0xb, 0xa, 0xb,
-	0x8, 0x9, 0x8, 0x9, 0xa, 0xb, 0xa, 0xb,
-	0xc, 0xd, 0xc, 0xd, 0xe, 0xf, 0xe, 0xf,
-	0xc, 0xd, 0xc, 0xd, 0xe, 0xf, 0xe, 0xf
-};
+inline uint32_t compressBits(uint32_t const bits)
+{
+	uint32_t x = (bits >> 1) & 0x55555555;
+	x = (x | (x >> 1)) & 0x33333333;
+	x = (x | (x >> 2)) & 0x0F0F0F0F;
+	x = (x | (x >> 4)) & 0x00FF00FF;
+	x = (x | (x >> 8)) & 0x0000FFFF;
+	return x;
+}
 
+#ifdef IMAGEPROC_HAVE_SSE2
 /**
- * Throw away every other bit starting with bit 0 and
- * pack the remaining bits into the upper half of a word.
+ * Does the same as compressBits() on 4 words, then joins the halves
+ * from adjacent words, leaving the two resulting words in the lower
+ * 64 bits.
  */
-inline uint32_t compressBitsUpperHalf(uint32_t const bits)
+inline __m128i compressBits(__m128i const bits)
 {
-	uint32_t r;
-	r = compressBitsLut[(bits >> 25) /*& 0x7F*/] << 28;
-	r |= compressBitsLut[(bits >> 17) & 0x7F] << 24;
-	r |= compressBitsLut[(bits >> 9) & 0x7F] << 20;
-	r |= compressBitsLut[(bits >> 1) & 0x7F] << 16;
-	return r;
+	__m128i x = _mm_and_si128(_mm_srli_epi32(bits, 1), _mm_set1_epi32(0x55555555));
+	x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 1)), _mm_set1_epi32(0x33333333));
+	x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 2)), _mm_set1_epi32(0x0F0F0F0F));
+	x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 4)), _mm_set1_epi32(0x00FF00FF));
+	x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 8)), _mm_set1_epi32(0x0000FFFF));
+	
+	// Join the halves from adjacent words, then take every other word.
+	x = _mm_or_si128(_mm_srli_epi64(x, 32), _mm_slli_epi64(x, 16));
+	return _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 1, 2, 0));
 }
+#endif
+
+class Threshold1
+{
+public:
+	static uint32_t transform(uint32_t const top, uint32_t const bottom) {
+		uint32_t word = top | bottom;
+		word |= word << 1;
+		return word;
+	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i const top, __m128i const bottom) {
+		__m128i const word = _mm_or_si128(top, bottom);
+		return _mm_or_si128(word, _mm_slli_epi32(word, 1));
+	}
+#endif
+};
+
+class Threshold2
+{
+public:
+	static uint32_t transform(uint32_t const top, uint32_t const bottom) {
+		uint32_t word1 = top & bottom;
+		word1 |= word1 << 1;
+		uint32_t word2 = top | bottom;
+		word2 &= word2 << 1;
+		return word1 | word2;
+	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i const top, __m128i const bottom) {
+		__m128i const word1 = _mm_and_si128(top, bottom);
+		__m128i const word2 = _mm_or_si128(top, bottom);
+		return _mm_or_si128(
+			_mm_or_si128(word1, _mm_slli_epi32(word1, 1)),
+			_mm_and_si128(word2, _mm_slli_epi32(word2, 1))
+		);
+	}
+#endif
+};
+
+class Threshold3
+{
+public:
+	static uint32_t transform(uint32_t const top, uint32_t const bottom) {
+		uint32_t word1 = top | bottom;
+		word1 &= word1 << 1;
+		uint32_t word2 = top & bottom;
+		word2 |= word2 << 1;
+		return word1 & word2;
+	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i const top, __m128i const bottom) {
+		__m128i const word1 = _mm_or_si128(top, bottom);
+		__m128i const word2 = _mm_and_si128(top, bottom);
+		return _mm_and_si128(
+			_mm_and_si128(word1, _mm_slli_epi32(word1, 1)),
+			_mm_or_si128(word2, _mm_slli_epi32(word2, 1))
+		);
+	}
+#endif
+};
+
+class Threshold4
+{
+public:
+	static uint32_t transform(uint32_t const top, uint32_t const bottom) {
+		uint32_t word = top & bottom;
+		word &= word << 1;
+		return word;
+	}
+#ifdef IMAGEPROC_HAVE_SSE2
+	static __m128i transform(__m128i const top, __m128i const bottom) {
+		__m128i const word = _mm_and_si128(top, bottom);
+		return _mm_and_si128(word, _mm_slli_epi32(word, 1));
+	}
+#endif
+};
 
 /**
- * Throw away every other bit starting with bit 0 and
- * pack the remaining bits into the lower half of a word.
+ * \brief Reduces two source lines into one destination line.
+ *
+ * \p steps_per_line is the number of source words to process.
+ * The corresponding destination words are overwritten.
  */
-inline uint32_t compressBitsLowerHalf(uint32_t const bits)
+template<typename Threshold>
+void reduceLineImpl(
+	uint32_t const* const top, uint32_t const* const bottom,
+	uint32_t* const dst, int const steps_per_line)
 {
-	uint32_t r;
-	r = compressBitsLut[(bits >> 25) /*& 0x7F*/] << 12;
-	r |= compressBitsLut[(bits >> 17) & 0x7F] << 8;
-	r |= compressBitsLut[(bits >> 9) & 0x7F] << 4;
-	r |= compressBitsLut[(bits >> 1) & 0x7F];
-	return r;
+	int j = 0;
+	
+#ifdef IMAGEPROC_HAVE_SSE2
+	for (; j + 8 <= steps_per_line; j += 8) {
+		__m128i const lo = compressBits(
+			Threshold::transform(
+				_mm_loadu_si128((__m128i const*)(top + j)),
+				_mm_loadu_si128((__m128i const*)(bottom + j))
+			)
+		);
+		__m128i const hi = compressBits(
+			Threshold::transform(
+				_mm_loadu_si128((__m128i const*)(top + j + 4)),
+				_mm_loadu_si128((__m128i const*)(bottom + j + 4))
+			)
+		);
+		_mm_storeu_si128((__m128i*)(dst + j / 2), _mm_unpacklo_epi64(lo, hi));
+	}
+#endif
+	
+	for (; j < steps_per_line; j += 2) {
+		uint32_t word = compressBits(Threshold::transform(top[j], bottom[j])) << 16;
+		if (j + 1 < steps_per_line) {
+			word |= compressBits(Threshold::transform(top[j + 1], bottom[j + 1]));
+		}
+		dst[j / 2] = word;
+	}
 }
 
-inline uint32_t threshold1(uint32_t const top, uint32_t const bottom)
+void reduceLine(
+	int const threshold, uint32_t const* top, uint32_t const* bottom,
+	uint32_t* dst, int const steps_per_line)
 {
-	uint32_t word = top | bottom;
-	word |= word << 1;
-	return word;
+	switch (threshold) {
+		case 1:
+			reduceLineImpl<Threshold1>(top, bottom, dst, steps_per_line);
+			break;
+		case 2:
+			reduceLineImpl<Threshold2>(top, bottom, dst, steps_per_line);
+			break;
+		case 3:
+			reduceLineImpl<Threshold3>(top, bottom, dst, steps_per_line);
+			break;
+		case 4:
+			reduceLineImpl<Threshold4>(top, bottom, dst, steps_per_line);
+			break;
+	}
 }
 
-inline uint32_t threshold2(uint32_t const top, uint32_t const bottom)
+/**
+ * \brief Performs a series of regular 2D reductions in a single pass.
+ *
+ * Lines of the final level are built recursively, so that every line
+ * of an intermediate level is reduced further right after it's produced.
+ * Intermediate levels therefore only keep their two most recent lines,
+ * and the source is read only once.  Every reduction must have at least
+ * two source pixels in both directions.
+ */
+class PyramidReducer
+{
+public:
+	PyramidReducer(BinaryImage const& src, int const* thresholds, int num_levels);
+	
+	BinaryImage reduce();
+private:
+	struct Level
+	{
+		int threshold;
+		int width;
+		int height;
+		int wpl;
+		int stepsPerLine;
+		std::vector<uint32_t> lines;
+	};
+	
+	uint32_t const* line(int level, int y);
+	
+	BinaryImage const& m_rSrc;
+	BinaryImage m_dst;
+	std::vector<Level> m_levels; // m_levels[0] is the source.
+};
+
+PyramidReducer::PyramidReducer(
+	BinaryImage const& src, int const* thresholds, int const num_levels)
+:	m_rSrc(src),
+	m_levels(num_levels + 1)
 {
-	uint32_t word1 = top & bottom;
-	word1 |= word1 << 1;
-	uint32_t word2 = top | bottom;
-	word2 &= word2 << 1;
-	return word1 | word2;
+	m_levels[0].threshold = 0;
+	m_levels[0].width = src.width();
+	m_levels[0].height = src.height();
+	m_levels[0].wpl = src.wordsPerLine();
+	m_levels[0].stepsPerLine = 0;
+	
+	for (int i = 1; i <= num_levels; ++i) {
+		Level& level = m_levels[i];
+		Level const& prev = m_levels[i - 1];
+		assert(prev.width >= 2 && prev.height >= 2);
+		level.threshold = thresholds[i - 1];
+		level.width = prev.width / 2;
+		level.height = prev.height / 2;
+		level.wpl = (level.width + 31) / 32;
+		level.stepsPerLine = (level.width * 2 + 31) / 32;
+		if (i != num_levels) {
+			level.lines.resize(level.wpl * 2);
+		}
+	}
+	
+	Level const& last = m_levels.back();
+	BinaryImage(last.width, last.height).swap(m_dst);
 }
 
-inline uint32_t threshold3(uint32_t const top, uint32_t const bottom)
+BinaryImage
+PyramidReducer::reduce()
 {
-	uint32_t word1 = top | bottom;
-	word1 &= word1 << 1;
-	uint32_t word2 = top & bottom;
-	word2 |= word2 << 1;
-	return word1 & word2;
+	int const last_level = m_levels.size() - 1;
+	int const height = m_levels[last_level].height;
+	for (int y = 0; y < height; ++y) {
+		line(last_level, y);
+	}
+	return m_dst;
 }
 
-inline uint32_t threshold4(uint32_t const top, uint32_t const bottom)
+uint32_t const*
+PyramidReducer::line(int const level_idx, int const y)
 {
-	uint32_t word = top & bottom;
-	word &= word << 1;
-	return word;
+	if (level_idx == 0) {
+		return m_rSrc.data() + y * m_rSrc.wordsPerLine();
+	}
+	
+	// Producing the bottom line doesn't overwrite the top one,
+	// as it goes to the other slot.
+	uint32_t const* top = line(level_idx - 1, y * 2);
+	uint32_t const* bottom = line(level_idx - 1, y * 2 + 1);
+	
+	Level& level = m_levels[level_idx];
+	uint32_t* dst;
+	if (level_idx == (int)m_levels.size() - 1) {
+		dst = m_dst.data() + y * m_dst.wordsPerLine();
+	} else {
+		dst = &level.lines[(y & 1) * level.wpl];
+	}
+	
+	reduceLine(level.threshold, top, bottom, dst, level.stepsPerLine);
+	return dst;
 }
 
 } // anonymous namespace
@@ -163,63 +339,53 @@ ReduceThreshold::reduce(int const threshold)
 	uint32_t const* src_line = src.data();
 	uint32_t* dst_line = dst.data();
 	
-	uint32_t word;
+	for (int i = dst_h; i > 0; --i) {
+		reduceLine(threshold, src_line, src_line + src_wpl, dst_line, steps_per_line);
+		src_line += src_wpl * 2;
+		dst_line += dst_wpl;
+	}
 	
-	if (threshold == 1) {
-		for (int i = dst_h; i > 0; --i) {
-			for (int j = 0; j < steps_per_line; j += 2) {
-				word = threshold1(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] = compressBitsUpperHalf(word);
-			}
-			for (int j = 1; j < steps_per_line; j += 2) {
-				word = threshold1(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] |= compressBitsLowerHalf(word);
-			}
-			src_line += src_wpl * 2;
-			dst_line += dst_wpl;
-		}
-	} else if (threshold == 2) {
-		for (int i = dst_h; i > 0; --i) {
-			for (int j = 0; j < steps_per_line; j += 2) {
-				word = threshold2(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] = compressBitsUpperHalf(word);
-			}
-			for (int j = 1; j < steps_per_line; j += 2) {
-				word = threshold2(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] |= compressBitsLowerHalf(word);
-			}
-			src_line += src_wpl * 2;
-			dst_line += dst_wpl;
-		}
-	} else if (threshold == 3) {
-		for (int i = dst_h; i > 0; --i) {
-			for (int j = 0; j < steps_per_line; j += 2) {
-				word = threshold3(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] = compressBitsUpperHalf(word);
-			}
-			for (int j = 1; j < steps_per_line; j += 2) {
-				word = threshold3(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] |= compressBitsLowerHalf(word);
-			}
-			src_line += src_wpl * 2;
-			dst_line += dst_wpl;
+	m_image = dst;
+	return *this;
+}
+
+ReduceThreshold&
+ReduceThreshold::reduce(std::vector<int> const& thresholds)
+{
+	int const num_reductions = thresholds.size();
+	for (int i = 0; i < num_reductions; ++i) {
+		if (thresholds[i] < 1 || thresholds[i] > 4) {
+			throw std::invalid_argument("ReduceThreshold: invalid threshold");
 		}
-	} else if (threshold == 4) {
-		for (int i = dst_h; i > 0; --i) {
-			for (int j = 0; j < steps_per_line; j += 2) {
-				word = threshold4(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] = compressBitsUpperHalf(word);
-			}
-			for (int j = 1; j < steps_per_line; j += 2) {
-				word = threshold4(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] |= compressBitsLowerHalf(word);
-			}
-			src_line += src_wpl * 2;
-			dst_line += dst_wpl;
+	}
+	
+	if (m_image.isNull()) {
+		return *this;
+	}
+	
+	// Lines 1 pixel thick are handled by the regular reduce(),
+	// which is cheap at that point anyway.
+	int num_levels = 0;
+	int width = m_image.width();
+	int height = m_image.height();
+	for (; num_levels < num_reductions; ++num_levels) {
+		if (width < 2 || height < 2) {
+			break;
 		}
+		width /= 2;
+		height /= 2;
+	}
+	
+	if (num_levels > 1) {
+		m_image = PyramidReducer(m_image, &thresholds[0], num_levels).reduce();
+	} else {
+		num_levels = 0;
+	}
+	
+	for (int i = num_levels; i < num_reductions; ++i) {
+		reduce(thresholds[i]);
 	}
 	
-	m_image = dst;
 	return *this;
 }
 
@@ -242,38 +408,9 @@ ReduceThreshold::reduceHorLine(int const threshold)
 	assert(steps_per_line <= src.wordsPerLine());
 	assert(steps_per_line / 2 <= dst.wordsPerLine());
 	
-	uint32_t word;
-	
-	switch (threshold) {
-		case 1:
-		case 2: {
-			for (int j = 0; j < steps_per_line; j += 2) {
-				word = src_line[j];
-				word |= word << 1;
-				dst_line[j / 2] = compressBitsUpperHalf(word);
-			}
-			for (int j = 1; j < steps_per_line; j += 2) {
-				word = src_line[j];
-				word |= word << 1;
-				dst_line[j / 2] |= compressBitsLowerHalf(word);
-			}
-			break;
-		}
-		case 3:
-		case 4: {
-			for (int j = 0; j < steps_per_line; j += 2) {
-				word = src_line[j];
-				word &= word << 1;
-				dst_line[j / 2] = compressBitsUpperHalf(word);
-			}
-			for (int j = 1; j < steps_per_line; j += 2) {
-				word = src_line[j];
-				word &= word << 1;
-				dst_line[j / 2] |= compressBitsLowerHalf(word);
-			}
-			break;
-		}
-	}
+	// With both lines being the same, thresholds 1 and 2 give the same
+	// result, and so do 3 and 4.
+	reduceLine(threshold, src_line, src_line, dst_line, steps_per_line);
 	
 	m_image = dst;
 }
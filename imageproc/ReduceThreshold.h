@@ -20,6 +20,7 @@
 #define IMAGEPROC_REDUCETHRESHOLD_H_
 
 #include "BinaryImage.h"
+#include <vector>
 
 namespace imageproc
 {
@@ -48,6 +49,15 @@ namespace imageproc
  * \code
  * BinaryImage out = ReduceThreshold(input)(4)(4)(3);
  * \endcode
+ * When intermediate results aren't needed, the same can be done
+ * in a single pass over the image:
+ * \code
+ * std::vector<int> thresholds;
+ * thresholds.push_back(4);
+ * thresholds.push_back(4);
+ * thresholds.push_back(3);
+ * BinaryImage out = ReduceThreshold(input).reduce(thresholds);
+ * \endcode
  */
 class ReduceThreshold
 {
@@ -72,6 +82,16 @@ public:
 	 */
 	ReduceThreshold& reduce(int threshold);
 	
+	/**
+	 * \brief Performs a series of reductions and returns *this.
+	 *
+	 * The result is the same as calling reduce(int) for each threshold
+	 * in turn, but the lines of intermediate images are reduced further
+	 * while they are still in cache, and only two lines of each are
+	 * kept in memory.
+	 */
+	ReduceThreshold& reduce(std::vector<int> const& thresholds);
+	
 	/**
 	 * \brief Operator () performs a reduction and returns *this.
 	 */
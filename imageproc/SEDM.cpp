@@ -25,7 +25,10 @@
 #include "Morphology.h"
 #include "SeedFill.h"
 #include "RasterOp.h"
+#include "ParallelRows.h"
+#include <QSize>
 #include <algorithm>
+#include <vector>
 #include <string.h>
 #include <math.h>
 #include <assert.h>
@@ -37,6 +40,268 @@ namespace imageproc
 // It exists to make sure INF_DIST + 1 doesn't overflow.
 uint32_t const SEDM::INF_DIST = ~uint32_t(0) - 1;
 
+namespace
+{
+
+int const MIN_ROWS_PER_BAND = 16;
+
+inline uint32_t distSq(int const x1, int const x2, uint32_t const dy_sq)
+{
+	if (dy_sq == SEDM::INF_DIST) {
+		return SEDM::INF_DIST;
+	}
+	int const dx = x1 - x2;
+	uint32_t const dx_sq = dx * dx;
+	return dx_sq + dy_sq;
+}
+
+/**
+ * \brief The first, vertical pass over the padded grid.
+ *
+ * Columns are independent of each other at this stage.  Instead of
+ * going down a single column at a time, we process a vertical strip
+ * of columns row by row, which is a lot more cache friendly.
+ * Different strips are processed in parallel.
+ *
+ * If \p labels is not null, labels get propagated along with distances.
+ */
+class ColumnPass : public RowRangeProcessor
+{
+public:
+	ColumnPass(uint32_t* sqd, uint32_t* labels, int width, int height)
+	: m_pSqd(sqd), m_pLabels(labels), m_width(width), m_height(height) {}
+	
+	int numStrips() const { return (m_width + STRIP_WIDTH - 1) / STRIP_WIDTH; }
+	
+	/**
+	 * Processes strips (not rows!) [begin, end).
+	 */
+	virtual void processRows(int begin, int end) const;
+private:
+	enum { STRIP_WIDTH = 64 };
+	
+	void processStrip(int x0, int x1) const;
+	
+	uint32_t* m_pSqd;
+	uint32_t* m_pLabels;
+	int m_width;
+	int m_height;
+};
+
+void
+ColumnPass::processRows(int const begin, int const end) const
+{
+	for (int strip = begin; strip < end; ++strip) {
+		int const x0 = strip * STRIP_WIDTH;
+		processStrip(x0, std::min(x0 + STRIP_WIDTH, m_width));
+	}
+}
+
+void
+ColumnPass::processStrip(int const x0, int const x1) const
+{
+	int const strip_width = x1 - x0;
+	int const stride = m_width;
+	
+	// (d + 1)^2 = d^2 + 2d + 1
+	// These are the 2d + 1 terms of the above formula.
+	uint32_t b[STRIP_WIDTH];
+	
+	// Top to bottom.
+	std::fill(b, b + strip_width, 1);
+	uint32_t* line = m_pSqd + x0;
+	uint32_t* label_line = m_pLabels ? m_pLabels + x0 : 0;
+	for (int y = 1; y < m_height; ++y) {
+		uint32_t const* const prev_line = line;
+		line += stride;
+		for (int i = 0; i < strip_width; ++i) {
+			uint32_t const sqd = prev_line[i] + b[i];
+			if (sqd < line[i]) {
+				line[i] = sqd;
+				b[i] += 2;
+			} else {
+				b[i] = 1;
+			}
+		}
+		if (label_line) {
+			label_line += stride;
+			for (int i = 0; i < strip_width; ++i) {
+				if (b[i] != 1) {
+					label_line[i] = label_line[i - stride];
+				}
+			}
+		}
+	}
+	
+	// Bottom to top.
+	std::fill(b, b + strip_width, 1);
+	for (int y = m_height - 2; y >= 0; --y) {
+		uint32_t const* const prev_line = line;
+		line -= stride;
+		for (int i = 0; i < strip_width; ++i) {
+			uint32_t const sqd = prev_line[i] + b[i];
+			if (sqd < line[i]) {
+				line[i] = sqd;
+				b[i] += 2;
+			} else {
+				b[i] = 1;
+			}
+		}
+		if (label_line) {
+			label_line -= stride;
+			for (int i = 0; i < strip_width; ++i) {
+				if (b[i] != 1) {
+					label_line[i] = label_line[i + stride];
+				}
+			}
+		}
+	}
+}
+
+/**
+ * \brief The second, horizontal pass over the padded grid.
+ *
+ * Rows are independent of each other at this stage,
+ * so bands of rows are processed in parallel.
+ *
+ * If \p labels is not null, labels get propagated along with distances.
+ */
+class RowPass : public RowRangeProcessor
+{
+public:
+	RowPass(uint32_t* sqd, uint32_t* labels, int width)
+	: m_pSqd(sqd), m_pLabels(labels), m_width(width) {}
+	
+	virtual void processRows(int begin, int end) const;
+private:
+	uint32_t* m_pSqd;
+	uint32_t* m_pLabels;
+	int m_width;
+};
+
+void
+RowPass::processRows(int const begin, int const end) const
+{
+	int const width = m_width;
+	
+	std::vector<int> s(width, 0);
+	std::vector<int> t(width, 0);
+	std::vector<uint32_t> row_copy(width, 0);
+	std::vector<uint32_t> label_row_copy(m_pLabels ? width : 0, 0);
+	
+	for (int y = begin; y < end; ++y) {
+		uint32_t* const line = m_pSqd + y * width;
+		
+		int q = 0;
+		s[0] = 0;
+		t[0] = 0;
+		for (int x = 1; x < width; ++x) {
+			while (q >= 0 && distSq(t[q], s[q], line[s[q]])
+					> distSq(t[q], x, line[x])) {
+				--q;
+			}
+			
+			if (q < 0) {
+				q = 0;
+				s[0] = x;
+			} else {
+				int const x2 = s[q];
+				if (line[x] != SEDM::INF_DIST && line[x2] != SEDM::INF_DIST) {
+					int w = (x * x + line[x]) - (x2 * x2 + line[x2]);
+					w /= (x - x2) << 1;
+					++w;
+					if ((unsigned)w < (unsigned)width) {
+						++q;
+						s[q] = x;
+						t[q] = w;
+					}
+				}
+			}
+		}
+		
+		memcpy(&row_copy[0], line, width * sizeof(*line));
+		
+		if (m_pLabels) {
+			uint32_t* const label_line = m_pLabels + y * width;
+			memcpy(&label_row_copy[0], label_line, width * sizeof(*label_line));
+			
+			for (int x = width - 1; x >= 0; --x) {
+				int const x2 = s[q];
+				line[x] = distSq(x, x2, row_copy[x2]);
+				label_line[x] = label_row_copy[x2];
+				if (x == t[q]) {
+					--q;
+				}
+			}
+		} else {
+			for (int x = width - 1; x >= 0; --x) {
+				int const x2 = s[q];
+				line[x] = distSq(x, x2, row_copy[x2]);
+				if (x == t[q]) {
+					--q;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * \brief Marks cells not having neighbors with a greater value.
+ *
+ * Works on bands of non-padded rows, taking padding into account
+ * as neighbors.
+ */
+class PeakCandidateRows : public RowRangeProcessor
+{
+public:
+	PeakCandidateRows(
+		uint32_t const* data, int stride, int width, BinaryImage& dst)
+	:	m_pData(data), m_stride(stride), m_width(width),
+		m_pDst(dst.data()), m_dstWpl(dst.wordsPerLine()) {}
+	
+	virtual void processRows(int begin, int end) const;
+private:
+	uint32_t const* m_pData;
+	int m_stride;
+	int m_width;
+	uint32_t* m_pDst;
+	int m_dstWpl;
+};
+
+void
+PeakCandidateRows::processRows(int const begin, int const end) const
+{
+	int const padded_width = m_width + 2;
+	std::vector<uint32_t> col_max(padded_width);
+	uint32_t const msb = uint32_t(1) << 31;
+	
+	for (int y = begin; y < end; ++y) {
+		uint32_t const* const line = m_pData + y * m_stride;
+		uint32_t* const dst_line = m_pDst + y * m_dstWpl;
+		
+		// The maximum of each column over this line and its neighbors,
+		// including the padding columns.
+		uint32_t const* const padded_line = line - 1;
+		for (int x = 0; x < padded_width; ++x) {
+			uint32_t const prev = padded_line[x - m_stride];
+			uint32_t const cur = padded_line[x];
+			uint32_t const next = padded_line[x + m_stride];
+			col_max[x] = std::max(prev, std::max(cur, next));
+		}
+		
+		for (int x = 0; x < m_width; ++x) {
+			uint32_t const max = std::max(
+				col_max[x], std::max(col_max[x + 1], col_max[x + 2])
+			);
+			if (max == line[x]) {
+				dst_line[x >> 5] |= msb >> (x & 31);
+			}
+		}
+	}
+}
+
+} // anonymous namespace
+
 SEDM::SEDM()
 :	m_pData(0),
 	m_size(),
@@ -219,197 +484,35 @@ SEDM::findPeaksDestructive()
 	return peak_candidates;
 }
 
-inline uint32_t
-SEDM::distSq(
-	int const x1, int const x2, uint32_t const dy_sq)
-{
-	if (dy_sq == INF_DIST) {
-		return INF_DIST;
-	}
-	int const dx = x1 - x2;
-	uint32_t const dx_sq = dx * dx;
-	return dx_sq + dy_sq;
-}
-
 void
 SEDM::processColumns()
 {
-	int const width = m_size.width() + 2;
-	int const height = m_size.height() + 2;
-	
-	uint32_t* p_sqd = &m_data[0];
-	for (int x = 0; x < width; ++x, ++p_sqd) {
-		// (d + 1)^2 = d^2 + 2d + 1
-		uint32_t b = 1; // 2d + 1 in the above formula.
-		for (int todo = height - 1; todo > 0; --todo) {
-			uint32_t const sqd = *p_sqd + b;
-			p_sqd += width;
-			if (*p_sqd > sqd) {
-				*p_sqd = sqd;
-				b += 2;
-			} else {
-				b = 1;
-			}
-		}
-		
-		b = 1;
-		for (int todo = height - 1; todo > 0; --todo) {
-			uint32_t const sqd = *p_sqd + b;
-			p_sqd -= width;
-			if (*p_sqd > sqd) {
-				*p_sqd = sqd;
-				b += 2;
-			} else {
-				b = 1;
-			}
-		}
-	}
+	ColumnPass const pass(&m_data[0], 0, m_size.width() + 2, m_size.height() + 2);
+	processRowsInParallel(pass, pass.numStrips(), 1);
 }
 
 void
 SEDM::processColumns(ConnectivityMap& cmap)
 {
-	int const width = m_size.width() + 2;
-	int const height = m_size.height() + 2;
-	
-	uint32_t* p_sqd = &m_data[0];
-	uint32_t* p_label = cmap.paddedData();
-	for (int x = 0; x < width; ++x, ++p_sqd, ++p_label) {
-		// (d + 1)^2 = d^2 + 2d + 1
-		uint32_t b = 1; // 2d + 1 in the above formula.
-		for (int todo = height - 1; todo > 0; --todo) {
-			uint32_t const sqd = *p_sqd + b;
-			p_sqd += width;
-			p_label += width;
-			if (sqd < *p_sqd) {
-				*p_sqd = sqd;
-				*p_label = p_label[-width];
-				b += 2;
-			} else {
-				b = 1;
-			}
-		}
-		
-		b = 1;
-		for (int todo = height - 1; todo > 0; --todo) {
-			uint32_t const sqd = *p_sqd + b;
-			p_sqd -= width;
-			p_label -= width;
-			if (sqd < *p_sqd) {
-				*p_sqd = sqd;
-				*p_label = p_label[width];
-				b += 2;
-			} else {
-				b = 1;
-			}
-		}
-	}
+	ColumnPass const pass(
+		&m_data[0], cmap.paddedData(),
+		m_size.width() + 2, m_size.height() + 2
+	);
+	processRowsInParallel(pass, pass.numStrips(), 1);
 }
 
 void
 SEDM::processRows()
 {
-	int const width = m_size.width() + 2;
-	int const height = m_size.height() + 2;
-	
-	std::vector<int> s(width, 0);
-	std::vector<int> t(width, 0);
-	std::vector<uint32_t> row_copy(width, 0);
-	
-	uint32_t* line = &m_data[0];
-	for (int y = 0; y < height; ++y, line += width) {
-		int q = 0;
-		s[0] = 0;
-		t[0] = 0;
-		for (int x = 1; x < width; ++x) {
-			while (q >= 0 && distSq(t[q], s[q], line[s[q]])
-					> distSq(t[q], x, line[x])) {
-				--q;
-			}
-			
-			if (q < 0) {
-				q = 0;
-				s[0] = x;
-			} else {
-				int const x2 = s[q];
-				if (line[x] != INF_DIST && line[x2] != INF_DIST) {
-					int w = (x * x + line[x]) - (x2 * x2 + line[x2]);
-					w /= (x - x2) << 1;
-					++w;
-					if ((unsigned)w < (unsigned)width) {
-						++q;
-						s[q] = x;
-						t[q] = w;
-					}
-				}
-			}
-		}
-		
-		memcpy(&row_copy[0], line, width * sizeof(*line));
-		
-		for (int x = width - 1; x >= 0; --x) {
-			int const x2 = s[q];
-			line[x] = distSq(x, x2, row_copy[x2]);
-			if (x == t[q]) {
-				--q;
-			}
-		}
-	}
+	RowPass const pass(&m_data[0], 0, m_size.width() + 2);
+	processRowsInParallel(pass, m_size.height() + 2, MIN_ROWS_PER_BAND);
 }
 
 void
 SEDM::processRows(ConnectivityMap& cmap)
 {
-	int const width = m_size.width() + 2;
-	int const height = m_size.height() + 2;
-	
-	std::vector<int> s(width, 0);
-	std::vector<int> t(width, 0);
-	std::vector<uint32_t> row_copy(width, 0);
-	std::vector<uint32_t> cmap_row_copy(width, 0);
-	
-	uint32_t* line = &m_data[0];
-	uint32_t* cmap_line = cmap.paddedData();
-	for (int y = 0; y < height; ++y, line += width, cmap_line += width) {
-		int q = 0;
-		s[0] = 0;
-		t[0] = 0;
-		for (int x = 1; x < width; ++x) {
-			while (q >= 0 && distSq(t[q], s[q], line[s[q]])
-					> distSq(t[q], x, line[x])) {
-				--q;
-			}
-			
-			if (q < 0) {
-				q = 0;
-				s[0] = x;
-			} else {
-				int const x2 = s[q];
-				if (line[x] != INF_DIST && line[x2] != INF_DIST) {
-					int w = (x * x + line[x]) - (x2 * x2 + line[x2]);
-					w /= (x - x2) << 1;
-					++w;
-					if ((unsigned)w < (unsigned)width) {
-						++q;
-						s[q] = x;
-						t[q] = w;
-					}
-				}
-			}
-		}
-		
-		memcpy(&row_copy[0], line, width * sizeof(*line));
-		memcpy(&cmap_row_copy[0], cmap_line, width * sizeof(*cmap_line));
-		
-		for (int x = width - 1; x >= 0; --x) {
-			int const x2 = s[q];
-			line[x] = distSq(x, x2, row_copy[x2]);
-			cmap_line[x] = cmap_row_copy[x2];
-			if (x == t[q]) {
-				--q;
-			}
-		}
-	}
+	RowPass const pass(&m_data[0], cmap.paddedData(), m_size.width() + 2);
+	processRowsInParallel(pass, m_size.height() + 2, MIN_ROWS_PER_BAND);
 }
 
 
@@ -418,115 +521,12 @@ SEDM::processRows(ConnectivityMap& cmap)
 BinaryImage
 SEDM::findPeakCandidatesNonPadded() const
 {
-	std::vector<uint32_t> maxed(m_data.size(), 0);
-	
-	// Every cell becomes the maximum of itself and its neighbors.
-	max3x3(&m_data[0], &maxed[0]);
-	
-	return buildEqualMapNonPadded(&m_data[0], &maxed[0]);
-}
-
-BinaryImage
-SEDM::buildEqualMapNonPadded(uint32_t const* src1, uint32_t const* src2) const
-{
-	int const width = m_size.width();
-	int const height = m_size.height();
-	
-	BinaryImage dst(width, height, WHITE);
-	uint32_t* dst_line = dst.data();
-	int const dst_wpl = dst.wordsPerLine();
-	int const src_stride = m_stride;
-	uint32_t const* src1_line = src1 + src_stride + 1;
-	uint32_t const* src2_line = src2 + src_stride + 1;
-	uint32_t const msb = uint32_t(1) << 31;
-	
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			if (std::max(src1_line[x], src2_line[x]) -
-				std::min(src1_line[x], src2_line[x]) == 0) {
-				dst_line[x >> 5] |= msb >> (x & 31);
-			}
-		}
-		dst_line += dst_wpl;
-		src1_line += src_stride;
-		src2_line += src_stride;
-	}
-	
+	BinaryImage dst(m_size, WHITE);
+	PeakCandidateRows const finder(m_pData, m_stride, m_size.width(), dst);
+	processRowsInParallel(finder, m_size.height(), MIN_ROWS_PER_BAND);
 	return dst;
 }
 
-void
-SEDM::max3x3(uint32_t const* src, uint32_t* dst) const
-{
-	std::vector<uint32_t> tmp(m_data.size(), 0);
-	max3x1(src, &tmp[0]);
-	max1x3(&tmp[0], dst);
-}
-
-void
-SEDM::max3x1(uint32_t const* src, uint32_t* dst) const
-{
-	int const width = m_size.width() + 2;
-	int const height = m_size.height() + 2;
-	
-	uint32_t const* src_line = &src[0];
-	uint32_t* dst_line = &dst[0];
-	
-	for (int y = 0; y < height; ++y) {
-		// First column (no left neighbors).
-		int x = 0;
-		dst_line[x] = std::max(src_line[x], src_line[x + 1]);
-		
-		for (++x; x < width - 1; ++x) {
-			uint32_t const prev = src_line[x - 1];
-			uint32_t const cur = src_line[x];
-			uint32_t const next = src_line[x + 1];
-			dst_line[x] = std::max(prev, std::max(cur, next));
-		}
-		
-		// Last column (no right neighbors).
-		dst_line[x] = std::max(src_line[x], src_line[x - 1]);
-		
-		src_line += width;
-		dst_line += width;
-	}
-}
-
-void
-SEDM::max1x3(uint32_t const* src, uint32_t* dst) const
-{
-	int const width = m_size.width() + 2;
-	int const height = m_size.height() + 2;
-	
-	// First row (no top neighbors).
-	uint32_t const* p_src = &src[0];
-	uint32_t* p_dst = &dst[0];
-	for (int x = 0; x < width; ++x) {
-		*p_dst = std::max(p_src[0], p_src[width]);
-		++p_src;
-		++p_dst;
-	}
-	
-	for (int y = 1; y < height - 1; ++y) {
-		for (int x = 0; x < width; ++x) {
-			uint32_t const prev = p_src[x - width];
-			uint32_t const cur = p_src[x];
-			uint32_t const next = p_src[x + width];
-			p_dst[x] = std::max(prev, std::max(cur, next));
-		}
-		
-		p_src += width;
-		p_dst += width;
-	}
-	
-	// Last row (no bottom neighbors).
-	for (int x = 0; x < width; ++x) {
-		*p_dst = std::max(p_src[0], p_src[-width]);
-		++p_src;
-		++p_dst;
-	}
-}
-
 void
 SEDM::incrementMaskedPadded(BinaryImage const& mask)
 {
@@ -172,8 +172,6 @@ public:
 	 */
 	BinaryImage findPeaksDestructive();
 private:
-	static uint32_t distSq(int x1, int x2, uint32_t dy_sq);
-	
 	void processColumns();
 	
 	void processColumns(ConnectivityMap& cmap);
@@ -184,14 +182,6 @@ private:
 	
 	BinaryImage findPeakCandidatesNonPadded() const;
 	
-	BinaryImage buildEqualMapNonPadded(uint32_t const* src1, uint32_t const* src2) const;
-	
-	void max3x3(uint32_t const* src, uint32_t* dst) const;
-	
-	void max3x1(uint32_t const* src, uint32_t* dst) const;
-	
-	void max1x3(uint32_t const* src, uint32_t* dst) const;
-	
 	void incrementMaskedPadded(BinaryImage const& mask);
 	
 	std::vector<uint32_t> m_data;
@@ -19,6 +19,7 @@
 #include "SeedFill.h"
 #include "SeedFillGeneric.h"
 #include "GrayImage.h"
+#include "FastQueue.h"
 #include <QSize>
 #include <QImage>
 #include <QDebug>
@@ -234,6 +235,141 @@ void seedFill8Iteration(BinaryImage& seed, BinaryImage const& mask)
 	}
 }
 
+struct WordPos
+{
+	int x; // Word index within a line.
+	int y;
+	
+	WordPos(int x_, int y_) : x(x_), y(y_) {}
+};
+
+/**
+ * \brief The queue-based part of Vincent's hybrid seed fill,
+ *        working on whole words rather than individual pixels.
+ *
+ * When a word gains black pixels, it gets queued, so that those
+ * pixels are spread into neighboring words later on.
+ */
+class BinarySeedFillQueue
+{
+public:
+	BinarySeedFillQueue(
+		BinaryImage& seed, BinaryImage const& mask, Connectivity conn);
+	
+	/**
+	 * \brief Spreads every word of the seed to its neighbors, and then
+	 *        keeps spreading the ones that changed, until nothing changes.
+	 *
+	 * The seed is expected to be clipped by the mask and to have
+	 * its off-screen bits cleared.  A raster and anti-raster
+	 * iteration will ensure that.
+	 */
+	void spreadAll();
+private:
+	void spreadWord(int x, int y);
+	
+	void addToWord(int x, int y, uint32_t bits);
+	
+	FastQueue<WordPos> m_queue;
+	uint32_t* m_pSeed;
+	uint32_t const* m_pMask;
+	int m_seedWpl;
+	int m_maskWpl;
+	int m_height;
+	int m_lastWordIdx;
+	uint32_t m_lastWordMask;
+	Connectivity m_connectivity;
+};
+
+BinarySeedFillQueue::BinarySeedFillQueue(
+	BinaryImage& seed, BinaryImage const& mask, Connectivity const conn)
+:	m_pSeed(seed.data()),
+	m_pMask(mask.data()),
+	m_seedWpl(seed.wordsPerLine()),
+	m_maskWpl(mask.wordsPerLine()),
+	m_height(seed.height()),
+	m_lastWordIdx((seed.width() - 1) >> 5),
+	m_lastWordMask(~uint32_t(0) << (((m_lastWordIdx + 1) << 5) - seed.width())),
+	m_connectivity(conn)
+{
+}
+
+void
+BinarySeedFillQueue::spreadAll()
+{
+	for (int y = 0; y < m_height; ++y) {
+		for (int x = 0; x <= m_lastWordIdx; ++x) {
+			spreadWord(x, y);
+		}
+	}
+	
+	while (!m_queue.empty()) {
+		WordPos const pos(m_queue.front());
+		m_queue.pop();
+		spreadWord(pos.x, pos.y);
+	}
+}
+
+void
+BinarySeedFillQueue::spreadWord(int const x, int const y)
+{
+	uint32_t const word = m_pSeed[y * m_seedWpl + x];
+	if (!word) {
+		return;
+	}
+	
+	// Note that the leftmost pixel is the most significant bit.
+	uint32_t const to_left = word >> 31;
+	uint32_t const to_right = word << 31;
+	
+	if (x > 0) {
+		addToWord(x - 1, y, to_left);
+	}
+	if (x < m_lastWordIdx) {
+		addToWord(x + 1, y, to_right);
+	}
+	
+	uint32_t vert = word;
+	if (m_connectivity == CONN8) {
+		vert |= (word << 1) | (word >> 1);
+	}
+	
+	for (int ny = y - 1; ny <= y + 1; ny += 2) {
+		if (ny < 0 || ny >= m_height) {
+			continue;
+		}
+		
+		addToWord(x, ny, vert);
+		
+		if (m_connectivity == CONN8) {
+			if (x > 0) {
+				addToWord(x - 1, ny, to_left);
+			}
+			if (x < m_lastWordIdx) {
+				addToWord(x + 1, ny, to_right);
+			}
+		}
+	}
+}
+
+void
+BinarySeedFillQueue::addToWord(int const x, int const y, uint32_t bits)
+{
+	uint32_t mask = m_pMask[y * m_maskWpl + x];
+	if (x == m_lastWordIdx) {
+		mask &= m_lastWordMask;
+	}
+	
+	uint32_t& word = m_pSeed[y * m_seedWpl + x];
+	bits &= mask;
+	if ((bits & ~word) == 0) {
+		return;
+	}
+	
+	word = fillWordHorizontally(word | bits, mask);
+	m_queue.push(WordPos(x, y));
+}
+
 inline uint8_t lightest(uint8_t lhs, uint8_t rhs)
 {
 	return lhs > rhs ? lhs : rhs;
@@ -504,17 +640,22 @@ BinaryImage seedFill(
 		throw std::invalid_argument("seedFill: seed and mask have different sizes");
 	}
 	
-	BinaryImage prev;
 	BinaryImage img(seed);
+	if (img.isNull()) {
+		return img;
+	}
 	
-	do {
-		prev = img;
-		if (connectivity == CONN4) {
-			seedFill4Iteration(img, mask);
-		} else {
-			seedFill8Iteration(img, mask);
-		}
-	} while (img != prev);
+	// A raster and an anti-raster scan do most of the work.
+	// Whatever they miss is done by spreading changes from a queue,
+	// which takes care of shapes that would otherwise take many
+	// more scans to converge.
+	if (connectivity == CONN4) {
+		seedFill4Iteration(img, mask);
+	} else {
+		seedFill8Iteration(img, mask);
+	}
+	
+	BinarySeedFillQueue(img, mask, connectivity).spreadAll();
 	
 	return img;
 }
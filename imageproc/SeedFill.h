@@ -39,8 +39,10 @@ class GrayImage;
  * \p seed is allowed to contain black pixels that are not in \p mask.
  * They will be ignored and will not appear in the resulting image.
  * \par
- * The underlying code implements Luc Vincent's iterative seed-fill
- * algorithm: http://www.vincent-net.com/luc/papers/93ieeeip_recons.pdf
+ * The underlying code implements Luc Vincent's hybrid seed-fill algorithm:
+ * http://www.vincent-net.com/luc/papers/93ieeeip_recons.pdf
+ * Its queue-based phase works on 32-pixel words rather than on
+ * individual pixels.
  */
 BinaryImage seedFill(
 	BinaryImage const& seed, BinaryImage const& mask,
@@ -17,18 +17,144 @@
 */
 
 #include "Shear.h"
-#include "RasterOp.h"
 #include "BinaryImage.h"
-#include <QRect>
-#include <QPoint>
+#include "AlignedArray.h"
+#include "Sse2.h"
+#include <vector>
+#include <algorithm>
 #include <stdexcept>
+#include <string.h>
 #include <math.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 
 namespace imageproc
 {
 
+namespace
+{
+
+/**
+ * \brief A range of columns [x1, x2) sharing the same shift,
+ *        expressed as words and masks.
+ *
+ * If firstWord == lastWord, firstMask covers the whole range
+ * and lastMask is not used.
+ */
+struct ShiftedRun
+{
+	int firstWord;
+	int lastWord;
+	uint32_t firstMask;
+	uint32_t lastMask;
+	int shift;
+	int numPixels;
+};
+
+/**
+ * \brief Tells if all lines have a zero shift, so dst = src is all it takes.
+ */
+bool isIdentityShear(double const shear, double const origin, int const len)
+{
+	double const shift = 0.5 + shear * (0.5 - origin);
+	double const shift_end = 0.5 + shear * (len - 0.5 - origin);
+	return floor(shift) == floor(shift_end);
+}
+
+/**
+ * \brief Builds a table of shift = floor(0.5 + shear * (i + 0.5 - origin)).
+ *
+ * The value is accumulated incrementally, so that band boundaries
+ * are exactly where they have always been.
+ */
+void calcShifts(
+	std::vector<int>& shifts, int const len,
+	double const shear, double const origin)
+{
+	shifts.resize(len);
+	double shift = 0.5 + shear * (0.5 - origin);
+	for (int i = 0; i < len; ++i, shift += shear) {
+		shifts[i] = (int)floor(shift);
+	}
+}
+
+/**
+ * \brief Splits columns into runs having the same shift.
+ */
+void buildRuns(std::vector<ShiftedRun>& runs, std::vector<int> const& shifts)
+{
+	int const width = shifts.size();
+	runs.clear();
+	
+	int x1 = 0;
+	for (int x2 = 1; x2 <= width; ++x2) {
+		if (x2 != width && shifts[x2] == shifts[x1]) {
+			continue;
+		}
+		
+		ShiftedRun run;
+		run.firstWord = x1 >> 5;
+		run.lastWord = (x2 - 1) >> 5;
+		run.firstMask = ~uint32_t(0) >> (x1 & 31);
+		run.lastMask = ~uint32_t(0) << (31 - ((x2 - 1) & 31));
+		if (run.firstWord == run.lastWord) {
+			run.firstMask &= run.lastMask;
+		}
+		run.shift = shifts[x1];
+		run.numPixels = x2 - x1;
+		runs.push_back(run);
+		
+		x1 = x2;
+	}
+}
+
+inline uint32_t blend(uint32_t const dst, uint32_t const src, uint32_t const mask)
+{
+	return (dst & ~mask) | (src & mask);
+}
+
+/**
+ * \brief Copies the pixels of a run from one line to another.
+ */
+inline void copyRun(ShiftedRun const& run, uint32_t const* src, uint32_t* dst)
+{
+	int const fw = run.firstWord;
+	int const lw = run.lastWord;
+	dst[fw] = blend(dst[fw], src[fw], run.firstMask);
+	if (fw != lw) {
+		for (int i = fw + 1; i < lw; ++i) {
+			dst[i] = src[i];
+		}
+		dst[lw] = blend(dst[lw], src[lw], run.lastMask);
+	}
+}
+
+/**
+ * \brief Same as countNonZeroBits(), but without table lookups.
+ */
+inline int countBits(uint32_t x)
+{
+	x -= (x >> 1) & 0x55555555;
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0F0F0F0F;
+	return (x * 0x01010101) >> 24;
+}
+
+/**
+ * \brief The part of a ShiftedRun that falls into a single word.
+ */
+struct ShiftedPiece
+{
+	int word;
+	uint32_t mask;
+	int shift;
+	
+	ShiftedPiece(int w, uint32_t m, int s) : word(w), mask(m), shift(s) {}
+};
+
+} // anonymous namespace
+
 void hShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
 	double const y_origin, BWColor const background_color)
 {
@@ -42,57 +168,71 @@ void hShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
 	int const width = src.width();
 	int const height = src.height();
 	
-	// shift = floor(0.5 + shear * (y + 0.5 - y_origin));
-	double shift = 0.5 + shear * (0.5 - y_origin);
-	double const shift_end = 0.5 + shear * (height - 0.5 - y_origin);
-	int shift1 = (int)floor(shift);
-	
-	if (shift1 == floor(shift_end)) {
-		assert(shift1 == 0);
+	if (isIdentityShear(shear, y_origin, height)) {
 		dst = src;
 		return;
 	}
 	
-	int shift2 = shift1;
-	int y1 = 0;
-	int y2 = 0;
-	for (;;) {
-		++y2;
-		shift += shear;
-		shift2 = (int)floor(shift);
-		if (shift1 != shift2 || y2 == height) {
-			int const block_height = y2 - y1;
-			if (abs(shift1) >= width) {
-				// The shifted block would be completely off the image.
-				QRect const fr(0, y1, width, block_height);
-				dst.fill(fr, background_color);
-			} else if (shift1 < 0) {
-				// Shift to the left.
-				QRect const dr(0, y1, width + shift1, block_height);
-				QPoint const sp(-shift1, y1);
-				rasterOp<RopSrc>(dst, dr, src, sp);
-				QRect const fr(width + shift1, y1, -shift1, block_height);
-				dst.fill(fr, background_color);
-			} else if (shift1 > 0) {
-				// Shift to the right.
-				QRect const dr(shift1, y1, width - shift1, block_height);
-				QPoint const sp(0, y1);
-				rasterOp<RopSrc>(dst, dr, src, sp);
-				QRect const fr(0, y1, shift1, block_height);
-				dst.fill(fr, background_color);
-			} else {
-				// No shift, just copy.
-				QRect const dr(0, y1, width, block_height);
-				QPoint const sp(0, y1);
-				rasterOp<RopSrc>(dst, dr, src, sp);
+	std::vector<int> shifts;
+	calcShifts(shifts, height, shear, y_origin);
+	
+	int const wpl = src.wordsPerLine();
+	int const last_word_idx = wpl - 1;
+	uint32_t const last_word_mask = ~uint32_t(0) << (31 - ((width - 1) & 31));
+	uint32_t const bg_word = background_color == WHITE ? 0 : ~uint32_t(0);
+	
+	// The line being shifted goes into the middle of the buffer,
+	// with one line worth of background on each side of it.
+	// That makes any shift below width a matter of taking 32 bits
+	// at some offset.  It also makes in-place operation possible.
+	std::vector<uint32_t> buf(wpl * 3, bg_word);
+	uint32_t* const buf_line = &buf[wpl];
+	
+	uint32_t const* src_line = src.data();
+	uint32_t* dst_line = dst.data();
+	
+	for (int y = 0; y < height; ++y, src_line += wpl, dst_line += wpl) {
+		int const shift = shifts[y];
+		
+		if (abs(shift) >= width) {
+			// The shifted line would be completely off the image.
+			for (int i = 0; i < last_word_idx; ++i) {
+				dst_line[i] = bg_word;
 			}
-			
-			if (y2 == height) {
-				break;
+			dst_line[last_word_idx] = blend(
+				dst_line[last_word_idx], bg_word, last_word_mask
+			);
+			continue;
+		}
+		
+		memcpy(buf_line, src_line, wpl * 4);
+		buf_line[last_word_idx] = blend(
+			bg_word, buf_line[last_word_idx], last_word_mask
+		);
+		
+		// Bit offset of dst_line[0] in buf, counting from the start.
+		int const offset = wpl * 32 - shift;
+		int const word_offset = offset >> 5;
+		int const bit_offset = offset & 31;
+		uint32_t const* const s = &buf[word_offset];
+		
+		if (bit_offset == 0) {
+			for (int i = 0; i < last_word_idx; ++i) {
+				dst_line[i] = s[i];
 			}
-			
-			y1 = y2;
-			shift1 = shift2;
+			dst_line[last_word_idx] = blend(
+				dst_line[last_word_idx], s[last_word_idx], last_word_mask
+			);
+		} else {
+			int const rshift = 32 - bit_offset;
+			for (int i = 0; i < last_word_idx; ++i) {
+				dst_line[i] = (s[i] << bit_offset) | (s[i + 1] >> rshift);
+			}
+			uint32_t const last = (s[last_word_idx] << bit_offset)
+				| (s[last_word_idx + 1] >> rshift);
+			dst_line[last_word_idx] = blend(
+				dst_line[last_word_idx], last, last_word_mask
+			);
 		}
 	}
 }
@@ -110,59 +250,161 @@ void vShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
 	int const width = src.width();
 	int const height = src.height();
 	
-	// shift = floor(0.5 + shear * (x + 0.5 - x_origin));
-	double shift = 0.5 + shear * (0.5 - x_origin);
-	double const shift_end = 0.5 + shear * (width - 0.5 - x_origin);
-	int shift1 = (int)floor(shift);
-	
-	if (shift1 == floor(shift_end)) {
-		assert(shift1 == 0);
+	if (isIdentityShear(shear, x_origin, width)) {
 		dst = src;
 		return;
 	}
 	
-	int shift2 = shift1;
-	int x1 = 0;
-	int x2 = 0;
-	for (;;) {
-		++x2;
-		shift += shear;
-		shift2 = (int)floor(shift);
-		if (shift1 != shift2 || x2 == width) {
-			int const block_width = x2 - x1;
-			if (abs(shift1) >= height) {
-				// The shifted block would be completely off the image.
-				QRect const fr(x1, 0, block_width, height);
-				dst.fill(fr, background_color);
-			} else if (shift1 < 0) {
-				// Shift upwards.
-				QRect const dr(x1, 0, block_width, height + shift1);
-				QPoint const sp(x1, -shift1);
-				rasterOp<RopSrc>(dst, dr, src, sp);
-				QRect const fr(x1, height + shift1, block_width, -shift1);
-				dst.fill(fr, background_color);
-			} else if (shift1 > 0) {
-				// Shift downwards.
-				QRect const dr(x1, shift1, block_width, height - shift1);
-				QPoint const sp(x1, 0);
-				rasterOp<RopSrc>(dst, dr, src, sp);
-				QRect const fr(x1, 0, block_width, shift1);
-				dst.fill(fr, background_color);
-			} else {
-				// No shift, just copy.
-				QRect const dr(x1, 0, block_width, height);
-				QPoint const sp(x1, 0);
-				rasterOp<RopSrc>(dst, dr, src, sp);
+	std::vector<int> shifts;
+	calcShifts(shifts, width, shear, x_origin);
+	std::vector<ShiftedRun> runs;
+	buildRuns(runs, shifts);
+	
+	// Lines are built from different lines of the source, so in-place
+	// operation needs a copy.  Holding a reference to the source data
+	// makes dst.data() trigger copy-on-write in that case.
+	BinaryImage const source(src);
+	
+	int const src_wpl = source.wordsPerLine();
+	int const dst_wpl = dst.wordsPerLine();
+	uint32_t const* const src_data = source.data();
+	uint32_t* dst_line = dst.data();
+	
+	std::vector<uint32_t> const bg_line(
+		src_wpl, background_color == WHITE ? 0 : ~uint32_t(0)
+	);
+	
+	std::vector<ShiftedRun>::const_iterator const runs_end(runs.end());
+	for (int y = 0; y < height; ++y, dst_line += dst_wpl) {
+		std::vector<ShiftedRun>::const_iterator run(runs.begin());
+		for (; run != runs_end; ++run) {
+			int const src_y = y - run->shift;
+			uint32_t const* src_line = &bg_line[0];
+			if (src_y >= 0 && src_y < height) {
+				src_line = src_data + src_y * src_wpl;
 			}
+			copyRun(*run, src_line, dst_line);
+		}
+	}
+}
+
+std::vector<int> vShearProjection(
+	BinaryImage const& src, double const shear,
+	double const x_origin, BWColor const background_color)
+{
+	if (src.isNull()) {
+		throw std::invalid_argument("Can't shear a null image");
+	}
+	
+	int const width = src.width();
+	int const height = src.height();
+	
+	std::vector<int> shifts;
+	if (isIdentityShear(shear, x_origin, width)) {
+		shifts.resize(width, 0);
+	} else {
+		calcShifts(shifts, width, shear, x_origin);
+	}
+	std::vector<ShiftedRun> runs;
+	buildRuns(runs, shifts);
+	
+	// Splitting runs into per-word pieces makes the inner loop trivial.
+	// Runs shifted completely off the image don't contribute anything
+	// but the background.
+	std::vector<ShiftedPiece> pieces;
+	int margin = 0;
+	std::vector<ShiftedRun>::const_iterator const runs_end(runs.end());
+	std::vector<ShiftedRun>::const_iterator run(runs.begin());
+	for (; run != runs_end; ++run) {
+		if (abs(run->shift) >= height) {
+			continue;
+		}
+		margin = std::max(margin, abs(run->shift));
+		if (run->firstWord == run->lastWord) {
+			pieces.push_back(ShiftedPiece(run->firstWord, run->firstMask, run->shift));
+			continue;
+		}
+		pieces.push_back(ShiftedPiece(run->firstWord, run->firstMask, run->shift));
+		for (int i = run->firstWord + 1; i < run->lastWord; ++i) {
+			pieces.push_back(ShiftedPiece(i, ~uint32_t(0), run->shift));
+		}
+		pieces.push_back(ShiftedPiece(run->lastWord, run->lastMask, run->shift));
+	}
+	
+	// With the margins, lines shifted outside of the image
+	// don't need any checks.
+	std::vector<int> counts(height + margin * 2, 0);
+	
+	int const wpl = src.wordsPerLine();
+	uint32_t const* line = src.data();
+	std::vector<ShiftedPiece>::const_iterator const pieces_end(pieces.end());
+	int y = 0;
+	
+#ifdef IMAGEPROC_HAVE_SSE2
+	// Four lines at a time, with lane k of every vector belonging to
+	// line y + k.  The counts of those lines for a piece then go to
+	// 4 adjacent histogram slots, whatever the shift is.  Words of the
+	// 4 lines are interleaved beforehand, so a piece takes a single load.
+	AlignedArray<uint32_t, 4> quads(wpl * 4);
+	__m128i const m1 = _mm_set1_epi32(0x55555555);
+	__m128i const m2 = _mm_set1_epi32(0x33333333);
+	__m128i const m4 = _mm_set1_epi32(0x0f0f0f0f);
+	__m128i const m6 = _mm_set1_epi32(0x3f);
+	for (; y + 4 <= height; y += 4, line += wpl * 4) {
+		for (int i = 0; i < wpl; ++i) {
+			quads[i * 4] = line[i];
+			quads[i * 4 + 1] = line[i + wpl];
+			quads[i * 4 + 2] = line[i + wpl * 2];
+			quads[i * 4 + 3] = line[i + wpl * 3];
+		}
+		
+		int* const dst_counts = &counts[y + margin];
+		std::vector<ShiftedPiece>::const_iterator piece(pieces.begin());
+		for (; piece != pieces_end; ++piece) {
+			__m128i v = _mm_load_si128((__m128i const*)&quads[piece->word * 4]);
+			v = _mm_and_si128(v, _mm_set1_epi32(piece->mask));
+			v = _mm_sub_epi32(v, _mm_and_si128(_mm_srli_epi32(v, 1), m1));
+			v = _mm_add_epi32(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi32(v, 2), m2));
+			v = _mm_and_si128(_mm_add_epi32(v, _mm_srli_epi32(v, 4)), m4);
+			v = _mm_add_epi32(v, _mm_srli_epi32(v, 8));
+			v = _mm_and_si128(_mm_add_epi32(v, _mm_srli_epi32(v, 16)), m6);
 			
-			if (x2 == width) {
-				break;
+			__m128i* const dst = (__m128i*)(dst_counts + piece->shift);
+			_mm_storeu_si128(dst, _mm_add_epi32(_mm_loadu_si128(dst), v));
+		}
+	}
+#endif
+	
+	for (; y < height; ++y, line += wpl) {
+		int* const dst_counts = &counts[y + margin];
+		std::vector<ShiftedPiece>::const_iterator piece(pieces.begin());
+		for (; piece != pieces_end; ++piece) {
+			dst_counts[piece->shift] += countBits(line[piece->word] & piece->mask);
+		}
+	}
+	
+	std::vector<int> projection(
+		counts.begin() + margin, counts.begin() + margin + height
+	);
+	
+	if (background_color == BLACK) {
+		// Areas not represented in the source image.
+		for (run = runs.begin(); run != runs_end; ++run) {
+			int begin = 0;
+			int end = 0;
+			if (run->shift > 0) {
+				end = std::min(run->shift, height);
+			} else if (run->shift < 0) {
+				begin = std::max(height + run->shift, 0);
+				end = height;
+			}
+			for (int y = begin; y < end; ++y) {
+				projection[y] += run->numPixels;
 			}
-			
-			x1 = x2;
-			shift1 = shift2;
 		}
 	}
+	
+	return projection;
 }
 
 BinaryImage hShear(
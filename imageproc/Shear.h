@@ -21,6 +21,7 @@
 #define IMAGEPROC_SHEAR_H_
 
 #include "BWColor.h"
+#include <vector>
 
 namespace imageproc
 {
@@ -61,6 +62,19 @@ void vShearFromTo(
 	BinaryImage const& src, BinaryImage& dst, double shear,
 	double x_origin, BWColor background_color);
 
+/**
+ * \brief Counts black pixels in each line of a vertically sheared image.
+ *
+ * The result is the same as counting black pixels in each line of
+ * vShear(src, shear, x_origin, background_color), except the sheared
+ * image is never built.  The source is only read, once.
+ *
+ * \return A vector of src.height() elements.
+ */
+std::vector<int> vShearProjection(
+	BinaryImage const& src, double shear,
+	double x_origin, BWColor background_color);
+
 /**
  * \brief Horizontal shear returing a new image.
  *
@@ -19,11 +19,13 @@
 #include "SkewFinder.h"
 #include "BinaryImage.h"
 #include "BWColor.h"
-#include "BitOps.h"
 #include "Shear.h"
 #include "ReduceThreshold.h"
+#include "ParallelRows.h"
 #include "Constants.h"
 #include <QDebug>
+#include <algorithm>
+#include <vector>
 #include <stdexcept>
 #include <stdint.h>
 #include <math.h>
@@ -31,6 +33,25 @@
 namespace imageproc
 {
 
+class SkewFinder::AngleScorer : public RowRangeProcessor
+{
+public:
+	AngleScorer(SkewFinder const& owner, BinaryImage const& src,
+		double const* angles, double* scores)
+	:	m_rOwner(owner), m_rSrc(src), m_pAngles(angles), m_pScores(scores) {}
+	
+	virtual void processRows(int begin, int end) const {
+		for (int i = begin; i < end; ++i) {
+			m_pScores[i] = m_rOwner.process(m_rSrc, m_pAngles[i]);
+		}
+	}
+private:
+	SkewFinder const& m_rOwner;
+	BinaryImage const& m_rSrc;
+	double const* m_pAngles;
+	double* m_pScores;
+};
+
 double const Skew::GOOD_CONFIDENCE = 2.0;
 
 double const SkewFinder::DEFAULT_MAX_ANGLE = 7.0;
@@ -109,24 +130,34 @@ SkewFinder::findSkew(BinaryImage const& image) const
 	
 	ReduceThreshold fine_reduced(coarse_reduced.image());
 	
+	std::vector<int> coarse_thresholds;
 	for (int i = min_reduction; i < m_coarseReduction; ++i) {
-		coarse_reduced.reduce(i == 0 ? 1 : 2);
+		coarse_thresholds.push_back(i == 0 ? 1 : 2);
 	}
+	coarse_reduced.reduce(coarse_thresholds);
 	
-	BinaryImage skewed(coarse_reduced.image().size());
 	double const coarse_step = 1.0; // degrees
 	
-	// Coarse linear search.
-	int num_coarse_scores = 0;
+	// Coarse linear search.  Angles are scored in parallel.
+	std::vector<double> coarse_angles;
+	for (double angle = -m_maxAngle; angle <= m_maxAngle; angle += coarse_step) {
+		coarse_angles.push_back(angle);
+	}
+	int const num_coarse_scores = coarse_angles.size();
+	std::vector<double> coarse_scores(num_coarse_scores);
+	processAngles(
+		coarse_reduced.image(), &coarse_angles[0],
+		&coarse_scores[0], num_coarse_scores
+	);
+	
 	double sum_coarse_scores = 0.0;
 	double best_coarse_score = 0.0;
 	double best_coarse_angle = -m_maxAngle;
-	for (double angle = -m_maxAngle; angle <= m_maxAngle; angle += coarse_step) {
-		double const score = process(coarse_reduced, skewed, angle);
+	for (int i = 0; i < num_coarse_scores; ++i) {
+		double const score = coarse_scores[i];
 		sum_coarse_scores += score;
-		++num_coarse_scores;
 		if (score > best_coarse_score) {
-			best_coarse_angle = angle;
+			best_coarse_angle = coarse_angles[i];
 			best_coarse_score = score;
 		}
 	}
@@ -140,31 +171,64 @@ SkewFinder::findSkew(BinaryImage const& image) const
 		return Skew(-best_coarse_angle, confidence - 1.0);
 	}
 	
+	std::vector<int> fine_thresholds;
 	for (int i = min_reduction; i < m_fineReduction; ++i) {
-		fine_reduced.reduce(i == 0 ? 1 : 2);
+		fine_thresholds.push_back(i == 0 ? 1 : 2);
 	}
+	fine_reduced.reduce(fine_thresholds);
 	
-	if (m_coarseReduction != m_fineReduction) {
-		skewed = BinaryImage(fine_reduced.image().size());
-	}
+	BinaryImage const& fine_image = fine_reduced.image();
 	
 	// Fine binary search.
-	double angle_plus = best_coarse_angle + 0.5 * coarse_step;
-	double angle_minus = best_coarse_angle - 0.5 * coarse_step;
-	double score_plus = process(fine_reduced, skewed, angle_plus);
-	double score_minus = process(fine_reduced, skewed, angle_minus);
+	double const initial_fine_angles[2] = {
+		best_coarse_angle + 0.5 * coarse_step,
+		best_coarse_angle - 0.5 * coarse_step
+	};
+	double initial_fine_scores[2];
+	processAngles(fine_image, initial_fine_angles, initial_fine_scores, 2);
+	double angle_plus = initial_fine_angles[0];
+	double angle_minus = initial_fine_angles[1];
+	double score_plus = initial_fine_scores[0];
+	double score_minus = initial_fine_scores[1];
 	double const fine_score1 = score_plus;
 	double const fine_score2 = score_minus;
-	while (angle_plus - angle_minus > m_accuracy) {
+	
+	// The next two steps of the search may only need one of three angles,
+	// so with enough threads, we score all of them at once.
+	bool const speculate = maxIntraPageThreads() > 2;
+	
+	// The score_plus != score_minus check protects us
+	// from unreasonably low m_accuracy.
+	while (angle_plus - angle_minus > m_accuracy && score_plus != score_minus) {
+		double const mid = 0.5 * (angle_plus + angle_minus);
+		double const angles[3] = {
+			mid, 0.5 * (angle_plus + mid), 0.5 * (mid + angle_minus)
+		};
+		double scores[3];
+		bool const two_steps = speculate &&
+			std::max(angle_plus - mid, mid - angle_minus) > m_accuracy;
+		processAngles(fine_image, angles, scores, two_steps ? 3 : 1);
+		
+		int next;
 		if (score_plus > score_minus) {
-			angle_minus = 0.5 * (angle_plus + angle_minus);
-			score_minus = process(fine_reduced, skewed, angle_minus);
-		} else if (score_plus < score_minus) {
-			angle_plus = 0.5 * (angle_plus + angle_minus);
-			score_plus = process(fine_reduced, skewed, angle_plus);
+			angle_minus = mid;
+			score_minus = scores[0];
+			next = 1;
 		} else {
-			// This protects us from unreasonably low m_accuracy.
-			break;
+			angle_plus = mid;
+			score_plus = scores[0];
+			next = 2;
+		}
+		
+		if (two_steps && angle_plus - angle_minus > m_accuracy
+				&& score_plus != score_minus) {
+			if (score_plus > score_minus) {
+				angle_minus = angles[next];
+				score_minus = scores[next];
+			} else {
+				angle_plus = angles[next];
+				score_plus = scores[next];
+			}
 		}
 	}
 	
@@ -197,33 +261,33 @@ SkewFinder::findSkew(BinaryImage const& image) const
 }
 
 double
-SkewFinder::process(BinaryImage const& src, BinaryImage& dst, double const angle) const
+SkewFinder::process(BinaryImage const& src, double const angle) const
 {
 	double const tg = tan(angle * constants::DEG2RAD);
-	double const x_center = 0.5 * dst.width();
-	vShearFromTo(src, dst, tg / m_resolutionRatio, x_center, WHITE);
-	return calcScore(dst);
+	double const x_center = 0.5 * src.width();
+	return calcScore(
+		vShearProjection(src, tg / m_resolutionRatio, x_center, WHITE)
+	);
+}
+
+void
+SkewFinder::processAngles(
+	BinaryImage const& src, double const* const angles,
+	double* const scores, int const num_angles) const
+{
+	AngleScorer const scorer(*this, src, angles, scores);
+	processRowsInParallel(scorer, num_angles, 1);
 }
 
 double
-SkewFinder::calcScore(BinaryImage const& image)
+SkewFinder::calcScore(std::vector<int> const& projection)
 {
-	int const width = image.width();
-	int const height = image.height();
-	uint32_t const* line = image.data();
-	int const wpl = image.wordsPerLine();
-	int const last_word_idx = (width - 1) >> 5;
-	uint32_t const last_word_mask = ~uint32_t(0) << (31 - ((width - 1) & 31));
+	int const height = projection.size();
 	
 	double score = 0.0;
 	int last_line_black_pixels = 0;
-	for (int y = 0; y < height; ++y, line += wpl) {
-		int num_black_pixels = 0;
-		int i = 0;
-		for (; i != last_word_idx; ++i) {
-			num_black_pixels += countNonZeroBits(line[i]);
-		}
-		num_black_pixels += countNonZeroBits(line[i] & last_word_mask);
+	for (int y = 0; y < height; ++y) {
+		int const num_black_pixels = projection[y];
 		
 		if (y != 0) {
 			double const diff = num_black_pixels - last_line_black_pixels;
@@ -20,6 +20,7 @@
 #define IMAGEPROC_SKEWFINDER_H_
 
 #include "NonCopyable.h"
+#include <vector>
 
 namespace imageproc
 {
@@ -139,11 +140,23 @@ public:
 	 */
 	Skew findSkew(BinaryImage const& image) const;
 private:
+	class AngleScorer;
+	
 	static double const LOW_SCORE;
 	
-	double process(BinaryImage const& src, BinaryImage& dst, double angle) const;
+	/**
+	 * \brief Scores an angle based on the line projection of the image
+	 *        sheared by that angle.
+	 */
+	double process(BinaryImage const& src, double angle) const;
+	
+	/**
+	 * \brief Calls process() for each of the angles, in parallel.
+	 */
+	void processAngles(BinaryImage const& src, double const* angles,
+		double* scores, int num_angles) const;
 	
-	static double calcScore(BinaryImage const& image);
+	static double calcScore(std::vector<int> const& projection);
 	
 	double m_maxAngle;
 	double m_accuracy;
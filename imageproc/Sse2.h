@@ -0,0 +1,34 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C) 2007-2008  Joseph Artsimovich <joseph_a@mail.ru>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGEPROC_SSE2_H_
+#define IMAGEPROC_SSE2_H_
+
+/**
+ * \file
+ * Defines IMAGEPROC_HAVE_SSE2 and brings in SSE2 intrinsics, provided
+ * the target is known to support them.  SSE2 is always there on x86-64.
+ * On 32-bit x86 we only use it if the compiler was told it may do so.
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGEPROC_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#endif
@@ -19,6 +19,8 @@
 #include "Transform.h"
 #include "Grayscale.h"
 #include "GrayImage.h"
+#include "ParallelRows.h"
+#include "Sse2.h"
 #include <QImage>
 #include <QRect>
 #include <QSizeF>
@@ -30,6 +32,7 @@
 #include <QDebug>
 #include <stdexcept>
 #include <algorithm>
+#include <vector>
 #include <stdint.h>
 #include <math.h>
 #include <assert.h>
@@ -63,6 +66,17 @@ public:
 		m_grayLevel += gray_level * area;
 	}
 	
+	void add(Gray const& other, unsigned const area) {
+		m_grayLevel += other.m_grayLevel * area;
+	}
+	
+	/**
+	 * \brief Does sums[i].add(line[i], area) for i in [0, count).
+	 *
+	 * \p area must not exceed 256.
+	 */
+	static void addLine(Gray* sums, uint8_t const* line, int count, unsigned area);
+	
 	uint8_t result(unsigned const total_area) const {
 		unsigned const half_area = total_area >> 1;
 		unsigned const res = (m_grayLevel + half_area) / total_area;
@@ -85,6 +99,21 @@ public:
 		m_red += (rgb & 0xFF) * area;
 	}
 	
+	void add(RGB32 const& other, unsigned const area) {
+		m_red += other.m_red * area;
+		m_green += other.m_green * area;
+		m_blue += other.m_blue * area;
+	}
+	
+	/**
+	 * \brief Does sums[i].add(line[i], area) for i in [0, count).
+	 */
+	static void addLine(RGB32* sums, uint32_t const* line, int count, unsigned area) {
+		for (int i = 0; i < count; ++i) {
+			sums[i].add(line[i], area);
+		}
+	}
+	
 	uint32_t result(unsigned const total_area) const {
 		unsigned const half_area = total_area >> 1;
 		uint32_t rgb = 0x0000FF00;
@@ -116,6 +145,20 @@ public:
 		m_alpha += argb * area;
 	}
 	
+	void add(ARGB32 const& other, unsigned const area) {
+		m_alpha += other.m_alpha * area;
+		m_red += other.m_red * area;
+		m_green += other.m_green * area;
+		m_blue += other.m_blue * area;
+	}
+	
+	/**
+	 * \brief Does sums[i].add(line[i], area) for i in [0, count).
+	 *
+	 * \p area must not exceed 256.
+	 */
+	static void addLine(ARGB32* sums, uint32_t const* line, int count, unsigned area);
+	
 	uint32_t result(unsigned const total_area) const {
 		unsigned const half_area = total_area >> 1;
 		uint32_t argb = (m_alpha + half_area) / total_area;
@@ -134,6 +177,106 @@ private:
 	unsigned m_blue;
 };
 
+/*
+ * The SSE2 versions of addLine() treat arrays of mixers as arrays
+ * of unsigned integers.  With areas not exceeding 256, products of
+ * 8-bit values and areas fit into 16 bits.
+ */
+
+void
+Gray::addLine(
+	Gray* const sums, uint8_t const* const line,
+	int const count, unsigned const area)
+{
+	assert(area <= 256);
+	int i = 0;
+	
+#ifdef IMAGEPROC_HAVE_SSE2
+	assert(sizeof(Gray) == sizeof(unsigned));
+	unsigned* const acc = &sums[0].m_grayLevel;
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const multiplier = _mm_set1_epi16(area);
+	for (; i + 8 <= count; i += 8) {
+		__m128i const pixels = _mm_unpacklo_epi8(
+			_mm_loadl_epi64((__m128i const*)(line + i)), zero
+		);
+		__m128i const products = _mm_mullo_epi16(pixels, multiplier);
+		__m128i* const dst = (__m128i*)(acc + i);
+		_mm_storeu_si128(dst, _mm_add_epi32(
+			_mm_loadu_si128(dst), _mm_unpacklo_epi16(products, zero)
+		));
+		_mm_storeu_si128(dst + 1, _mm_add_epi32(
+			_mm_loadu_si128(dst + 1), _mm_unpackhi_epi16(products, zero)
+		));
+	}
+#endif
+	
+	for (; i < count; ++i) {
+		sums[i].add(line[i], area);
+	}
+}
+
+void
+ARGB32::addLine(
+	ARGB32* const sums, uint32_t const* const line,
+	int const count, unsigned const area)
+{
+	assert(area <= 256);
+	int i = 0;
+	
+#ifdef IMAGEPROC_HAVE_SSE2
+	// Bytes of a pixel come in BGRA order, while the members
+	// go in ARGB order.
+	assert(sizeof(ARGB32) == sizeof(unsigned) * 4);
+	unsigned* const acc = &sums[0].m_alpha;
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const multiplier = _mm_set1_epi16(area);
+	for (; i + 2 <= count; i += 2) {
+		__m128i const channels = _mm_unpacklo_epi8(
+			_mm_loadl_epi64((__m128i const*)(line + i)), zero
+		);
+		__m128i const products = _mm_mullo_epi16(channels, multiplier);
+		__m128i const first = _mm_shuffle_epi32(
+			_mm_unpacklo_epi16(products, zero), _MM_SHUFFLE(0, 1, 2, 3)
+		);
+		__m128i const second = _mm_shuffle_epi32(
+			_mm_unpackhi_epi16(products, zero), _MM_SHUFFLE(0, 1, 2, 3)
+		);
+		__m128i* const dst = (__m128i*)(acc + i * 4);
+		_mm_storeu_si128(dst, _mm_add_epi32(_mm_loadu_si128(dst), first));
+		_mm_storeu_si128(dst + 1, _mm_add_epi32(_mm_loadu_si128(dst + 1), second));
+	}
+#endif
+	
+	for (; i < count; ++i) {
+		sums[i].add(line[i], area);
+	}
+}
+
+/**
+ * \brief Converts source pixels and mixing results to destination pixels.
+ *
+ * Pixels of the same type are taken as they are.
+ */
+template<typename StorageUnit, typename DstUnit>
+struct PixelConversion
+{
+	static DstUnit convert(StorageUnit const pixel) {
+		return pixel;
+	}
+};
+
+/**
+ * Gray levels are expanded to opaque RGB32 pixels.
+ */
+template<>
+struct PixelConversion<uint8_t, uint32_t>
+{
+	static uint32_t convert(uint8_t const gray_level) {
+		return 0xff000000u | (gray_level * 0x00010101u);
+	}
+};
+
 static QSizeF calcSrcUnitSize(QTransform const& xform, QSizeF const& min)
 {
 	// Imagine a rectangle of (0, 0, 1, 1), except we take
@@ -157,11 +300,198 @@ static QSizeF calcSrcUnitSize(QTransform const& xform, QSizeF const& min)
 	);
 }
 
-template<typename StorageUnit, typename Mixer>
-static void transformGeneric(
+/**
+ * \brief The source interval a destination pixel maps to along one axis.
+ *
+ * Applicable to transformations that don't mix the axes.
+ * Fields with the 32 suffix are in 1/32 of a source pixel.
+ */
+struct AxisSpan
+{
+	int src32_begin; /**< Clipped to the source image. */
+	int src32_end; /**< Clipped to the source image.  Exclusive. */
+	int first; /**< The first source pixel, clipped. */
+	int last; /**< The last source pixel, clipped.  Inclusive. */
+	int nearest; /**< The pixel to take if the span is completely outside. */
+	unsigned unclipped_size; /**< src32_end - src32_begin before clipping. */
+	bool outside; /**< Whether the span is completely outside. */
+	
+	/**
+	 * The part of the span covered by the given source pixel.
+	 */
+	unsigned weight(int const pixel) const {
+		int const begin = std::max(src32_begin, pixel << 5);
+		int const end = std::min(src32_end, (pixel + 1) << 5);
+		return end - begin;
+	}
+};
+
+/**
+ * Calculates AxisSpan for each pixel of a destination axis.  The math
+ * matches that of transformGeneric(), to produce identical results.
+ */
+static void calcAxisSpans(
+	std::vector<AxisSpan>& spans, int const dst_size,
+	double const src32_origin, double const src32_step,
+	int const src32_unit, int const src_size)
+{
+	spans.resize(dst_size);
+	
+	for (int d = 0; d < dst_size; ++d) {
+		double const f_src32_center = src32_origin + (d + 0.5) * src32_step;
+		int src32_begin = (int)f_src32_center - (src32_unit >> 1);
+		int src32_end = src32_begin + src32_unit;
+		int first = src32_begin >> 5;
+		int last = (src32_end - 1) >> 5; // inclusive
+		
+		AxisSpan& span = spans[d];
+		span.unclipped_size = src32_unit;
+		span.outside = last < 0 || first >= src_size;
+		span.nearest = qBound<int>(0, (first + last) >> 1, src_size - 1);
+		
+		if (first < 0) {
+			first = 0;
+			src32_begin = 0;
+		}
+		if (last >= src_size) {
+			last = src_size - 1;
+			src32_end = src_size << 5;
+		}
+		
+		span.src32_begin = src32_begin;
+		span.src32_end = src32_end;
+		span.first = first;
+		span.last = last;
+		assert(span.outside || src32_end > src32_begin);
+	}
+}
+
+/**
+ * \brief A special case of transformGeneric() for transformations
+ *        consisting of scaling and translation only.
+ *
+ * The area a destination pixel maps to is then an axis-aligned
+ * rectangle, and the weight of each source pixel is a product of
+ * its horizontal and vertical coverage.  That allows summing source
+ * pixels vertically first, once per destination line, and then
+ * horizontally.  As the sums are the same, so are the results.
+ */
+template<typename StorageUnit, typename Mixer, typename DstUnit>
+static void transformScaleOnly(
 	StorageUnit const* const src_data, int const src_stride, QSize const src_size,
-	StorageUnit* const dst_data, int const dst_stride, QTransform const& xform,
-	QRect const& dst_rect, StorageUnit const outside_color, int const outside_flags,
+	DstUnit* const dst_data, int const dst_stride, QSize const dst_size,
+	int const dy_begin, int const dy_end,
+	QTransform const& inv_xform, int const src32_unit_w, int const src32_unit_h,
+	StorageUnit const outside_color, int const outside_flags)
+{
+	typedef PixelConversion<StorageUnit, DstUnit> Conv;
+	
+	int const sw = src_size.width();
+	int const sh = src_size.height();
+	int const dw = dst_size.width();
+	int const dh = dst_size.height();
+	
+	std::vector<AxisSpan> hor_spans;
+	calcAxisSpans(hor_spans, dw, inv_xform.dx(), inv_xform.m11(), src32_unit_w, sw);
+	std::vector<AxisSpan> ver_spans;
+	calcAxisSpans(ver_spans, dh, inv_xform.dy(), inv_xform.m22(), src32_unit_h, sh);
+	
+	// The range of source columns that contribute to anything.
+	int col_begin = sw;
+	int col_end = 0;
+	for (int dx = 0; dx < dw; ++dx) {
+		AxisSpan const& span = hor_spans[dx];
+		if (!span.outside) {
+			col_begin = std::min(col_begin, span.first);
+			col_end = std::max(col_end, span.last + 1);
+		}
+	}
+	
+	// column_sums[sx - col_begin] is the weighted sum of source pixels
+	// in column sx, within the vertical span of the current line.
+	std::vector<Mixer> column_sums(std::max(0, col_end - col_begin));
+	AxisSpan const* summed_span = 0;
+	
+	DstUnit* dst_line = dst_data + dy_begin * dst_stride;
+	for (int dy = dy_begin; dy < dy_end; ++dy, dst_line += dst_stride) {
+		AxisSpan const& ver_span = ver_spans[dy];
+		
+		if (ver_span.outside) {
+			for (int dx = 0; dx < dw; ++dx) {
+				if (outside_flags & OutsidePixels::COLOR) {
+					dst_line[dx] = Conv::convert(outside_color);
+				} else {
+					dst_line[dx] = Conv::convert(src_data[
+						ver_span.nearest * src_stride + hor_spans[dx].nearest
+					]);
+				}
+			}
+			continue;
+		}
+		
+		// When upscaling, adjacent lines often map to the same span.
+		if (!summed_span || summed_span->src32_begin != ver_span.src32_begin
+				|| summed_span->src32_end != ver_span.src32_end) {
+			std::fill(column_sums.begin(), column_sums.end(), Mixer());
+			StorageUnit const* src_line = src_data + ver_span.first * src_stride;
+			for (int sy = ver_span.first; sy <= ver_span.last;
+					++sy, src_line += src_stride) {
+				if (!column_sums.empty()) {
+					Mixer::addLine(
+						&column_sums[0], src_line + col_begin,
+						col_end - col_begin, ver_span.weight(sy)
+					);
+				}
+			}
+			summed_span = &ver_span;
+		}
+		
+		unsigned const ver_size = ver_span.src32_end - ver_span.src32_begin;
+		
+		for (int dx = 0; dx < dw; ++dx) {
+			AxisSpan const& hor_span = hor_spans[dx];
+			
+			if (hor_span.outside) {
+				if (outside_flags & OutsidePixels::COLOR) {
+					dst_line[dx] = Conv::convert(outside_color);
+				} else {
+					dst_line[dx] = Conv::convert(src_data[
+						ver_span.nearest * src_stride + hor_span.nearest
+					]);
+				}
+				continue;
+			}
+			
+			unsigned const src_area = ver_size * (hor_span.src32_end - hor_span.src32_begin);
+			unsigned background_area = ver_span.unclipped_size
+				* hor_span.unclipped_size - src_area;
+			
+			Mixer mixer;
+			if (outside_flags & OutsidePixels::WEAK) {
+				background_area = 0;
+			} else {
+				mixer.add(outside_color, background_area);
+			}
+			
+			for (int sx = hor_span.first; sx <= hor_span.last; ++sx) {
+				mixer.add(column_sums[sx - col_begin], hor_span.weight(sx));
+			}
+			
+			dst_line[dx] = Conv::convert(mixer.result(src_area + background_area));
+		}
+	}
+}
+
+/**
+ * Transforms destination rows [dy_begin, dy_end).  The results don't
+ * depend on how the rows are split.
+ */
+template<typename StorageUnit, typename Mixer, typename DstUnit>
+static void transformRows(
+	StorageUnit const* const src_data, int const src_stride, QSize const src_size,
+	DstUnit* const dst_data, int const dst_stride, QTransform const& xform,
+	QRect const& dst_rect, int const dy_begin, int const dy_end,
+	StorageUnit const outside_color, int const outside_flags,
 	QSizeF const& min_mapping_area)
 {
 	int const sw = src_size.width();
@@ -169,7 +499,8 @@ static void transformGeneric(
 	int const dw = dst_rect.width();
 	int const dh = dst_rect.height();
 
-	StorageUnit* dst_line = dst_data;
+	typedef PixelConversion<StorageUnit, DstUnit> Conv;
+	DstUnit* dst_line = dst_data + dy_begin * dst_stride;
 	
 	QTransform inv_xform;
 	inv_xform.translate(dst_rect.x(), dst_rect.y());
@@ -183,10 +514,31 @@ static void transformGeneric(
 	int const src32_unit_w = std::max<int>(1, qRound(src32_unit_size.width()));
 	int const src32_unit_h = std::max<int>(1, qRound(src32_unit_size.height()));
 	
-	for (int dy = 0; dy < dh; ++dy, dst_line += dst_stride) {
+	if (inv_xform.m12() == 0.0 && inv_xform.m21() == 0.0) {
+		transformScaleOnly<StorageUnit, Mixer, DstUnit>(
+			src_data, src_stride, src_size, dst_data, dst_stride,
+			dst_rect.size(), dy_begin, dy_end,
+			inv_xform, src32_unit_w, src32_unit_h,
+			outside_color, outside_flags
+		);
+		return;
+	}
+	
+	// These are calculated for all rows, not just for ours.  Otherwise,
+	// if the compiler turns multiplications into additions (which
+	// -ffast-math allows), the results would depend on where our
+	// range of rows starts.
+	std::vector<double> sx32_bases(dh);
+	std::vector<double> sy32_bases(dh);
+	for (int dy = 0; dy < dh; ++dy) {
 		double const f_dy_center = dy + 0.5;
-		double const f_sx32_base = f_dy_center * inv_xform.m21() + inv_xform.dx();
-		double const f_sy32_base = f_dy_center * inv_xform.m22() + inv_xform.dy();
+		sx32_bases[dy] = f_dy_center * inv_xform.m21() + inv_xform.dx();
+		sy32_bases[dy] = f_dy_center * inv_xform.m22() + inv_xform.dy();
+	}
+	
+	for (int dy = dy_begin; dy < dy_end; ++dy, dst_line += dst_stride) {
+		double const f_sx32_base = sx32_bases[dy];
+		double const f_sy32_base = sy32_bases[dy];
 		
 		for (int dx = 0; dx < dw; ++dx) {
 			double const f_dx_center = dx + 0.5;
@@ -206,11 +558,11 @@ static void transformGeneric(
 			if (src_bottom < 0 || src_right < 0 || src_left >= sw || src_top >= sh) {
 				// Completely outside of src image.
 				if (outside_flags & OutsidePixels::COLOR) {
-					dst_line[dx] = outside_color;
+					dst_line[dx] = Conv::convert(outside_color);
 				} else {
 					int const src_x = qBound<int>(0, (src_left + src_right) >> 1, sw - 1);
 					int const src_y = qBound<int>(0, (src_top + src_bottom) >> 1, sh - 1);
-					dst_line[dx] = src_data[src_y * src_stride + src_x];
+					dst_line[dx] = Conv::convert(src_data[src_y * src_stride + src_x]);
 				}
 				continue;
 			}
@@ -284,11 +636,11 @@ static void transformGeneric(
 			unsigned const src_area = (src32_bottom - src32_top) * (src32_right - src32_left);
 			if (src_area == 0) {
 				if ((outside_flags & OutsidePixels::COLOR)) {
-					dst_line[dx] = outside_color;
+					dst_line[dx] = Conv::convert(outside_color);
 				} else {
 					int const src_x = qBound<int>(0, (src_left + src_right) >> 1, sw - 1);
 					int const src_y = qBound<int>(0, (src_top + src_bottom) >> 1, sh - 1);
-					dst_line[dx] = src_data[src_y * src_stride + src_x];
+					dst_line[dx] = Conv::convert(src_data[src_y * src_stride + src_x]);
 				}
 				continue;
 			}
@@ -301,7 +653,7 @@ static void transformGeneric(
 					StorageUnit const c = src_line[src_left];
 					if (background_area == 0) {
 						// common case optimization
-						dst_line[dx] = c;
+						dst_line[dx] = Conv::convert(c);
 						continue;
 					}
 					mixer.add(c, src_area);
@@ -387,11 +739,69 @@ static void transformGeneric(
 				mixer.add(src_line[src_right], bottomright_area);
 			}
 
-			dst_line[dx] = mixer.result(src_area + background_area);
+			dst_line[dx] = Conv::convert(mixer.result(src_area + background_area));
 		}
 	}
 }
 
+template<typename StorageUnit, typename Mixer, typename DstUnit>
+class TransformRowsProcessor : public RowRangeProcessor
+{
+public:
+	TransformRowsProcessor(
+		StorageUnit const* src_data, int src_stride, QSize src_size,
+		DstUnit* dst_data, int dst_stride, QTransform const& xform,
+		QRect const& dst_rect, StorageUnit outside_color, int outside_flags,
+		QSizeF const& min_mapping_area)
+	:	m_pSrcData(src_data),
+		m_srcStride(src_stride),
+		m_srcSize(src_size),
+		m_pDstData(dst_data),
+		m_dstStride(dst_stride),
+		m_rXform(xform),
+		m_rDstRect(dst_rect),
+		m_outsideColor(outside_color),
+		m_outsideFlags(outside_flags),
+		m_rMinMappingArea(min_mapping_area)
+	{
+	}
+	
+	virtual void processRows(int const begin, int const end) const {
+		transformRows<StorageUnit, Mixer, DstUnit>(
+			m_pSrcData, m_srcStride, m_srcSize,
+			m_pDstData, m_dstStride, m_rXform, m_rDstRect, begin, end,
+			m_outsideColor, m_outsideFlags, m_rMinMappingArea
+		);
+	}
+private:
+	StorageUnit const* m_pSrcData;
+	int m_srcStride;
+	QSize m_srcSize;
+	DstUnit* m_pDstData;
+	int m_dstStride;
+	QTransform const& m_rXform;
+	QRect const& m_rDstRect;
+	StorageUnit m_outsideColor;
+	int m_outsideFlags;
+	QSizeF const& m_rMinMappingArea;
+};
+
+template<typename StorageUnit, typename Mixer, typename DstUnit>
+static void transformGeneric(
+	StorageUnit const* const src_data, int const src_stride, QSize const src_size,
+	DstUnit* const dst_data, int const dst_stride, QTransform const& xform,
+	QRect const& dst_rect, StorageUnit const outside_color, int const outside_flags,
+	QSizeF const& min_mapping_area)
+{
+	TransformRowsProcessor<StorageUnit, Mixer, DstUnit> const processor(
+		src_data, src_stride, src_size, dst_data, dst_stride, xform,
+		dst_rect, outside_color, outside_flags, min_mapping_area
+	);
+	
+	// Destination rows are independent of each other.
+	processRowsInParallel(processor, dst_rect.height(), 16);
+}
+
 } // anonymous namespace
 
 QImage transform(
@@ -411,12 +821,37 @@ QImage transform(
 		throw std::invalid_argument("transform: dst_rect is invalid");
 	}
 	
-	if (src.format() == QImage::Format_Indexed8 && src.allGray()) {
+	QRgb const outside_color = outside_pixels.rgba();
+	bool const opaque_gray_outside = qAlpha(outside_color) == 0xff
+		&& qRed(outside_color) == qGreen(outside_color)
+		&& qGreen(outside_color) == qBlue(outside_color);
+	bool const mono = src.format() == QImage::Format_Mono
+		|| src.format() == QImage::Format_MonoLSB;
+	
+	if ((src.format() == QImage::Format_Indexed8 || (mono && opaque_gray_outside))
+			&& src.allGray()) {
 		// The palette of src may be non-standard, so we create a GrayImage,
-		// which is guaranteed to have a standard palette.
+		// which is guaranteed to have a standard palette.  For grayscale
+		// sources with a standard palette, that doesn't involve copying.
 		GrayImage gray_src(src);
+		
+		if (mono) {
+			// Bitonal sources are transformed as grayscale rather than
+			// being expanded to 32 bits per pixel.  With an opaque gray
+			// outside color, every channel of the RGB32 path would produce
+			// the same values, so we just write them as RGB32 pixels.
+			QImage dst(dst_rect.size(), QImage::Format_RGB32);
+			transformGeneric<uint8_t, Gray, uint32_t>(
+				gray_src.data(), gray_src.stride(), src.size(),
+				(uint32_t*)dst.bits(), dst.bytesPerLine() / 4, xform, dst_rect,
+				outside_pixels.grayLevel(), outside_pixels.flags(),
+				min_mapping_area
+			);
+			return dst;
+		}
+		
 		GrayImage gray_dst(dst_rect.size());
-		transformGeneric<uint8_t, Gray>(
+		transformGeneric<uint8_t, Gray, uint8_t>(
 			gray_src.data(), gray_src.stride(), src.size(),
 			gray_dst.data(), gray_dst.stride(), xform, dst_rect,
 			outside_pixels.grayLevel(), outside_pixels.flags(),
@@ -427,7 +862,7 @@ QImage transform(
 		if (src.hasAlphaChannel() || qAlpha(outside_pixels.rgba()) != 0xff) {
 			QImage const src_argb32(src.convertToFormat(QImage::Format_ARGB32));
 			QImage dst(dst_rect.size(), QImage::Format_ARGB32);
-			transformGeneric<uint32_t, ARGB32>(
+			transformGeneric<uint32_t, ARGB32, uint32_t>(
 				(uint32_t const*)src_argb32.bits(), src_argb32.bytesPerLine() / 4, src_argb32.size(),
 				(uint32_t*)dst.bits(), dst.bytesPerLine() / 4, xform, dst_rect,
 				outside_pixels.rgba(), outside_pixels.flags(), min_mapping_area
@@ -436,7 +871,7 @@ QImage transform(
 		} else {
 			QImage const src_rgb32(src.convertToFormat(QImage::Format_RGB32));
 			QImage dst(dst_rect.size(), QImage::Format_RGB32);
-			transformGeneric<uint32_t, RGB32>(
+			transformGeneric<uint32_t, RGB32, uint32_t>(
 				(uint32_t const*)src_rgb32.bits(), src_rgb32.bytesPerLine() / 4, src_rgb32.size(),
 				(uint32_t*)dst.bits(), dst.bytesPerLine() / 4, xform, dst_rect,
 				outside_pixels.rgb(), outside_pixels.flags(), min_mapping_area
@@ -466,7 +901,7 @@ GrayImage transformToGray(
 	GrayImage const gray_src(src);
 	GrayImage dst(dst_rect.size());
 	
-	transformGeneric<uint8_t, Gray>(
+	transformGeneric<uint8_t, Gray, uint8_t>(
 		gray_src.data(), gray_src.stride(), gray_src.size(),
 		dst.data(), dst.stride(), xform, dst_rect,
 		outside_pixels.grayLevel(), outside_pixels.flags(),
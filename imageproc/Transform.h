@@ -86,6 +86,9 @@ private:
 /**
  * \brief Apply an affine transformation to the image.
  *
+ * Bands of destination rows are processed in parallel, with the number
+ * of threads limited by setMaxIntraPageThreads().
+ *
  * \param src The source image.
  * \param xform The transformation from source to destination.
  *        Only affine transformations are supported.
@@ -18,9 +18,13 @@
 
 #include "Binarize.h"
 #include "BinaryImage.h"
+#include "ParallelRows.h"
+#include "RasterOp.h"
 #include "Utils.h"
 #include <QImage>
 #include <QSize>
+#include <vector>
+#include <stdlib.h>
 #ifndef Q_MOC_RUN
 #include <boost/test/auto_unit_test.hpp>
 #endif
@@ -34,6 +38,104 @@ namespace tests
 using namespace utils;
 
 BOOST_AUTO_TEST_SUITE(BinarizeTestSuite);
+
+BOOST_AUTO_TEST_CASE(test_lines_on_uneven_background)
+{
+	int const w = 120;
+	int const h = 90;
+	std::vector<int> gray(w * h);
+	std::vector<int> control(w * h);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			bool const line = (y >= 30 && y < 33)
+				|| (y >= 60 && y < 63) || (x >= 50 && x < 53);
+			gray[y * w + x] = line ? 30 : 180 + (x + y) / 10;
+			control[y * w + x] = line ? 1 : 0;
+		}
+	}
+	
+	QImage const img(makeGrayImage(&gray[0], w, h));
+	BinaryImage const control_img(makeBinaryImage(&control[0], w, h));
+	QSize const window_size(31, 31);
+	
+	BOOST_CHECK(binarizeSauvola(img, window_size, EXACT_LOCAL_STATS) == control_img);
+	BOOST_CHECK(binarizeSauvola(img, window_size, APPROXIMATE_LOCAL_STATS) == control_img);
+	BOOST_CHECK(binarizeWolf(img, window_size, 1, 254, EXACT_LOCAL_STATS) == control_img);
+	BOOST_CHECK(binarizeWolf(img, window_size, 1, 254, APPROXIMATE_LOCAL_STATS) == control_img);
+}
+
+BOOST_AUTO_TEST_CASE(test_approximate_close_to_exact)
+{
+	// Short dark strokes on a noisy background that varies smoothly.
+	int const w = 301;
+	int const h = 233;
+	std::vector<int> gray(w * h);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			gray[y * w + x] = 140 + (x * 60 / w) + (y * 40 / h) + rand() % 20;
+		}
+	}
+	for (int i = 0; i < 600; ++i) {
+		int const x0 = rand() % (w - 12);
+		int const y0 = rand() % (h - 12);
+		bool const horizontal = rand() % 2 == 0;
+		for (int j = 0; j < 12; ++j) {
+			int const x = horizontal ? x0 + j : x0;
+			int const y = horizontal ? y0 : y0 + j;
+			gray[y * w + x] = 30 + rand() % 50;
+		}
+	}
+	QImage const img(makeGrayImage(&gray[0], w, h));
+	
+	QSize const window_sizes[] = { QSize(31, 31), QSize(51, 21), QSize(5, 9) };
+	for (int i = 0; i < 3; ++i) {
+		QSize const window_size(window_sizes[i]);
+		BinaryImage sauvola_diff(
+			binarizeSauvola(img, window_size, EXACT_LOCAL_STATS)
+		);
+		rasterOp<RopXor<RopSrc, RopDst> >(
+			sauvola_diff, binarizeSauvola(img, window_size, APPROXIMATE_LOCAL_STATS)
+		);
+		BinaryImage wolf_diff(
+			binarizeWolf(img, window_size, 1, 254, EXACT_LOCAL_STATS)
+		);
+		rasterOp<RopXor<RopSrc, RopDst> >(
+			wolf_diff, binarizeWolf(img, window_size, 1, 254, APPROXIMATE_LOCAL_STATS)
+		);
+		
+		// Less than 1% of pixels may differ.
+		BOOST_CHECK(sauvola_diff.countBlackPixels() * 100 < w * h);
+		BOOST_CHECK(wolf_diff.countBlackPixels() * 100 < w * h);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_bands_match_single_band)
+{
+	// Tall enough to be split into many bands.  The width isn't
+	// a multiple of 32, so partial words are covered as well.
+	int const w = 75;
+	int const h = 1500;
+	std::vector<int> gray(w * h);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			int const background = 120 + (x * 2 + y / 15) % 100;
+			gray[y * w + x] = rand() % 8 == 0 ? rand() % 256 : background;
+		}
+	}
+	QImage const img(makeGrayImage(&gray[0], w, h));
+	QSize const window_size(21, 25);
+	
+	setMaxIntraPageThreads(1);
+	BinaryImage const sauvola(binarizeSauvola(img, window_size));
+	BinaryImage const wolf(binarizeWolf(img, window_size, 1, 254));
+	
+	setMaxIntraPageThreads(4);
+	BOOST_CHECK(binarizeSauvola(img, window_size) == sauvola);
+	BOOST_CHECK(binarizeWolf(img, window_size, 1, 254) == wolf);
+	
+	setMaxIntraPageThreads(0);
+}
+
 #if 0
 BOOST_AUTO_TEST_CASE(test)
 {
@@ -0,0 +1,141 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ConnectivityMap.h"
+#include "BinaryImage.h"
+#include "BWColor.h"
+#include "Utils.h"
+#include <QRect>
+#include <QSize>
+#ifndef Q_MOC_RUN
+#include <boost/test/auto_unit_test.hpp>
+#endif
+#include <stdint.h>
+
+namespace imageproc
+{
+
+namespace tests
+{
+
+using namespace utils;
+
+BOOST_AUTO_TEST_SUITE(ConnectivityMapTestSuite);
+
+static bool verifyMap(ConnectivityMap const& cmap, uint32_t const* control)
+{
+	uint32_t const* line = cmap.data();
+	for (int y = 0; y < cmap.size().height(); ++y) {
+		for (int x = 0; x < cmap.size().width(); ++x) {
+			if (line[x] != *control) {
+				return false;
+			}
+			++control;
+		}
+		line += cmap.stride();
+	}
+	return true;
+}
+
+BOOST_AUTO_TEST_CASE(test_label_order)
+{
+	static int const inp[] = {
+		0, 0, 1, 0, 0, 0, 1, 1, 0,
+		0, 0, 1, 0, 0, 1, 0, 0, 0,
+		1, 0, 1, 1, 0, 0, 0, 1, 0,
+		1, 0, 0, 0, 1, 0, 0, 1, 0,
+		1, 1, 1, 0, 0, 0, 1, 1, 0
+	};
+	
+	// Labels follow the raster order of the first pixel
+	// of each component.
+	static uint32_t const out4[] = {
+		0, 0, 1, 0, 0, 0, 2, 2, 0,
+		0, 0, 1, 0, 0, 3, 0, 0, 0,
+		4, 0, 1, 1, 0, 0, 0, 5, 0,
+		4, 0, 0, 0, 6, 0, 0, 5, 0,
+		4, 4, 4, 0, 0, 0, 5, 5, 0
+	};
+	
+	static uint32_t const out8[] = {
+		0, 0, 1, 0, 0, 0, 2, 2, 0,
+		0, 0, 1, 0, 0, 2, 0, 0, 0,
+		3, 0, 1, 1, 0, 0, 0, 4, 0,
+		3, 0, 0, 0, 1, 0, 0, 4, 0,
+		3, 3, 3, 0, 0, 0, 4, 4, 0
+	};
+	
+	BinaryImage const img(makeBinaryImage(inp, 9, 5));
+	
+	ConnectivityMap const cmap4(img, CONN4);
+	BOOST_CHECK(cmap4.maxLabel() == 6);
+	BOOST_CHECK(verifyMap(cmap4, out4));
+	
+	ConnectivityMap const cmap8(img, CONN8);
+	BOOST_CHECK(cmap8.maxLabel() == 4);
+	BOOST_CHECK(verifyMap(cmap8, out8));
+}
+
+BOOST_AUTO_TEST_CASE(test_tall_components)
+{
+	// Tall enough to be split into bands labelled separately.
+	int const width = 40;
+	int const height = 500;
+	BinaryImage img(width, height, WHITE);
+	
+	// A "U" shape, whose left and right sides are only connected at the bottom.
+	img.fill(QRect(5, 10, 3, 480), BLACK);
+	img.fill(QRect(20, 10, 3, 480), BLACK);
+	img.fill(QRect(5, 487, 18, 3), BLACK);
+	
+	// A diagonal line, connected only under CONN8.
+	for (int y = 0; y < height; ++y) {
+		img.fill(QRect(30 + (y & 1), y, 1, 1), BLACK);
+	}
+	
+	ConnectivityMap const cmap4(img, CONN4);
+	ConnectivityMap const cmap8(img, CONN8);
+	uint32_t const* const data4 = cmap4.data();
+	uint32_t const* const data8 = cmap8.data();
+	int const stride = cmap4.stride();
+	
+	BOOST_CHECK(cmap4.maxLabel() == 1 + height);
+	BOOST_CHECK(cmap8.maxLabel() == 2);
+	
+	// The diagonal line starts on the first row.
+	BOOST_CHECK(data8[30] == 1);
+	BOOST_CHECK(data8[(height - 1) * stride + 31] == 1);
+	BOOST_CHECK(data8[10 * stride + 5] == 2);
+	BOOST_CHECK(data8[10 * stride + 20] == 2);
+	
+	BOOST_CHECK(data4[30] == 1);
+	BOOST_CHECK(data4[10 * stride + 5] == 11);
+	BOOST_CHECK(data4[10 * stride + 20] == 11);
+	BOOST_CHECK(data4[488 * stride + 21] == 11);
+	
+	// Padding is labelled as background.
+	BOOST_CHECK(cmap8.paddedData()[0] == 0);
+	BOOST_CHECK(data8[-1] == 0);
+	BOOST_CHECK(data8[width] == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+} // namespace tests
+
+} // namespace imageproc
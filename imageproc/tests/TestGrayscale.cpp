@@ -81,6 +81,58 @@ BOOST_AUTO_TEST_CASE(test_argb32_to_grayscale)
 	BOOST_CHECK(toGrayscale(argb32) == gray);
 }
 
+BOOST_AUTO_TEST_CASE(test_rgb32_to_grayscale)
+{
+	// Odd width, to have pixels not covered by vectorized code.
+	int const w = 37;
+	int const h = 20;
+	
+	QImage rgb32(w, h, QImage::Format_RGB32);
+	QImage gray(w, h, QImage::Format_Indexed8);
+	gray.setColorTable(createGrayscalePalette());
+	
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			QRgb const rgb = qRgb(rand() & 0xff, rand() & 0xff, rand() & 0xff);
+			rgb32.setPixel(x, y, rgb);
+			gray.setPixel(x, y, qGray(rgb));
+		}
+	}
+	
+	BOOST_CHECK(toGrayscale(rgb32) == gray);
+}
+
+BOOST_AUTO_TEST_CASE(test_indexed8_to_grayscale)
+{
+	int const w = 50;
+	int const h = 64;
+	
+	QVector<QRgb> inverted_palette(256);
+	for (int i = 0; i < 256; ++i) {
+		inverted_palette[i] = qRgb(255 - i, 255 - i, 255 - i);
+	}
+	
+	QImage inverted(w, h, QImage::Format_Indexed8);
+	inverted.setColorTable(inverted_palette);
+	QImage gray(w, h, QImage::Format_Indexed8);
+	gray.setColorTable(createGrayscalePalette());
+	
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			int const rnd = rand() & 0xff;
+			inverted.setPixel(x, y, rnd);
+			gray.setPixel(x, y, 255 - rnd);
+		}
+	}
+	
+	BOOST_CHECK(toGrayscale(inverted) == gray);
+	
+	// An image with the standard palette is returned as is.
+	QImage const& const_gray = gray;
+	QImage const result(toGrayscale(gray));
+	BOOST_CHECK(result.bits() == const_gray.bits());
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
@@ -24,9 +24,13 @@
 #include <QImage>
 #include <QSize>
 #include <QPoint>
+#include <QRect>
 #ifndef Q_MOC_RUN
 #include <boost/test/auto_unit_test.hpp>
 #endif
+#include <algorithm>
+#include <stdlib.h>
+#include <stdint.h>
 
 namespace imageproc
 {
@@ -38,6 +42,82 @@ using namespace utils;
 
 BOOST_AUTO_TEST_SUITE(MorphologyTestSuite);
 
+namespace
+{
+
+/**
+ * A brute force implementation of dilateGray() and erodeGray().
+ */
+GrayImage slowDilateOrErodeGray(
+	GrayImage const& src, Brick const& brick,
+	QRect const& dst_area, uint8_t const src_surroundings, bool const dilate)
+{
+	GrayImage dst(dst_area.size());
+	for (int y = 0; y < dst_area.height(); ++y) {
+		for (int x = 0; x < dst_area.width(); ++x) {
+			uint8_t extremum = dilate ? 0xff : 0x00;
+			for (int dy = -brick.maxY(); dy <= -brick.minY(); ++dy) {
+				for (int dx = -brick.maxX(); dx <= -brick.minX(); ++dx) {
+					int const sx = dst_area.left() + x + dx;
+					int const sy = dst_area.top() + y + dy;
+					uint8_t pixel = src_surroundings;
+					if (src.rect().contains(sx, sy)) {
+						pixel = src.data()[sy * src.stride() + sx];
+					}
+					extremum = dilate ? std::min(extremum, pixel)
+						: std::max(extremum, pixel);
+				}
+			}
+			dst.data()[y * dst.stride() + x] = extremum;
+		}
+	}
+	return dst;
+}
+
+bool isBlack(BinaryImage const& img, int const x, int const y)
+{
+	uint32_t const word = img.data()[y * img.wordsPerLine() + (x >> 5)];
+	return (word >> (31 - (x & 31))) & 1;
+}
+
+void setBlack(BinaryImage& img, int const x, int const y)
+{
+	img.data()[y * img.wordsPerLine() + (x >> 5)] |= uint32_t(1) << (31 - (x & 31));
+}
+
+/**
+ * A brute force implementation of dilateBrick() and erodeBrick().
+ */
+BinaryImage slowDilateOrErodeBrick(
+	BinaryImage const& src, Brick const& brick,
+	QRect const& dst_area, BWColor const src_surroundings, bool const dilate)
+{
+	BinaryImage dst(dst_area.size(), WHITE);
+	for (int y = 0; y < dst_area.height(); ++y) {
+		for (int x = 0; x < dst_area.width(); ++x) {
+			bool black = !dilate;
+			for (int dy = -brick.maxY(); dy <= -brick.minY(); ++dy) {
+				for (int dx = -brick.maxX(); dx <= -brick.minX(); ++dx) {
+					int const sx = dst_area.left() + x + dx;
+					int const sy = dst_area.top() + y + dy;
+					bool pixel = (src_surroundings == BLACK);
+					if (src.rect().contains(sx, sy)) {
+						pixel = isBlack(src, sx, sy);
+					}
+					black = dilate ? (black || pixel) : (black && pixel);
+				}
+			}
+			if (black) {
+				setBlack(dst, x, y);
+			}
+		}
+	}
+	return dst;
+}
+
+} // anonymous namespace
+
+
 BOOST_AUTO_TEST_CASE(test_dilate_1x1)
 {
 	static int const inp[] = {
@@ -199,6 +279,31 @@ BOOST_AUTO_TEST_CASE(test_dilate_1x3_gray)
 	BOOST_CHECK(dilateGray(img, QSize(1, 3), img.rect()) == control);
 }
 
+BOOST_AUTO_TEST_CASE(test_large_gray_bricks)
+{
+	// Wider than a single strip processed by the vertical pass.
+	GrayImage const img(randomGrayImage(300, 40));
+	Brick const bricks[] = {
+		Brick(-7, -3, 12, 5), Brick(0, -20, 0, 2), Brick(-40, 1, -1, 1)
+	};
+	QRect const areas[] = {
+		img.rect(), img.rect().adjusted(-5, 10, 15, -3)
+	};
+	
+	for (int b = 0; b < 3; ++b) {
+		for (int a = 0; a < 2; ++a) {
+			BOOST_CHECK(
+				dilateGray(img, bricks[b], areas[a], 0xff)
+				== slowDilateOrErodeGray(img, bricks[b], areas[a], 0xff, true)
+			);
+			BOOST_CHECK(
+				erodeGray(img, bricks[b], areas[a], 0x00)
+				== slowDilateOrErodeGray(img, bricks[b], areas[a], 0x00, false)
+			);
+		}
+	}
+}
+
 BOOST_AUTO_TEST_CASE(test_dilate_1x20_gray)
 {
 	static int const inp[] = {
@@ -641,6 +746,40 @@ BOOST_AUTO_TEST_CASE(test_large_dilate)
 	BOOST_CHECK(dilateBrick(img, brick, img.rect(), WHITE) == control);
 }
 
+BOOST_AUTO_TEST_CASE(test_large_binary_bricks)
+{
+	// Sparse black pixels, so that dilation doesn't saturate.
+	BinaryImage img(150, 70, WHITE);
+	for (int i = 0; i < 40; ++i) {
+		setBlack(img, rand() % img.width(), rand() % img.height());
+	}
+	BinaryImage inverted(img);
+	inverted.invert();
+	
+	Brick const bricks[] = {
+		Brick(-20, 0, 22, 0), Brick(3, -35, 3, 1), Brick(-9, -4, 30, 12)
+	};
+	QRect const areas[] = {
+		img.rect(), img.rect().adjusted(-10, 15, 25, -5)
+	};
+	BWColor const colors[] = { WHITE, BLACK };
+	
+	for (int b = 0; b < 3; ++b) {
+		for (int a = 0; a < 2; ++a) {
+			for (int c = 0; c < 2; ++c) {
+				BOOST_CHECK(
+					dilateBrick(img, bricks[b], areas[a], colors[c])
+					== slowDilateOrErodeBrick(img, bricks[b], areas[a], colors[c], true)
+				);
+				BOOST_CHECK(
+					erodeBrick(inverted, bricks[b], areas[a], colors[c])
+					== slowDilateOrErodeBrick(inverted, bricks[b], areas[a], colors[c], false)
+				);
+			}
+		}
+	}
+}
+
 BOOST_AUTO_TEST_CASE(test_erode_1x1)
 {
 	static int const inp[] = {
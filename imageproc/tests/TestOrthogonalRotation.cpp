@@ -21,9 +21,11 @@
 #include "Utils.h"
 #include <QImage>
 #include <QRect>
+#include <QSize>
 #ifndef Q_MOC_RUN
 #include <boost/test/auto_unit_test.hpp>
 #endif
+#include <stdint.h>
 
 namespace imageproc
 {
@@ -35,6 +37,45 @@ using namespace utils;
 
 BOOST_AUTO_TEST_SUITE(OrthogonalRotationTestSuite);
 
+static bool isBlack(BinaryImage const& img, int x, int y)
+{
+	uint32_t const word = img.data()[y * img.wordsPerLine() + (x >> 5)];
+	return (word >> (31 - (x & 31))) & 1;
+}
+
+/**
+ * Checks that \p rotated is \p rect of \p img rotated by \p degrees.
+ */
+static bool checkRotation(
+	BinaryImage const& img, QRect const& rect,
+	BinaryImage const& rotated, int const degrees)
+{
+	for (int y = 0; y < rotated.height(); ++y) {
+		for (int x = 0; x < rotated.width(); ++x) {
+			int src_x = 0;
+			int src_y = 0;
+			switch (degrees) {
+				case 90:
+					src_x = rect.left() + y;
+					src_y = rect.bottom() - x;
+					break;
+				case 180:
+					src_x = rect.right() - x;
+					src_y = rect.bottom() - y;
+					break;
+				case 270:
+					src_x = rect.right() - y;
+					src_y = rect.top() + x;
+					break;
+			}
+			if (isBlack(rotated, x, y) != isBlack(img, src_x, src_y)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
 BOOST_AUTO_TEST_CASE(test_null_image)
 {
 	BinaryImage const null_img;
@@ -177,6 +218,25 @@ BOOST_AUTO_TEST_CASE(test_sub_image)
 	BOOST_REQUIRE(orthogonalRotation(img, rect, -90) == out4_img);
 }
 
+BOOST_AUTO_TEST_CASE(test_multiple_blocks)
+{
+	// Large enough for several 32x32 blocks, with an unaligned rect.
+	BinaryImage const img(randomBinaryImage(150, 110));
+	QRect const rect(5, 3, 137, 101);
+	
+	BinaryImage const rotated90(orthogonalRotation(img, rect, 90));
+	BinaryImage const rotated180(orthogonalRotation(img, rect, 180));
+	BinaryImage const rotated270(orthogonalRotation(img, rect, 270));
+	
+	BOOST_REQUIRE(rotated90.size() == QSize(101, 137));
+	BOOST_REQUIRE(rotated180.size() == QSize(137, 101));
+	BOOST_REQUIRE(rotated270.size() == QSize(101, 137));
+	
+	BOOST_CHECK(checkRotation(img, rect, rotated90, 90));
+	BOOST_CHECK(checkRotation(img, rect, rotated180, 180));
+	BOOST_CHECK(checkRotation(img, rect, rotated270, 270));
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
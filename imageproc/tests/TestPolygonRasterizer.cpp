@@ -31,6 +31,7 @@
 #include <QBrush>
 #include <QColor>
 #include <Qt>
+#include <algorithm>
 #include <math.h>
 #ifndef Q_MOC_RUN
 #include <boost/test/auto_unit_test.hpp>
@@ -179,6 +180,61 @@ BOOST_AUTO_TEST_CASE(regression_test_1)
 	BOOST_CHECK(testFillExceptShape(QSize(938, 1299), shape, Qt::WindingFill));
 }
 
+BOOST_AUTO_TEST_CASE(test_batch)
+{
+	QSize const image_size(500, 500);
+	QPolygonF const shape(createShape(image_size, 230));
+	QPolygonF const bigger_shape(createShape(image_size, 300));
+	QPolygonF const rect(QRectF(QPointF(100, 150), QSize(300, 200)));
+	
+	// Fills overlapping each other.
+	PolygonRasterizer::Batch batch;
+	batch.fill(BLACK, shape, Qt::OddEvenFill);
+	batch.fill(WHITE, rect, Qt::WindingFill);
+	batch.fillExcept(BLACK, bigger_shape, Qt::WindingFill);
+	
+	BinaryImage image(image_size, WHITE);
+	batch.apply(image);
+	
+	// The same fills done by QPainter.
+	QImage control(image_size, QImage::Format_RGB32);
+	control.fill(0xffffffff);
+	
+	{
+		QPainter painter(&control);
+		painter.setRenderHint(QPainter::Antialiasing, true);
+		painter.setPen(Qt::NoPen);
+		painter.setBrush(QColor(0x00, 0x00, 0x00));
+		painter.drawPolygon(shape, Qt::OddEvenFill);
+		painter.setBrush(QColor(0xff, 0xff, 0xff));
+		painter.drawPolygon(rect, Qt::WindingFill);
+	}
+	
+	// The area outside of bigger_shape is drawn separately,
+	// and then made black in the control image.
+	QImage outside(image_size, QImage::Format_RGB32);
+	outside.fill(0x00000000);
+	
+	{
+		QPainter painter(&outside);
+		painter.setRenderHint(QPainter::Antialiasing, true);
+		painter.setPen(Qt::NoPen);
+		painter.setBrush(QColor(0xff, 0xff, 0xff));
+		painter.drawPolygon(bigger_shape, Qt::WindingFill);
+	}
+	
+	for (int y = 0; y < image_size.height(); ++y) {
+		QRgb* control_line = (QRgb*)control.scanLine(y);
+		QRgb const* outside_line = (QRgb const*)outside.scanLine(y);
+		for (int x = 0; x < image_size.width(); ++x) {
+			int const gray = std::min(qGray(control_line[x]), qGray(outside_line[x]));
+			control_line[x] = qRgb(gray, gray, gray);
+		}
+	}
+	
+	BOOST_CHECK(fuzzyCompare(image, control));
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
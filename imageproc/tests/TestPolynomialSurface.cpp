@@ -0,0 +1,255 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PolynomialSurface.h"
+#include "GrayImage.h"
+#include "BinaryImage.h"
+#include "Utils.h"
+#include <QSize>
+#include <vector>
+#ifndef Q_MOC_RUN
+#include <boost/test/auto_unit_test.hpp>
+#endif
+#include <algorithm>
+#include <stdlib.h>
+#include <math.h>
+
+namespace imageproc
+{
+
+namespace tests
+{
+
+using namespace utils;
+
+BOOST_AUTO_TEST_SUITE(PolynomialSurfaceTestSuite);
+
+/**
+ * \brief Maps pixel position \p i in [0, \p dimension) to [-1, 1].
+ */
+static double toUnitRange(int const i, int const dimension)
+{
+	return dimension > 1 ? 2.0 * i / (dimension - 1) - 1.0 : -1.0;
+}
+
+/**
+ * \brief Fills \p out with T_0(t) .. T_(n-1)(t).
+ */
+static void chebyshev(double const t, int const n, double* out)
+{
+	double prev = 1.0;
+	double cur = t;
+	for (int i = 0; i < n; ++i) {
+		out[i] = prev;
+		double const next = 2.0 * t * cur - prev;
+		prev = cur;
+		cur = next;
+	}
+}
+
+/**
+ * \brief Fits a polynomial the straightforward way: one equation per pixel,
+ *        summed into normal equations solved by Gaussian elimination.
+ */
+static std::vector<double> referenceFit(
+	GrayImage const& image, BinaryImage const* mask,
+	int const hor_degree, int const vert_degree)
+{
+	int const width = image.width();
+	int const height = image.height();
+	int const num_hor_terms = hor_degree + 1;
+	int const num_vert_terms = vert_degree + 1;
+	int const num_terms = num_hor_terms * num_vert_terms;
+	
+	std::vector<double> ata(num_terms * num_terms, 0.0);
+	std::vector<double> atb(num_terms, 0.0);
+	std::vector<double> tx(num_hor_terms);
+	std::vector<double> ty(num_vert_terms);
+	std::vector<double> row(num_terms);
+	
+	for (int y = 0; y < height; ++y) {
+		chebyshev(toUnitRange(y, height), num_vert_terms, &ty[0]);
+		for (int x = 0; x < width; ++x) {
+			if (mask) {
+				uint32_t const word = mask->data()[y * mask->wordsPerLine() + (x >> 5)];
+				if (!(word & (uint32_t(1) << (31 - (x & 31))))) {
+					continue;
+				}
+			}
+			
+			chebyshev(toUnitRange(x, width), num_hor_terms, &tx[0]);
+			for (int i = 0; i < num_vert_terms; ++i) {
+				for (int j = 0; j < num_hor_terms; ++j) {
+					row[i * num_hor_terms + j] = ty[i] * tx[j];
+				}
+			}
+			
+			double const value = image.data()[y * image.stride() + x] / 255.0;
+			for (int r = 0; r < num_terms; ++r) {
+				for (int c = 0; c < num_terms; ++c) {
+					ata[r * num_terms + c] += row[r] * row[c];
+				}
+				atb[r] += row[r] * value;
+			}
+		}
+	}
+	
+	// Gaussian elimination with partial pivoting.
+	for (int col = 0; col < num_terms; ++col) {
+		int pivot = col;
+		for (int r = col + 1; r < num_terms; ++r) {
+			if (fabs(ata[r * num_terms + col]) > fabs(ata[pivot * num_terms + col])) {
+				pivot = r;
+			}
+		}
+		for (int c = 0; c < num_terms; ++c) {
+			std::swap(ata[col * num_terms + c], ata[pivot * num_terms + c]);
+		}
+		std::swap(atb[col], atb[pivot]);
+		
+		for (int r = col + 1; r < num_terms; ++r) {
+			double const factor = ata[r * num_terms + col] / ata[col * num_terms + col];
+			for (int c = col; c < num_terms; ++c) {
+				ata[r * num_terms + c] -= factor * ata[col * num_terms + c];
+			}
+			atb[r] -= factor * atb[col];
+		}
+	}
+	
+	std::vector<double> coeffs(num_terms);
+	for (int r = num_terms - 1; r >= 0; --r) {
+		double sum = atb[r];
+		for (int c = r + 1; c < num_terms; ++c) {
+			sum -= ata[r * num_terms + c] * coeffs[c];
+		}
+		coeffs[r] = sum / ata[r * num_terms + r];
+	}
+	
+	return coeffs;
+}
+
+static bool coeffsMatch(
+	std::vector<double> const& coeffs, std::vector<double> const& control)
+{
+	if (coeffs.size() != control.size()) {
+		return false;
+	}
+	
+	for (size_t i = 0; i < coeffs.size(); ++i) {
+		if (fabs(coeffs[i] - control[i]) > 1e-6 * (1.0 + fabs(control[i]))) {
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/**
+ * \brief Checks that every pixel of \p rendered is within 1 gray level
+ *        of the polynomial evaluated in double precision.
+ */
+static bool renderMatches(
+	GrayImage const& rendered, std::vector<double> const& coeffs,
+	int const hor_degree, int const vert_degree)
+{
+	int const width = rendered.width();
+	int const height = rendered.height();
+	int const num_hor_terms = hor_degree + 1;
+	int const num_vert_terms = vert_degree + 1;
+	std::vector<double> tx(num_hor_terms);
+	std::vector<double> ty(num_vert_terms);
+	
+	for (int y = 0; y < height; ++y) {
+		chebyshev(toUnitRange(y, height), num_vert_terms, &ty[0]);
+		for (int x = 0; x < width; ++x) {
+			chebyshev(toUnitRange(x, width), num_hor_terms, &tx[0]);
+			double sum = 0.0;
+			for (int i = 0; i < num_vert_terms; ++i) {
+				for (int j = 0; j < num_hor_terms; ++j) {
+					sum += coeffs[i * num_hor_terms + j] * ty[i] * tx[j];
+				}
+			}
+			double const control = std::min(std::max(sum * 255.0 + 0.5, 0.0), 255.0);
+			double const actual = rendered.data()[y * rendered.stride() + x];
+			if (fabs(actual - floor(control)) > 1.0) {
+				return false;
+			}
+		}
+	}
+	
+	return true;
+}
+
+/**
+ * \brief A smooth background with noise on top of it.
+ */
+static GrayImage makeBackground(int const width, int const height)
+{
+	GrayImage image(QSize(width, height));
+	for (int y = 0; y < height; ++y) {
+		uint8_t* const line = image.data() + y * image.stride();
+		for (int x = 0; x < width; ++x) {
+			double const v = 140.0 + 60.0 * sin(5.0 * x / width)
+				* cos(3.0 * y / height) + rand() % 41 - 20;
+			line[x] = static_cast<uint8_t>(std::min(std::max(v, 0.0), 255.0));
+		}
+	}
+	return image;
+}
+
+BOOST_AUTO_TEST_CASE(test_fit_and_render)
+{
+	GrayImage const image(makeBackground(67, 45));
+	
+	static int const degrees[][2] = { { 0, 0 }, { 1, 3 }, { 4, 2 }, { 6, 5 } };
+	for (size_t i = 0; i < sizeof(degrees) / sizeof(degrees[0]); ++i) {
+		int const hor_degree = degrees[i][0];
+		int const vert_degree = degrees[i][1];
+		PolynomialSurface const surface(hor_degree, vert_degree, image);
+		std::vector<double> const control(
+			referenceFit(image, 0, hor_degree, vert_degree)
+		);
+		BOOST_CHECK(coeffsMatch(surface.coefficients(), control));
+		
+		// The same size, a size that's not a multiple of 4, and a single line.
+		BOOST_CHECK(renderMatches(surface.render(image.size()), control, hor_degree, vert_degree));
+		BOOST_CHECK(renderMatches(surface.render(QSize(101, 73)), control, hor_degree, vert_degree));
+		BOOST_CHECK(renderMatches(surface.render(QSize(30, 1)), control, hor_degree, vert_degree));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_fit_with_mask)
+{
+	GrayImage const image(makeBackground(83, 50));
+	BinaryImage const mask(randomBinaryImage(83, 50));
+	
+	int const hor_degree = 5;
+	int const vert_degree = 3;
+	PolynomialSurface const surface(hor_degree, vert_degree, image, mask);
+	std::vector<double> const control(
+		referenceFit(image, &mask, hor_degree, vert_degree)
+	);
+	BOOST_CHECK(coeffsMatch(surface.coefficients(), control));
+	BOOST_CHECK(renderMatches(surface.render(QSize(90, 61)), control, hor_degree, vert_degree));
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+} // namespace tests
+
+} // namespace imageproc
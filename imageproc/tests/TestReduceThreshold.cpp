@@ -20,9 +20,12 @@
 #include "BinaryImage.h"
 #include "Utils.h"
 #include <QImage>
+#include <QSize>
 #ifndef Q_MOC_RUN
 #include <boost/test/auto_unit_test.hpp>
 #endif
+#include <vector>
+#include <stdint.h>
 
 namespace imageproc
 {
@@ -34,6 +37,12 @@ using namespace utils;
 
 BOOST_AUTO_TEST_SUITE(ReduceThresholdTestSuite);
 
+static bool isBlack(BinaryImage const& img, int x, int y)
+{
+	uint32_t const word = img.data()[y * img.wordsPerLine() + (x >> 5)];
+	return (word >> (31 - (x & 31))) & 1;
+}
+
 BOOST_AUTO_TEST_CASE(test_null_image)
 {
 	BOOST_CHECK(ReduceThreshold(BinaryImage())(2).image().isNull());
@@ -120,6 +129,54 @@ BOOST_AUTO_TEST_CASE(test_lines)
 	BOOST_CHECK(makeBinaryImage(out4, 1, 4) == ReduceThreshold(img)(4));
 }
 
+BOOST_AUTO_TEST_CASE(test_wide_image)
+{
+	// Wide enough to be processed in blocks of several words.
+	BinaryImage const img(randomBinaryImage(601, 6));
+	
+	for (int threshold = 1; threshold <= 4; ++threshold) {
+		BinaryImage const reduced(ReduceThreshold(img)(threshold));
+		BOOST_REQUIRE(reduced.width() == 300 && reduced.height() == 3);
+		
+		bool ok = true;
+		for (int y = 0; y < reduced.height(); ++y) {
+			for (int x = 0; x < reduced.width(); ++x) {
+				int const num_black = isBlack(img, x * 2, y * 2)
+					+ isBlack(img, x * 2 + 1, y * 2)
+					+ isBlack(img, x * 2, y * 2 + 1)
+					+ isBlack(img, x * 2 + 1, y * 2 + 1);
+				if (isBlack(reduced, x, y) != (num_black >= threshold)) {
+					ok = false;
+				}
+			}
+		}
+		BOOST_CHECK(ok);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_multiple_reductions)
+{
+	static int const thresholds[] = { 1, 2, 4, 3, 2, 2, 1 };
+	std::vector<int> const thresholds_vec(
+		thresholds, thresholds + sizeof(thresholds) / sizeof(thresholds[0])
+	);
+	
+	// The last one turns into a line along the way.
+	QSize const sizes[] = { QSize(1000, 300), QSize(77, 1000), QSize(600, 20) };
+	for (int i = 0; i < 3; ++i) {
+		BinaryImage const img(randomBinaryImage(sizes[i].width(), sizes[i].height()));
+		
+		ReduceThreshold cascade(img);
+		for (unsigned j = 0; j < thresholds_vec.size(); ++j) {
+			cascade.reduce(thresholds_vec[j]);
+		}
+		
+		BOOST_CHECK(ReduceThreshold(img).reduce(thresholds_vec).image() == cascade.image());
+	}
+	
+	BOOST_CHECK(ReduceThreshold(BinaryImage()).reduce(thresholds_vec).image().isNull());
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
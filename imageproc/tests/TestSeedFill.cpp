@@ -25,6 +25,7 @@
 #include <QImage>
 #include <QSize>
 #include <QPoint>
+#include <QRect>
 #ifndef Q_MOC_RUN
 #include <boost/test/auto_unit_test.hpp>
 #endif
@@ -140,6 +141,35 @@ BOOST_AUTO_TEST_CASE(test_regression_4)
 	BOOST_REQUIRE(seedFill(seed, mask, CONN4) == fill);
 }
 
+BOOST_AUTO_TEST_CASE(test_serpentine)
+{
+	// A serpentine corridor takes many raster / anti-raster scans
+	// to fill, but is no problem for a queue-based fill.
+	int const width = 100;
+	int const height = 41;
+	BinaryImage mask(width, height, WHITE);
+	for (int y = 0; y < height; y += 2) {
+		mask.fill(QRect(0, y, width, 1), BLACK);
+		if (y + 1 < height) {
+			int const x = (y & 2) ? 0 : width - 1;
+			mask.fill(QRect(x, y + 1, 1, 1), BLACK);
+		}
+	}
+	
+	BinaryImage seed(width, height, WHITE);
+	seed.fill(QRect(0, 0, 1, 1), BLACK);
+	
+	BOOST_CHECK(seedFill(seed, mask, CONN4) == mask);
+	BOOST_CHECK(seedFill(seed, mask, CONN8) == mask);
+	
+	// Now fill it from the other end.
+	seed.fill(WHITE);
+	seed.fill(QRect(width - 1, height - 1, 1, 1), BLACK);
+	
+	BOOST_CHECK(seedFill(seed, mask, CONN4) == mask);
+	BOOST_CHECK(seedFill(seed, mask, CONN8) == mask);
+}
+
 BOOST_AUTO_TEST_CASE(test_gray4_random)
 {
 	for (int i = 0; i < 200; ++i) {
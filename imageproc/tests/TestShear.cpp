@@ -24,6 +24,8 @@
 #ifndef Q_MOC_RUN
 #include <boost/test/auto_unit_test.hpp>
 #endif
+#include <vector>
+#include <stdint.h>
 
 namespace imageproc
 {
@@ -35,6 +37,16 @@ using namespace utils;
 
 BOOST_AUTO_TEST_SUITE(ShearTestSuite);
 
+static int countBlackPixels(BinaryImage const& img, int y)
+{
+	uint32_t const* line = img.data() + y * img.wordsPerLine();
+	int count = 0;
+	for (int x = 0; x < img.width(); ++x) {
+		count += (line[x >> 5] >> (31 - (x & 31))) & 1;
+	}
+	return count;
+}
+
 BOOST_AUTO_TEST_CASE(test_small_image)
 {
 	static int const inp[] = {
@@ -92,6 +104,31 @@ BOOST_AUTO_TEST_CASE(test_small_image)
 	BOOST_REQUIRE(v_shear_inplace == v_out_img);
 }
 
+BOOST_AUTO_TEST_CASE(test_projection)
+{
+	BinaryImage const img(randomBinaryImage(203, 150));
+	double const shears[] = { 0.001, -0.02, 0.3, -1.5, 7.0 };
+	BWColor const colors[] = { WHITE, BLACK };
+	
+	for (int i = 0; i < 5; ++i) {
+		for (int j = 0; j < 2; ++j) {
+			BinaryImage const sheared(vShear(img, shears[i], 80.5, colors[j]));
+			std::vector<int> const projection(
+				vShearProjection(img, shears[i], 80.5, colors[j])
+			);
+			BOOST_REQUIRE(projection.size() == 150);
+			
+			bool ok = true;
+			for (int y = 0; y < 150; ++y) {
+				if (projection[y] != countBlackPixels(sheared, y)) {
+					ok = false;
+				}
+			}
+			BOOST_CHECK(ok);
+		}
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
@@ -21,6 +21,8 @@
 #include "Utils.h"
 #include <QImage>
 #include <QSize>
+#include <QRect>
+#include <QTransform>
 #ifndef Q_MOC_RUN
 #include <boost/test/auto_unit_test.hpp>
 #endif
@@ -66,6 +68,62 @@ BOOST_AUTO_TEST_CASE(test_random_image)
 	BOOST_CHECK(transformToGray(img, null_xform, img.rect(), outside_pixels) == img);
 }
 
+BOOST_AUTO_TEST_CASE(test_downscale_by_two)
+{
+	GrayImage img(QSize(100, 60));
+	uint8_t* line = img.data();
+	for (int y = 0; y < img.height(); ++y) {
+		for (int x = 0; x < img.width(); ++x) {
+			line[x] = rand() % 256;
+		}
+		line += img.stride();
+	}
+	
+	// Each destination pixel maps exactly to a 2x2 block of source pixels.
+	GrayImage expected(QSize(50, 30));
+	uint8_t const* src_line = img.data();
+	uint8_t* dst_line = expected.data();
+	for (int y = 0; y < expected.height(); ++y) {
+		for (int x = 0; x < expected.width(); ++x) {
+			unsigned const sum = src_line[x * 2] + src_line[x * 2 + 1]
+				+ src_line[x * 2 + img.stride()]
+				+ src_line[x * 2 + 1 + img.stride()];
+			dst_line[x] = static_cast<uint8_t>((sum + 2) / 4);
+		}
+		src_line += img.stride() * 2;
+		dst_line += expected.stride();
+	}
+	
+	QColor const bgcolor(0xff, 0xff, 0xff);
+	OutsidePixels const outside_pixels(OutsidePixels::assumeColor(bgcolor));
+	
+	QTransform xform;
+	xform.scale(0.5, 0.5);
+	QRect const dst_rect(0, 0, 50, 30);
+	BOOST_CHECK(transformToGray(img, xform, dst_rect, outside_pixels) == expected);
+}
+
+BOOST_AUTO_TEST_CASE(test_mono_image)
+{
+	// Bitonal images are transformed as grayscale internally, but the
+	// result has to be the same as transforming their RGB32 version.
+	QImage const mono(randomMonoQImage(100, 80));
+	QImage const rgb32(mono.convertToFormat(QImage::Format_RGB32));
+	
+	QTransform xform;
+	xform.rotate(3.0);
+	xform.scale(0.7, 0.6);
+	QRect const dst_rect(-5, -3, 80, 60);
+	
+	QColor const colors[] = { QColor(0xff, 0xff, 0xff), QColor(0x40, 0x80, 0xc0) };
+	for (int i = 0; i < 2; ++i) {
+		OutsidePixels const outside_pixels(OutsidePixels::assumeColor(colors[i]));
+		QImage const res(transform(mono, xform, dst_rect, outside_pixels));
+		BOOST_CHECK(res.format() == QImage::Format_RGB32);
+		BOOST_CHECK(res == transform(rgb32, xform, dst_rect, outside_pixels));
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
@@ -24,6 +24,7 @@
 
 #include "CommandLine.h"
 #include "ConsoleBatch.h"
+#include "imageproc/ParallelRows.h"
 
 
 int main(int argc, char **argv)
@@ -44,6 +45,8 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	imageproc::setMaxIntraPageThreads(cli.getThreads());
+
 	std::auto_ptr<ConsoleBatch> cbatch;
 
 	try {
@@ -22,6 +22,7 @@
 #include "PngMetadataLoader.h"
 #include "TiffMetadataLoader.h"
 #include "JpegMetadataLoader.h"
+#include "imageproc/ParallelRows.h"
 #include <QMetaType>
 #include <QtPlugin>
 #include <QLocale>
@@ -155,6 +156,8 @@ int main(int argc, char** argv)
 		return 0;
 	}
 	
+	imageproc::setMaxIntraPageThreads(cli.getThreads());
+	
 	QString const translation("scantailor_"+QLocale::system().name());
 	QTranslator translator;
 	
@@ -0,0 +1,234 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Despeckle.h"
+#include "TaskStatus.h"
+#include "Dpi.h"
+#include "imageproc/BinaryImage.h"
+#include "imageproc/BWColor.h"
+#include "imageproc/RasterOp.h"
+#include <QSize>
+#include <QRect>
+#include <QPoint>
+#include <boost/test/auto_unit_test.hpp>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Tests
+{
+
+using namespace imageproc;
+
+BOOST_AUTO_TEST_SUITE(DespeckleTestSuite);
+
+class NullTaskStatus : public TaskStatus
+{
+public:
+	virtual void cancel() {}
+	
+	virtual bool isCancelled() const { return false; }
+	
+	virtual void throwIfCancelled() const {}
+};
+
+/**
+ * Makes an image from rows of text, with 'X' standing for black pixels.
+ */
+static BinaryImage makeImage(char const* const* rows, int const height)
+{
+	int const width = strlen(rows[0]);
+	BinaryImage image(width, height, WHITE);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			if (rows[y][x] == 'X') {
+				image.fill(QRect(x, y, 1, 1), BLACK);
+			}
+		}
+	}
+	return image;
+}
+
+BOOST_AUTO_TEST_CASE(test_fixture)
+{
+	// The expected output was produced by the implementation that kept
+	// connections in a std::map.  At the NORMAL level, the result depends
+	// on the order connections between components are visited in:
+	// visiting them in reverse keeps the 3x2 blob at the bottom left.
+	static char const* const inp[] = {
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		".........................X.....",
+		"...........X.....XX.....XX.....",
+		"...............................",
+		"XXX............................",
+		"XXX............................"
+	};
+	
+	static char const* const out[] = {
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"..............................X",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		"...............................",
+		".........................X.....",
+		"...........X.....XX.....XX.....",
+		"...............................",
+		"...............................",
+		"..............................."
+	};
+	
+	int const height = sizeof(inp) / sizeof(inp[0]);
+	BinaryImage const input(makeImage(inp, height));
+	BinaryImage const output(makeImage(out, height));
+	Dpi const dpi(568, 568);
+	NullTaskStatus const status;
+	
+	BOOST_CHECK(Despeckle::despeckle(input, dpi, Despeckle::CAUTIOUS, status) == output);
+	BOOST_CHECK(Despeckle::despeckle(input, dpi, Despeckle::NORMAL, status) == output);
+	
+	// Nothing is big enough to survive this level.
+	BinaryImage const white(input.size(), WHITE);
+	BOOST_CHECK(Despeckle::despeckle(input, dpi, Despeckle::AGGRESSIVE, status) == white);
+}
+
+BOOST_AUTO_TEST_CASE(test_profile)
+{
+	// Sparse noise of various density, with a few lines
+	// to act as big components.
+	BinaryImage input(200, 150, WHITE);
+	for (int y = 0; y < input.height(); ++y) {
+		int const density = 4 + y / 10;
+		for (int x = 0; x < input.width(); ++x) {
+			if (rand() % density == 0) {
+				input.fill(QRect(x, y, 1, 1), BLACK);
+			}
+		}
+	}
+	input.fill(QRect(20, 10, 2, 120), BLACK);
+	input.fill(QRect(40, 70, 140, 3), BLACK);
+	
+	Dpi const dpi(300, 300);
+	NullTaskStatus const status;
+	Despeckle::Profile const profile(Despeckle::buildProfile(input, dpi, status));
+	
+	for (int i = 0; i < Despeckle::NUM_LEVELS; ++i) {
+		Despeckle::Level const level = (Despeckle::Level)i;
+		BinaryImage redespeckled(input);
+		profile.apply(redespeckled, level);
+		BOOST_CHECK(redespeckled == Despeckle::despeckle(input, dpi, level, status));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_embedded_profile)
+{
+	BinaryImage input(120, 90, WHITE);
+	for (int y = 0; y < input.height(); ++y) {
+		for (int x = 0; x < input.width(); ++x) {
+			if (rand() % 6 == 0) {
+				input.fill(QRect(x, y, 1, 1), BLACK);
+			}
+		}
+	}
+	input.fill(QRect(30, 5, 60, 3), BLACK);
+	
+	Dpi const dpi(300, 300);
+	NullTaskStatus const status;
+	Despeckle::Profile const profile(Despeckle::buildProfile(input, dpi, status));
+	
+	// A part of the input, drawn over a larger white image.
+	QSize const size(170, 140);
+	QRect const dst_rect(25, 40, 80, 70);
+	QPoint const src_pos(15, 10);
+	BinaryImage embedded_input(size, WHITE);
+	rasterOp<RopSrc>(embedded_input, dst_rect, input, src_pos);
+	
+	Despeckle::Profile const embedded(profile.embedded(size, dst_rect, src_pos));
+	
+	for (int i = 0; i < Despeckle::NUM_LEVELS; ++i) {
+		Despeckle::Level const level = (Despeckle::Level)i;
+		
+		BinaryImage const despeckled(Despeckle::despeckle(input, dpi, level, status));
+		BinaryImage expected(size, WHITE);
+		rasterOp<RopSrc>(expected, dst_rect, despeckled, src_pos);
+		
+		BinaryImage redespeckled(embedded_input);
+		embedded.apply(redespeckled, level);
+		BOOST_CHECK(redespeckled == expected);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+} // namespace Tests